@@ -0,0 +1,268 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - Benchmark mode
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * When a media verifies slowly, it isn't obvious whether the USB controller,
+ * the file system driver, the hash or the console is to blame. So, when the
+ * hash list sets the md5sum_benchmark directive, we measure each of these
+ * separately, before verification starts: sequential reads from the disk,
+ * file reads through the firmware file system driver at various read sizes,
+ * the time it takes to open the first entries of the list, the hash speed
+ * on a memory buffer and the time it takes to redraw a line of the console.
+ */
+
+/* The read sizes that file reads are measured with */
+STATIC CONST UINTN BenchmarkReadSize[] = { 16 * 1024, 128 * 1024, READ_BUFFERSIZE };
+
+/**
+  Measure the throughput of sequential reads from the disk, through DiskIo.
+
+  @param[in]   DeviceHandle     The handle of the boot volume.
+  @param[out]  Rate             A pointer to receive the throughput in MB/s.
+
+  @retval EFI_SUCCESS           The disk was measured.
+  @retval EFI_UNSUPPORTED       The volume doesn't provide BlockIo and DiskIo.
+  @retval other                 A read error occurred.
+**/
+STATIC EFI_STATUS BenchmarkDisk(
+	IN CONST EFI_HANDLE DeviceHandle,
+	OUT UINTN* Rate
+)
+{
+	EFI_STATUS Status;
+	EFI_BLOCK_IO_PROTOCOL* BlockIo;
+	EFI_DISK_IO_PROTOCOL* DiskIo;
+	UINT8* Buffer;
+	UINTN ChunkSize;
+	UINT64 Offset, Size, Start;
+
+	if (EFI_ERROR(gBS->HandleProtocol(DeviceHandle, &gEfiBlockIoProtocolGuid, (VOID**)&BlockIo)) ||
+		BlockIo->Media == NULL || EFI_ERROR(gBS->HandleProtocol(DeviceHandle,
+		&gEfiDiskIoProtocolGuid, (VOID**)&DiskIo)))
+		return EFI_UNSUPPORTED;
+
+	Buffer = GetIoBuffer(0, &ChunkSize);
+	Size = MIN(BENCHMARK_SIZE, (BlockIo->Media->LastBlock + 1) * BlockIo->Media->BlockSize);
+	Start = GetTimestamp();
+	for (Offset = 0; Offset < Size; Offset += ChunkSize) {
+		Status = DiskIo->ReadDisk(DiskIo, BlockIo->Media->MediaId, Offset,
+			(UINTN)MIN(ChunkSize, Size - Offset), Buffer);
+		if (EFI_ERROR(Status))
+			return Status;
+	}
+	*Rate = GetThroughput(Size, GetTimestamp() - Start);
+	return EFI_SUCCESS;
+}
+
+/**
+  Measure the throughput of reads from a file, through the firmware file
+  system driver, using a specific read size.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   Path             A pointer to the CHAR16 string with the path of the file.
+  @param[in]   ReadSize         The size of the reads.
+  @param[out]  Rate             A pointer to receive the throughput in MB/s.
+
+  @retval EFI_SUCCESS           The reads were measured.
+  @retval other                 The file could not be opened or read.
+**/
+STATIC EFI_STATUS BenchmarkFileRead(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST CHAR16* Path,
+	IN CONST UINTN ReadSize,
+	OUT UINTN* Rate
+)
+{
+	EFI_STATUS Status;
+	EFI_FILE_HANDLE File;
+	UINT8* Buffer;
+	UINTN Size, ChunkSize;
+	UINT64 ReadBytes = 0, Start;
+
+	Buffer = GetIoBuffer(0, &ChunkSize);
+	V_ASSERT(ReadSize <= ChunkSize);
+	Status = Root->Open(Root, &File, (CHAR16*)Path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+	if (EFI_ERROR(Status))
+		return Status;
+	Start = GetTimestamp();
+	while (ReadBytes < BENCHMARK_SIZE) {
+		Size = ReadSize;
+		Status = File->Read(File, &Size, Buffer);
+		if (EFI_ERROR(Status) || Size == 0)
+			break;
+		ReadBytes += Size;
+	}
+	*Rate = GetThroughput(ReadBytes, GetTimestamp() - Start);
+	File->Close(File);
+	return Status;
+}
+
+/**
+  Measure the time it takes to open the first entries of a hash list and to get
+  their size, through the firmware file system driver, and find the largest of
+  their files.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST to open the entries of.
+  @param[out]  Latency          A pointer to receive the average time, in microseconds.
+  @param[out]  Largest          A pointer to the PATH_MAX + 1 buffer that receives the path
+                                of the largest file, or an empty string if none was opened.
+
+  @retval      The number of files that were opened.
+**/
+STATIC UINTN BenchmarkOpen(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	OUT UINTN* Latency,
+	OUT CHAR16* Largest
+)
+{
+	EFI_STATUS Status;
+	EFI_FILE_HANDLE File;
+	EFI_FILE_INFO* Info = GetIoFileInfo();
+	CHAR16 Path[PATH_MAX + 1];
+	UINTN i, Size, NumFiles = 0;
+	UINT64 Start, Time = 0, LargestSize = 0;
+
+	Largest[0] = L'\0';
+	for (i = 0; i < MIN(List->NumEntries, BENCHMARK_ENTRIES); i++) {
+		if (EFI_ERROR(DecodeHashEntry(List, &List->Entry[i], Path, ARRAY_SIZE(Path))))
+			continue;
+		Start = GetTimestamp();
+		Status = Root->Open(Root, &File, Path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+		if (EFI_ERROR(Status))
+			continue;
+		Size = FILE_INFO_SIZE;
+		Status = File->GetInfo(File, &gEfiFileInfoGuid, &Size, Info);
+		Time += GetTimestamp() - Start;
+		File->Close(File);
+		if (EFI_ERROR(Status))
+			continue;
+		NumFiles++;
+		if (!(Info->Attribute & EFI_FILE_DIRECTORY) && Info->FileSize > LargestSize) {
+			LargestSize = Info->FileSize;
+			SafeStrCpy(Largest, PATH_MAX + 1, Path);
+		}
+	}
+	*Latency = (NumFiles == 0) ? 0 : (UINTN)(Time / NumFiles);
+	return NumFiles;
+}
+
+/**
+  Measure the speed of a hash algorithm, on a memory buffer.
+
+  @param[in]   Algorithm        A pointer to the HASH_ALGORITHM to measure.
+
+  @retval      The speed in MB/s.
+**/
+STATIC UINTN BenchmarkHash(
+	IN CONST HASH_ALGORITHM* Algorithm
+)
+{
+	HASH_CONTEXT Context;
+	UINT8* Buffer;
+	UINTN ChunkSize;
+	UINT64 Size, Start;
+
+	Buffer = GetIoBuffer(0, &ChunkSize);
+	Start = GetTimestamp();
+	Algorithm->Init(&Context);
+	for (Size = 0; Size < BENCHMARK_SIZE; Size += ChunkSize)
+		Algorithm->Write(&Context, Buffer, ChunkSize);
+	Algorithm->Final(&Context);
+	return GetThroughput(Size, GetTimestamp() - Start);
+}
+
+/**
+  Measure the time it takes to redraw a whole line of the console.
+
+  @retval      The average time, in microseconds.
+**/
+STATIC UINTN BenchmarkConsole(VOID)
+{
+	CHAR16 Line[STRING_MAX];
+	UINTN i, j, Width = MIN(gConsole.Cols, STRING_MAX) - 1;
+	UINT64 Start;
+
+	Start = GetTimestamp();
+	for (i = 0; i <= BENCHMARK_REDRAWS; i++) {
+		// Alternate between shaded and blank lines, and end with a blank one
+		for (j = 0; j < Width; j++)
+			Line[j] = (i == BENCHMARK_REDRAWS || (i & 1)) ? L' ' : BLOCKELEMENT_LIGHT_SHADE;
+		Line[j] = L'\0';
+		PrintCentered(Line, gConsole.Rows / 2 - 1);
+	}
+	return (UINTN)((GetTimestamp() - Start) / (BENCHMARK_REDRAWS + 1));
+}
+
+/**
+  Measure the throughput of each of the components that verification relies
+  on, and report the results.
+
+  @param[in]   DeviceHandle     The handle of the boot volume.
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST being verified.
+
+  @retval EFI_SUCCESS           The results were reported.
+  @retval EFI_UNSUPPORTED       The system has no timestamp counter to measure time with.
+**/
+EFI_STATUS RunBenchmark(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List
+)
+{
+	CHAR16 Largest[PATH_MAX + 1];
+	UINTN i, DiskRate = 0, HashRate, Latency, NumFiles, ConsoleTime = 0;
+	UINTN ReadRate[ARRAY_SIZE(BenchmarkReadSize)] = { 0 };
+	BOOLEAN HasDisk;
+
+	if (GetTimestamp() == 0)
+		return EFI_UNSUPPORTED;
+
+	HasDisk = (BenchmarkDisk(DeviceHandle, &DiskRate) == EFI_SUCCESS);
+	NumFiles = BenchmarkOpen(Root, List, &Latency, Largest);
+	for (i = 0; Largest[0] != L'\0' && i < ARRAY_SIZE(BenchmarkReadSize); i++)
+		BenchmarkFileRead(Root, Largest, BenchmarkReadSize[i], &ReadRate[i]);
+	HashRate = BenchmarkHash(List->Algorithm);
+	// The console isn't used in test mode
+	if (!gIsTestMode)
+		ConsoleTime = BenchmarkConsole();
+
+	if (gIsTestMode) {
+		if (HasDisk)
+			PrintTest(L"Benchmark disk = %d MB/s", DiskRate);
+		for (i = 0; Largest[0] != L'\0' && i < ARRAY_SIZE(BenchmarkReadSize); i++)
+			PrintTest(L"Benchmark read %d KB = %d MB/s", BenchmarkReadSize[i] / 1024, ReadRate[i]);
+		PrintTest(L"Benchmark open = %d us", Latency);
+		PrintTest(L"Benchmark %s = %d MB/s", List->Algorithm->Name, HashRate);
+		PrintTest(L"Benchmark files = %d", NumFiles);
+	} else {
+		if (HasDisk)
+			PrintInfo(L"Benchmark: disk %d MB/s, %s %d MB/s, console %d us per line",
+				DiskRate, List->Algorithm->Name, HashRate, ConsoleTime);
+		else
+			PrintInfo(L"Benchmark: %s %d MB/s, console %d us per line",
+				List->Algorithm->Name, HashRate, ConsoleTime);
+		PrintInfo(L"Benchmark: open %d us (%d files), read %d/%d/%d MB/s (16 KB/128 KB/1 MB)",
+			Latency, NumFiles, ReadRate[0], ReadRate[1], ReadRate[2]);
+	}
+	return EFI_SUCCESS;
+}
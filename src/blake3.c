@@ -0,0 +1,279 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - BLAKE3 Hash functions
+ * Copyright © 2023-2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This is a portable implementation of the BLAKE3 hash function, with the
+ * default 256-bit output, as per the specification and reference code from
+ * https://github.com/BLAKE3-team/BLAKE3 (CC0 1.0 / Apache 2.0).
+ *
+ * Data is split into 1024-byte chunks, that are each hashed into a chaining
+ * value, with the chaining values then being combined in a binary tree. We
+ * keep the chaining values of the subtrees that are still incomplete in the
+ * context's stack, and merge them as soon as a new chunk completes a subtree.
+ */
+
+#include "boot.h"
+
+/* Domain separation flags */
+#define CHUNK_START         (1 << 0)
+#define CHUNK_END           (1 << 1)
+#define PARENT              (1 << 2)
+#define ROOT                (1 << 3)
+
+/* Number of blocks in a chunk */
+#define BLOCKS_PER_CHUNK    (BLAKE3_CHUNKSIZE / BLAKE3_BLOCKSIZE)
+
+STATIC CONST UINT32 Blake3Iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+/* The quarter-round function, mixing message words x and y into the state */
+#define G(a, b, c, d, x, y) do { \
+	s[a] += s[b] + (x); s[d] = ROR32(s[d] ^ s[a], 16); \
+	s[c] += s[d];       s[b] = ROR32(s[b] ^ s[c], 12); \
+	s[a] += s[b] + (y); s[d] = ROR32(s[d] ^ s[a], 8);  \
+	s[c] += s[d];       s[b] = ROR32(s[b] ^ s[c], 7); } while(0)
+
+/* A full round, with the message words in the order given by the schedule for this round */
+#define ROUND(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15) do { \
+	G(0, 4,  8, 12, m[m0],  m[m1]);  G(1, 5,  9, 13, m[m2],  m[m3]);  \
+	G(2, 6, 10, 14, m[m4],  m[m5]);  G(3, 7, 11, 15, m[m6],  m[m7]);  \
+	G(0, 5, 10, 15, m[m8],  m[m9]);  G(1, 6, 11, 12, m[m10], m[m11]); \
+	G(2, 7,  8, 13, m[m12], m[m13]); G(3, 4,  9, 14, m[m14], m[m15]); } while(0)
+
+/* Compress a block into a chaining value */
+STATIC VOID Blake3Compress(
+	CONST UINT32* Cv,
+	CONST UINT8* Block,
+	CONST UINT64 Counter,
+	CONST UINT32 BlockLen,
+	CONST UINT32 Flags,
+	UINT32* Out
+)
+{
+	UINT32 m[16], s[16];
+	UINTN i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = LOAD32(Block, i);
+	for (i = 0; i < 8; i++)
+		s[i] = Cv[i];
+	s[8] = Blake3Iv[0];
+	s[9] = Blake3Iv[1];
+	s[10] = Blake3Iv[2];
+	s[11] = Blake3Iv[3];
+	s[12] = (UINT32)Counter;
+	s[13] = (UINT32)(Counter >> 32);
+	s[14] = BlockLen;
+	s[15] = Flags;
+
+	ROUND( 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15);
+	ROUND( 2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8);
+	ROUND( 3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1);
+	ROUND(10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6);
+	ROUND(12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4);
+	ROUND( 9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7);
+	ROUND(11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13);
+
+	for (i = 0; i < 8; i++)
+		Out[i] = s[i] ^ s[i + 8];
+}
+
+#undef ROUND
+#undef G
+
+/* Compute the chaining value of a parent node, from the ones of its children */
+STATIC VOID Blake3Parent(CONST UINT32* Left, CONST UINT32* Right, CONST UINT32 Flags, UINT32* Out)
+{
+	UINT32 Block[16];
+
+	CopyMem(&Block[0], Left, 8 * sizeof(UINT32));
+	CopyMem(&Block[8], Right, 8 * sizeof(UINT32));
+	Blake3Compress(Blake3Iv, (CONST UINT8*)Block, 0, BLAKE3_BLOCKSIZE, PARENT | Flags, Out);
+}
+
+/* Flags that apply to the next block that is compressed for the current chunk */
+#define ChunkFlags(Context) (((Context)->Blake3.BlocksCompressed == 0) ? CHUNK_START : 0)
+
+/* Hash context initialisation */
+VOID Blake3Init(HASH_CONTEXT* Context)
+{
+	ZeroMem(&Context->Blake3, sizeof(Context->Blake3));
+	CopyMem(Context->Blake3.State, Blake3Iv, sizeof(Blake3Iv));
+}
+
+/*
+ * Add the chaining value of a chunk that was just completed to the tree. The
+ * number of trailing zero bits in the total number of chunks tells us how many
+ * subtrees this chunk completes, and that we can merge.
+ */
+STATIC VOID Blake3AddChunk(HASH_CONTEXT* Context, UINT32* Cv)
+{
+	UINT64 TotalChunks = ++Context->Blake3.ChunkCounter;
+
+	while ((TotalChunks & 1) == 0) {
+		V_ASSERT(Context->Blake3.StackLen > 0);
+		Context->Blake3.StackLen--;
+		Blake3Parent(Context->Blake3.Stack[Context->Blake3.StackLen], Cv, 0, Cv);
+		TotalChunks >>= 1;
+	}
+	V_ASSERT(Context->Blake3.StackLen < BLAKE3_MAX_DEPTH);
+	CopyMem(Context->Blake3.Stack[Context->Blake3.StackLen++], Cv, 8 * sizeof(UINT32));
+}
+
+/*
+ * Update the hash with the contents of the buffer. Since the last block of a
+ * chunk, and of the data, must be compressed with specific flags, a block is
+ * only compressed once we know that more data follows it.
+ */
+VOID Blake3Write(HASH_CONTEXT* Context, CONST UINT8* Buffer, UINTN Length)
+{
+	UINT32 Cv[8];
+	UINTN Num;
+
+	Context->Blake3.ByteCount += Length;
+
+	while (Length > 0) {
+		// Close the current chunk if it is full, as it isn't the last one
+		if (Context->Blake3.BlocksCompressed == BLOCKS_PER_CHUNK - 1 &&
+			Context->Blake3.BlockLen == BLAKE3_BLOCKSIZE) {
+			Blake3Compress(Context->Blake3.State, Context->Blake3.Buffer, Context->Blake3.ChunkCounter,
+				BLAKE3_BLOCKSIZE, CHUNK_END, Cv);
+			Blake3AddChunk(Context, Cv);
+			CopyMem(Context->Blake3.State, Blake3Iv, sizeof(Blake3Iv));
+			Context->Blake3.BlocksCompressed = 0;
+			Context->Blake3.BlockLen = 0;
+		}
+
+		// Compress the block we buffered, as it isn't the last one of the chunk
+		if (Context->Blake3.BlockLen == BLAKE3_BLOCKSIZE) {
+			Blake3Compress(Context->Blake3.State, Context->Blake3.Buffer, Context->Blake3.ChunkCounter,
+				BLAKE3_BLOCKSIZE, ChunkFlags(Context), Context->Blake3.State);
+			Context->Blake3.BlocksCompressed++;
+			Context->Blake3.BlockLen = 0;
+		}
+
+		// Compress the blocks that aren't the last one of the chunk or of the
+		// data straight from the input, without copying them
+		while (Context->Blake3.BlockLen == 0 && Length > BLAKE3_BLOCKSIZE &&
+			Context->Blake3.BlocksCompressed < BLOCKS_PER_CHUNK - 1) {
+			Blake3Compress(Context->Blake3.State, Buffer, Context->Blake3.ChunkCounter,
+				BLAKE3_BLOCKSIZE, ChunkFlags(Context), Context->Blake3.State);
+			Context->Blake3.BlocksCompressed++;
+			Buffer += BLAKE3_BLOCKSIZE;
+			Length -= BLAKE3_BLOCKSIZE;
+		}
+
+		// Buffer the rest
+		Num = MIN(BLAKE3_BLOCKSIZE - Context->Blake3.BlockLen, Length);
+		CopyMem(&Context->Blake3.Buffer[Context->Blake3.BlockLen], Buffer, Num);
+		Context->Blake3.BlockLen += Num;
+		Buffer += Num;
+		Length -= Num;
+	}
+}
+
+/* Finalize the computation and write the digest in Context->Blake3.Buffer[] */
+VOID Blake3Final(HASH_CONTEXT* Context)
+{
+	UINT32 Cv[8], Out[8], Flags;
+	UINTN i;
+
+	// The current chunk is the last one, and the root of the tree if the
+	// stack is empty. Else, we merge it with all the pending subtrees.
+	ZeroMem(&Context->Blake3.Buffer[Context->Blake3.BlockLen], BLAKE3_BLOCKSIZE - Context->Blake3.BlockLen);
+	Flags = ChunkFlags(Context) | CHUNK_END;
+	if (Context->Blake3.StackLen == 0) {
+		Blake3Compress(Context->Blake3.State, Context->Blake3.Buffer, Context->Blake3.ChunkCounter,
+			(UINT32)Context->Blake3.BlockLen, Flags | ROOT, Out);
+	} else {
+		Blake3Compress(Context->Blake3.State, Context->Blake3.Buffer, Context->Blake3.ChunkCounter,
+			(UINT32)Context->Blake3.BlockLen, Flags, Cv);
+		for (i = Context->Blake3.StackLen - 1; i > 0; i--)
+			Blake3Parent(Context->Blake3.Stack[i], Cv, 0, Cv);
+		Blake3Parent(Context->Blake3.Stack[0], Cv, ROOT, Out);
+	}
+
+	for (i = 0; i < 8; i++) {
+		Context->Blake3.Buffer[4 * i] = (UINT8)Out[i];
+		Context->Blake3.Buffer[4 * i + 1] = (UINT8)(Out[i] >> 8);
+		Context->Blake3.Buffer[4 * i + 2] = (UINT8)(Out[i] >> 16);
+		Context->Blake3.Buffer[4 * i + 3] = (UINT8)(Out[i] >> 24);
+	}
+}
+
+/**
+  Validate the BLAKE3 implementation against the official test vectors.
+
+  @retval EFI_SUCCESS           The BLAKE3 implementation can be used.
+  @retval EFI_CRC_ERROR         The BLAKE3 implementation failed the test.
+**/
+EFI_STATUS InitBlake3(VOID)
+{
+	/* From test_vectors.json, where the input is a repeating 0, 1, ..., 250 byte sequence */
+	STATIC CONST struct {
+		UINTN           Length;
+		UINT8           Hash[BLAKE3_HASHSIZE];
+	} TestSuite[] = {
+		{ 0,
+		  { 0xaf, 0x13, 0x49, 0xb9, 0xf5, 0xf9, 0xa1, 0xa6, 0xa0, 0x40, 0x4d, 0xea, 0x36, 0xdc, 0xc9, 0x49,
+		    0x9b, 0xcb, 0x25, 0xc9, 0xad, 0xc1, 0x12, 0xb7, 0xcc, 0x9a, 0x93, 0xca, 0xe4, 0x1f, 0x32, 0x62 } },
+		{ 1,
+		  { 0x2d, 0x3a, 0xde, 0xdf, 0xf1, 0x1b, 0x61, 0xf1, 0x4c, 0x88, 0x6e, 0x35, 0xaf, 0xa0, 0x36, 0x73,
+		    0x6d, 0xcd, 0x87, 0xa7, 0x4d, 0x27, 0xb5, 0xc1, 0x51, 0x02, 0x25, 0xd0, 0xf5, 0x92, 0xe2, 0x13 } },
+		{ 1023,
+		  { 0x10, 0x10, 0x89, 0x70, 0xee, 0xda, 0x3e, 0xb9, 0x32, 0xba, 0xac, 0x14, 0x28, 0xc7, 0xa2, 0x16,
+		    0x3b, 0x0e, 0x92, 0x4c, 0x9a, 0x9e, 0x25, 0xb3, 0x5b, 0xba, 0x72, 0xb2, 0x8f, 0x70, 0xbd, 0x11 } },
+		{ 1024,
+		  { 0x42, 0x21, 0x47, 0x39, 0xf0, 0x95, 0xa4, 0x06, 0xf3, 0xfc, 0x83, 0xde, 0xb8, 0x89, 0x74, 0x4a,
+		    0xc0, 0x0d, 0xf8, 0x31, 0xc1, 0x0d, 0xaa, 0x55, 0x18, 0x9b, 0x5d, 0x12, 0x1c, 0x85, 0x5a, 0xf7 } },
+		{ 1025,
+		  { 0xd0, 0x02, 0x78, 0xae, 0x47, 0xeb, 0x27, 0xb3, 0x4f, 0xae, 0xcf, 0x67, 0xb4, 0xfe, 0x26, 0x3f,
+		    0x82, 0xd5, 0x41, 0x29, 0x16, 0xc1, 0xff, 0xd9, 0x7c, 0x8c, 0xb7, 0xfb, 0x81, 0x4b, 0x84, 0x44 } },
+		{ 2049,
+		  { 0x5f, 0x4d, 0x72, 0xf4, 0x0d, 0x7a, 0x5f, 0x82, 0xb1, 0x5c, 0xa2, 0xb2, 0xe4, 0x4b, 0x1d, 0xe3,
+		    0xc2, 0xef, 0x86, 0xc4, 0x26, 0xc9, 0x5c, 0x1a, 0xf0, 0xb6, 0x87, 0x95, 0x22, 0x56, 0x30, 0x30 } },
+		{ 3072,
+		  { 0xb9, 0x8c, 0xb0, 0xff, 0x36, 0x23, 0xbe, 0x03, 0x32, 0x6b, 0x37, 0x3d, 0xe6, 0xb9, 0x09, 0x52,
+		    0x18, 0x51, 0x3e, 0x64, 0xf1, 0xee, 0x2e, 0xdd, 0x25, 0x25, 0xc7, 0xad, 0x1e, 0x5c, 0xff, 0xd2 } },
+		{ 4097,
+		  { 0x9b, 0x40, 0x52, 0xb3, 0x8f, 0x1c, 0x5f, 0xc8, 0xb1, 0xf9, 0xff, 0x7a, 0xc7, 0xb2, 0x7c, 0xd2,
+		    0x42, 0x48, 0x7b, 0x3d, 0x89, 0x0d, 0x15, 0xc9, 0x6a, 0x1c, 0x25, 0xb8, 0xaa, 0x0f, 0xb9, 0x95 } },
+		{ 31744,
+		  { 0x62, 0xb6, 0x96, 0x0e, 0x1a, 0x44, 0xbc, 0xc1, 0xeb, 0x1a, 0x61, 0x1a, 0x8d, 0x62, 0x35, 0xb6,
+		    0xb4, 0xb7, 0x8f, 0x32, 0xe7, 0xab, 0xc4, 0xfb, 0x4c, 0x6c, 0xdc, 0xce, 0x94, 0x89, 0x5c, 0x47 } },
+	};
+	HASH_CONTEXT Context;
+	UINT8 Pattern[251];
+	UINTN i, j;
+
+	for (i = 0; i < ARRAY_SIZE(Pattern); i++)
+		Pattern[i] = (UINT8)i;
+
+	// Feed the data one pattern at a time, which also exercises partial blocks
+	for (i = 0; i < ARRAY_SIZE(TestSuite); i++) {
+		Blake3Init(&Context);
+		for (j = 0; j < TestSuite[i].Length; j += ARRAY_SIZE(Pattern))
+			Blake3Write(&Context, Pattern, MIN(ARRAY_SIZE(Pattern), TestSuite[i].Length - j));
+		Blake3Final(&Context);
+		if (CompareMem(Context.Buffer, TestSuite[i].Hash, BLAKE3_HASHSIZE) != 0)
+			return EFI_CRC_ERROR;
+	}
+
+	return EFI_SUCCESS;
+}
@@ -219,6 +219,7 @@ STATIC EFI_STATUS ExitProcess(
 	EFI_HANDLE ImageHandle;
 	EFI_INPUT_KEY Key = { 0 };
 	BOOLEAN AskToContinue, SkipCountDown;
+	UINT64 StatsStart;
 
 	AskToContinue = (EFI_ERROR(Status) && (Status != EFI_ABORTED) &&
 		(Status != EFI_NOT_FOUND) && !gIsTestMode);
@@ -249,8 +250,12 @@ STATIC EFI_STATUS ExitProcess(
 		}
 		// Reset the watchdog to the default 5 minutes timeout and system code
 		gBS->SetWatchdogTimer(300, 0, 0, NULL);
+		StatsStart = STATS_TIMESTAMP();
 		Status = gBS->LoadImage(FALSE, gMainImageHandle, DevicePath, NULL, 0, &ImageHandle);
+		STATS_ADD(STATS_CHAINLOAD, StatsStart, 0);
 		SafeFree(DevicePath);
+		// The statistics must be reported before the original bootloader takes over
+		ReportStats();
 		if (Status == EFI_SUCCESS) {
 			if (!SkipCountDown)
 				CountDown(L"Continuing in", 3000);
@@ -258,10 +263,14 @@ STATIC EFI_STATUS ExitProcess(
 				gST->ConOut->ClearScreen(gST->ConOut);
 			Status = gBS->StartImage(ImageHandle, NULL, NULL);
 		}
+		// The files are no longer verified once the bootloader returns
+		ExitVerifyProxy();
 		if (EFI_ERROR(Status)) {
 			SetTextPosition(0, gConsole.Rows / 2 + 1);
 			PrintError(L"Could not launch original bootloader");
 		}
+	} else {
+		ReportStats();
 	}
 
 	// If running in test mode, shut down QEMU
@@ -294,16 +303,15 @@ EFI_STATUS EFIAPI efi_main(
 	IN EFI_SYSTEM_TABLE* SystemTable
 )
 {
-	EFI_STATUS Status;
+	EFI_STATUS Status, ParseStatus;
 	EFI_HANDLE DeviceHandle;
-	EFI_FILE_HANDLE Root;
+	EFI_FILE_HANDLE Root, Partition = NULL;
 	EFI_DEVICE_PATH* DevicePath = NULL;
 	HASH_LIST HashList = { 0 };
-	CHAR8 c;
-	CHAR16 Path[PATH_MAX + 1], Message[128], LoaderPath[64];
-	UINT8 ComputedHash[MD5_HASHSIZE], ExpectedHash[MD5_HASHSIZE];
-	UINTN i, Index, NumFailed = 0;
+	CHAR16 Message[128], LoaderPath[64], Rate[32];
+	UINTN i, Index = 0, Coverage, NumFailed = 0, NumVolumesFailed = 0;
 	PROGRESS_DATA Progress = { 0 };
+	UINT64 StatsStart, StartTime, ParseTime, VerifyTime;
 
 	// Keep a global copy of the bootloader's image handle
 	gMainImageHandle = BaseImageHandle;
@@ -318,6 +326,8 @@ EFI_STATUS EFIAPI efi_main(
 	gIsTestMode = IsTestSystem();
 
 	InitConsole();
+	InitTimestamp();
+	StartTime = GetTimestamp();
 
 	Status = GetRootHandle(&DeviceHandle, &Root);
 	if (EFI_ERROR(Status)) {
@@ -329,7 +339,7 @@ EFI_STATUS EFIAPI efi_main(
 	if (IsEarlyAmiUefi()) {
 		PrintWarning(L"Early AMI UEFI firmware detected!");
 		PrintWarning(L"This system may have trouble processing keyboard input.");
-		gPauseAfterRead = 5000;
+		gPauseAfterRead = PAUSE_AFTER_READ_MAX;
 	}
 
 	// Detect if we are booting from an NTFS partition served by the buggy
@@ -346,22 +356,130 @@ EFI_STATUS EFIAPI efi_main(
 	if (SetPathCase(Root, LoaderPath) == EFI_SUCCESS)
 		DevicePath = FileDevicePath(DeviceHandle, LoaderPath);
 
-	// Parse md5sum.txt to construct a hash list.
+	// Parse md5sum.txt, or the hash list of the first other algorithm we
+	// find, to construct a hash list.
 	// We parse the full file, rather than process it line by line so that we
 	// can report progress and, unless md5sum_totalbytes is always specified at
 	// the beginning, progress requires knowing how many files we have to hash.
-	Status = Parse(Root, HASH_FILE, &HashList);
+	StatsStart = STATS_TIMESTAMP();
+	ParseTime = GetTimestamp();
+	for (i = 0; i < HASH_TYPE_MAX; i++) {
+		Status = Parse(Root, &gHashAlgorithm[i], TRUE, &HashList);
+		if (Status != EFI_NOT_FOUND)
+			break;
+	}
+	ParseTime = GetTimestamp() - ParseTime;
+	STATS_ADD(STATS_PARSE, StatsStart, 0);
+	// A missing hash list is not really an error, so don't
+	// report it, unless we're running in test mode.
+	if (Status == EFI_NOT_FOUND && gIsTestMode)
+		PrintError(L"Unable to open '%s'", gHashAlgorithm[HASH_TYPE_MD5].HashFile);
 	if (EFI_ERROR(Status))
 		goto out;
 	V_ASSERT(HashList.Entry != NULL);
 
+	// Make sure that the hash implementation produces valid hashes before we
+	// use it, so that a bad one can't be mistaken for corrupted media.
+	Status = HashList.Algorithm->SelfTest();
+	if (EFI_ERROR(Status)) {
+		PrintError(L"%s self-test failed", HashList.Algorithm->Name);
+		goto out;
+	}
+
+	// Other volumes can only be verified along with all the files of the boot volume
+	if (HashList.NumVolumes != 0 && (HashList.Verify != HASH_VERIFY_FULL ||
+		HashList.PartitionBlocks != 0 || HashList.SampleBytes != 0)) {
+		PrintWarning(L"Ignoring md5sum_volume, which requires the full verification of the files");
+		CloseHashVolumes(&HashList);
+	}
+
+	// The cache only records the full verification of the files of the boot volume
+	if (HashList.CacheSeconds != 0 && (HashList.Verify != HASH_VERIFY_FULL ||
+		HashList.PartitionBlocks != 0 || HashList.SampleBytes != 0 || HashList.NumVolumes != 0)) {
+		PrintWarning(L"Ignoring md5sum_cache, which requires the full verification of the files");
+		HashList.CacheSeconds = 0;
+	}
+
+	// Leave the verification of the files to the proxy, if the hash list
+	// requested it and we have a bootloader that is going to read them
+	if (HashList.Verify == HASH_VERIFY_ONDEMAND && HashList.PartitionBlocks == 0 && DevicePath != NULL) {
+		Status = InstallVerifyProxy(DeviceHandle, &HashList);
+		if (!EFI_ERROR(Status)) {
+			HashList.Buffer = NULL;
+			HashList.Entry = NULL;
+			HashList.Size = NULL;
+			goto out;
+		}
+		PrintWarning(L"On-demand verification is not available for this media");
+	}
+
+	// Set up the buffers we read the media into
+	Status = InitIoPool(DeviceHandle);
+	if (EFI_ERROR(Status)) {
+		PrintError(L"Could not allocate I/O buffers");
+		goto out;
+	}
+
+	// Read the files straight from the disk, if the hash list requested it,
+	// or if it provides the hash of the partition, which we can only read so.
+	// The raw reader only reads the boot volume, so it can't be used along
+	// with other volumes.
+	if (HashList.Reader == HASH_READER_RAW && HashList.NumVolumes != 0)
+		PrintWarning(L"Raw reader is not available when verifying multiple volumes");
+	else if ((HashList.Reader == HASH_READER_RAW || HashList.PartitionBlocks != 0) &&
+		EFI_ERROR(InitRawReader(DeviceHandle)) && HashList.PartitionBlocks == 0)
+		PrintWarning(L"Raw reader is not available for this media");
+
+	// Write the statistics to the media, unless its partition is verified as a whole
+	InitStats((HashList.PartitionBlocks == 0) ? Root : NULL);
+
+	// Measure the components that verification relies on, if the hash list requested it
+	if (HashList.Benchmark && RunBenchmark(DeviceHandle, Root, &HashList) == EFI_UNSUPPORTED)
+		PrintWarning(L"Benchmark mode is not available on this system");
+
+	if (HashList.PartitionBlocks != 0) {
+		// Verify the partition as a whole, rather than the files it contains
+		Status = OpenRawPartition(HashList.Algorithm->HashFile, HashList.PartitionBlocks,
+			&Partition, &HashList.TotalBytes);
+		if (EFI_ERROR(Status)) {
+			PrintError(L"Could not open boot partition");
+			goto out;
+		}
+	} else {
+		// Only verify a sample of the entries, if the media was verified in full recently
+		if (HashList.CacheSeconds != 0 && EFI_ERROR(CheckMediaCache(DeviceHandle, Root, &HashList)))
+			PrintWarning(L"Verified media cache is not available on this system");
+		// Only verify part of the entries on this boot, if the hash list requested it
+		if (HashList.SampleBytes != 0) {
+			Status = SampleHashList(DeviceHandle, Root, &HashList);
+			if (Status == EFI_UNSUPPORTED) {
+				PrintWarning(L"Sampled verification is not available on this system");
+			} else if (EFI_ERROR(Status)) {
+				PrintError(L"Could not select the entries to verify");
+				goto out;
+			}
+		}
+		// Reorder the entries, if the hash list requested it
+		Status = ScheduleHashList(Root, &HashList);
+		if (EFI_ERROR(Status)) {
+			PrintError(L"Could not reorder hash list");
+			goto out;
+		}
+		// Merge the entries of the other volumes, if the hash list named any
+		Status = OpenHashVolumes(DeviceHandle, Root, &HashList, &NumVolumesFailed);
+		if (EFI_ERROR(Status))
+			goto out;
+	}
+
 	// Print any extra data we want to validate
 	PrintTest(L"TotalBytes = 0x%lx", HashList.TotalBytes);
+	if (HashList.Algorithm != &gHashAlgorithm[HASH_TYPE_MD5])
+		PrintTest(L"Algorithm = %s", HashList.Algorithm->Name);
 
 	// Set up the progress bar data
 	Progress.Type = (HashList.TotalBytes == 0) ? PROGRESS_TYPE_FILE : PROGRESS_TYPE_BYTE;
 	Progress.Maximum = (HashList.TotalBytes == 0) ? HashList.NumEntries : HashList.TotalBytes;
-	Progress.Message = L"Media validation";
+	Progress.Message = IsMediaCached() ? L"Media validation (fast path)" : L"Media validation";
 	Progress.YPos = gConsole.Rows / 2 - 3;
 	InitProgress(&Progress);
 	SetText(TEXT_YELLOW);
@@ -371,6 +489,7 @@ EFI_STATUS EFIAPI efi_main(
 
 	// Flush the keyboard input before we check for user cancel
 	FlushKeyboardInput();
+	InitHousekeeping();
 
 	// Set up the scroll section where we display individual file validation errors
 	Status = InitScrollSection(gConsole.Rows / 2 + 1, gConsole.Rows / 2 - 4);
@@ -379,62 +498,102 @@ EFI_STATUS EFIAPI efi_main(
 		goto out;
 	}
 
-	// Now go through each entry we parsed
-	for (Index = 0; Index < HashList.NumEntries; Index++) {
-		// Convert the expected hexascii hash to a binary value we can use
-		ZeroMem(ExpectedHash, sizeof(ExpectedHash));
-		for (i = 0; i < MD5_HASHSIZE * 2; i++) {
-			c = HashList.Entry[Index].Hash[i];
-			// The Parse() call should have filtered any invalid string
-			V_ASSERT(IsValidHexAscii(c));
-			ExpectedHash[i / 2] <<= 4;
-			ExpectedHash[i / 2] |= c >= 'a' ? (c - 'a' + 0x0A) : c - '0';
-		}
-
-		// Convert the UTF-8 path to UCS-2
-		Status = Utf8ToUcs2(HashList.Entry[Index].Path, Path, ARRAY_SIZE(Path));
-		if (EFI_ERROR(Status)) {
-			// Conversion failed but we want a UCS-2 Path for the failure
-			// report so just filter out anything that is non lower ASCII.
-			V_ASSERT(AsciiStrLen(HashList.Entry[Index].Path) < ARRAY_SIZE(Path));
-			for (i = 0; i < AsciiStrLen(HashList.Entry[Index].Path); i++) {
-				c = HashList.Entry[Index].Path[i];
-				if (c < ' ' || c > 0x80)
-					c = '?';
-				Path[i] = (CHAR16)c;
-			}
-			Path[i] = L'\0';
-		} else {
-			// Hash the file and compare the result to the expected value
-			Status = HashFile(Root, Path, &Progress, ComputedHash);
-			if (Status == EFI_SUCCESS &&
-				(CompareMem(ComputedHash, ExpectedHash, MD5_HASHSIZE) != 0))
-				Status = EFI_CRC_ERROR;
-		}
-
-		// Check for user cancellation
-		if (Status == EFI_ABORTED)
-			break;
-
-		// Report failures
-		if (EFI_ERROR(Status)) {
-			NumFailed++;
-			PrintFailedEntry(Status, Path);
+	// Go through each entry we parsed, using the multiprocessor engine if the
+	// system has processors we can use for it, else the multi-lane engine if
+	// the CPU has SIMD instructions we can use for it. The firmware hash
+	// engine can only be used from the sequential one, so it is only measured
+	// against our own when neither of the others can be used, since these are
+	// faster than a single built-in context.
+	// The partition is hashed as a single file, by the sequential engine.
+	VerifyTime = GetTimestamp();
+	if (Partition != NULL) {
+		InitHash2(HashList.Algorithm);
+		Status = VerifyPartition(Partition, HashList.TotalBytes, &HashList, &Progress, &NumFailed);
+		Partition = NULL;
+	} else {
+		Status = VerifyListMp(Root, &HashList, &Progress, &Index, &NumFailed);
+		if (Status == EFI_UNSUPPORTED)
+			Status = VerifyListLanes(Root, &HashList, &Progress, &Index, &NumFailed);
+		if (Status == EFI_UNSUPPORTED) {
+			InitHash2(HashList.Algorithm);
+			Status = VerifyList(Root, &HashList, &Progress, &Index, &NumFailed);
 		}
 	}
-
+	ExitHousekeeping();
+	// An invalid line in a streamed hash list is only found during validation
+	ParseStatus = ExitParse();
+	if (EFI_ERROR(ParseStatus) && !EFI_ERROR(Status))
+		Status = ParseStatus;
+	VerifyTime = GetTimestamp() - VerifyTime;
+
+	// Failures of a reordered list are only reported once all are known
+	ReportFailedEntries(&HashList, NumFailed);
 	ExitScrollSection();
 
 	// Final report
-	UnicodeSPrint(Message, ARRAY_SIZE(Message), L"%d/%d file%s processed [%d failed]",
-		Index, HashList.NumEntries, (HashList.NumEntries == 1) ? L"" : L"s", NumFailed);
+	if (HashList.PartitionBlocks != 0)
+		UnicodeSPrint(Message, ARRAY_SIZE(Message), L"Partition processed [%d failed]", NumFailed);
+	else
+		UnicodeSPrint(Message, ARRAY_SIZE(Message), L"%d/%d file%s processed [%d failed]",
+			Index, HashList.NumEntries, (HashList.NumEntries == 1) ? L"" : L"s", NumFailed);
+	// The average rate varies from one run to the next, so it is not reported in test mode
+	if (!gIsTestMode && GetProgressRate(&Progress, Rate, ARRAY_SIZE(Rate))) {
+		SafeStrCat(Message, ARRAY_SIZE(Message), L" at ");
+		SafeStrCat(Message, ARRAY_SIZE(Message), Rate);
+	}
 	PrintCentered(Message, Progress.YPos + 2);
-	if (Status == EFI_SUCCESS && HashList.TotalBytes != 0 &&
+	// Volumes that couldn't be verified are failures of their own
+	ReportHashVolumes(&HashList, NumFailed, Progress.YPos + 3);
+	NumFailed += NumVolumesFailed;
+	if (GetSampleCoverage(&Coverage)) {
+		UnicodeSPrint(Message, ARRAY_SIZE(Message), L"%d%% of the media verified on this boot", Coverage);
+		PrintCentered(Message, Progress.YPos + 3);
+		// Media that failed keep being verified from the same position
+		if (Status == EFI_SUCCESS && NumFailed == 0 && EFI_ERROR(SaveSampleState()))
+			PrintWarning(L"Could not store the position of the sampled verification");
+	}
+	// Media that failed are verified in full on the next boot
+	if (Status == EFI_SUCCESS && EFI_ERROR(SaveMediaCache(NumFailed == 0)))
+		PrintWarning(L"Could not update the verified media cache");
+	if (Status == EFI_SUCCESS && NumFailed == 0 && HashList.TotalBytes != 0 &&
 		Progress.Current != HashList.TotalBytes)
 		PrintWarning(L"Actual 'md5sum_totalbytes' was 0x%lx", Progress.Current);
 
+	// Report the time that the phases took, for the performance tests to check
+	// and chart. Since it varies from one run to the next, run_tests.sh keeps
+	// this line out of the comparison with the expected output.
+	if (StartTime != 0)
+		PrintTest(L"Timing: files=%d bytes=%ld parse_us=%ld verify_us=%ld total_us=%ld", Index,
+			(Progress.Type == PROGRESS_TYPE_BYTE) ? Progress.Current : 0, ParseTime, VerifyTime,
+			GetTimestamp() - StartTime);
+
 out:
-	SafeFree(HashList.Buffer);
+	if (Partition != NULL)
+		Partition->Close(Partition);
+	// The directory handles must be closed before we chain load
+	FlushDirectoryCache();
+	CloseHashVolumes(&HashList);
+	ExitHousekeeping();
+	ExitParse();
+	ExitHash2();
+	ExitRawReader();
+	ExitIoPool();
+	ExitSample();
+	ExitMediaCache();
+	if (HashList.Buffer != NULL)
+		SafeFree(HashList.Buffer);
+	if (HashList.Entry != NULL)
+		SafeFree(HashList.Entry);
+	if (HashList.Size != NULL)
+		SafeFree(HashList.Size);
+	if (HashList.Chunk != NULL)
+		SafeFree(HashList.Chunk);
+	if (HashList.ChunkBuffer != NULL)
+		SafeFree(HashList.ChunkBuffer);
+	if (HashList.ChunkIndex != NULL)
+		SafeFree(HashList.ChunkIndex);
+	if (HashList.Failure != NULL)
+		SafeFree(HashList.Failure);
 	if (NumFailed != 0)
 		Status = EFI_CRC_ERROR;
 	return ExitProcess(Status, DevicePath);
@@ -22,6 +22,153 @@
 #include <efilib.h>
 #include <libsmbios.h>
 
+/*
+ * gnu-efi does not provide the PI Multiprocessor Services Protocol,
+ * so we define the subset of it that we need to use.
+ */
+#ifndef EFI_MP_SERVICES_PROTOCOL_GUID
+#define EFI_MP_SERVICES_PROTOCOL_GUID \
+	{ 0x3fdda605, 0xa76e, 0x4f46, { 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08 } }
+
+#define PROCESSOR_AS_BSP_BIT        0x00000001
+#define PROCESSOR_ENABLED_BIT       0x00000002
+#define PROCESSOR_HEALTH_STATUS_BIT 0x00000004
+
+typedef struct _EFI_MP_SERVICES_PROTOCOL EFI_MP_SERVICES_PROTOCOL;
+
+typedef struct {
+	UINT32 Package;
+	UINT32 Core;
+	UINT32 Thread;
+} EFI_CPU_PHYSICAL_LOCATION;
+
+typedef struct {
+	UINT32 Package;
+	UINT32 Die;
+	UINT32 Tile;
+	UINT32 Module;
+	UINT32 Core;
+	UINT32 Thread;
+} EFI_CPU_PHYSICAL_LOCATION2;
+
+typedef union {
+	EFI_CPU_PHYSICAL_LOCATION2 Location2;
+} EXTENDED_PROCESSOR_INFORMATION;
+
+typedef struct {
+	UINT64 ProcessorId;
+	UINT32 StatusFlag;
+	EFI_CPU_PHYSICAL_LOCATION Location;
+	EXTENDED_PROCESSOR_INFORMATION ExtendedInformation;
+} EFI_PROCESSOR_INFORMATION;
+
+typedef VOID (EFIAPI *EFI_AP_PROCEDURE)(IN OUT VOID* Buffer);
+
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS)(
+	IN EFI_MP_SERVICES_PROTOCOL* This, OUT UINTN* NumberOfProcessors,
+	OUT UINTN* NumberOfEnabledProcessors);
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_GET_PROCESSOR_INFO)(
+	IN EFI_MP_SERVICES_PROTOCOL* This, IN UINTN ProcessorNumber,
+	OUT EFI_PROCESSOR_INFORMATION* ProcessorInfoBuffer);
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_STARTUP_THIS_AP)(
+	IN EFI_MP_SERVICES_PROTOCOL* This, IN EFI_AP_PROCEDURE Procedure,
+	IN UINTN ProcessorNumber, IN EFI_EVENT WaitEvent OPTIONAL,
+	IN UINTN TimeoutInMicroseconds, IN VOID* ProcedureArgument OPTIONAL,
+	OUT BOOLEAN* Finished OPTIONAL);
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_WHOAMI)(
+	IN EFI_MP_SERVICES_PROTOCOL* This, OUT UINTN* ProcessorNumber);
+
+struct _EFI_MP_SERVICES_PROTOCOL {
+	EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS GetNumberOfProcessors;
+	EFI_MP_SERVICES_GET_PROCESSOR_INFO       GetProcessorInfo;
+	VOID*                                    StartupAllAPs;
+	EFI_MP_SERVICES_STARTUP_THIS_AP          StartupThisAP;
+	VOID*                                    SwitchBSP;
+	VOID*                                    EnableDisableAP;
+	EFI_MP_SERVICES_WHOAMI                   WhoAmI;
+};
+#endif
+
+/*
+ * Nor does it provide the Hash2 Protocol or the Service Binding Protocol.
+ */
+#ifndef EFI_HASH2_PROTOCOL_GUID
+#define EFI_HASH2_SERVICE_BINDING_PROTOCOL_GUID \
+	{ 0xda836f8d, 0x217f, 0x4ca0, { 0x99, 0xc2, 0x1c, 0xa4, 0xe1, 0x60, 0x77, 0xea } }
+#define EFI_HASH2_PROTOCOL_GUID \
+	{ 0x55b1d734, 0xc5e1, 0x49db, { 0x96, 0x47, 0xb1, 0x6a, 0xfb, 0x0e, 0x30, 0x5b } }
+
+typedef struct _EFI_HASH2_PROTOCOL EFI_HASH2_PROTOCOL;
+typedef struct _EFI_SERVICE_BINDING_PROTOCOL EFI_SERVICE_BINDING_PROTOCOL;
+
+typedef union {
+	UINT8 Md5Hash[16];
+	UINT8 Sha1Hash[20];
+	UINT8 Sha224Hash[28];
+	UINT8 Sha256Hash[32];
+	UINT8 Sha384Hash[48];
+	UINT8 Sha512Hash[64];
+} EFI_HASH2_OUTPUT;
+
+typedef EFI_STATUS (EFIAPI *EFI_HASH2_GET_HASH_SIZE)(
+	IN CONST EFI_HASH2_PROTOCOL* This, IN CONST EFI_GUID* HashAlgorithm, OUT UINTN* HashSize);
+typedef EFI_STATUS (EFIAPI *EFI_HASH2_HASH_INIT)(
+	IN CONST EFI_HASH2_PROTOCOL* This, IN CONST EFI_GUID* HashAlgorithm);
+typedef EFI_STATUS (EFIAPI *EFI_HASH2_HASH_UPDATE)(
+	IN CONST EFI_HASH2_PROTOCOL* This, IN CONST UINT8* Message, IN UINTN MessageSize);
+typedef EFI_STATUS (EFIAPI *EFI_HASH2_HASH_FINAL)(
+	IN CONST EFI_HASH2_PROTOCOL* This, IN OUT EFI_HASH2_OUTPUT* Hash);
+
+struct _EFI_HASH2_PROTOCOL {
+	EFI_HASH2_GET_HASH_SIZE                  GetHashSize;
+	VOID*                                    Hash;
+	EFI_HASH2_HASH_INIT                      HashInit;
+	EFI_HASH2_HASH_UPDATE                    HashUpdate;
+	EFI_HASH2_HASH_FINAL                     HashFinal;
+};
+
+typedef EFI_STATUS (EFIAPI *EFI_SERVICE_BINDING_CREATE_CHILD)(
+	IN EFI_SERVICE_BINDING_PROTOCOL* This, IN OUT EFI_HANDLE* ChildHandle);
+typedef EFI_STATUS (EFIAPI *EFI_SERVICE_BINDING_DESTROY_CHILD)(
+	IN EFI_SERVICE_BINDING_PROTOCOL* This, IN EFI_HANDLE ChildHandle);
+
+struct _EFI_SERVICE_BINDING_PROTOCOL {
+	EFI_SERVICE_BINDING_CREATE_CHILD         CreateChild;
+	EFI_SERVICE_BINDING_DESTROY_CHILD        DestroyChild;
+};
+#endif
+
+#ifndef EFI_HASH_ALGORITHM_MD5_GUID
+#define EFI_HASH_ALGORITHM_MD5_GUID \
+	{ 0x0af7c79c, 0x65b5, 0x4319, { 0xb0, 0xae, 0x44, 0xec, 0x48, 0x4e, 0x4a, 0xd7 } }
+#endif
+#ifndef EFI_HASH_ALGORITHM_SHA256_GUID
+#define EFI_HASH_ALGORITHM_SHA256_GUID \
+	{ 0x51aa59de, 0xfdf2, 0x4ea3, { 0xbc, 0x63, 0x87, 0x5f, 0xb7, 0x84, 0x2e, 0xe9 } }
+#endif
+
+/* gnu-efi also lacks the BaseLib calls we use for multiprocessor synchronization */
+#if defined(_MSC_VER)
+#include <intrin.h>
+#if defined(_M_IX86) || defined(_M_X64)
+#define CpuPause()          _mm_pause()
+#define MemoryFence()       do { _ReadWriteBarrier(); _mm_mfence(); } while(0)
+#else
+#define CpuPause()          __yield()
+#define MemoryFence()       __dmb(0xF)
+#endif
+#else
+/* Spin-wait hint, so that a waiting CPU yields to its sibling thread and saves power */
+#if defined(__x86_64__) || defined(__i386__)
+#define CpuPause()          __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define CpuPause()          __asm__ __volatile__("yield" ::: "memory")
+#else
+#define CpuPause()          __asm__ __volatile__("" ::: "memory")
+#endif
+#define MemoryFence()       __sync_synchronize()
+#endif
+
 #else /* EDK2 */
 
 #include <Base.h>
@@ -38,11 +185,15 @@
 #include <Library/UefiLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
 
+#include <Protocol/BlockIo.h>
 #include <Protocol/ComponentName.h>
 #include <Protocol/ComponentName2.h>
 #include <Protocol/DiskIo.h>
 #include <Protocol/DiskIo2.h>
+#include <Protocol/Hash2.h>
 #include <Protocol/LoadedImage.h>
+#include <Protocol/MpService.h>
+#include <Protocol/ServiceBinding.h>
 
 #include <Guid/FileInfo.h>
 #include <Guid/FileSystemInfo.h>
@@ -87,9 +238,6 @@ extern UINTN                gAlertYPos;
 /* SMBIOS vendor name used by GitHub Actions' qemu when running the tests */
 #define TESTING_SMBIOS_NAME "GitHub Actions Test"
 
-/* Name of the file containing the list of hashes */
-#define HASH_FILE           L"md5sum.txt"
-
 /* Minimum dimensions we expect the console to accomodate */
 #define COLS_MIN            50
 #define ROWS_MIN            20
@@ -100,15 +248,143 @@ extern UINTN                gAlertYPos;
 /* Block size used for MD5 hash computation */
 #define MD5_BLOCKSIZE       64
 
-/* Size of the hexascii representation of a hash */
-#define HASH_HEXASCII_SIZE  (MD5_HASHSIZE * 2)
+/* Size of a SHA-256 hash */
+#define SHA256_HASHSIZE     32
+
+/* Block size used for SHA-256 hash computation */
+#define SHA256_BLOCKSIZE    64
+
+/* Size of a BLAKE3 hash (using the default output length) */
+#define BLAKE3_HASHSIZE     32
+
+/* Block and chunk sizes used for BLAKE3 hash computation */
+#define BLAKE3_BLOCKSIZE    64
+#define BLAKE3_CHUNKSIZE    1024
+
+/* Maximum depth of the BLAKE3 tree, i.e. log2 of the maximum number of chunks in a file */
+#define BLAKE3_MAX_DEPTH    54
+
+/* Size of the largest hash we support */
+#define HASH_SIZE_MAX       MAX(SHA256_HASHSIZE, BLAKE3_HASHSIZE)
+
+/* Size of the largest data block that a hash context may need to buffer */
+#define HASH_BLOCKSIZE_MAX  MAX(MAX(MD5_BLOCKSIZE, SHA256_BLOCKSIZE), BLAKE3_BLOCKSIZE)
 
 /* Buffer size for file reads and MD5 hashing */
 #define READ_BUFFERSIZE     (1024 * 1024)
 
-/* Number of bytes to process between watchdog resets */
+/* Maximum number of buffers to keep in flight for asynchronous file reads */
+#define READ_BUFFERCOUNT    3
+
+/* Largest buffer size that the I/O buffer pool may grow to, for media that benefit from it */
+#define READ_BUFFERSIZE_MAX (16 * 1024 * 1024)
+
+/* Share of the free memory that the I/O buffer pool may use, as a power of two divisor */
+#define IO_POOL_BUDGET_SHIFT 4
+
+/* Amount of data to read with a buffer size, before we measure the throughput it yields */
+#define IO_POOL_SAMPLE_SIZE (64 * 1024 * 1024)
+
+/* Throughput gain (in percent) that doubling the buffer size must provide, for us to keep it */
+#define IO_POOL_MIN_GAIN    5
+
+/* Maximum number of application processors we use for parallel hashing */
+#define MP_WORKERS_MAX      8
+
+/* Number of read buffers that can be queued to each application processor */
+#define MP_QUEUE_SIZE       2
+
+/* Amount of time to wait for an application processor to start (in μs) */
+#define MP_STARTUP_TIMEOUT  500000
+
+/* Maximum number of MD5 computations that the multi-lane engine runs in lockstep */
+#define MD5_LANES_MAX       8
+
+/* Number of read buffers of each lane, so that a read is in flight while another buffer is hashed */
+#define MD5_LANE_BUFFERCOUNT 2
+
+/* Number of read buffers of the I/O pool for the engines that hash several files at once */
+#define IO_ENGINE_BUFFERCOUNT MAX(MP_WORKERS_MAX * MP_QUEUE_SIZE, MD5_LANES_MAX * MD5_LANE_BUFFERCOUNT)
+
+/* Amount of time during which we measure the speed of each hash engine (in ms) */
+#define HASH2_CALIBRATION_TIME 50
+
+/* Maximum number of entries that may be processed ahead of the one being reported */
+#define HASH_RESULT_WINDOW  (4 * MAX(MP_WORKERS_MAX, MD5_LANES_MAX))
+
+/* Largest file that is read in a single read, into the small file buffers of the I/O pool */
+#define SMALL_FILE_MAX      (64 * 1024)
+
+/* Number of entries that are opened, and read if they are small files, ahead of time */
+#define SMALL_FILE_PREFETCH 8
+
+/* Amount of time we spend calibrating the timestamp counter (in ms) */
+#define TIMESTAMP_CALIBRATION_TIME 10
+
+/* Number of parent directory handles we keep open, to speed up file opens */
+#define DIR_CACHE_SIZE      16
+
+/* Size of the reads that the raw reader uses to cache the FAT */
+#define RAW_FAT_CACHE_SIZE  (64 * 1024)
+
+/* Maximum number of extents that a file may have, for the raw reader to read it */
+#define RAW_EXTENTS_MAX     256
+
+/* Largest directory that the raw reader may look files up in */
+#define RAW_DIR_SIZE_MAX    (2 * 1024 * 1024)
+
+/* Maximum length of a FAT long file name */
+#define RAW_NAME_MAX        255
+
+/* Maximum number of volumes that a hash list may be verified across, including the boot volume */
+#define HASH_VOLUMES_MAX    8
+
+/* Size of the label of a volume (in CHAR16), which is larger than the one of any file system we know of */
+#define VOLUME_LABEL_SIZE   36
+
+/* Amount of data that the benchmark mode reads or hashes, for each of its measurements */
+#define BENCHMARK_SIZE      (32 * 1024 * 1024)
+
+/* Number of entries of the hash list that the benchmark mode opens */
+#define BENCHMARK_ENTRIES   32
+
+/* Number of console lines that the benchmark mode draws */
+#define BENCHMARK_REDRAWS   16
+
+/* Number of the slowest files that the statistics report */
+#define STATS_SLOWEST_FILES 10
+
+/* Name of the file that the statistics are written to, on volumes that are writable */
+#define STATS_LOG_NAME      L"md5sum.log"
+
+/* Minimum amount of time between two redraws of the progress bar and of the current file (in μs) */
+#define CONSOLE_FRAME_INTERVAL 100000
+
+/* Time constant of the smoothed rate that the progress bar shows (in μs) */
+#define PROGRESS_RATE_PERIOD 2000000
+
+/* Number of bytes to process between watchdog resets, when there is no housekeeping timer */
 #define WATCHDOG_RESETSIZE  (128 * 1024 * 1024)
 
+/* Period of the timer event that performs the housekeeping during verification (in μs) */
+#define HOUSEKEEPING_INTERVAL 50000
+
+/* Number of housekeeping timer periods between watchdog resets */
+#define WATCHDOG_RESETTICKS 1200
+
+/* Range of the pause that early AMI systems require after each read (in μs) */
+#define PAUSE_AFTER_READ_MIN 500
+#define PAUSE_AFTER_READ_MAX 5000
+
+/* Delay of the housekeeping timer past which input is assumed to be lagging (in μs) */
+#define INPUT_LAG_MAX       200000
+
+/* Number of timely housekeeping timer notifications in a row after which the pause is halved */
+#define PAUSE_DECAY_TICKS   40
+
+/* Number of housekeeping timer notifications over which lateness is measured with the RTC */
+#define PAUSE_RTC_TICKS     40
+
 /* Maximum size to be used for paths */
 #ifndef PATH_MAX
 #define PATH_MAX            512
@@ -124,7 +400,10 @@ typedef UINT32              CHAR32;
 #define HASH_FILE_SIZE_MAX  (64 * 1024 * 1024)
 
 /* Maximum number of lines allowed in a hash file */
-#define HASH_FILE_LINES_MAX 100000
+#define HASH_FILE_LINES_MAX 2000000
+
+/* Size of the reads we use to parse a hash file */
+#define HASH_FILE_READSIZE  (1024 * 1024)
 
 /* Maximum size for the File Info structure we query */
 #define FILE_INFO_SIZE      (SIZE_OF_EFI_FILE_INFO + PATH_MAX * sizeof(CHAR16))
@@ -136,6 +415,28 @@ typedef UINT32              CHAR32;
 #define ALIGNED(m)          __declspec(align(m))
 #endif
 
+/* Unaligned 32-bit little endian read of the k-th word of the data at p */
+#if defined(_MSC_VER) && !defined(__clang__)
+#define LOAD32(p, k)        (((CONST UINT32 __unaligned*)(p))[k])
+#else
+typedef UINT32 UNALIGNED_UINT32 __attribute__((aligned(1), may_alias));
+#define LOAD32(p, k)        (((CONST UNALIGNED_UINT32*)(p))[k])
+#endif
+
+/* 32-bit rotate left, that maps to the native rotate instruction */
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ROL32(a, s)         _rotl(a, s)
+#else
+#define ROL32(a, s)         (((a) << (s)) | ((a) >> (32 - (s))))
+#endif
+
+/* 32-bit rotate right, that maps to the native rotate instruction */
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ROR32(a, s)         _rotr(a, s)
+#else
+#define ROR32(a, s)         (((a) >> (s)) | ((a) << (32 - (s))))
+#endif
+
 /* Macro used to compute the size of an array */
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(Array)   (sizeof(Array) / sizeof((Array)[0]))
@@ -187,6 +488,10 @@ typedef struct {
 	UINT64        Current;   /* Current progres value */
 	UINT64        Maximum;   /* Maximum progress value */
 	CONST CHAR16* Message;   /* Message that should be displayed above the progress bar */
+	UINT64        StartTime; /* Timestamp of the initialization, or 0 if there is no timestamp counter */
+	UINT64        RateTime;  /* Timestamp of the last update of the rate */
+	UINT64        RateValue; /* Progress value at the last update of the rate */
+	UINT64        Rate;      /* Smoothed rate, in thousandths of progress value per second */
 } PROGRESS_DATA;
 
 /*
@@ -222,27 +527,288 @@ typedef struct {
 #define COMPARE_GUID CompareGuid
 #endif
 
-/* Context that is used to hash data */
-typedef struct ALIGNED(64) {
+/* Per-algorithm hash states, that all start with the block buffer, which holds the digest once finalized */
+typedef struct {
 	UINT8       Buffer[MD5_BLOCKSIZE];
 	UINT32      State[4];
 	UINT64      ByteCount;
+} MD5_CONTEXT;
+
+typedef struct {
+	UINT8       Buffer[SHA256_BLOCKSIZE];
+	UINT32      State[8];
+	UINT64      ByteCount;
+} SHA256_CONTEXT;
+
+typedef struct {
+	UINT8       Buffer[BLAKE3_BLOCKSIZE];
+	UINT32      State[8];
+	UINT64      ByteCount;
+	/* Position in the current chunk and chaining values of the pending subtrees */
+	UINT64      ChunkCounter;
+	UINTN       BlocksCompressed;
+	UINTN       BlockLen;
+	UINTN       StackLen;
+	UINT32      Stack[BLAKE3_MAX_DEPTH][8];
+} BLAKE3_CONTEXT;
+
+/*
+ * Context that is used to hash data. Each algorithm only initialises and
+ * touches its own state, so that MD5 doesn't pay for the BLAKE3 stack.
+ */
+typedef union ALIGNED(64) {
+	UINT8           Buffer[HASH_BLOCKSIZE_MAX];
+	MD5_CONTEXT     Md5;
+	SHA256_CONTEXT  Sha256;
+	BLAKE3_CONTEXT  Blake3;
 } HASH_CONTEXT;
 
-/* Hash entry, comprised of the (hexascii) hash value and the path it applies to */
+/* Hash algorithm, along with the names of the hash list files that use it */
+typedef struct {
+	CONST CHAR16*   Name;
+	CONST CHAR16*   HashFile;        /* Name of the file containing the list of hashes */
+	CONST CHAR16*   ChunksFile;      /* Name of the optional file with the per-chunk hashes */
+	CONST CHAR16*   BinaryFile;      /* Name of the optional precompiled binary hash list */
+	UINTN           HashSize;
+	EFI_STATUS      (*SelfTest)(VOID);
+	VOID            (*Init)(HASH_CONTEXT* Context);
+	VOID            (*Write)(HASH_CONTEXT* Context, CONST UINT8* Buffer, UINTN Length);
+	VOID            (*Final)(HASH_CONTEXT* Context);
+} HASH_ALGORITHM;
+
+/* The hash algorithms we support, in the order we look for their hash list */
+#define HASH_TYPE_MD5       0
+#define HASH_TYPE_SHA256    1
+#define HASH_TYPE_BLAKE3    2
+#define HASH_TYPE_MAX       3
+extern CONST HASH_ALGORITHM gHashAlgorithm[HASH_TYPE_MAX];
+
+/* MD5 block transform, that processes MD5_BLOCKSIZE bytes of data */
+typedef VOID (*MD5_TRANSFORM)(HASH_CONTEXT* Context, CONST UINT8* Data);
+
+/* Little endian architectures for which we provide a tuned MD5 transform */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__) || defined(_M_ARM64) || \
+    (defined(__arm__) && defined(__ARMEL__)) || defined(_M_ARM)
+#if !defined(BIG_ENDIAN_HOST)
+#define MD5_TUNED_TRANSFORM
+#endif
+#endif
+
+/*
+ * Hash entry, comprised of the offsets of the (binary) hash value and of the
+ * NUL-terminated path it applies to, in the buffer of its hash list. The path
+ * is UTF-8, unless the list has WidePaths. See GetEntryPath() and GetEntryHash().
+ * The expected size of the file, which most lists don't provide, is kept out of
+ * the entry, in the sizes of its hash list. See GetEntrySize().
+ */
 typedef struct {
-	CHAR8*      Hash;
-	CHAR8*      Path;
+	UINT32      Hash;
+	UINT32      Path;
+	UINT32      Index;      /* Position of the entry in the hash list files, in the order of the volumes */
+	UINT16      Flags;      /* HASH_ENTRY_# flags */
+	UINT16      Volume;     /* The volume of the file, in the volumes of its hash list */
 } HASH_ENTRY;
 
+/* Value of the size of a hash entry whose list doesn't provide one */
+#define HASH_SIZE_UNKNOWN   ((UINT64)-1)
+
+/* Flag of the hash entries that are verified on every boot, when sampling (see md5sum_critical) */
+#define HASH_ENTRY_CRITICAL 0x0001
+
+/* Flag of the hash entries whose path is not valid UTF-8, and only has a version of it for reports */
+#define HASH_ENTRY_INVALID_PATH 0x0002
+
+/*
+ * Precompiled binary hash list, that is used as is, instead of being parsed.
+ * It starts with a HASH_BIN_HEADER, followed by NumEntries records, each made
+ * of a HASH_BIN_RECORD and of the hash value (padded to a multiple of 8 bytes),
+ * and ends with the table of the NUL-terminated UCS-2 paths of the entries.
+ * All values are little-endian.
+ */
+#define HASH_BIN_MAGIC      "HASHLIST"
+#define HASH_BIN_VERSION    1
+
+typedef struct {
+	CHAR8       Magic[8];
+	UINT32      Version;
+	UINT32      HashSize;
+	UINT32      NumEntries;
+	UINT32      PathsOffset;    /* Offset of the path table, from the start of the file */
+	UINT32      PathsSize;      /* Size of the path table, in bytes */
+	UINT32      Crc32;          /* CRC32 of this header, computed with this field set to 0 */
+	UINT64      TotalBytes;     /* Same as md5sum_totalbytes, or 0 if not provided */
+} HASH_BIN_HEADER;
+
+typedef struct {
+	UINT64      Size;           /* Size of the file, or HASH_SIZE_UNKNOWN */
+	UINT32      Path;           /* Offset of the path in the path table, in CHAR16 */
+	UINT32      Reserved;
+} HASH_BIN_RECORD;
+
+/* Size of a binary hash list record, for a specific hash size */
+#define HASH_BIN_RECORD_SIZE(HashSize) (sizeof(HASH_BIN_RECORD) + (((HashSize) + 7) & ~7))
+
+/* Orders in which the entries of a hash list may be verified (see md5sum_order) */
+#define HASH_ORDER_MANIFEST 0
+#define HASH_ORDER_DIRECTORY 1
+#define HASH_ORDER_SIZE     2
+#define HASH_ORDER_MAX      3
+
+/* Backends that may be used to read the files of a hash list (see md5sum_reader) */
+#define HASH_READER_FILESYSTEM 0
+#define HASH_READER_RAW     1
+#define HASH_READER_MAX     2
+
+/* When the files of a hash list are verified (see md5sum_verify) */
+#define HASH_VERIFY_FULL    0
+#define HASH_VERIFY_ONDEMAND 1
+#define HASH_VERIFY_MAX     2
+
+/* A failed entry, that is reported once the whole list has been verified */
+typedef struct {
+	CONST HASH_ENTRY* Entry;
+	EFI_STATUS  Status;
+	UINT64      FailedOffset;
+} HASH_FAILURE;
+
+/*
+ * A volume that the entries of a hash list are verified from, besides the boot
+ * volume, as named by md5sum_volume. The boot volume is always the first one.
+ */
+typedef struct {
+	CHAR16          Label[VOLUME_LABEL_SIZE];   /* The label of the volume, or the name that md5sum_volume gave */
+	EFI_FILE_HANDLE Root;       /* The root directory of the volume, or NULL if it is not used */
+	EFI_STATUS      Status;     /* Why the volume is not used, if it isn't */
+	UINTN           NumEntries;
+} HASH_VOLUME;
+
 /* Hash list of <Size> Hash entries */
 typedef struct {
+	CONST HASH_ALGORITHM* Algorithm;
 	HASH_ENTRY* Entry;
 	UINTN       NumEntries;
 	UINT8*      Buffer;
+	UINT64*     Size;       /* The expected size of the files, by entry Index, or NULL if none is provided */
+	BOOLEAN     WidePaths;  /* Whether the paths are UCS-2, as is the case for binary hash lists */
 	UINT64      TotalBytes;
+	UINTN       Order;
+	UINTN       Reader;
+	UINTN       Verify;
+	/* Optional hash of the first PartitionBlocks blocks of the boot partition, from md5sum_partition */
+	UINT64      PartitionBlocks;
+	UINT8       PartitionHash[HASH_SIZE_MAX];
+	/* Amount of data to verify on each boot, from md5sum_sample, or 0 to verify all the entries */
+	UINT64      SampleBytes;
+	/* How long, in seconds, a media that was verified in full is trusted for, from md5sum_cache */
+	UINT64      CacheSeconds;
+	/* Whether to measure the components that verification relies on first, from md5sum_benchmark */
+	BOOLEAN     Benchmark;
+	/* Optional volumes to verify along with the boot volume, from md5sum_volume, or NULL */
+	HASH_VOLUME* Volume;
+	UINTN       NumVolumes;
+	/* Failed entries, if they are to be reported in list order after being verified out of order */
+	HASH_FAILURE* Failure;
+	/* Optional per-chunk hashes, from the algorithm's ChunksFile */
+	HASH_ENTRY* Chunk;
+	UINTN       NumChunks;
+	UINT8*      ChunkBuffer;
+	UINT64      ChunkSize;
+	/* Open addressing path index of the first chunk of each file, as chunk index + 1 */
+	UINT32*     ChunkIndex;
+	UINTN       ChunkIndexMask;
 } HASH_LIST;
 
+/* The per-chunk hashes of a single file, with chunk n starting at offset n * ChunkSize */
+typedef struct {
+	CONST UINT8* Buffer;
+	CONST HASH_ENTRY* Entry;
+	UINTN       NumChunks;
+	UINT64      ChunkSize;
+} HASH_CHUNKS;
+
+/* Result of a hash list entry, for the engines that may complete entries out of order */
+typedef struct {
+	BOOLEAN     Done;
+	BOOLEAN     Opened;
+	BOOLEAN     Hashed;
+	EFI_STATUS  Status;
+	UINT64      Size;
+	CHAR16      Path[PATH_MAX + 1];
+	UINT8       ExpectedHash[HASH_SIZE_MAX];
+	/* For files that are verified per chunk (Chunks.NumChunks != 0) */
+	HASH_CHUNKS Chunks;
+	UINTN       NextChunk;
+	UINTN       PendingChunks;
+	UINT64      ReadBytes;
+	UINT64      FailedOffset;
+	/* For entries that were opened ahead of time (Prefetched), along with the
+	   read of their content, if they are small files (Token.Buffer != NULL) */
+	BOOLEAN     Prefetched;
+	BOOLEAN     ReadPending;
+	EFI_FILE_HANDLE File;
+	EFI_FILE_IO_TOKEN Token;
+	/* When the entry was started, minus the time it took to open it, for the statistics */
+	UINT64      StatsStart;
+} HASH_RESULT;
+
+/* A hashing task for the verification engines: either a whole file or one of its chunks */
+typedef struct {
+	CONST HASH_ALGORITHM* Algorithm;
+	UINTN            Entry;
+	UINTN            Chunk;
+	EFI_FILE_HANDLE  File;
+	UINT64           Length;     /* Number of bytes to read and hash */
+	CONST UINT8*     Data;       /* The content of the file, if it was prefetched, or NULL */
+	UINTN            DataPos;    /* The position of the next read from Data */
+} HASH_TASK;
+
+/* A read of a hashing task, that is asynchronous if the driver supports it */
+typedef struct {
+	EFI_FILE_IO_TOKEN Token;     /* The event is created on first use, and kept for the next reads */
+	UINTN            Requested;  /* Number of bytes that were requested */
+	BOOLEAN          Pending;    /* Set until the read has completed */
+} HASH_READ;
+
+/* Offset value used when a failure doesn't apply to a specific chunk */
+#define HASH_OFFSET_NONE    ((UINT64)-1)
+
+/* MD5 states of the multi-lane engine, with the A, B, C and D values of each lane grouped together */
+typedef struct ALIGNED(64) {
+	UINT32      State[4][MD5_LANES_MAX];
+} MD5_LANES;
+
+/* Phases of the verification that the statistics measure */
+#define STATS_PARSE         0
+#define STATS_UTF8          1
+#define STATS_OPEN          2
+#define STATS_GETINFO       3
+#define STATS_READ          4
+#define STATS_HASH          5
+#define STATS_PROGRESS      6
+#define STATS_CHAINLOAD     7
+#define STATS_PHASE_MAX     8
+
+/*
+ * Convenience macros to measure the phases of the verification and the time
+ * each file takes, which compile out unless ENABLE_STATS is defined. A phase
+ * is measured from a STATS_TIMESTAMP() value, and accounts for a number of
+ * bytes processed (or 0 if it doesn't process any data).
+ */
+#if defined(ENABLE_STATS)
+#define STATS_TIMESTAMP()                   GetTimestamp()
+#define STATS_ADD(Phase, Start, Size)       AddPhaseStats(Phase, GetTimestamp() - (Start), Size)
+#define STATS_ADD_FILE(Path, Size, Start)   AddFileStats(Path, Size, GetTimestamp() - (Start))
+#else
+#define STATS_TIMESTAMP()                   0
+#define STATS_ADD(Phase, Start, Size)       ((VOID)(Start))
+#define STATS_ADD_FILE(Path, Size, Start)   ((VOID)(Start))
+#endif
+
+/* Architectures for which we provide a multi-lane MD5 engine */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__ARM_NEON) || defined(_M_ARM64)
+#define MD5_LANES_ENGINE
+#endif
+
 /* Check for a valid lowercase hex ASCII value */
 STATIC __inline BOOLEAN IsValidHexAscii(CHAR8 c)
 {
@@ -255,6 +821,31 @@ STATIC __inline BOOLEAN IsWhiteSpace(CHAR8 c)
 	return (c == ' ' || c == '\t');
 }
 
+/* Get the path of a hash entry, from the buffer of its hash list */
+STATIC __inline CONST CHAR8* GetEntryPath(CONST UINT8* Buffer, CONST HASH_ENTRY* Entry)
+{
+	return (CONST CHAR8*)&Buffer[Entry->Path];
+}
+
+/* Get the expected size of the file of a hash entry, or HASH_SIZE_UNKNOWN */
+STATIC __inline UINT64 GetEntrySize(CONST HASH_LIST* List, CONST HASH_ENTRY* Entry)
+{
+	return (List->Size == NULL) ? HASH_SIZE_UNKNOWN : List->Size[Entry->Index];
+}
+
+/* Get the root directory of the volume of a hash entry, where Root is the one of the boot volume */
+STATIC __inline EFI_FILE_HANDLE GetEntryRoot(CONST HASH_LIST* List, CONST HASH_ENTRY* Entry,
+	CONST EFI_FILE_HANDLE Root)
+{
+	return (Entry->Volume == 0) ? Root : List->Volume[Entry->Volume].Root;
+}
+
+/* Get the hash value of a hash entry, from the buffer of its hash list */
+STATIC __inline CONST UINT8* GetEntryHash(CONST UINT8* Buffer, CONST HASH_ENTRY* Entry)
+{
+	return &Buffer[Entry->Hash];
+}
+
 /* Pause the system for a specific duration (in us) */
 STATIC __inline EFI_STATUS Sleep(UINTN MicroSeconds)
 {
@@ -404,11 +995,67 @@ BOOLEAN IsProblematicNtfsDriver(
 );
 
 /**
-  Parse a hash sum list file and populate a HASH_LIST structure from it.
+  Detect if the CPU supports the AVX2 instruction set, and if the YMM registers
+  have been enabled by the firmware.
+
+  @retval TRUE   AVX2 instructions can be used.
+  @retval FALSE  AVX2 instructions are not available.
+**/
+BOOLEAN IsAvx2Supported(VOID);
+
+/**
+  Detect if the CPU supports the BMI1 instruction set.
+
+  @retval TRUE   BMI1 instructions can be used.
+  @retval FALSE  BMI1 instructions are not available.
+**/
+BOOLEAN IsBmiSupported(VOID);
+
+/**
+  Detect if the CPU supports the SHA-256 instructions, i.e. the SHA extensions
+  (along with SSSE3) on x86 or the SHA2 instructions of the ARMv8 Cryptographic
+  Extension on AArch64.
+
+  @retval TRUE   SHA-256 instructions can be used.
+  @retval FALSE  SHA-256 instructions are not available.
+**/
+BOOLEAN IsSha256Supported(VOID);
+
+/**
+  Calibrate the timestamp counter that GetTimestamp() uses against gBS->Stall().
+**/
+VOID InitTimestamp(VOID);
+
+/**
+  Get a timestamp, that is only meant to measure elapsed time.
+
+  @retval The timestamp in microseconds, or 0 if the platform has no usable timestamp counter.
+**/
+UINT64 GetTimestamp(VOID);
+
+/**
+  Compute a throughput in MB/s.
+
+  @param[in]   Bytes            The number of bytes that were processed.
+  @param[in]   Time             The time it took, in microseconds.
+
+  @retval      The throughput in MB/s.
+**/
+UINTN GetThroughput(
+	IN CONST UINT64 Bytes,
+	IN CONST UINT64 Time
+);
+
+/**
+  Parse the hash sum list file of a hash algorithm and populate a HASH_LIST
+  structure from it. If the optional chunks file is present, it is parsed as well.
+  A missing hash list file is not reported, so that the caller can look for the
+  one from another algorithm.
 
-  @param[in]  Root   A file handle to the root directory.
-  @param[in]  Path   A pointer to the CHAR16 string.
-  @param[out] List   A pointer to the HASH_LIST structure to populate.
+  @param[in]  Root      A file handle to the root directory.
+  @param[in]  Algorithm A pointer to the HASH_ALGORITHM of the hash list.
+  @param[in]  AllowStreaming Whether the entries may be verified before the whole list is parsed.
+  @param[out] List      A pointer to the HASH_LIST structure to populate.
 
   @retval EFI_SUCCESS           The file was successfully parsed and the hash list is populated.
   @retval EFI_INVALID_PARAMETER One or more of the input parameters are invalid.
@@ -420,134 +1067,1070 @@ BOOLEAN IsProblematicNtfsDriver(
 **/
 EFI_STATUS Parse(
 	IN CONST EFI_FILE_HANDLE Root,
-	IN CONST CHAR16* Path,
+	IN CONST HASH_ALGORITHM* Algorithm,
+	IN CONST BOOLEAN AllowStreaming,
 	OUT HASH_LIST* List
 );
 
 /**
-  Compute the MD5 hash of a single file.
+  Check if a hash list is being streamed, i.e. if more of its entries are yet
+  to be parsed by ParseNextEntries().
 
-  @param[in]   Root             A file handle to the root directory.
-  @param[in]   Path             A pointer to the CHAR16 string with the target path.
-  @param[in]   Progress         (Optional) A pointer to a PROGRESS_DATA structure. If provided then
-                                the current progress value will be updated by this call.
-  @param[out]  Hash             A pointer to the 16-byte array that is to receive the hash.
+  @retval TRUE                  The hash list has more entries to parse.
+  @retval FALSE                 The hash list has been fully parsed, or parsing failed.
+**/
+BOOLEAN IsStreamingList(VOID);
 
-  @retval EFI_SUCCESS           The file was successfully processed and the hash has been populated.
-  @retval EFI_INVALID_PARAMETER One or more of the input parameters are invalid or one of the paths
-                                from the hash list points to a directory.
-  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
-  @retval EFI_NOT_FOUND         The target file could not be found on the media.
-  @retval EFI_END_OF_FILE       The file could not be read in full.
-  @retval EFI_ABORTED           User cancelled the operation.
+/**
+  Parse the next part of the hash list that is being streamed, and add its
+  entries to the HASH_LIST that Parse() populated. If an error occurs, it is
+  reported, streaming stops and the error is returned by ExitParse().
 **/
-EFI_STATUS HashFile(
-	IN CONST EFI_FILE_HANDLE Root,
-	IN CONST CHAR16* Path,
-	OPTIONAL IN PROGRESS_DATA* Progress,
-	OUT UINT8* Hash
-);
+VOID ParseNextEntries(VOID);
 
 /**
-  Convert a UTF-8 encoded string to a UCS-2 encoded string.
+  Stop streaming the hash list, if one is being streamed, and close its file.
 
-  @param[in]  Utf8String      A pointer to the input UTF-8 encoded string.
-  @param[out] Ucs2String      A pointer to the output UCS-2 encoded string.
-  @param[in]  Ucs2StringSize  The size of the Ucs2String buffer (in CHAR16).
+  @retval EFI_SUCCESS           The hash list was fully parsed, or streaming was interrupted.
+  @retval other                 An error occurred while parsing the rest of the hash list.
+**/
+EFI_STATUS ExitParse(VOID);
 
-  @retval EFI_SUCCESS            The conversion was successful.
-  @retval EFI_INVALID_PARAMETER  One or more of the input parameters are invalid.
-  @retval EFI_BUFFER_TOO_SMALL   The output buffer is too small to hold the result.
+/**
+  Decode the path of a hash list entry into an UCS-2 path.
+
+  @param[in]  List          A pointer to the HASH_LIST the entry belongs to.
+  @param[in]  Entry         A pointer to the HASH_ENTRY to decode.
+  @param[out] Path          A pointer to the CHAR16 buffer that receives the path.
+  @param[in]  PathSize      The size of the Path buffer (in CHAR16).
+
+  @retval EFI_SUCCESS           The entry was successfully decoded.
+  @retval EFI_INVALID_PARAMETER The path of the hash list file is not valid UTF-8.
+  @retval EFI_BUFFER_TOO_SMALL  The path is too long.
+                                For the two errors above, Path is still filled with a
+                                version of the path that can be used for error reports.
 **/
-EFI_STATUS Utf8ToUcs2(
-	IN CONST CHAR8* Utf8String,
-	OUT CHAR16* Ucs2String,
-	IN CONST UINTN Ucs2StringSize
+EFI_STATUS DecodeHashEntry(
+	IN CONST HASH_LIST* List,
+	IN CONST HASH_ENTRY* Entry,
+	OUT CHAR16* Path,
+	IN CONST UINTN PathSize
 );
 
 /**
-  Console initialisation.
+  Look up the per-chunk hashes of a hash list entry.
+
+  @param[in]  List          A pointer to the HASH_LIST the entry belongs to.
+  @param[in]  Entry         A pointer to the HASH_ENTRY to look up.
+  @param[out] Chunks        A pointer to the HASH_CHUNKS structure to populate.
+
+  @retval TRUE              Chunks were found for this entry.
+  @retval FALSE             The entry has no chunks.
 **/
-VOID InitConsole(VOID);
+BOOLEAN FindHashChunks(
+	IN CONST HASH_LIST* List,
+	IN CONST HASH_ENTRY* Entry,
+	OUT HASH_CHUNKS* Chunks
+);
+
+/*
+ * MD5 primitives. These do not call any UEFI service, so that they can
+ * also be used from application processors.
+ */
+VOID Md5Init(HASH_CONTEXT* Context);
+VOID Md5Write(HASH_CONTEXT* Context, CONST UINT8* Buffer, UINTN Length);
+VOID Md5Final(HASH_CONTEXT* Context);
 
 /**
-  Flush the keyboard input buffers.
+  Select the fastest MD5 transform that the platform supports, after
+  validating it against the RFC 1321 test suite. A transform that fails
+  the test is reported and skipped.
+
+  @retval EFI_SUCCESS           A valid MD5 transform has been selected.
+  @retval EFI_CRC_ERROR         None of the MD5 transforms passed the test.
 **/
-VOID FlushKeyboardInput(VOID);
+EFI_STATUS InitMd5(VOID);
 
 /**
-  Initialize a scrolling section on the console.
-
-  @param[in]   YPos              The vertical start position of the scrolling section.
-  @param[in]   NumberOfLines     How many lines should the scrolling section have.
+  Start the timer that performs the housekeeping during verification. This
+  must be called after the keyboard input has been flushed.
 
-  @retval EFI_SUCCESS            The scroll section was successfully initialized.
-  @retval EFI_INVALID_PARAMETER  The provided parameters are invalid.
-  @retval EFI_OUT_OF_RESOURCES   A memory allocation error occurred.
+  @retval EFI_SUCCESS           The timer was started.
+  @retval other                 The timer could not be started, in which case
+                                UpdateHashProgress() performs the housekeeping.
 **/
-EFI_STATUS InitScrollSection(
-	CONST UINTN YPos,
-	CONST UINTN NumberOfLines
-);
+EFI_STATUS InitHousekeeping(VOID);
 
 /**
-  Scroll section teardown.
+  Stop the housekeeping timer.
 **/
-VOID ExitScrollSection(VOID);
+VOID ExitHousekeeping(VOID);
 
 /**
-  Print a centered message on the console.
+  Perform the housekeeping that needs to occur after each file read, i.e.
+  update the progress, and, if the housekeeping timer isn't running, reset
+  the watchdog and check for user cancellation.
 
-  @param[in]  Message    The text message to print.
-  @param[in]  YPos       The vertical position to print the message to.
+  @param[in]   Size             The size of the data that was read.
+  @param[in]   Progress         (Optional) A pointer to a PROGRESS_DATA structure.
+
+  @retval EFI_SUCCESS           The operation can carry on.
+  @retval EFI_ABORTED           User cancelled the operation.
 **/
-VOID PrintCentered(
-	IN CONST CHAR16* Message,
-	IN CONST UINTN YPos
+EFI_STATUS UpdateHashProgress(
+	IN CONST UINTN Size,
+	OPTIONAL IN PROGRESS_DATA* Progress
 );
 
 /**
-  Print a hash entry that has failed processing.
-  Do this over a specific section of the console we cycle over.
-
-  @param[in]  Status     The Status code from the failed operation on the entry.
-  @param[in]  Path       A pointer to the CHAR16 string with the Path of the entry.
-  @param[in]  NumFailed  The current number of failed entries.
+  Close all the directory handles from the directory cache.
 **/
-VOID PrintFailedEntry(
-	IN CONST EFI_STATUS Status,
-	IN CONST CHAR16* Path
-);
+VOID FlushDirectoryCache(VOID);
 
 /**
-  Display a countdown on screen.
+  Open a file that is to be hashed and validate that it is not a directory.
 
-  @param[in]  Message   A message to display with the countdown.
-  @param[in]  Duration  The duration of the countdown (in ms).
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   Path             A pointer to the CHAR16 string with the target path.
+  @param[out]  File             A pointer to receive the handle of the opened file.
+  @param[out]  FileSize         A pointer to receive the size of the file.
+
+  @retval EFI_SUCCESS           The file was successfully opened.
+  @retval EFI_INVALID_PARAMETER The path points to a directory.
+  @retval EFI_NOT_FOUND         The target file could not be found on the media.
 **/
-VOID CountDown(
-	IN CONST CHAR16* Message,
-	IN CONST UINTN Duration
+EFI_STATUS OpenFileToHash(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST CHAR16* Path,
+	OUT EFI_FILE_HANDLE* File,
+	OUT UINT64* FileSize
 );
 
 /**
-  Initialize a progress bar.
+  Compute the hash of the data referenced by a hashing task, i.e. a whole
+  file or a single chunk of it.
 
-  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
+  @param[in]   Task             A pointer to the HASH_TASK to process.
+  @param[in]   Progress         (Optional) A pointer to a PROGRESS_DATA structure. If provided then
+                                the current progress value will be updated by this call.
+  @param[out]  Hash             A pointer to the HASH_SIZE_MAX array that is to receive the hash.
+  @param[out]  ReadBytes        A pointer to receive the number of bytes that were hashed.
+
+  @retval EFI_SUCCESS           The data was successfully processed and the hash has been populated.
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval other                 A read error occurred.
 **/
-VOID InitProgress(
-	IN PROGRESS_DATA* Progress
+EFI_STATUS HashFile(
+	IN CONST HASH_TASK* Task,
+	OPTIONAL IN PROGRESS_DATA* Progress,
+	OUT UINT8* Hash,
+	OUT UINT64* ReadBytes
 );
 
 /**
-  Update a progress bar.
-
-  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
+  Start the next hashing task, which is the next chunk of the last entry that was
+  started, if that entry is verified per chunk and has no failed chunk, or else
+  the next entry of the hash list (as long as there's room in the results window).
+  Entries that can't be opened are completed straight away and skipped.
+
+  @param[in]     Root           A file handle to the root directory.
+  @param[in]     List           A pointer to the HASH_LIST being verified.
+  @param[in]     Results        A pointer to the HASH_RESULT_WINDOW entries window.
+  @param[in,out] NextEntry      A pointer to the index of the next entry that is yet to be started.
+  @param[in]     NextReport     The index of the next entry to report.
+  @param[out]    Task           A pointer to the HASH_TASK to populate.
+
+  @retval EFI_SUCCESS           A new task was started.
+  @retval EFI_NOT_FOUND         There is no task that can be started at this stage.
+**/
+EFI_STATUS StartHashTask(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN HASH_RESULT* Results,
+	IN OUT UINTN* NextEntry,
+	IN CONST UINTN NextReport,
+	OUT HASH_TASK* Task
+);
+
+/**
+  Complete a hashing task, by closing its file, validating the amount of data
+  read, and comparing the computed hash against the expected one. The result of
+  an entry only becomes complete once all the chunks that were started for it
+  have been completed.
+
+  @param[in]   Results          A pointer to the HASH_RESULT_WINDOW entries window.
+  @param[in]   Task             A pointer to the HASH_TASK to complete.
+  @param[in]   Status           The status of the hash computation.
+  @param[in]   ReadBytes        The number of bytes that were hashed.
+  @param[in]   Hash             A pointer to the computed hash.
+**/
+VOID CompleteHashTask(
+	IN HASH_RESULT* Results,
+	IN HASH_TASK* Task,
+	IN CONST EFI_STATUS Status,
+	IN CONST UINT64 ReadBytes,
+	IN CONST UINT8* Hash
+);
+
+/**
+  Report the hash results that have been completed, in the order of the hash list.
+  Reporting stops at the first result that isn't completed, or that was aborted.
+  Failures are recorded instead of printed, if the list was reordered or merged.
+
+  @param[in]     List           A pointer to the HASH_LIST being verified.
+  @param[in]     Results        A pointer to the HASH_RESULT_WINDOW entries window.
+  @param[in,out] NextReport     A pointer to the index of the next entry to report.
+  @param[in]     NextEntry      The index of the next entry that is yet to be started.
+  @param[in]     Progress       A pointer to a PROGRESS_DATA structure.
+  @param[in,out] NumFailed      A pointer to the number of failed entries, to be updated.
+  @param[out]    LastStatus     A pointer to receive the status of the last reported entry.
+
+  @retval TRUE                  An aborted entry was encountered.
+  @retval FALSE                 Reporting can continue.
+**/
+BOOLEAN ReportHashResults(
+	IN CONST HASH_LIST* List,
+	IN HASH_RESULT* Results,
+	IN OUT UINTN* NextReport,
+	IN CONST UINTN NextEntry,
+	IN PROGRESS_DATA* Progress,
+	IN OUT UINTN* NumFailed,
+	OUT EFI_STATUS* LastStatus
+);
+
+/**
+  Queue the read of the next block of data of a hashing task. The read is
+  asynchronous if the driver supports it, else it completes straight away,
+  as it does for the content that was prefetched for small files. Reads of
+  the same task complete in the order they were queued.
+
+  @param[in]     Task           A pointer to the HASH_TASK to read from.
+  @param[in,out] Read           A pointer to the HASH_READ to queue, which must not be pending.
+  @param[out]    Buffer         A pointer to the buffer that receives the data.
+  @param[in]     Size           The number of bytes to read.
+**/
+VOID QueueHashTaskRead(
+	IN HASH_TASK* Task,
+	IN OUT HASH_READ* Read,
+	OUT UINT8* Buffer,
+	IN CONST UINTN Size
+);
+
+/**
+  Check whether a read that was queued by QueueHashTaskRead() has completed,
+  without waiting for it.
+
+  @param[in,out] Read           A pointer to the HASH_READ to check.
+
+  @retval TRUE                  The read has completed.
+  @retval FALSE                 The read is still in progress.
+**/
+BOOLEAN IsHashTaskReadDone(
+	IN OUT HASH_READ* Read
+);
+
+/**
+  Wait for a read that was queued by QueueHashTaskRead() to complete.
+
+  @param[in,out] Read           A pointer to the HASH_READ to wait for.
+  @param[out]    Size           A pointer to receive the number of bytes read.
+
+  @retval EFI_SUCCESS           The data was read.
+  @retval other                 A read error occurred.
+**/
+EFI_STATUS WaitHashTaskRead(
+	IN OUT HASH_READ* Read,
+	OUT UINTN* Size
+);
+
+/**
+  Release a HASH_READ, once the read it may have in progress has completed.
+
+  @param[in,out] Read           A pointer to the HASH_READ to release.
+**/
+VOID CloseHashTaskRead(
+	IN OUT HASH_READ* Read
+);
+
+/**
+  Release a results window, along with the entries that were opened ahead of
+  time and that were not started.
+
+  @param[in]   Results          A pointer to the HASH_RESULT_WINDOW entries window.
+**/
+VOID ReleaseHashResults(
+	IN HASH_RESULT* Results
+);
+
+/**
+  Verify all the entries from a hash list, one file at a time.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST to verify.
+  @param[in]   Progress         A pointer to a PROGRESS_DATA structure.
+  @param[out]  NumProcessed     A pointer to receive the number of entries processed.
+  @param[out]  NumFailed        A pointer to the number of failed entries, to be updated.
+
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval other                 The status of the last entry that was processed.
+**/
+EFI_STATUS VerifyList(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN PROGRESS_DATA* Progress,
+	OUT UINTN* NumProcessed,
+	IN OUT UINTN* NumFailed
+);
+
+/**
+  Verify the first blocks of the boot partition against the hash from the
+  md5sum_partition directive of a hash list.
+
+  @param[in]   File             A handle to the partition, from OpenRawPartition(), that is closed by this call.
+  @param[in]   Size             The size of the partition data.
+  @param[in]   List             A pointer to the HASH_LIST with the expected hash.
+  @param[in]   Progress         A pointer to a PROGRESS_DATA structure.
+  @param[in,out] NumFailed      A pointer to the number of failed entries, to be updated.
+
+  @retval EFI_SUCCESS           The partition data matches the expected hash.
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval EFI_CRC_ERROR         The partition data doesn't match the expected hash.
+  @retval other                 A read error occurred.
+**/
+EFI_STATUS VerifyPartition(
+	IN EFI_FILE_HANDLE File,
+	IN CONST UINT64 Size,
+	IN CONST HASH_LIST* List,
+	IN PROGRESS_DATA* Progress,
+	IN OUT UINTN* NumFailed
+);
+
+/**
+  Reorder the entries of a hash list according to its md5sum_order directive:
+  either grouped by parent directory, so that files from the same directory are
+  opened consecutively, or by decreasing file size, so that the largest files
+  (which dominate the verification time) are started first.
+  When the list is reordered, the array that records failures is also allocated,
+  so that failures can be reported in the order of the hash list file.
+
+  @param[in]     Root           A file handle to the root directory.
+  @param[in,out] List           A pointer to the HASH_LIST to reorder.
+
+  @retval EFI_SUCCESS           The list was reordered, or doesn't need to be.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS ScheduleHashList(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN OUT HASH_LIST* List
+);
+
+/**
+  Print the failures that were recorded while verifying a reordered or merged hash list,
+  in the order of the hash list file.
+
+  @param[in]   List             A pointer to the HASH_LIST that was verified.
+  @param[in]   NumFailed        The number of failures that were recorded.
+**/
+VOID ReportFailedEntries(
+	IN CONST HASH_LIST* List,
+	IN CONST UINTN NumFailed
+);
+
+/**
+  Look for a firmware EFI_HASH2_PROTOCOL that supports the hash algorithm and,
+  if it produces valid hashes faster than the built-in implementation, select
+  it for HashFile(). Since that protocol can only be used from the BSP, and
+  with only one hash in progress, it is only used by VerifyList() and
+  VerifyPartition(), and should therefore only be considered when neither
+  VerifyListMp() nor VerifyListLanes() can be used.
+
+  @param[in]   Algorithm        A pointer to the HASH_ALGORITHM of the hash list.
+
+  @retval EFI_SUCCESS           The firmware hash engine has been selected.
+  @retval EFI_UNSUPPORTED       The built-in hash implementation is to be used.
+**/
+EFI_STATUS InitHash2(
+	IN CONST HASH_ALGORITHM* Algorithm
+);
+
+/**
+  Release the firmware hash engine, if one was selected.
+**/
+VOID ExitHash2(VOID);
+
+/**
+  Check if the firmware hash engine was selected for a hash algorithm.
+
+  @param[in]   Algorithm        A pointer to a HASH_ALGORITHM.
+
+  @retval TRUE                  Data for this algorithm is to be hashed by the firmware.
+  @retval FALSE                 Data for this algorithm is to be hashed by the built-in implementation.
+**/
+BOOLEAN IsHash2Selected(
+	IN CONST HASH_ALGORITHM* Algorithm
+);
+
+/*
+ * Firmware hash engine operations, that must only be called from the BSP,
+ * after IsHash2Selected() returned TRUE. Once Hash2Start() succeeded, the
+ * operation must be terminated with Hash2Finish(), even if an error occurred.
+ */
+EFI_STATUS Hash2Start(VOID);
+EFI_STATUS Hash2Update(IN CONST UINT8* Buffer, IN CONST UINTN Size);
+EFI_STATUS Hash2Finish(OPTIONAL OUT UINT8* Hash);
+
+/**
+  Allocate the I/O buffer pool, for reads from the boot media.
+
+  @param[in]   DeviceHandle     The handle of the boot media.
+
+  @retval EFI_SUCCESS           The I/O buffer pool was allocated.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS InitIoPool(
+	IN CONST EFI_HANDLE DeviceHandle
+);
+
+/**
+  Release the I/O buffer pool.
+**/
+VOID ExitIoPool(VOID);
+
+/**
+  Get a read buffer from the I/O buffer pool.
+
+  @param[in]   Index            The index of the buffer (between 0 and READ_BUFFERCOUNT - 1).
+  @param[out]  ChunkSize        A pointer to receive the size that reads should currently use.
+
+  @retval      A pointer to a buffer that can hold at least ChunkSize bytes.
+**/
+UINT8* GetIoBuffer(
+	IN CONST UINTN Index,
+	OUT UINTN* ChunkSize
+);
+
+/**
+  Get a read buffer for the engines that hash several files at once, from the
+  I/O buffer pool. These buffers are only allocated on first use.
+
+  @param[in]   Index            The index of the buffer (between 0 and IO_ENGINE_BUFFERCOUNT - 1).
+
+  @retval      A pointer to a READ_BUFFERSIZE buffer, or NULL if the buffers could not be allocated.
+**/
+UINT8* GetIoEngineBuffer(
+	IN CONST UINTN Index
+);
+
+/**
+  Get a small file buffer from the I/O buffer pool.
+
+  @param[in]   Index            The index of the buffer (between 0 and HASH_RESULT_WINDOW - 1).
+
+  @retval      A pointer to a SMALL_FILE_MAX buffer.
+**/
+UINT8* GetIoSmallFileBuffer(
+	IN CONST UINTN Index
+);
+
+/**
+  Get the file information buffer from the I/O buffer pool.
+
+  @retval      A pointer to a FILE_INFO_SIZE buffer.
+**/
+EFI_FILE_INFO* GetIoFileInfo(VOID);
+
+/**
+  Account for the time it took to read and hash a buffer and, once enough data
+  was processed with the current read size, adjust the read size. Short reads,
+  as well as reads that were issued with a previous read size, are ignored.
+
+  @param[in]   Bytes            The number of bytes that were read and hashed.
+  @param[in]   Time             The time it took, in microseconds.
+**/
+VOID UpdateIoThroughput(
+	IN CONST UINT64 Bytes,
+	IN CONST UINT64 Time
+);
+
+/**
+  Set up the raw reader for the boot volume, if it uses a file system we support.
+
+  @param[in]   DeviceHandle     The handle of the boot volume.
+
+  @retval EFI_SUCCESS           The raw reader is set up.
+  @retval EFI_UNSUPPORTED       The volume can't be read directly.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS InitRawReader(
+	IN CONST EFI_HANDLE DeviceHandle
+);
+
+/**
+  Release the raw reader.
+**/
+VOID ExitRawReader(VOID);
+
+/**
+  Open a file with the raw reader, if it was set up.
+
+  @param[in]   Path             A pointer to the CHAR16 string with the path of the file.
+  @param[out]  File             A pointer to receive the handle of the opened file.
+  @param[out]  FileSize         A pointer to receive the size of the file.
+
+  @retval EFI_SUCCESS           The file was opened.
+  @retval other                 The file is to be opened with the file system driver.
+**/
+EFI_STATUS OpenRawFile(
+	IN CONST CHAR16* Path,
+	OUT EFI_FILE_HANDLE* File,
+	OUT UINT64* FileSize
+);
+
+/**
+  Open the first blocks of the boot partition with the raw reader, as a single
+  file where the clusters of a file that is to be excluded read as zeroes.
+
+  @param[in]   ExcludePath      A pointer to the CHAR16 string with the path of the file to exclude.
+  @param[in]   NumBlocks        The number of blocks to open.
+  @param[out]  File             A pointer to receive the handle of the opened partition.
+  @param[out]  Size             A pointer to receive the size of the opened partition.
+
+  @retval EFI_SUCCESS           The partition was opened.
+  @retval EFI_UNSUPPORTED       The raw reader wasn't set up.
+  @retval EFI_END_OF_MEDIA      The partition is smaller than NumBlocks.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval EFI_VOLUME_CORRUPTED  The clusters of the file to exclude overlap.
+  @retval other                 The file to exclude could not be resolved.
+**/
+EFI_STATUS OpenRawPartition(
+	IN CONST CHAR16* ExcludePath,
+	IN CONST UINT64 NumBlocks,
+	OUT EFI_FILE_HANDLE* File,
+	OUT UINT64* Size
+);
+
+/**
+  Get the serial number of a volume, from its boot sector, so that the volume
+  can be told apart from other media, whether or not the raw reader can read it.
+
+  @param[in]   DeviceHandle     The handle of the volume.
+  @param[out]  Serial           A pointer to receive the serial number.
+
+  @retval EFI_SUCCESS           The serial number was retrieved.
+  @retval EFI_UNSUPPORTED       The volume is not FAT16, FAT32, exFAT or NTFS, or has no serial number.
+  @retval other                 A read error occurred.
+**/
+EFI_STATUS GetVolumeSerial(
+	IN CONST EFI_HANDLE DeviceHandle,
+	OUT UINT64* Serial
+);
+
+/**
+  Replace the simple file system protocol of the boot volume with the on-demand
+  verification proxy. On success, the proxy takes ownership of the buffers of
+  the hash list.
+
+  @param[in]   DeviceHandle     The handle of the boot volume.
+  @param[in]   List             A pointer to the HASH_LIST with the hashes of the files.
+
+  @retval EFI_SUCCESS           The proxy was installed.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval other                 The proxy could not be installed.
+**/
+EFI_STATUS InstallVerifyProxy(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST HASH_LIST* List
+);
+
+/**
+  Restore the original simple file system protocol of the boot volume, if the
+  on-demand verification proxy was installed, and release the proxy.
+**/
+VOID ExitVerifyProxy(VOID);
+
+/**
+  Compute the hash of the entries of a hash list, i.e. of their hashes and paths.
+
+  @param[in]   List             A pointer to the HASH_LIST to hash.
+  @param[out]  Hash             A pointer to the HASH_SIZE_MAX array that receives the hash.
+**/
+VOID HashEntries(
+	IN CONST HASH_LIST* List,
+	OUT UINT8* Hash
+);
+
+/**
+  Reduce a hash list to the entries that are to be verified on this boot,
+  according to its md5sum_sample directive: the critical entries, followed by
+  the next entries of the rotation, for as long as they fit in the budget.
+  The entries are kept in the order of the list, and the total size of the
+  list is updated to the one of the sample.
+
+  @param[in]     DeviceHandle   The handle of the boot volume.
+  @param[in]     Root           A file handle to the root directory.
+  @param[in,out] List           A pointer to the HASH_LIST to sample.
+
+  @retval EFI_SUCCESS           The list was sampled.
+  @retval EFI_UNSUPPORTED       The NV variable of the volume could not be read.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS SampleHashList(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST EFI_FILE_HANDLE Root,
+	IN OUT HASH_LIST* List
+);
+
+/**
+  Get the coverage of the sample of the current boot.
+
+  @param[out]  Coverage         A pointer to receive the percentage of the media that the sample covers.
+
+  @retval TRUE                  The hash list was sampled.
+  @retval FALSE                 The hash list was not sampled.
+**/
+BOOLEAN GetSampleCoverage(
+	OUT UINTN* Coverage
+);
+
+/**
+  Store the position of the rotation, once the sample of the current boot has
+  been verified, so that the next boot verifies the entries that follow it.
+
+  @retval EFI_SUCCESS           The position was stored, or the hash list was not sampled.
+  @retval other                 The NV variable of the volume could not be written.
+**/
+EFI_STATUS SaveSampleState(VOID);
+
+/**
+  Release the sample of the current boot.
+**/
+VOID ExitSample(VOID);
+
+/**
+  Get the label of a volume, from its file system information.
+
+  @param[in]   Root             A file handle to the root directory of the volume.
+  @param[out]  Label            A pointer to the VOLUME_LABEL_SIZE buffer that receives the
+                                label, which is empty if the volume has none.
+**/
+VOID GetVolumeLabel(
+	IN CONST EFI_FILE_HANDLE Root,
+	OUT CHAR16* Label
+);
+
+/**
+  Open the volumes that the md5sum_volume directives of a hash list name, parse
+  their own hash list, with the algorithm of the boot one, and merge their
+  entries into the hash list, so that all the volumes are verified at once.
+  Volumes that can't be used are reported, and counted as failures.
+
+  @param[in]     DeviceHandle   The handle of the boot volume.
+  @param[in]     Root           A file handle to the root directory of the boot volume.
+  @param[in,out] List           A pointer to the HASH_LIST of the boot volume.
+  @param[out]    NumFailed      A pointer to receive the number of volumes that can't be used.
+
+  @retval EFI_SUCCESS           The volumes were merged, or the hash list names none.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS OpenHashVolumes(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST EFI_FILE_HANDLE Root,
+	IN OUT HASH_LIST* List,
+	OUT UINTN* NumFailed
+);
+
+/**
+  Get the path of a hash list entry, as it is displayed, i.e. prefixed with
+  the label of its volume, if it isn't on the boot volume.
+
+  @param[in]   List             A pointer to the HASH_LIST the entry belongs to.
+  @param[in]   Entry            A pointer to the HASH_ENTRY.
+  @param[in]   Path             A pointer to the decoded path of the entry.
+  @param[out]  Buffer           A pointer to a buffer that may receive the displayed path.
+  @param[in]   BufferSize       The size of Buffer (in CHAR16).
+
+  @retval      Either Path or Buffer.
+**/
+CONST CHAR16* GetDisplayPath(
+	IN CONST HASH_LIST* List,
+	IN CONST HASH_ENTRY* Entry,
+	IN CONST CHAR16* Path,
+	OUT CHAR16* Buffer,
+	IN CONST UINTN BufferSize
+);
+
+/**
+  Print the number of files and of failures of each of the volumes that a
+  hash list was verified from, if there is more than one.
+
+  @param[in]   List             A pointer to the HASH_LIST that was verified.
+  @param[in]   NumFailed        The number of failures that were recorded.
+  @param[in]   YPos             The vertical position of the report on the console.
+**/
+VOID ReportHashVolumes(
+	IN CONST HASH_LIST* List,
+	IN CONST UINTN NumFailed,
+	IN CONST UINTN YPos
+);
+
+/**
+  Close the volumes of a hash list, besides the boot one, and release them.
+
+  @param[in,out] List           A pointer to the HASH_LIST.
+**/
+VOID CloseHashVolumes(
+	IN OUT HASH_LIST* List
+);
+
+/**
+  Check whether a media was verified in full recently enough, according to the
+  md5sum_cache directive of its hash list, and hasn't changed since, in which
+  case only a sample of its entries is to be verified on this boot, by setting
+  the sample budget of the hash list.
+
+  @param[in]     DeviceHandle   The handle of the boot volume.
+  @param[in]     Root           A file handle to the root directory.
+  @param[in,out] List           A pointer to the HASH_LIST to check.
+
+  @retval EFI_SUCCESS           The media was checked against the cache.
+  @retval EFI_UNSUPPORTED       The NV variable of the volume or the time could not be read.
+**/
+EFI_STATUS CheckMediaCache(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST EFI_FILE_HANDLE Root,
+	IN OUT HASH_LIST* List
+);
+
+/**
+  Get whether the current boot takes the fast path of the cache.
+
+  @retval TRUE                  The media was verified in full recently, and only a sample is verified.
+  @retval FALSE                 The media is verified in full, or the hash list has no cache.
+**/
+BOOLEAN IsMediaCached(VOID);
+
+/**
+  Update the cache once the media has been verified: record the time of a full
+  verification that succeeded, or forget the media if the verification failed.
+
+  @param[in]   Verified         Whether all the entries that were verified matched.
+
+  @retval EFI_SUCCESS           The cache was updated, or the hash list has no cache.
+  @retval other                 The NV variable of the volume could not be written.
+**/
+EFI_STATUS SaveMediaCache(
+	IN CONST BOOLEAN Verified
+);
+
+/**
+  Release the cache state of the current boot.
+**/
+VOID ExitMediaCache(VOID);
+
+/**
+  Measure the throughput of each of the components that verification relies
+  on, and report the results.
+
+  @param[in]   DeviceHandle     The handle of the boot volume.
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST being verified.
+
+  @retval EFI_SUCCESS           The results were reported.
+  @retval EFI_UNSUPPORTED       The system has no timestamp counter to measure time with.
+**/
+EFI_STATUS RunBenchmark(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List
+);
+
+/**
+  Set up the statistics report, along with the volume that it is written to.
+
+  @param[in]   Root             (Optional) A file handle to the root directory of the
+                                volume to write STATS_LOG_NAME to, or NULL for none.
+**/
+VOID InitStats(
+	OPTIONAL IN CONST EFI_FILE_HANDLE Root
+);
+
+/**
+  Account for the time spent in a phase of the verification.
+
+  @param[in]   Phase            The STATS_ phase to account the time to.
+  @param[in]   Time             The time that was spent, in microseconds.
+  @param[in]   Size             The number of bytes that were processed.
+**/
+VOID AddPhaseStats(
+	IN CONST UINTN Phase,
+	IN CONST UINT64 Time,
+	IN CONST UINT64 Size
+);
+
+/**
+  Account for the time it took to verify a file, and record it if it is one
+  of the STATS_SLOWEST_FILES slowest.
+
+  @param[in]   Path             A pointer to the CHAR16 string with the path of the file.
+  @param[in]   Size             The size of the file.
+  @param[in]   Time             The time it took, in microseconds.
+**/
+VOID AddFileStats(
+	IN CONST CHAR16* Path,
+	IN CONST UINT64 Size,
+	IN CONST UINT64 Time
+);
+
+/**
+  Report the statistics, i.e. the time spent in each phase and the slowest
+  files, on the console (unless running in test mode) and to STATS_LOG_NAME,
+  if the volume set by InitStats() is writable. This only reports data if
+  ENABLE_STATS is defined.
+**/
+VOID ReportStats(VOID);
+
+/**
+  Verify all the entries from a hash list, using the application processors
+  of the system to hash multiple files in parallel. The BSP performs all the
+  file reads and UEFI calls, while the APs only run the MD5 computations.
+  Results are reported in the order of the hash list.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST to verify.
+  @param[in]   Progress         A pointer to a PROGRESS_DATA structure.
+  @param[out]  NumProcessed     A pointer to receive the number of entries processed.
+  @param[out]  NumFailed        A pointer to the number of failed entries, to be updated.
+
+  @retval EFI_UNSUPPORTED       No application processor can be used, and no entry was processed.
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval other                 The status of the last entry that was processed.
+**/
+EFI_STATUS VerifyListMp(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN PROGRESS_DATA* Progress,
+	OUT UINTN* NumProcessed,
+	IN OUT UINTN* NumFailed
+);
+
+/**
+  Verify all the entries from a hash list, by hashing multiple files in
+  lockstep, using the SIMD instructions of the CPU.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST to verify.
+  @param[in]   Progress         A pointer to a PROGRESS_DATA structure.
+  @param[out]  NumProcessed     A pointer to receive the number of entries processed.
+  @param[out]  NumFailed        A pointer to the number of failed entries, to be updated.
+
+  @retval EFI_UNSUPPORTED       The multi-lane engine can't be used, and no entry was processed.
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval other                 The status of the last entry that was processed.
+**/
+EFI_STATUS VerifyListLanes(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN PROGRESS_DATA* Progress,
+	OUT UINTN* NumProcessed,
+	IN OUT UINTN* NumFailed
+);
+
+/*
+ * SHA-256 primitives. Like the MD5 ones, these do not call any UEFI service.
+ */
+VOID Sha256Init(HASH_CONTEXT* Context);
+VOID Sha256Write(HASH_CONTEXT* Context, CONST UINT8* Buffer, UINTN Length);
+VOID Sha256Final(HASH_CONTEXT* Context);
+
+/**
+  Select the fastest SHA-256 transform that the platform supports, after
+  validating it against the FIPS 180 test vectors.
+
+  @retval EFI_SUCCESS           A valid SHA-256 transform has been selected.
+  @retval EFI_CRC_ERROR         None of the SHA-256 transforms passed the test.
+**/
+EFI_STATUS InitSha256(VOID);
+
+/*
+ * BLAKE3 primitives. Like the MD5 ones, these do not call any UEFI service.
+ */
+VOID Blake3Init(HASH_CONTEXT* Context);
+VOID Blake3Write(HASH_CONTEXT* Context, CONST UINT8* Buffer, UINTN Length);
+VOID Blake3Final(HASH_CONTEXT* Context);
+
+/**
+  Validate the BLAKE3 implementation against the official test vectors.
+
+  @retval EFI_SUCCESS           The BLAKE3 implementation can be used.
+  @retval EFI_CRC_ERROR         The BLAKE3 implementation failed the test.
+**/
+EFI_STATUS InitBlake3(VOID);
+
+/**
+  Convert a UTF-8 encoded string to a UCS-2 encoded string.
+
+  @param[in]  Utf8String      A pointer to the input NUL-terminated UTF-8 encoded string.
+  @param[in]  Utf8Length      The length of Utf8String (in bytes, not including the NUL terminator).
+  @param[out] Ucs2String      A pointer to the output UCS-2 encoded string.
+  @param[in]  Ucs2StringSize  The size of the Ucs2String buffer (in CHAR16).
+  @param[out] Ucs2Length      A pointer to the variable that receives the length of Ucs2String
+                              (in CHAR16, not including the NUL terminator).
+
+  @retval EFI_SUCCESS            The conversion was successful.
+  @retval EFI_INVALID_PARAMETER  One or more of the input parameters are invalid.
+  @retval EFI_BUFFER_TOO_SMALL   The output buffer is too small to hold the result.
+**/
+EFI_STATUS Utf8ToUcs2(
+	IN CONST CHAR8* Utf8String,
+	IN CONST UINTN Utf8Length,
+	OUT CHAR16* Ucs2String,
+	IN CONST UINTN Ucs2StringSize,
+	OUT UINTN* Ucs2Length
+);
+
+/**
+  Convert a UCS-2 encoded string to a UTF-8 encoded string.
+
+  @param[in]  Ucs2String      A pointer to the input NUL-terminated UCS-2 encoded string.
+  @param[out] Utf8String      A pointer to the output UTF-8 encoded string, or NULL to
+                              only compute the length of the result.
+  @param[in]  Utf8StringSize  The size of the Utf8String buffer (in bytes).
+
+  @retval     The length of the UTF-8 string (in bytes, not including the NUL terminator),
+              which is only written up to Utf8StringSize bytes, NUL terminator included.
+**/
+UINTN Ucs2ToUtf8(
+	IN CONST CHAR16* Ucs2String,
+	OUT CHAR8* Utf8String,
+	IN CONST UINTN Utf8StringSize
+);
+
+/**
+  Console initialisation.
+**/
+VOID InitConsole(VOID);
+
+/**
+  Flush the keyboard input buffers.
+**/
+VOID FlushKeyboardInput(VOID);
+
+/**
+  Initialize a scrolling section on the console.
+
+  @param[in]   YPos              The vertical start position of the scrolling section.
+  @param[in]   NumberOfLines     How many lines should the scrolling section have.
+
+  @retval EFI_SUCCESS            The scroll section was successfully initialized.
+  @retval EFI_INVALID_PARAMETER  The provided parameters are invalid.
+  @retval EFI_OUT_OF_RESOURCES   A memory allocation error occurred.
+**/
+EFI_STATUS InitScrollSection(
+	CONST UINTN YPos,
+	CONST UINTN NumberOfLines
+);
+
+/**
+  Scroll section teardown.
+**/
+VOID ExitScrollSection(VOID);
+
+/**
+  Print a centered message on the console.
+
+  @param[in]  Message    The text message to print.
+  @param[in]  YPos       The vertical position to print the message to.
+**/
+VOID PrintCentered(
+	IN CONST CHAR16* Message,
+	IN CONST UINTN YPos
+);
+
+/**
+  Print the path and size of the file that is being processed. Outside of test
+  mode, the display is only updated once per frame, so that only the last of
+  the files that are started within a frame is printed.
+
+  @param[in]  Path       A pointer to the CHAR16 string with the Path of the file.
+  @param[in]  Size       The size of the file.
+**/
+VOID PrintFileEntry(
+	IN CONST CHAR16* Path,
+	IN CONST UINT64 Size
+);
+
+/**
+  Signal that the next frame of the progress and file display is due. This is
+  called by the housekeeping timer, on each of its periods, and, once it has
+  been, frames are only drawn on these signals.
+
+  @param[in]  Enable     FALSE to go back to drawing frames at most every
+                         CONSOLE_FRAME_INTERVAL, when the timer is stopped.
+**/
+VOID SignalFrame(
+	IN CONST BOOLEAN Enable
+);
+
+/**
+  Print a hash entry that has failed processing.
+  Do this over a specific section of the console we cycle over.
+
+  @param[in]  Status     The Status code from the failed operation on the entry.
+  @param[in]  Path       A pointer to the CHAR16 string with the Path of the entry.
+  @param[in]  Offset     The offset of the chunk that failed, or HASH_OFFSET_NONE.
+**/
+VOID PrintFailedEntry(
+	IN CONST EFI_STATUS Status,
+	IN CONST CHAR16* Path,
+	IN CONST UINT64 Offset
+);
+
+/**
+  Display a countdown on screen.
+
+  @param[in]  Message   A message to display with the countdown.
+  @param[in]  Duration  The duration of the countdown (in ms).
+**/
+VOID CountDown(
+	IN CONST CHAR16* Message,
+	IN CONST UINTN Duration
+);
+
+/**
+  Initialize a progress bar.
+
+  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
+**/
+VOID InitProgress(
+	IN PROGRESS_DATA* Progress
+);
+
+/**
+  Update a progress bar.
+
+  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
 **/
 VOID UpdateProgress(
 	IN PROGRESS_DATA* Progress
 );
 
+/**
+  Get the average rate of a progress bar, since it was initialized, as a
+  string, e.g. "35.2 MB/s" or "12.5 files/s".
+
+  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
+  @param[out] Rate       A pointer to the CHAR16 buffer that receives the rate.
+  @param[in]  RateSize   The size of the Rate buffer (in CHAR16).
+
+  @retval TRUE           The rate was written.
+  @retval FALSE          The rate is not known, as there is no timestamp counter.
+**/
+BOOLEAN GetProgressRate(
+	IN CONST PROGRESS_DATA* Progress,
+	OUT CHAR16* Rate,
+	IN CONST UINTN RateSize
+);
+
 /**
   Create a " (####.# <suffix>)" static string, e.g. " (133.7 MB)", from a 64-bit
   size value, that can be appended to a file path so as to report size to the
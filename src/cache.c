@@ -0,0 +1,251 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - Verified media cache
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * When the same media is booted again shortly after it was verified, e.g. to
+ * retry an installation that failed, verifying all of it again is the longest
+ * part of the boot. So, when the hash list requests it with md5sum_cache, we
+ * record each full verification that succeeds in an NV variable that is named
+ * after the serial number of the volume, along with the label of the volume, a
+ * hash of the hash list and a hash of the sizes and modification times of the
+ * files. A boot that finds all of these unchanged, within the number of seconds
+ * that md5sum_cache provides, only verifies a sample of the entries, as if the
+ * hash list had an md5sum_sample directive, and says so on screen. The window
+ * starts from the full verification, so that fast boots can't extend it, and a
+ * failure on any boot forgets the media, so that the next boot verifies it all.
+ */
+
+/* Vendor GUID of the NV variables that keep the verified media */
+STATIC EFI_GUID CacheVariableGuid =
+	{ 0x1d3e5c07, 0x92b4, 0x4f6a, { 0xa8, 0x3d, 0x6c, 0x0e, 0x51, 0xf2, 0x97, 0xb4 } };
+
+/* Version of the content of the NV variables */
+#define CACHE_STATE_VERSION     1
+
+/* Amount of data that the fast path verifies, along with the critical entries */
+#define CACHE_SAMPLE_BYTES      0x4000000ULL
+
+/* What identifies a media, and must be unchanged for the fast path to be taken */
+typedef struct {
+	UINT32      Version;
+	UINT32      NumEntries;     /* Number of entries of the hash list */
+	UINT8       ListHash[HASH_SIZE_MAX];
+	UINT8       FilesHash[HASH_SIZE_MAX];   /* Hash of the sizes and modification times of the files */
+	CHAR16      Label[VOLUME_LABEL_SIZE];
+} CACHE_MEDIA;
+
+/* The content of the NV variable of a volume */
+typedef struct {
+	CACHE_MEDIA Media;
+	EFI_TIME    LastFullPass;   /* When the last full verification that succeeded started */
+} CACHE_STATE;
+
+/* The size and modification time of a file, as they are hashed */
+typedef struct {
+	UINT64      Size;
+	EFI_TIME    ModificationTime;
+} CACHE_FILE;
+
+/* The cache state of the current boot, as set by CheckMediaCache() */
+STATIC struct {
+	BOOLEAN         Active;
+	BOOLEAN         Hit;        /* Whether only a sample of the entries is verified */
+	CHAR16          Name[32];   /* The name of the NV variable of the volume */
+	CACHE_STATE     State;      /* The content to store, once the media has been verified in full */
+} Cache = { 0 };
+
+/**
+  Convert a time to a number of seconds, from an arbitrary origin. The time
+  zone is ignored, since the times that are compared come from the same clock.
+
+  @param[in]   Time             A pointer to the EFI_TIME to convert.
+
+  @retval      The number of seconds.
+**/
+STATIC UINT64 TimeToSeconds(
+	IN CONST EFI_TIME* Time
+)
+{
+	// Count the years from March, so that the leap day is the last one
+	UINT64 Year = Time->Year - ((Time->Month <= 2) ? 1 : 0);
+	UINT64 Month = (Time->Month <= 2) ? Time->Month + 9 : Time->Month - 3;
+	UINT64 Days = Year * 365 + Year / 4 - Year / 100 + Year / 400 + (153 * Month + 2) / 5 + Time->Day - 1;
+
+	return ((Days * 24 + Time->Hour) * 60 + Time->Minute) * 60 + Time->Second;
+}
+
+/**
+  Compute the hash of the sizes and modification times of the files of a hash
+  list, as the file system reports them.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST of the files.
+  @param[out]  Hash             A pointer to the HASH_SIZE_MAX array that receives the hash.
+**/
+STATIC VOID HashFiles(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	OUT UINT8* Hash
+)
+{
+	HASH_CONTEXT Context;
+	EFI_FILE_INFO* Info = GetIoFileInfo();
+	EFI_FILE_HANDLE File;
+	CACHE_FILE Data;
+	CHAR16 Path[PATH_MAX + 1];
+	UINTN i, Size;
+
+	List->Algorithm->Init(&Context);
+	for (i = 0; i < List->NumEntries; i++) {
+		// Files that can't be opened fail verification, so they only need to hash differently
+		ZeroMem(&Data, sizeof(Data));
+		Data.Size = HASH_SIZE_UNKNOWN;
+		if (DecodeHashEntry(List, &List->Entry[i], Path, ARRAY_SIZE(Path)) == EFI_SUCCESS &&
+			Root->Open(Root, &File, Path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY) == EFI_SUCCESS) {
+			Size = FILE_INFO_SIZE;
+			if (File->GetInfo(File, &gEfiFileInfoGuid, &Size, Info) == EFI_SUCCESS) {
+				Data.Size = Info->FileSize;
+				CopyMem(&Data.ModificationTime, &Info->ModificationTime, sizeof(EFI_TIME));
+				Data.ModificationTime.Pad1 = 0;
+				Data.ModificationTime.Pad2 = 0;
+			}
+			File->Close(File);
+		}
+		List->Algorithm->Write(&Context, (CONST UINT8*)&Data, sizeof(Data));
+	}
+	List->Algorithm->Final(&Context);
+	ZeroMem(Hash, HASH_SIZE_MAX);
+	CopyMem(Hash, Context.Buffer, List->Algorithm->HashSize);
+}
+
+/**
+  Check whether a media was verified in full recently enough, according to the
+  md5sum_cache directive of its hash list, and hasn't changed since, in which
+  case only a sample of its entries is to be verified on this boot, by setting
+  the sample budget of the hash list.
+
+  @param[in]     DeviceHandle   The handle of the boot volume.
+  @param[in]     Root           A file handle to the root directory.
+  @param[in,out] List           A pointer to the HASH_LIST to check.
+
+  @retval EFI_SUCCESS           The media was checked against the cache.
+  @retval EFI_UNSUPPORTED       The NV variable of the volume or the time could not be read.
+**/
+EFI_STATUS CheckMediaCache(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST EFI_FILE_HANDLE Root,
+	IN OUT HASH_LIST* List
+)
+{
+	EFI_STATUS Status;
+	CACHE_STATE State;
+	UINT64 Serial = 0, Now, LastFullPass;
+	UINTN DataSize;
+
+	ExitMediaCache();
+	if (List->NumEntries == 0)
+		return EFI_SUCCESS;
+	if (EFI_ERROR(gRT->GetTime(&Cache.State.LastFullPass, NULL)))
+		return EFI_UNSUPPORTED;
+
+	// Media that have no serial number all share the same variable
+	GetVolumeSerial(DeviceHandle, &Serial);
+	UnicodeSPrint(Cache.Name, ARRAY_SIZE(Cache.Name), L"Cache%016lx", Serial);
+	Cache.State.Media.Version = CACHE_STATE_VERSION;
+	Cache.State.Media.NumEntries = (UINT32)List->NumEntries;
+	HashEntries(List, Cache.State.Media.ListHash);
+	HashFiles(Root, List, Cache.State.Media.FilesHash);
+	GetVolumeLabel(Root, Cache.State.Media.Label);
+
+	DataSize = sizeof(State);
+	Status = gRT->GetVariable(Cache.Name, &CacheVariableGuid, NULL, &DataSize, &State);
+	if (Status == EFI_SUCCESS && DataSize == sizeof(State) &&
+		CompareMem(&State.Media, &Cache.State.Media, sizeof(CACHE_MEDIA)) == 0) {
+		// Clocks that went backwards don't get to extend the window
+		Now = TimeToSeconds(&Cache.State.LastFullPass);
+		LastFullPass = TimeToSeconds(&State.LastFullPass);
+		Cache.Hit = (Now >= LastFullPass && Now - LastFullPass <= List->CacheSeconds);
+	} else if (Status == EFI_SUCCESS || Status == EFI_NOT_FOUND || Status == EFI_BUFFER_TOO_SMALL) {
+		// New or modified media are verified in full
+		Status = EFI_SUCCESS;
+	}
+	if (EFI_ERROR(Status)) {
+		ExitMediaCache();
+		return EFI_UNSUPPORTED;
+	}
+
+	if (gIsTestMode)
+		PrintTest(L"Cache = %s", Cache.Hit ? L"hit" : L"miss");
+	else if (Cache.Hit)
+		PrintWarning(L"FAST PATH: The media was verified in full on %04d.%02d.%02d at %02d:%02d",
+			State.LastFullPass.Year, State.LastFullPass.Month, State.LastFullPass.Day,
+			State.LastFullPass.Hour, State.LastFullPass.Minute);
+	if (Cache.Hit)
+		List->SampleBytes = CACHE_SAMPLE_BYTES;
+	Cache.Active = TRUE;
+	return EFI_SUCCESS;
+}
+
+/**
+  Get whether the current boot takes the fast path of the cache.
+
+  @retval TRUE                  The media was verified in full recently, and only a sample is verified.
+  @retval FALSE                 The media is verified in full, or the hash list has no cache.
+**/
+BOOLEAN IsMediaCached(VOID)
+{
+	return Cache.Hit;
+}
+
+/**
+  Update the cache once the media has been verified: record the time of a full
+  verification that succeeded, or forget the media if the verification failed.
+
+  @param[in]   Verified         Whether all the entries that were verified matched.
+
+  @retval EFI_SUCCESS           The cache was updated, or the hash list has no cache.
+  @retval other                 The NV variable of the volume could not be written.
+**/
+EFI_STATUS SaveMediaCache(
+	IN CONST BOOLEAN Verified
+)
+{
+	EFI_STATUS Status;
+
+	// The fast path keeps the time of the full verification, rather than the one of this boot
+	if (!Cache.Active || (Cache.Hit && Verified))
+		return EFI_SUCCESS;
+	if (!Verified) {
+		Status = gRT->SetVariable(Cache.Name, &CacheVariableGuid,
+			EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS, 0, NULL);
+		return (Status == EFI_NOT_FOUND) ? EFI_SUCCESS : Status;
+	}
+	return gRT->SetVariable(Cache.Name, &CacheVariableGuid,
+		EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+		sizeof(Cache.State), &Cache.State);
+}
+
+/**
+  Release the cache state of the current boot.
+**/
+VOID ExitMediaCache(VOID)
+{
+	ZeroMem(&Cache, sizeof(Cache));
+}
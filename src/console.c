@@ -47,6 +47,23 @@ STATIC struct {
 	UINTN MaxLines;
 } Scroll = { 0 };
 
+/*
+ * Consoles can be slow to render text, so the progress bar and the file that
+ * is being processed are only redrawn once per frame, i.e. at most every
+ * CONSOLE_FRAME_INTERVAL, with only the last file that was started being shown.
+ * During verification, frames are instead signaled by the housekeeping timer.
+ */
+STATIC struct {
+	UINT64          LastFrame;              /* Timestamp of the last frame that was drawn */
+	BOOLEAN         Signaled;               /* Whether frames are signaled by the housekeeping timer */
+	volatile BOOLEAN Due;                   /* Whether the housekeeping timer signaled the next frame */
+	PROGRESS_DATA*  Progress;               /* The progress bar that was last initialized */
+	BOOLEAN         FilePending;            /* Whether File is yet to be drawn */
+	UINTN           StatusLen;              /* Length of the percentage and rate that were last drawn */
+	CHAR16          File[PATH_MAX];
+	CHAR16          Cells[STRING_MAX];      /* Buffer for the cells of the progress bar */
+} Frame = { 0 };
+
 /**
   Console initialisation.
 **/
@@ -163,19 +180,223 @@ VOID ExitScrollSection(VOID)
 	SafeFree(Scroll.Section);
 }
 
+/**
+  Check if the next frame of the progress and file display is due.
+
+  @retval TRUE                  The display may be redrawn.
+  @retval FALSE                 The last frame was drawn less than CONSOLE_FRAME_INTERVAL ago,
+                                or the housekeeping timer hasn't signaled the next one yet.
+**/
+STATIC BOOLEAN IsFrameDue(VOID)
+{
+	UINT64 Now;
+
+	if (Frame.Signaled)
+		return Frame.Due;
+	Now = GetTimestamp();
+	// Without a timestamp counter, every update is drawn
+	return (Now == 0 || Frame.LastFrame == 0 || Now - Frame.LastFrame >= CONSOLE_FRAME_INTERVAL);
+}
+
+/**
+  Signal that the next frame of the progress and file display is due. This is
+  called by the housekeeping timer, on each of its periods, and, once it has
+  been, frames are only drawn on these signals.
+
+  @param[in]  Enable     FALSE to go back to drawing frames at most every
+                         CONSOLE_FRAME_INTERVAL, when the timer is stopped.
+**/
+VOID SignalFrame(
+	IN CONST BOOLEAN Enable
+)
+{
+	Frame.Signaled = Enable;
+	Frame.Due = Enable;
+}
+
+/**
+  Compute a rate, in thousandths of progress value per second.
+
+  @param[in]  Value      The progress value.
+  @param[in]  Time       The time it took, in microseconds (must not be 0).
+
+  @retval     The rate.
+**/
+STATIC UINT64 ComputeRate(
+	IN CONST UINT64 Value,
+	IN CONST UINT64 Time
+)
+{
+	// Split the computation, so that it can't overflow for large values
+	return ((Value * 1000000) / Time) * 1000 + (((Value * 1000000) % Time) * 1000) / Time;
+}
+
+/**
+  Format a rate of a progress bar, in MB/s or, if the progress is per file, in files/s.
+
+  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
+  @param[in]  Rate       The rate, in thousandths of progress value per second.
+  @param[out] String     A pointer to the CHAR16 buffer that receives the rate.
+  @param[in]  StringSize The size of the String buffer (in CHAR16).
+**/
+STATIC VOID FormatRate(
+	IN CONST PROGRESS_DATA* Progress,
+	IN CONST UINT64 Rate,
+	OUT CHAR16* String,
+	IN CONST UINTN StringSize
+)
+{
+	UINT64 Tenths;
+
+	if (Progress->Type == PROGRESS_TYPE_BYTE) {
+		Tenths = Rate / (100 * 1024 * 1024);
+		UnicodeSPrint(String, StringSize, L"%ld.%ld MB/s", Tenths / 10, Tenths % 10);
+	} else {
+		Tenths = Rate / 100;
+		UnicodeSPrint(String, StringSize, L"%ld.%ld files/s", Tenths / 10, Tenths % 10);
+	}
+}
+
+/**
+  Update the smoothed rate of a progress bar, with the progress that was made
+  since the last update. The rate is an exponentially weighted moving average,
+  with a time constant of PROGRESS_RATE_PERIOD, so that the weight of each
+  update follows the time that elapsed since the previous one.
+
+  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
+  @param[in]  Now        The current timestamp.
+
+  @retval TRUE           The rate is known.
+  @retval FALSE          No time has elapsed yet, or there is no timestamp counter.
+**/
+STATIC BOOLEAN UpdateRate(
+	IN PROGRESS_DATA* Progress,
+	IN CONST UINT64 Now
+)
+{
+	UINT64 Elapsed, Rate;
+
+	if (Progress->StartTime == 0 || Now <= Progress->RateTime)
+		return (Progress->Rate != 0);
+	Elapsed = Now - Progress->RateTime;
+	Rate = ComputeRate(Progress->Current - Progress->RateValue, Elapsed);
+	if (Progress->Rate == 0 || Elapsed >= PROGRESS_RATE_PERIOD)
+		Progress->Rate = Rate;
+	else
+		Progress->Rate = (Progress->Rate * PROGRESS_RATE_PERIOD + Rate * Elapsed) /
+			(PROGRESS_RATE_PERIOD + Elapsed);
+	Progress->RateTime = Now;
+	Progress->RateValue = Progress->Current;
+	return (Progress->Rate != 0);
+}
+
+/**
+  Draw the file that is being processed, if it changed, and the progress bar,
+  if it is active.
+
+  @param[in]  Progress   (Optional) A pointer to a PROGRESS_DATA structure.
+**/
+STATIC VOID DrawFrame(
+	OPTIONAL IN PROGRESS_DATA* Progress
+)
+{
+	CHAR16 Status[80], Rate[32];
+	UINTN i, Len, CurCol, PerMille;
+	UINT64 Seconds;
+
+	Frame.LastFrame = GetTimestamp();
+	Frame.Due = FALSE;
+	if (Frame.FilePending) {
+		PrintCentered(Frame.File, gConsole.Rows / 2 - 1);
+		Frame.FilePending = FALSE;
+	}
+	if (Progress == NULL || !Progress->Active || Progress->Maximum == 0)
+		return;
+
+	// Update the percentage figure, along with the rate and the time left
+	PerMille = (UINTN)((MIN(Progress->Current, Progress->Maximum) * 1000) / Progress->Maximum);
+	UnicodeSPrint(Status, ARRAY_SIZE(Status), L"%d.%d%%", PerMille / 10, PerMille % 10);
+	Len = StrLen(Status);
+	if (UpdateRate(Progress, Frame.LastFrame)) {
+		FormatRate(Progress, Progress->Rate, Rate, ARRAY_SIZE(Rate));
+		Seconds = ((Progress->Maximum - MIN(Progress->Current, Progress->Maximum)) * 1000) / Progress->Rate;
+		UnicodeSPrint(&Status[Len], ARRAY_SIZE(Status) - Len, L" (%s, ETA %ld:%02ld)",
+			Rate, Seconds / 60, Seconds % 60);
+		// Only keep the percentage if the rate doesn't fit on the line
+		if (Progress->PPos + StrLen(Status) >= gConsole.Cols)
+			Status[Len] = L'\0';
+		Len = StrLen(Status);
+	}
+	// Erase what remains of the previous figures
+	for (i = Len; i < Frame.StatusLen && i < ARRAY_SIZE(Status) - 1; i++)
+		Status[i] = L' ';
+	Status[i] = L'\0';
+	Frame.StatusLen = Len;
+	SetTextPosition(Progress->PPos, Progress->YPos);
+	Print(L"%s", Status);
+
+	// Update the progress bar, with all the new cells at once
+	CurCol = (UINTN)((MIN(Progress->Current, Progress->Maximum) * gConsole.Cols) / Progress->Maximum);
+	if (CurCol > Progress->LastCol && Progress->LastCol < gConsole.Cols) {
+		for (i = 0; i < CurCol - Progress->LastCol && Progress->LastCol + i < gConsole.Cols; i++)
+			Frame.Cells[i] = BLOCKELEMENT_FULL_BLOCK;
+		Frame.Cells[i] = L'\0';
+		SetTextPosition(Progress->LastCol, Progress->YPos + 1);
+		gST->ConOut->OutputString(gST->ConOut, Frame.Cells);
+		Progress->LastCol += i;
+	}
+}
+
+/**
+  Print the path and size of the file that is being processed. Outside of test
+  mode, the display is only updated once per frame, so that only the last of
+  the files that are started within a frame is printed.
+
+  @param[in]  Path       A pointer to the CHAR16 string with the Path of the file.
+  @param[in]  Size       The size of the file.
+**/
+VOID PrintFileEntry(
+	IN CONST CHAR16* Path,
+	IN CONST UINT64 Size
+)
+{
+	CHAR16* DisplayPath = Frame.File, *StrSize;
+
+	V_ASSERT(ARRAY_SIZE(Frame.File) > gConsole.Cols);
+	StrSize = SizeToHumanReadable(Size);
+	// We could do without this assert since StrSize is at most 32 and
+	// gConsole.Cols at least COLS_MIN (>32) but in case someone worries...
+	V_ASSERT(gConsole.Cols > SafeStrLen(StrSize) - 1);
+	SafeStrCpy(DisplayPath, ARRAY_SIZE(Frame.File), Path);
+	// The following unconditionally truncates the path to what's needed
+	// to append the size in case it's too long to fit on one line.
+	DisplayPath[gConsole.Cols - SafeStrLen(StrSize) - 1] = 0;
+	SafeStrCat(DisplayPath, ARRAY_SIZE(Frame.File), StrSize);
+	// In test mode, all the entries must be printed
+	if (gIsTestMode) {
+		PrintCentered(DisplayPath, gConsole.Rows / 2 - 1);
+		return;
+	}
+	Frame.FilePending = TRUE;
+	if (IsFrameDue())
+		DrawFrame(Frame.Progress);
+}
+
 /**
   Print a hash entry that has failed processing.
   Do this over a specific section of the console we cycle over.
 
   @param[in]  Status     The Status code from the failed operation on the entry.
   @param[in]  Path       A pointer to the CHAR16 string with the Path of the entry.
+  @param[in]  Offset     The offset of the chunk that failed, or HASH_OFFSET_NONE.
 **/
 VOID PrintFailedEntry(
 	IN CONST EFI_STATUS Status,
-	IN CONST CHAR16* Path
+	IN CONST CHAR16* Path,
+	IN CONST UINT64 Offset
 )
 {
-	CHAR16 ErrorMsg[128], *Src, *Line;
+	CHAR16 ErrorMsg[128], StrOffset[32], *Src, *Line;
 	UINTN Index;
 
 	if (!EFI_ERROR(Status) || Path == NULL || Scroll.Section == NULL ||
@@ -183,10 +404,18 @@ VOID PrintFailedEntry(
 		return;
 
 	// Display a more explicit message (than "CRC Error") for files that fail MD5
+	// or (than "Bad Buffer Size") for files that don't have their listed size
 	if (Status == EFI_CRC_ERROR)
 		UnicodeSPrint(ErrorMsg, ARRAY_SIZE(ErrorMsg), L": [27] Checksum Error");
+	else if (Status == EFI_BAD_BUFFER_SIZE)
+		UnicodeSPrint(ErrorMsg, ARRAY_SIZE(ErrorMsg), L": [4] Size Mismatch");
 	else
 		UnicodeSPrint(ErrorMsg, ARRAY_SIZE(ErrorMsg), L": [%d] %r", (Status & 0x7FFFFFFF), Status);
+	// For files that are verified per chunk, tell where the failure occurred
+	if (Offset != HASH_OFFSET_NONE) {
+		UnicodeSPrint(StrOffset, ARRAY_SIZE(StrOffset), L" at 0x%lx", Offset);
+		SafeStrCat(ErrorMsg, ARRAY_SIZE(ErrorMsg), StrOffset);
+	}
 	if (gIsTestMode)
 		SafeStrCat(ErrorMsg, ARRAY_SIZE(ErrorMsg), L"\r\n");
 
@@ -273,17 +502,25 @@ VOID InitProgress(
 	Progress->Current = 0;
 	Progress->LastCol = 0;
 	Progress->PPos = MessagePos + SafeStrLen(Progress->Message) + 2;
+	Progress->StartTime = GetTimestamp();
+	Progress->RateTime = Progress->StartTime;
+	Progress->RateValue = 0;
+	Progress->Rate = 0;
+	Frame.StatusLen = 0;
 
 	if (!gIsTestMode) {
 		SetTextPosition(MessagePos, Progress->YPos);
 		Print(L"%s: 0.0%%", Progress->Message);
 
-		SetTextPosition(0, Progress->YPos + 1);
 		for (i = 0; i < gConsole.Cols; i++)
-			Print(L"░");
+			Frame.Cells[i] = L'░';
+		Frame.Cells[i] = L'\0';
+		SetTextPosition(0, Progress->YPos + 1);
+		gST->ConOut->OutputString(gST->ConOut, Frame.Cells);
 	}
 
 	Progress->Active = TRUE;
+	Frame.Progress = Progress;
 }
 
 /**
@@ -295,32 +532,43 @@ VOID UpdateProgress(
 	IN PROGRESS_DATA* Progress
 )
 {
-	UINTN CurCol, PerMille;
-
 	if (Progress == NULL || !Progress->Active || Progress->Maximum == 0 ||
 		gConsole.Cols < COLS_MIN || gConsole.Cols >= STRING_MAX)
 		return;
 
-	// Update the percentage figure
-	PerMille = (UINTN)((MIN(Progress->Current, Progress->Maximum) * 1000) / Progress->Maximum);
-	if (!gIsTestMode) {
-		SetTextPosition(Progress->PPos, Progress->YPos);
-		Print(L"%d.%d%%", PerMille / 10, PerMille % 10);
-	}
-
-	// Update the progress bar
-	CurCol = (UINTN)((MIN(Progress->Current, Progress->Maximum) * gConsole.Cols) / Progress->Maximum);
-	if (!gIsTestMode) {
-		for (; CurCol > Progress->LastCol && Progress->LastCol < gConsole.Cols; Progress->LastCol++) {
-			SetTextPosition(Progress->LastCol, Progress->YPos + 1);
-			Print(L"%c", BLOCKELEMENT_FULL_BLOCK);
-		}
-	}
+	// The final state is always drawn
+	if (!gIsTestMode && (Progress->Current >= Progress->Maximum || IsFrameDue()))
+		DrawFrame(Progress);
 
 	if (Progress->Current >= Progress->Maximum)
 		Progress->Active = FALSE;
 }
 
+/**
+  Get the average rate of a progress bar, since it was initialized, as a
+  string, e.g. "35.2 MB/s" or "12.5 files/s".
+
+  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
+  @param[out] Rate       A pointer to the CHAR16 buffer that receives the rate.
+  @param[in]  RateSize   The size of the Rate buffer (in CHAR16).
+
+  @retval TRUE           The rate was written.
+  @retval FALSE          The rate is not known, as there is no timestamp counter.
+**/
+BOOLEAN GetProgressRate(
+	IN CONST PROGRESS_DATA* Progress,
+	OUT CHAR16* Rate,
+	IN CONST UINTN RateSize
+)
+{
+	UINT64 Now = GetTimestamp();
+
+	if (Progress->StartTime == 0 || Now <= Progress->StartTime)
+		return FALSE;
+	FormatRate(Progress, ComputeRate(Progress->Current, Now - Progress->StartTime), Rate, RateSize);
+	return TRUE;
+}
+
 /**
   Display a countdown on screen.
 
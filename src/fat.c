@@ -0,0 +1,1155 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - Raw FAT/exFAT reader
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * Some firmware file system drivers are slow, as they walk cluster chains one
+ * cluster at a time and issue small reads. When the hash list requests it, we
+ * parse the FAT16, FAT32 or exFAT structures of the boot partition ourselves,
+ * through EFI_DISK_IO_PROTOCOL, and resolve the cluster chain of each file into
+ * a list of extents, i.e. runs of contiguous clusters. The file handles we
+ * produce then read these extents straight into the buffers of the hash
+ * engines, asynchronously if the EFI_DISK_IO2_PROTOCOL is available.
+ * Any file we can't handle (non ASCII case differences, heavy fragmentation,
+ * inconsistent metadata) is left to the file system driver, which also
+ * remains in charge of reporting errors.
+ * The same handles are used to read the whole partition, for md5sum_partition,
+ * in which case the clusters of the hash list file are read as zeroes, since
+ * the hash list can't contain its own hash.
+ */
+
+#if defined(_GNU_EFI)
+STATIC EFI_GUID gEfiDiskIo2ProtocolGuid = EFI_DISK_IO2_PROTOCOL_GUID;
+#endif
+
+#pragma pack(push, 1)
+/* The BIOS Parameter Block of a FAT16 or FAT32 boot sector */
+typedef struct {
+	UINT8       Jump[3];
+	CHAR8       OemName[8];
+	UINT16      BytesPerSector;
+	UINT8       SectorsPerCluster;
+	UINT16      ReservedSectors;
+	UINT8       NumFats;
+	UINT16      RootEntries;
+	UINT16      Sectors16;
+	UINT8       Media;
+	UINT16      FatSize16;
+	UINT16      SectorsPerTrack;
+	UINT16      NumHeads;
+	UINT32      HiddenSectors;
+	UINT32      Sectors32;
+	/* FAT32 only from here on */
+	UINT32      FatSize32;
+	UINT16      ExtFlags;
+	UINT16      Version;
+	UINT32      RootCluster;
+} FAT_BOOT_SECTOR;
+
+/* The parameters of an exFAT boot sector */
+typedef struct {
+	UINT8       Jump[3];
+	CHAR8       FileSystemName[8];
+	UINT8       MustBeZero[53];
+	UINT64      PartitionOffset;
+	UINT64      VolumeLength;
+	UINT32      FatOffset;
+	UINT32      FatLength;
+	UINT32      ClusterHeapOffset;
+	UINT32      ClusterCount;
+	UINT32      RootCluster;
+	UINT32      SerialNumber;
+	UINT16      Revision;
+	UINT16      VolumeFlags;
+	UINT8       BytesPerSectorShift;
+	UINT8       SectorsPerClusterShift;
+	UINT8       NumFats;
+} EXFAT_BOOT_SECTOR;
+
+/* A FAT 8.3 directory entry */
+typedef struct {
+	CHAR8       Name[11];
+	UINT8       Attributes;
+	UINT8       Reserved;
+	UINT8       CreateTimeTenth;
+	UINT16      CreateTime;
+	UINT16      CreateDate;
+	UINT16      AccessDate;
+	UINT16      ClusterHigh;
+	UINT16      WriteTime;
+	UINT16      WriteDate;
+	UINT16      ClusterLow;
+	UINT32      Size;
+} FAT_DIR_ENTRY;
+
+/* A FAT long file name directory entry */
+typedef struct {
+	UINT8       Ordinal;
+	CHAR16      Name1[5];
+	UINT8       Attributes;
+	UINT8       Type;
+	UINT8       Checksum;
+	CHAR16      Name2[6];
+	UINT16      Cluster;
+	CHAR16      Name3[2];
+} FAT_LFN_ENTRY;
+
+/* An exFAT File directory entry */
+typedef struct {
+	UINT8       Type;
+	UINT8       SecondaryCount;
+	UINT16      Checksum;
+	UINT16      Attributes;
+	UINT8       Reserved[26];
+} EXFAT_FILE_ENTRY;
+
+/* An exFAT Stream Extension directory entry */
+typedef struct {
+	UINT8       Type;
+	UINT8       Flags;
+	UINT8       Reserved;
+	UINT8       NameLength;
+	UINT16      NameHash;
+	UINT16      Reserved2;
+	UINT64      ValidDataLength;
+	UINT32      Reserved3;
+	UINT32      FirstCluster;
+	UINT64      DataLength;
+} EXFAT_STREAM_ENTRY;
+
+/* An exFAT File Name directory entry */
+typedef struct {
+	UINT8       Type;
+	UINT8       Flags;
+	CHAR16      Name[15];
+} EXFAT_NAME_ENTRY;
+
+typedef union {
+	UINT8               Type;
+	FAT_DIR_ENTRY       Fat;
+	FAT_LFN_ENTRY       Lfn;
+	EXFAT_FILE_ENTRY    File;
+	EXFAT_STREAM_ENTRY  Stream;
+	EXFAT_NAME_ENTRY    Name;
+} RAW_DIR_ENTRY;
+#pragma pack(pop)
+
+/* Offsets of the volume serial numbers of FAT16, FAT32 and NTFS boot sectors */
+#define FAT16_SERIAL_OFFSET 0x27
+#define FAT32_SERIAL_OFFSET 0x43
+#define NTFS_SERIAL_OFFSET  0x48
+
+/* Signature of the FAT extended boot records, that precedes their serial number */
+#define FAT_EXTENDED_BOOT_SIGNATURE 0x29
+
+/* File systems that the raw reader supports */
+#define RAW_FS_NONE         0
+#define RAW_FS_FAT16        1
+#define RAW_FS_FAT32        2
+#define RAW_FS_EXFAT        3
+
+/* FAT directory entry attributes */
+#define FAT_ATTR_VOLUME_ID  0x08
+#define FAT_ATTR_DIRECTORY  0x10
+#define FAT_ATTR_LFN        0x0F
+
+/* exFAT directory entry types and flags */
+#define EXFAT_ENTRY_FILE    0x85
+#define EXFAT_ENTRY_STREAM  0xC0
+#define EXFAT_ENTRY_NAME    0xC1
+#define EXFAT_NO_FAT_CHAIN  0x02
+
+/* Size value for the cluster chains that have no known size */
+#define RAW_SIZE_UNKNOWN    ((UINT64)-1)
+
+/* Offset value for the extents that read as zeroes */
+#define RAW_OFFSET_ZEROES   ((UINT64)-1)
+
+/* The properties of a directory entry that was looked up */
+typedef struct {
+	BOOLEAN     Directory;
+	BOOLEAN     NoFatChain;
+	UINT32      Cluster;
+	UINT64      Size;       /* RAW_SIZE_UNKNOWN for FAT directories */
+} RAW_ENTRY;
+
+/* A run of contiguous data on the disk, or of zeroes */
+typedef struct {
+	UINT64      Offset;
+	UINT64      Length;
+} RAW_EXTENT;
+
+/* A file handle produced by the raw reader */
+typedef struct {
+	EFI_FILE_PROTOCOL   Protocol;   /* Must be the first field, as handles are cast to RAW_FILE */
+	UINT64              Size;
+	UINT64              Position;
+	UINTN               NumExtents;
+	RAW_EXTENT*         Extent;
+	UINTN               CurExtent;  /* The extent that Position was last found in */
+	UINT64              CurStart;   /* The file offset at which CurExtent starts */
+} RAW_FILE;
+
+/* The volume that the raw reader was set up for, by InitRawReader() */
+STATIC struct {
+	EFI_DISK_IO_PROTOCOL*   DiskIo;
+	EFI_DISK_IO2_PROTOCOL*  DiskIo2;
+	UINT32                  MediaId;
+	UINT32                  BlockSize;
+	EFI_LBA                 LastBlock;
+	UINTN                   Type;
+	UINTN                   ClusterShift;
+	UINT32                  ClusterCount;
+	UINT32                  EndOfChain;     /* Lowest FAT value that terminates a chain */
+	UINT64                  FatOffset;
+	UINT64                  FatSize;
+	UINT64                  DataOffset;
+	UINT64                  RootOffset;     /* FAT16 only */
+	UINT64                  RootSize;       /* FAT16 only */
+	UINT32                  RootCluster;
+	UINT8*                  FatCache;       /* RAW_FAT_CACHE_SIZE bytes of the FAT */
+	UINT64                  FatCacheBase;
+	UINT64                  FatCacheSize;
+	UINT8*                  Dir;            /* The content of the last directory we looked up */
+	UINTN                   DirSize;
+	UINTN                   DirAllocSize;
+	BOOLEAN                 DirValid;
+	CHAR16                  DirPath[PATH_MAX + 1];
+	UINTN                   NumExtents;
+	RAW_EXTENT              Extent[RAW_EXTENTS_MAX];
+} Volume = { 0 };
+
+STATIC CONST CHAR16* FsName[] = { L"none", L"FAT16", L"FAT32", L"exFAT" };
+
+/**
+  Read data from the volume.
+
+  @param[in]   Offset           The byte offset of the data, from the start of the volume.
+  @param[in]   Size             The number of bytes to read.
+  @param[out]  Buffer           A pointer to the buffer that receives the data.
+
+  @retval EFI_SUCCESS           The data was read.
+  @retval other                 A read error occurred.
+**/
+STATIC EFI_STATUS ReadVolume(
+	IN CONST UINT64 Offset,
+	IN CONST UINTN Size,
+	OUT VOID* Buffer
+)
+{
+	return Volume.DiskIo->ReadDisk(Volume.DiskIo, Volume.MediaId, Offset, Size, Buffer);
+}
+
+/**
+  Get the FAT entry of a cluster, i.e. the next cluster of its chain.
+
+  @param[in]   Cluster          The cluster, which must be a valid data cluster.
+  @param[out]  Next             A pointer to receive the FAT entry.
+
+  @retval EFI_SUCCESS           The FAT entry was read.
+  @retval other                 A read error occurred.
+**/
+STATIC EFI_STATUS GetFatEntry(
+	IN CONST UINT32 Cluster,
+	OUT UINT32* Next
+)
+{
+	EFI_STATUS Status;
+	UINT64 Offset, Base;
+
+	Offset = (UINT64)Cluster * ((Volume.Type == RAW_FS_FAT16) ? 2 : 4);
+	if (Volume.FatCacheSize == 0 || Offset < Volume.FatCacheBase ||
+		Offset >= Volume.FatCacheBase + Volume.FatCacheSize) {
+		Base = Offset & ~((UINT64)RAW_FAT_CACHE_SIZE - 1);
+		Volume.FatCacheSize = 0;
+		Status = ReadVolume(Volume.FatOffset + Base,
+			(UINTN)MIN(RAW_FAT_CACHE_SIZE, Volume.FatSize - Base), Volume.FatCache);
+		if (EFI_ERROR(Status))
+			return Status;
+		Volume.FatCacheBase = Base;
+		Volume.FatCacheSize = MIN(RAW_FAT_CACHE_SIZE, Volume.FatSize - Base);
+	}
+
+	Offset -= Volume.FatCacheBase;
+	if (Volume.Type == RAW_FS_FAT16)
+		*Next = Volume.FatCache[Offset] | (Volume.FatCache[Offset + 1] << 8);
+	else
+		*Next = LOAD32(&Volume.FatCache[Offset], 0);
+	if (Volume.Type == RAW_FS_FAT32)
+		*Next &= 0x0FFFFFFF;
+	return EFI_SUCCESS;
+}
+
+/**
+  Resolve a cluster chain into the Volume.Extent array, merging the clusters
+  that follow each other on the disk.
+
+  @param[in]   Cluster          The first cluster of the chain.
+  @param[in]   Size             The size of the data, or RAW_SIZE_UNKNOWN to follow the
+                                chain until its end (up to RAW_DIR_SIZE_MAX bytes).
+  @param[in]   NoFatChain       Whether the clusters are contiguous, without a FAT chain.
+  @param[out]  ChainSize        A pointer to receive the number of bytes the extents cover.
+
+  @retval EFI_SUCCESS           The extents were resolved.
+  @retval EFI_UNSUPPORTED       The data has too many extents or is too large.
+  @retval EFI_VOLUME_CORRUPTED  The cluster chain is invalid.
+  @retval other                 A read error occurred.
+**/
+STATIC EFI_STATUS GetExtents(
+	IN UINT32 Cluster,
+	IN CONST UINT64 Size,
+	IN CONST BOOLEAN NoFatChain,
+	OUT UINT64* ChainSize
+)
+{
+	EFI_STATUS Status;
+	UINT64 Offset, NumClusters, MaxClusters;
+	RAW_EXTENT* Extent = NULL;
+
+	Volume.NumExtents = 0;
+	*ChainSize = 0;
+	if (Size == 0)
+		return EFI_SUCCESS;
+	if (Cluster < 2 || Cluster >= Volume.ClusterCount + 2)
+		return EFI_VOLUME_CORRUPTED;
+
+	MaxClusters = (Size == RAW_SIZE_UNKNOWN) ? ((UINT64)RAW_DIR_SIZE_MAX >> Volume.ClusterShift) :
+		((Size + (1ULL << Volume.ClusterShift) - 1) >> Volume.ClusterShift);
+	if (NoFatChain) {
+		if (Size == RAW_SIZE_UNKNOWN || MaxClusters > Volume.ClusterCount + 2 - Cluster)
+			return EFI_VOLUME_CORRUPTED;
+		Volume.Extent[0].Offset = Volume.DataOffset + ((UINT64)(Cluster - 2) << Volume.ClusterShift);
+		Volume.Extent[0].Length = Size;
+		Volume.NumExtents = 1;
+		*ChainSize = Size;
+		return EFI_SUCCESS;
+	}
+
+	for (NumClusters = 1; ; NumClusters++) {
+		Offset = Volume.DataOffset + ((UINT64)(Cluster - 2) << Volume.ClusterShift);
+		if (Extent != NULL && Extent->Offset + Extent->Length == Offset) {
+			Extent->Length += 1ULL << Volume.ClusterShift;
+		} else {
+			if (Volume.NumExtents >= RAW_EXTENTS_MAX)
+				return EFI_UNSUPPORTED;
+			Extent = &Volume.Extent[Volume.NumExtents++];
+			Extent->Offset = Offset;
+			Extent->Length = 1ULL << Volume.ClusterShift;
+		}
+		// Files only use as many clusters as their size requires
+		if (Size != RAW_SIZE_UNKNOWN && NumClusters == MaxClusters)
+			break;
+		Status = GetFatEntry(Cluster, &Cluster);
+		if (EFI_ERROR(Status))
+			return Status;
+		if (Cluster >= Volume.EndOfChain) {
+			if (Size != RAW_SIZE_UNKNOWN)
+				return EFI_VOLUME_CORRUPTED;
+			break;
+		}
+		if (Cluster < 2 || Cluster >= Volume.ClusterCount + 2)
+			return EFI_VOLUME_CORRUPTED;
+		if (NumClusters == MaxClusters)
+			return EFI_UNSUPPORTED;
+	}
+
+	*ChainSize = NumClusters << Volume.ClusterShift;
+	// The last cluster of a file is usually not full
+	if (Size != RAW_SIZE_UNKNOWN) {
+		Extent->Length -= *ChainSize - Size;
+		*ChainSize = Size;
+	}
+	return EFI_SUCCESS;
+}
+
+/**
+  Read the content of a directory into the Volume.Dir buffer.
+
+  @param[in]   Entry            A pointer to the RAW_ENTRY of the directory, or NULL for the root.
+  @param[in]   Path             A pointer to the CHAR16 string with the path of the directory.
+  @param[in]   Length           The length of the directory path.
+
+  @retval EFI_SUCCESS           The directory was read.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval other                 The directory could not be resolved or read.
+**/
+STATIC EFI_STATUS ReadDirectory(
+	IN CONST RAW_ENTRY* Entry,
+	IN CONST CHAR16* Path,
+	IN CONST UINTN Length
+)
+{
+	EFI_STATUS Status;
+	UINT64 Size;
+	UINTN i, Offset;
+
+	Volume.DirValid = FALSE;
+	if (Entry == NULL && Volume.Type == RAW_FS_FAT16) {
+		Volume.Extent[0].Offset = Volume.RootOffset;
+		Volume.Extent[0].Length = Volume.RootSize;
+		Volume.NumExtents = 1;
+		Size = Volume.RootSize;
+	} else if (Entry == NULL) {
+		Status = GetExtents(Volume.RootCluster, RAW_SIZE_UNKNOWN, FALSE, &Size);
+		if (EFI_ERROR(Status))
+			return Status;
+	} else {
+		if (Entry->Size != RAW_SIZE_UNKNOWN && Entry->Size > RAW_DIR_SIZE_MAX)
+			return EFI_UNSUPPORTED;
+		Status = GetExtents(Entry->Cluster, Entry->Size, Entry->NoFatChain, &Size);
+		if (EFI_ERROR(Status))
+			return Status;
+	}
+
+	if (Size > Volume.DirAllocSize) {
+		if (Volume.Dir != NULL)
+			SafeFree(Volume.Dir);
+		Volume.DirAllocSize = 0;
+		Volume.Dir = AllocatePool((UINTN)Size);
+		if (Volume.Dir == NULL)
+			return EFI_OUT_OF_RESOURCES;
+		Volume.DirAllocSize = (UINTN)Size;
+	}
+	for (i = 0, Offset = 0; i < Volume.NumExtents; i++) {
+		Status = ReadVolume(Volume.Extent[i].Offset, (UINTN)Volume.Extent[i].Length, &Volume.Dir[Offset]);
+		if (EFI_ERROR(Status))
+			return Status;
+		Offset += (UINTN)Volume.Extent[i].Length;
+	}
+
+	Volume.DirSize = (UINTN)Size;
+	CopyMem(Volume.DirPath, Path, Length * sizeof(CHAR16));
+	Volume.DirPath[Length] = L'\0';
+	Volume.DirValid = TRUE;
+	return EFI_SUCCESS;
+}
+
+/* Convert a lowercase ASCII character to uppercase */
+STATIC __inline CHAR16 ToUpperAscii(
+	IN CONST CHAR16 c
+)
+{
+	return (c >= L'a' && c <= L'z') ? (CHAR16)(c - L'a' + L'A') : c;
+}
+
+/**
+  Compare a name from a directory entry against the name we look for. Since
+  FAT names are case insensitive, we ignore the case of ASCII characters but,
+  as we don't have the up-case table of the volume, other characters must be
+  identical, so that names that only differ by the case of these fall back to
+  the file system driver.
+
+  @param[in]   Name             A pointer to the name to look for.
+  @param[in]   Length           The length of Name.
+  @param[in]   EntryName        A pointer to the name from the directory entry.
+  @param[in]   EntryLength      The length of EntryName.
+
+  @retval TRUE                  The names match.
+  @retval FALSE                 The names are different.
+**/
+STATIC BOOLEAN IsSameName(
+	IN CONST CHAR16* Name,
+	IN CONST UINTN Length,
+	IN CONST CHAR16* EntryName,
+	IN CONST UINTN EntryLength
+)
+{
+	UINTN i;
+
+	if (Length != EntryLength)
+		return FALSE;
+	for (i = 0; i < Length && ToUpperAscii(Name[i]) == ToUpperAscii(EntryName[i]); i++);
+	return (i == Length);
+}
+
+/**
+  Look a name up in the FAT directory from the Volume.Dir buffer, using either
+  the long file name or the 8.3 name of the entries.
+
+  @param[in]   Name             A pointer to the name to look for.
+  @param[in]   Length           The length of Name.
+  @param[out]  Entry            A pointer to the RAW_ENTRY to populate.
+
+  @retval EFI_SUCCESS           The entry was found.
+  @retval EFI_NOT_FOUND         The directory has no such entry.
+**/
+STATIC EFI_STATUS FindFatEntry(
+	IN CONST CHAR16* Name,
+	IN CONST UINTN Length,
+	OUT RAW_ENTRY* Entry
+)
+{
+	RAW_DIR_ENTRY* Dir = (RAW_DIR_ENTRY*)Volume.Dir;
+	CHAR16 LongName[RAW_NAME_MAX + 1], ShortName[13];
+	UINTN i, j, k, LongLength = 0, ShortLength, NumEntries = Volume.DirSize / sizeof(RAW_DIR_ENTRY);
+	UINT8 Ordinal = 0, Checksum = 0, Sum;
+
+	for (i = 0; i < NumEntries && Dir[i].Type != 0x00; i++) {
+		if (Dir[i].Type == 0xE5) {
+			Ordinal = 0;
+			continue;
+		}
+		// Long file names are stored in reverse order, 13 characters per entry,
+		// so Ordinal is 1 once the whole name has been collected.
+		if (Dir[i].Fat.Attributes == FAT_ATTR_LFN) {
+			if (Dir[i].Lfn.Ordinal & 0x40) {
+				Ordinal = Dir[i].Lfn.Ordinal & 0x1F;
+				Checksum = Dir[i].Lfn.Checksum;
+				LongLength = Ordinal * 13;
+				if (LongLength > RAW_NAME_MAX)
+					Ordinal = 0;
+			} else if (Ordinal > 1 && Dir[i].Lfn.Ordinal == Ordinal - 1 && Dir[i].Lfn.Checksum == Checksum) {
+				Ordinal--;
+			} else {
+				Ordinal = 0;
+			}
+			if (Ordinal == 0)
+				continue;
+			k = (Ordinal - 1) * 13;
+			for (j = 0; j < 5; j++)
+				LongName[k++] = Dir[i].Lfn.Name1[j];
+			for (j = 0; j < 6; j++)
+				LongName[k++] = Dir[i].Lfn.Name2[j];
+			for (j = 0; j < 2; j++)
+				LongName[k++] = Dir[i].Lfn.Name3[j];
+			continue;
+		}
+		if (Dir[i].Fat.Attributes & FAT_ATTR_VOLUME_ID) {
+			Ordinal = 0;
+			continue;
+		}
+
+		// The long file name applies if its checksum is the one of the 8.3 name
+		for (j = 0, Sum = 0; j < 11; j++)
+			Sum = (UINT8)(((Sum & 1) << 7) + (Sum >> 1) + (UINT8)Dir[i].Fat.Name[j]);
+		if (Ordinal == 1 && Sum == Checksum) {
+			for (j = 0; j < LongLength && LongName[j] != L'\0'; j++);
+			if (IsSameName(Name, Length, LongName, j))
+				break;
+		}
+		Ordinal = 0;
+
+		// Names with non ASCII characters use an OEM code page, that we can't convert
+		for (j = 0, ShortLength = 0; j < 11; j++) {
+			if (Dir[i].Fat.Name[j] == ' ')
+				continue;
+			if (j == 8 && ShortLength != 0)
+				ShortName[ShortLength++] = L'.';
+			ShortName[ShortLength++] = (CHAR16)(UINT8)Dir[i].Fat.Name[j];
+		}
+		for (j = 0; j < ShortLength && ShortName[j] < 0x80; j++);
+		if (j == ShortLength && IsSameName(Name, Length, ShortName, ShortLength))
+			break;
+	}
+	if (i >= NumEntries || Dir[i].Type == 0x00)
+		return EFI_NOT_FOUND;
+
+	Entry->Directory = ((Dir[i].Fat.Attributes & FAT_ATTR_DIRECTORY) != 0);
+	Entry->NoFatChain = FALSE;
+	Entry->Cluster = Dir[i].Fat.ClusterLow;
+	if (Volume.Type == RAW_FS_FAT32)
+		Entry->Cluster |= (UINT32)Dir[i].Fat.ClusterHigh << 16;
+	Entry->Size = Entry->Directory ? RAW_SIZE_UNKNOWN : Dir[i].Fat.Size;
+	return EFI_SUCCESS;
+}
+
+/**
+  Look a name up in the exFAT directory from the Volume.Dir buffer.
+
+  @param[in]   Name             A pointer to the name to look for.
+  @param[in]   Length           The length of Name.
+  @param[out]  Entry            A pointer to the RAW_ENTRY to populate.
+
+  @retval EFI_SUCCESS           The entry was found.
+  @retval EFI_NOT_FOUND         The directory has no such entry.
+  @retval EFI_UNSUPPORTED       The file has data past its valid data length.
+**/
+STATIC EFI_STATUS FindExFatEntry(
+	IN CONST CHAR16* Name,
+	IN CONST UINTN Length,
+	OUT RAW_ENTRY* Entry
+)
+{
+	RAW_DIR_ENTRY* Dir = (RAW_DIR_ENTRY*)Volume.Dir;
+	UINTN i, j, k, NumEntries = Volume.DirSize / sizeof(RAW_DIR_ENTRY);
+	UINTN NameLength, SecondaryCount;
+
+	for (i = 0; i < NumEntries && Dir[i].Type != 0x00; i++) {
+		if (Dir[i].Type != EXFAT_ENTRY_FILE)
+			continue;
+		// A file is a set of a File entry, a Stream Extension entry and File Name entries
+		SecondaryCount = Dir[i].File.SecondaryCount;
+		if (SecondaryCount < 2 || i + SecondaryCount >= NumEntries ||
+			Dir[i + 1].Type != EXFAT_ENTRY_STREAM)
+			continue;
+		NameLength = Dir[i + 1].Stream.NameLength;
+		if (NameLength != Length || (NameLength + 14) / 15 > SecondaryCount - 1)
+			continue;
+		for (j = 0; j < NameLength; j++) {
+			k = i + 2 + j / 15;
+			if (Dir[k].Type != EXFAT_ENTRY_NAME ||
+				ToUpperAscii(Name[j]) != ToUpperAscii(Dir[k].Name.Name[j % 15]))
+				break;
+		}
+		if (j == NameLength)
+			break;
+		i += SecondaryCount;
+	}
+	if (i >= NumEntries || Dir[i].Type == 0x00)
+		return EFI_NOT_FOUND;
+
+	Entry->Directory = ((Dir[i].File.Attributes & FAT_ATTR_DIRECTORY) != 0);
+	Entry->NoFatChain = ((Dir[i + 1].Stream.Flags & EXFAT_NO_FAT_CHAIN) != 0);
+	Entry->Cluster = Dir[i + 1].Stream.FirstCluster;
+	Entry->Size = Dir[i + 1].Stream.DataLength;
+	// The data past the valid length of a file reads as zeroes, which we don't handle
+	if (Dir[i + 1].Stream.ValidDataLength != Entry->Size)
+		return EFI_UNSUPPORTED;
+	return EFI_SUCCESS;
+}
+
+/**
+  Look a name up in the directory from the Volume.Dir buffer.
+
+  @param[in]   Name             A pointer to the name to look for.
+  @param[in]   Length           The length of Name.
+  @param[out]  Entry            A pointer to the RAW_ENTRY to populate.
+
+  @retval EFI_SUCCESS           The entry was found.
+  @retval other                 The entry was not found, or can't be handled.
+**/
+STATIC EFI_STATUS FindEntry(
+	IN CONST CHAR16* Name,
+	IN CONST UINTN Length,
+	OUT RAW_ENTRY* Entry
+)
+{
+	// Leave the special names to the file system driver
+	if (Length == 0 || Length > RAW_NAME_MAX || Name[0] == L'.')
+		return EFI_UNSUPPORTED;
+	if (Volume.Type == RAW_FS_EXFAT)
+		return FindExFatEntry(Name, Length, Entry);
+	return FindFatEntry(Name, Length, Entry);
+}
+
+/*
+ * EFI_FILE_PROTOCOL implementation of the handles we produce. These handles are
+ * only used by the hash engines, that never call the methods we leave unset.
+ */
+
+/**
+  Get the extent of a raw file that holds the data at the current position.
+
+  @param[in]   File             A pointer to the RAW_FILE.
+  @param[out]  Offset           A pointer to receive the disk offset of the data, or
+                                RAW_OFFSET_ZEROES if it reads as zeroes.
+
+  @retval      The number of bytes of the extent past the current position, or 0 at EOF.
+**/
+STATIC UINT64 GetCurrentExtent(
+	IN RAW_FILE* File,
+	OUT UINT64* Offset
+)
+{
+	if (File->Position >= File->Size)
+		return 0;
+	// Reads are sequential, so we look from the last extent we used
+	if (File->Position < File->CurStart) {
+		File->CurExtent = 0;
+		File->CurStart = 0;
+	}
+	while (File->Position >= File->CurStart + File->Extent[File->CurExtent].Length) {
+		File->CurStart += File->Extent[File->CurExtent].Length;
+		File->CurExtent++;
+		V_ASSERT(File->CurExtent < File->NumExtents);
+	}
+	*Offset = File->Extent[File->CurExtent].Offset;
+	if (*Offset != RAW_OFFSET_ZEROES)
+		*Offset += File->Position - File->CurStart;
+	return File->CurStart + File->Extent[File->CurExtent].Length - File->Position;
+}
+
+STATIC EFI_STATUS EFIAPI RawFileClose(
+	IN EFI_FILE_HANDLE This
+)
+{
+	FreePool(This);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI RawFileRead(
+	IN EFI_FILE_HANDLE This,
+	IN OUT UINTN* BufferSize,
+	OUT VOID* Buffer
+)
+{
+	EFI_STATUS Status;
+	RAW_FILE* File = (RAW_FILE*)This;
+	UINT64 Offset, Length;
+	UINTN Size = 0;
+
+	while (Size < *BufferSize) {
+		Length = GetCurrentExtent(File, &Offset);
+		if (Length == 0)
+			break;
+		Length = MIN(Length, *BufferSize - Size);
+		if (Offset == RAW_OFFSET_ZEROES) {
+			ZeroMem(&((UINT8*)Buffer)[Size], (UINTN)Length);
+		} else {
+			Status = ReadVolume(Offset, (UINTN)Length, &((UINT8*)Buffer)[Size]);
+			if (EFI_ERROR(Status))
+				return Status;
+		}
+		File->Position += Length;
+		Size += (UINTN)Length;
+	}
+	*BufferSize = Size;
+	return EFI_SUCCESS;
+}
+
+/*
+ * Reads that span more than one extent are cut short at the end of the current
+ * one, which the hash engines handle. And since the file and disk I/O tokens
+ * both start with Event and Status fields, the file token can be passed as is.
+ */
+STATIC EFI_STATUS EFIAPI RawFileReadEx(
+	IN EFI_FILE_HANDLE This,
+	IN OUT EFI_FILE_IO_TOKEN* Token
+)
+{
+	EFI_STATUS Status;
+	RAW_FILE* File = (RAW_FILE*)This;
+	UINT64 Offset, Length;
+
+	Length = MIN(GetCurrentExtent(File, &Offset), Token->BufferSize);
+	Token->BufferSize = (UINTN)Length;
+	if (Length == 0 || Offset == RAW_OFFSET_ZEROES) {
+		if (Length != 0)
+			ZeroMem(Token->Buffer, Token->BufferSize);
+		File->Position += Length;
+		Token->Status = EFI_SUCCESS;
+		if (Token->Event != NULL)
+			gBS->SignalEvent(Token->Event);
+		return EFI_SUCCESS;
+	}
+	Status = Volume.DiskIo2->ReadDiskEx(Volume.DiskIo2, Volume.MediaId, Offset,
+		(EFI_DISK_IO2_TOKEN*)Token, Token->BufferSize, Token->Buffer);
+	if (!EFI_ERROR(Status))
+		File->Position += Length;
+	return Status;
+}
+
+STATIC EFI_STATUS EFIAPI RawFileGetPosition(
+	IN EFI_FILE_HANDLE This,
+	OUT UINT64* Position
+)
+{
+	*Position = ((RAW_FILE*)This)->Position;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI RawFileSetPosition(
+	IN EFI_FILE_HANDLE This,
+	IN UINT64 Position
+)
+{
+	RAW_FILE* File = (RAW_FILE*)This;
+
+	File->Position = (Position == (UINT64)-1) ? File->Size : Position;
+	return EFI_SUCCESS;
+}
+
+/**
+  Set up the raw reader for the boot volume, if it uses a file system we support.
+
+  @param[in]   DeviceHandle     The handle of the boot volume.
+
+  @retval EFI_SUCCESS           The raw reader is set up.
+  @retval EFI_UNSUPPORTED       The volume can't be read directly.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS InitRawReader(
+	IN CONST EFI_HANDLE DeviceHandle
+)
+{
+	EFI_STATUS Status;
+	EFI_BLOCK_IO_PROTOCOL* BlockIo;
+	UINT8 Sector[512];
+	FAT_BOOT_SECTOR* Fat = (FAT_BOOT_SECTOR*)Sector;
+	EXFAT_BOOT_SECTOR* ExFat = (EXFAT_BOOT_SECTOR*)Sector;
+	UINT64 NumSectors, FatSectors, RootSectors;
+	UINTN SectorShift, ClusterShift;
+
+	ExitRawReader();
+	if (EFI_ERROR(gBS->HandleProtocol(DeviceHandle, &gEfiBlockIoProtocolGuid, (VOID**)&BlockIo)) ||
+		BlockIo->Media == NULL || EFI_ERROR(gBS->HandleProtocol(DeviceHandle,
+		&gEfiDiskIoProtocolGuid, (VOID**)&Volume.DiskIo)))
+		goto unsupported;
+	Volume.MediaId = BlockIo->Media->MediaId;
+	Volume.BlockSize = BlockIo->Media->BlockSize;
+	Volume.LastBlock = BlockIo->Media->LastBlock;
+	if (EFI_ERROR(gBS->HandleProtocol(DeviceHandle, &gEfiDiskIo2ProtocolGuid, (VOID**)&Volume.DiskIo2)))
+		Volume.DiskIo2 = NULL;
+
+	Status = ReadVolume(0, sizeof(Sector), Sector);
+	if (EFI_ERROR(Status) || Sector[510] != 0x55 || Sector[511] != 0xAA)
+		goto unsupported;
+
+	if (CompareMem(ExFat->FileSystemName, "EXFAT   ", 8) == 0) {
+		if (ExFat->BytesPerSectorShift < 9 || ExFat->BytesPerSectorShift > 12 ||
+			ExFat->SectorsPerClusterShift > 25 - ExFat->BytesPerSectorShift ||
+			ExFat->NumFats < 1 || ExFat->ClusterCount > 0xFFFFFFF5)
+			goto unsupported;
+		SectorShift = ExFat->BytesPerSectorShift;
+		Volume.Type = RAW_FS_EXFAT;
+		Volume.ClusterShift = SectorShift + ExFat->SectorsPerClusterShift;
+		Volume.ClusterCount = ExFat->ClusterCount;
+		Volume.EndOfChain = 0xFFFFFFF8;
+		// Use the FAT that is marked as active
+		Volume.FatOffset = ((UINT64)ExFat->FatOffset +
+			((ExFat->NumFats > 1 && (ExFat->VolumeFlags & 1)) ? ExFat->FatLength : 0)) << SectorShift;
+		Volume.FatSize = (UINT64)ExFat->FatLength << SectorShift;
+		Volume.DataOffset = (UINT64)ExFat->ClusterHeapOffset << SectorShift;
+		Volume.RootCluster = ExFat->RootCluster;
+	} else {
+		// Like the file system driver, we tell FAT types apart from their number of clusters
+		for (SectorShift = 9; SectorShift <= 12 && (1U << SectorShift) != Fat->BytesPerSector; SectorShift++);
+		for (ClusterShift = 0; ClusterShift <= 7 && (1U << ClusterShift) != Fat->SectorsPerCluster; ClusterShift++);
+		if (SectorShift > 12 || ClusterShift > 7 || Fat->NumFats == 0 || Fat->ReservedSectors == 0)
+			goto unsupported;
+		NumSectors = (Fat->Sectors16 != 0) ? Fat->Sectors16 : Fat->Sectors32;
+		FatSectors = (Fat->FatSize16 != 0) ? Fat->FatSize16 : Fat->FatSize32;
+		RootSectors = (((UINT64)Fat->RootEntries * sizeof(RAW_DIR_ENTRY)) + Fat->BytesPerSector - 1) >> SectorShift;
+		if (NumSectors <= Fat->ReservedSectors + Fat->NumFats * FatSectors + RootSectors)
+			goto unsupported;
+		Volume.ClusterCount = (UINT32)((NumSectors - Fat->ReservedSectors -
+			Fat->NumFats * FatSectors - RootSectors) >> ClusterShift);
+		if (Volume.ClusterCount < 4085) {
+			goto unsupported;
+		} else if (Volume.ClusterCount < 65525) {
+			Volume.Type = RAW_FS_FAT16;
+			Volume.EndOfChain = 0xFFF8;
+			Volume.FatOffset = (UINT64)Fat->ReservedSectors << SectorShift;
+			Volume.RootOffset = (Fat->ReservedSectors + Fat->NumFats * FatSectors) << SectorShift;
+			Volume.RootSize = (UINT64)Fat->RootEntries * sizeof(RAW_DIR_ENTRY);
+		} else {
+			if (Fat->FatSize16 != 0 || RootSectors != 0)
+				goto unsupported;
+			Volume.Type = RAW_FS_FAT32;
+			Volume.EndOfChain = 0x0FFFFFF8;
+			// Use the active FAT, if mirroring is disabled
+			Volume.FatOffset = ((UINT64)Fat->ReservedSectors +
+				((Fat->ExtFlags & 0x80) ? (Fat->ExtFlags & 0x0F) * FatSectors : 0)) << SectorShift;
+			Volume.RootCluster = Fat->RootCluster;
+		}
+		Volume.ClusterShift = SectorShift + ClusterShift;
+		Volume.FatSize = FatSectors << SectorShift;
+		Volume.DataOffset = (Fat->ReservedSectors + Fat->NumFats * FatSectors + RootSectors) << SectorShift;
+	}
+	// The FAT must have an entry for every cluster
+	if (Volume.FatSize < ((UINT64)Volume.ClusterCount + 2) * ((Volume.Type == RAW_FS_FAT16) ? 2 : 4))
+		goto unsupported;
+
+	Volume.FatCache = AllocatePool(RAW_FAT_CACHE_SIZE);
+	if (Volume.FatCache == NULL) {
+		ExitRawReader();
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	if (gIsTestMode)
+		PrintTest(L"Reader = raw %s", FsName[Volume.Type]);
+	else
+		PrintInfo(L"Reading %s volume directly (%d-byte clusters%s)", FsName[Volume.Type],
+			1 << Volume.ClusterShift, (Volume.DiskIo2 != NULL) ? L", asynchronous" : L"");
+	return EFI_SUCCESS;
+
+unsupported:
+	ExitRawReader();
+	return EFI_UNSUPPORTED;
+}
+
+/**
+  Release the raw reader.
+**/
+VOID ExitRawReader(VOID)
+{
+	if (Volume.FatCache != NULL)
+		FreePool(Volume.FatCache);
+	if (Volume.Dir != NULL)
+		FreePool(Volume.Dir);
+	ZeroMem(&Volume, sizeof(Volume));
+}
+
+/**
+  Look a file up, by walking its path from the root directory.
+
+  @param[in]   Path             A pointer to the CHAR16 string with the path of the file.
+  @param[out]  Entry            A pointer to the RAW_ENTRY to populate.
+
+  @retval EFI_SUCCESS           The file was found.
+  @retval EFI_INVALID_PARAMETER The path points to a directory.
+  @retval other                 The file was not found, or can't be handled.
+**/
+STATIC EFI_STATUS LookupFile(
+	IN CONST CHAR16* Path,
+	OUT RAW_ENTRY* Entry
+)
+{
+	EFI_STATUS Status;
+	UINTN i, Start, Length, Separator = 0;
+
+	for (Length = 0; Path[Length] != L'\0'; Length++) {
+		if (Path[Length] == L'\\')
+			Separator = Length;
+	}
+	if (Length > PATH_MAX)
+		return EFI_UNSUPPORTED;
+
+	// Walk the path from the root, unless we already have the parent directory
+	if (!Volume.DirValid || StrnCmp(Volume.DirPath, Path, Separator) != 0 ||
+		Volume.DirPath[Separator] != L'\0') {
+		Status = ReadDirectory(NULL, Path, 0);
+		for (Start = 0; !EFI_ERROR(Status) && Start < Separator; Start = i + 1) {
+			for (i = Start; i < Separator && Path[i] != L'\\'; i++);
+			// Skip the leading separator, as well as any double one or "." directory
+			if (i == Start || (i == Start + 1 && Path[Start] == L'.'))
+				continue;
+			Status = FindEntry(&Path[Start], i - Start, Entry);
+			if (!EFI_ERROR(Status) && !Entry->Directory)
+				Status = EFI_NOT_FOUND;
+			if (!EFI_ERROR(Status))
+				Status = ReadDirectory(Entry, Path, i);
+		}
+		if (EFI_ERROR(Status))
+			return Status;
+	}
+
+	Start = (Path[Separator] == L'\\') ? Separator + 1 : 0;
+	Status = FindEntry(&Path[Start], Length - Start, Entry);
+	if (EFI_ERROR(Status))
+		return Status;
+	return Entry->Directory ? EFI_INVALID_PARAMETER : EFI_SUCCESS;
+}
+
+/**
+  Create a raw file handle.
+
+  @param[in]   Extent           A pointer to the extents of the data of the file.
+  @param[in]   NumExtents       The number of extents.
+  @param[in]   Size             The size of the file, which the extents must cover.
+  @param[out]  File             A pointer to receive the handle of the file.
+
+  @retval EFI_SUCCESS           The handle was created.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+STATIC EFI_STATUS CreateRawFile(
+	IN CONST RAW_EXTENT* Extent,
+	IN CONST UINTN NumExtents,
+	IN CONST UINT64 Size,
+	OUT EFI_FILE_HANDLE* File
+)
+{
+	RAW_FILE* Raw;
+
+	Raw = AllocateZeroPool(sizeof(RAW_FILE) + NumExtents * sizeof(RAW_EXTENT));
+	if (Raw == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	Raw->Size = Size;
+	Raw->NumExtents = NumExtents;
+	Raw->Extent = (RAW_EXTENT*)&Raw[1];
+	CopyMem(Raw->Extent, Extent, NumExtents * sizeof(RAW_EXTENT));
+	Raw->Protocol.Revision = (Volume.DiskIo2 != NULL) ? EFI_FILE_PROTOCOL_REVISION2 : EFI_FILE_PROTOCOL_REVISION;
+	Raw->Protocol.Close = RawFileClose;
+	Raw->Protocol.Read = RawFileRead;
+	Raw->Protocol.GetPosition = RawFileGetPosition;
+	Raw->Protocol.SetPosition = RawFileSetPosition;
+	if (Volume.DiskIo2 != NULL)
+		Raw->Protocol.ReadEx = RawFileReadEx;
+
+	*File = &Raw->Protocol;
+	return EFI_SUCCESS;
+}
+
+/**
+  Open a file with the raw reader, if it was set up.
+
+  @param[in]   Path             A pointer to the CHAR16 string with the path of the file.
+  @param[out]  File             A pointer to receive the handle of the opened file.
+  @param[out]  FileSize         A pointer to receive the size of the file.
+
+  @retval EFI_SUCCESS           The file was opened.
+  @retval other                 The file is to be opened with the file system driver.
+**/
+EFI_STATUS OpenRawFile(
+	IN CONST CHAR16* Path,
+	OUT EFI_FILE_HANDLE* File,
+	OUT UINT64* FileSize
+)
+{
+	EFI_STATUS Status;
+	RAW_ENTRY Entry;
+	UINT64 Size;
+
+	*File = NULL;
+	if (Volume.Type == RAW_FS_NONE)
+		return EFI_UNSUPPORTED;
+
+	Status = LookupFile(Path, &Entry);
+	if (EFI_ERROR(Status))
+		return Status;
+	Status = GetExtents(Entry.Cluster, Entry.Size, Entry.NoFatChain, &Size);
+	if (EFI_ERROR(Status))
+		return Status;
+	Status = CreateRawFile(Volume.Extent, Volume.NumExtents, Size, File);
+	if (EFI_ERROR(Status))
+		return Status;
+	*FileSize = Size;
+	return EFI_SUCCESS;
+}
+
+/**
+  Open the first blocks of the boot partition with the raw reader, as a single
+  file where the clusters of a file that is to be excluded read as zeroes.
+
+  @param[in]   ExcludePath      A pointer to the CHAR16 string with the path of the file to exclude.
+  @param[in]   NumBlocks        The number of blocks to open.
+  @param[out]  File             A pointer to receive the handle of the opened partition.
+  @param[out]  Size             A pointer to receive the size of the opened partition.
+
+  @retval EFI_SUCCESS           The partition was opened.
+  @retval EFI_UNSUPPORTED       The raw reader wasn't set up.
+  @retval EFI_END_OF_MEDIA      The partition is smaller than NumBlocks.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval EFI_VOLUME_CORRUPTED  The clusters of the file to exclude overlap.
+  @retval other                 The file to exclude could not be resolved.
+**/
+EFI_STATUS OpenRawPartition(
+	IN CONST CHAR16* ExcludePath,
+	IN CONST UINT64 NumBlocks,
+	OUT EFI_FILE_HANDLE* File,
+	OUT UINT64* Size
+)
+{
+	EFI_STATUS Status;
+	RAW_ENTRY Entry;
+	RAW_EXTENT *Extent, Tmp;
+	UINT64 Offset, ChainSize, ClusterMask;
+	UINTN i, j, NumExtents = 0;
+
+	*File = NULL;
+	if (Volume.Type == RAW_FS_NONE || Volume.BlockSize == 0)
+		return EFI_UNSUPPORTED;
+	if (NumBlocks > Volume.LastBlock + 1 || NumBlocks > (UINT64)-1 / Volume.BlockSize)
+		return EFI_END_OF_MEDIA;
+
+	Status = LookupFile(ExcludePath, &Entry);
+	if (!EFI_ERROR(Status))
+		Status = GetExtents(Entry.Cluster, Entry.Size, Entry.NoFatChain, &ChainSize);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	// Exclude whole clusters, as the slack of the last one may change when the
+	// file is written, and sort them, since chains may go backwards
+	ClusterMask = (1ULL << Volume.ClusterShift) - 1;
+	for (i = 0; i < Volume.NumExtents; i++) {
+		Volume.Extent[i].Length = (Volume.Extent[i].Length + ClusterMask) & ~ClusterMask;
+		Tmp = Volume.Extent[i];
+		for (j = i; j > 0 && Volume.Extent[j - 1].Offset > Tmp.Offset; j--)
+			Volume.Extent[j] = Volume.Extent[j - 1];
+		Volume.Extent[j] = Tmp;
+	}
+
+	// Each excluded extent can split the partition's data in two
+	Extent = AllocatePool((2 * Volume.NumExtents + 1) * sizeof(RAW_EXTENT));
+	if (Extent == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	*Size = NumBlocks * Volume.BlockSize;
+	for (i = 0, Offset = 0; i < Volume.NumExtents && Volume.Extent[i].Offset < *Size; i++) {
+		if (Volume.Extent[i].Offset < Offset) {
+			FreePool(Extent);
+			return EFI_VOLUME_CORRUPTED;
+		}
+		if (Volume.Extent[i].Offset > Offset) {
+			Extent[NumExtents].Offset = Offset;
+			Extent[NumExtents++].Length = Volume.Extent[i].Offset - Offset;
+		}
+		Offset = MIN(Volume.Extent[i].Offset + Volume.Extent[i].Length, *Size);
+		Extent[NumExtents].Offset = RAW_OFFSET_ZEROES;
+		Extent[NumExtents++].Length = Offset - Volume.Extent[i].Offset;
+	}
+	if (Offset < *Size) {
+		Extent[NumExtents].Offset = Offset;
+		Extent[NumExtents++].Length = *Size - Offset;
+	}
+
+	Status = CreateRawFile(Extent, NumExtents, *Size, File);
+	FreePool(Extent);
+	return Status;
+}
+
+/**
+  Get the serial number of a volume, from its boot sector, so that the volume
+  can be told apart from other media, whether or not the raw reader can read it.
+
+  @param[in]   DeviceHandle     The handle of the volume.
+  @param[out]  Serial           A pointer to receive the serial number.
+
+  @retval EFI_SUCCESS           The serial number was retrieved.
+  @retval EFI_UNSUPPORTED       The volume is not FAT16, FAT32, exFAT or NTFS, or has no serial number.
+  @retval other                 A read error occurred.
+**/
+EFI_STATUS GetVolumeSerial(
+	IN CONST EFI_HANDLE DeviceHandle,
+	OUT UINT64* Serial
+)
+{
+	EFI_STATUS Status;
+	EFI_BLOCK_IO_PROTOCOL* BlockIo;
+	EFI_DISK_IO_PROTOCOL* DiskIo;
+	UINT8 Sector[512];
+	FAT_BOOT_SECTOR* Fat = (FAT_BOOT_SECTOR*)Sector;
+	EXFAT_BOOT_SECTOR* ExFat = (EXFAT_BOOT_SECTOR*)Sector;
+	UINTN Offset;
+
+	if (EFI_ERROR(gBS->HandleProtocol(DeviceHandle, &gEfiBlockIoProtocolGuid, (VOID**)&BlockIo)) ||
+		BlockIo->Media == NULL || EFI_ERROR(gBS->HandleProtocol(DeviceHandle,
+		&gEfiDiskIoProtocolGuid, (VOID**)&DiskIo)))
+		return EFI_UNSUPPORTED;
+	Status = DiskIo->ReadDisk(DiskIo, BlockIo->Media->MediaId, 0, sizeof(Sector), Sector);
+	if (EFI_ERROR(Status))
+		return Status;
+	if (Sector[510] != 0x55 || Sector[511] != 0xAA)
+		return EFI_UNSUPPORTED;
+
+	if (CompareMem(ExFat->FileSystemName, "EXFAT   ", 8) == 0) {
+		*Serial = ExFat->SerialNumber;
+		return EFI_SUCCESS;
+	}
+	if (CompareMem(Fat->OemName, "NTFS    ", 8) == 0) {
+		*Serial = LOAD32(&Sector[NTFS_SERIAL_OFFSET], 0) |
+			((UINT64)LOAD32(&Sector[NTFS_SERIAL_OFFSET], 1) << 32);
+		return EFI_SUCCESS;
+	}
+	// FAT32 is the only one that doesn't have a 16-bit FAT size
+	Offset = (Fat->FatSize16 != 0) ? FAT16_SERIAL_OFFSET : FAT32_SERIAL_OFFSET;
+	if (Fat->BytesPerSector == 0 || Sector[Offset - 1] != FAT_EXTENDED_BOOT_SIGNATURE)
+		return EFI_UNSUPPORTED;
+	*Serial = LOAD32(&Sector[Offset], 0);
+	return EFI_SUCCESS;
+}
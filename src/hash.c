@@ -45,24 +45,24 @@
 #endif
 
 /* Hash context initialisation */
-STATIC VOID Md5Init(HASH_CONTEXT* Context)
+VOID Md5Init(HASH_CONTEXT* Context)
 {
-	ZeroMem(Context, sizeof(*Context));
-	Context->State[0] = 0x67452301;
-	Context->State[1] = 0xefcdab89;
-	Context->State[2] = 0x98badcfe;
-	Context->State[3] = 0x10325476;
+	ZeroMem(&Context->Md5, sizeof(Context->Md5));
+	Context->Md5.State[0] = 0x67452301;
+	Context->Md5.State[1] = 0xefcdab89;
+	Context->Md5.State[2] = 0x98badcfe;
+	Context->Md5.State[3] = 0x10325476;
 }
 
 /* Transform the message X which consists of 16 32-bit-words (MD5) */
-STATIC VOID Md5Transform(HASH_CONTEXT* Context, CONST UINT8* Data)
+STATIC VOID Md5TransformGeneric(HASH_CONTEXT* Context, CONST UINT8* Data)
 {
 	UINT32 a, b, c, d, x[16];
 
-	a = Context->State[0];
-	b = Context->State[1];
-	c = Context->State[2];
-	d = Context->State[3];
+	a = Context->Md5.State[0];
+	b = Context->Md5.State[1];
+	c = Context->Md5.State[2];
+	d = Context->Md5.State[3];
 
 #ifdef BIG_ENDIAN_HOST
 	{
@@ -161,31 +161,159 @@ STATIC VOID Md5Transform(HASH_CONTEXT* Context, CONST UINT8* Data)
 	#undef F4
 
 	/* Update chaining vars */
-	Context->State[0] += a;
-	Context->State[1] += b;
-	Context->State[2] += c;
-	Context->State[3] += d;
+	Context->Md5.State[0] += a;
+	Context->Md5.State[1] += b;
+	Context->Md5.State[2] += c;
+	Context->Md5.State[3] += d;
 }
 
+#if defined(MD5_TUNED_TRANSFORM)
+/*
+ * Tuned transform for the little endian platforms with fast unaligned accesses
+ * of MD5_TUNED_TRANSFORM, in portable C, that leaves instruction selection to
+ * the compiler:
+ * - The message words are read directly from the data, rather than copied.
+ * - The message word and constant are added first, since they don't depend
+ *   on the previous step and can therefore be computed ahead.
+ * - G is computed as ((~z & y) + (z & x)), so that the two terms can be added
+ *   independently (and use ANDN/BIC where available).
+ * - Rotates use the native rotate instructions.
+ */
+#define T1(x, y, z) (z ^ (x & (y ^ z)))
+#define T3(x, y, z) (x ^ y ^ z)
+#define T4(x, y, z) (y ^ (x | ~z))
+
+#define TSTEP(f, w, x, y, z, k, t, s) do { \
+	w += LOAD32(Data, k) + t; w += f(x, y, z); w = ROL32(w, s); w += x; } while(0)
+#define TSTEP2(w, x, y, z, k, t, s) do { \
+	w += LOAD32(Data, k) + t; w += (~z & y); w += (z & x); w = ROL32(w, s); w += x; } while(0)
+
+/* The body is shared with the BMI1 variant, which only differs by its target */
+#define MD5_TUNED_TRANSFORM_BODY { \
+	UINT32 a = Context->Md5.State[0], b = Context->Md5.State[1], c = Context->Md5.State[2], d = Context->Md5.State[3]; \
+	TSTEP(T1, a, b, c, d,  0, 0xd76aa478,  7); \
+	TSTEP(T1, d, a, b, c,  1, 0xe8c7b756, 12); \
+	TSTEP(T1, c, d, a, b,  2, 0x242070db, 17); \
+	TSTEP(T1, b, c, d, a,  3, 0xc1bdceee, 22); \
+	TSTEP(T1, a, b, c, d,  4, 0xf57c0faf,  7); \
+	TSTEP(T1, d, a, b, c,  5, 0x4787c62a, 12); \
+	TSTEP(T1, c, d, a, b,  6, 0xa8304613, 17); \
+	TSTEP(T1, b, c, d, a,  7, 0xfd469501, 22); \
+	TSTEP(T1, a, b, c, d,  8, 0x698098d8,  7); \
+	TSTEP(T1, d, a, b, c,  9, 0x8b44f7af, 12); \
+	TSTEP(T1, c, d, a, b, 10, 0xffff5bb1, 17); \
+	TSTEP(T1, b, c, d, a, 11, 0x895cd7be, 22); \
+	TSTEP(T1, a, b, c, d, 12, 0x6b901122,  7); \
+	TSTEP(T1, d, a, b, c, 13, 0xfd987193, 12); \
+	TSTEP(T1, c, d, a, b, 14, 0xa679438e, 17); \
+	TSTEP(T1, b, c, d, a, 15, 0x49b40821, 22); \
+	TSTEP2(a, b, c, d,  1, 0xf61e2562,  5); \
+	TSTEP2(d, a, b, c,  6, 0xc040b340,  9); \
+	TSTEP2(c, d, a, b, 11, 0x265e5a51, 14); \
+	TSTEP2(b, c, d, a,  0, 0xe9b6c7aa, 20); \
+	TSTEP2(a, b, c, d,  5, 0xd62f105d,  5); \
+	TSTEP2(d, a, b, c, 10, 0x02441453,  9); \
+	TSTEP2(c, d, a, b, 15, 0xd8a1e681, 14); \
+	TSTEP2(b, c, d, a,  4, 0xe7d3fbc8, 20); \
+	TSTEP2(a, b, c, d,  9, 0x21e1cde6,  5); \
+	TSTEP2(d, a, b, c, 14, 0xc33707d6,  9); \
+	TSTEP2(c, d, a, b,  3, 0xf4d50d87, 14); \
+	TSTEP2(b, c, d, a,  8, 0x455a14ed, 20); \
+	TSTEP2(a, b, c, d, 13, 0xa9e3e905,  5); \
+	TSTEP2(d, a, b, c,  2, 0xfcefa3f8,  9); \
+	TSTEP2(c, d, a, b,  7, 0x676f02d9, 14); \
+	TSTEP2(b, c, d, a, 12, 0x8d2a4c8a, 20); \
+	TSTEP(T3, a, b, c, d,  5, 0xfffa3942,  4); \
+	TSTEP(T3, d, a, b, c,  8, 0x8771f681, 11); \
+	TSTEP(T3, c, d, a, b, 11, 0x6d9d6122, 16); \
+	TSTEP(T3, b, c, d, a, 14, 0xfde5380c, 23); \
+	TSTEP(T3, a, b, c, d,  1, 0xa4beea44,  4); \
+	TSTEP(T3, d, a, b, c,  4, 0x4bdecfa9, 11); \
+	TSTEP(T3, c, d, a, b,  7, 0xf6bb4b60, 16); \
+	TSTEP(T3, b, c, d, a, 10, 0xbebfbc70, 23); \
+	TSTEP(T3, a, b, c, d, 13, 0x289b7ec6,  4); \
+	TSTEP(T3, d, a, b, c,  0, 0xeaa127fa, 11); \
+	TSTEP(T3, c, d, a, b,  3, 0xd4ef3085, 16); \
+	TSTEP(T3, b, c, d, a,  6, 0x04881d05, 23); \
+	TSTEP(T3, a, b, c, d,  9, 0xd9d4d039,  4); \
+	TSTEP(T3, d, a, b, c, 12, 0xe6db99e5, 11); \
+	TSTEP(T3, c, d, a, b, 15, 0x1fa27cf8, 16); \
+	TSTEP(T3, b, c, d, a,  2, 0xc4ac5665, 23); \
+	TSTEP(T4, a, b, c, d,  0, 0xf4292244,  6); \
+	TSTEP(T4, d, a, b, c,  7, 0x432aff97, 10); \
+	TSTEP(T4, c, d, a, b, 14, 0xab9423a7, 15); \
+	TSTEP(T4, b, c, d, a,  5, 0xfc93a039, 21); \
+	TSTEP(T4, a, b, c, d, 12, 0x655b59c3,  6); \
+	TSTEP(T4, d, a, b, c,  3, 0x8f0ccc92, 10); \
+	TSTEP(T4, c, d, a, b, 10, 0xffeff47d, 15); \
+	TSTEP(T4, b, c, d, a,  1, 0x85845dd1, 21); \
+	TSTEP(T4, a, b, c, d,  8, 0x6fa87e4f,  6); \
+	TSTEP(T4, d, a, b, c, 15, 0xfe2ce6e0, 10); \
+	TSTEP(T4, c, d, a, b,  6, 0xa3014314, 15); \
+	TSTEP(T4, b, c, d, a, 13, 0x4e0811a1, 21); \
+	TSTEP(T4, a, b, c, d,  4, 0xf7537e82,  6); \
+	TSTEP(T4, d, a, b, c, 11, 0xbd3af235, 10); \
+	TSTEP(T4, c, d, a, b,  2, 0x2ad7d2bb, 15); \
+	TSTEP(T4, b, c, d, a,  9, 0xeb86d391, 21); \
+	Context->Md5.State[0] += a; \
+	Context->Md5.State[1] += b; \
+	Context->Md5.State[2] += c; \
+	Context->Md5.State[3] += d; }
+
+STATIC VOID Md5TransformTuned(HASH_CONTEXT* Context, CONST UINT8* Data)
+MD5_TUNED_TRANSFORM_BODY
+
+#if defined(__x86_64__) || defined(_M_X64)
+/* Same as the above, with the compiler being free to use the BMI1 ANDN instruction */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("bmi")))
+#endif
+STATIC VOID Md5TransformTunedBmi(HASH_CONTEXT* Context, CONST UINT8* Data)
+MD5_TUNED_TRANSFORM_BODY
+#endif
+
+#undef T1
+#undef T3
+#undef T4
+#endif /* MD5_TUNED_TRANSFORM */
+
+/* The list of MD5 transforms we can use, in order of preference */
+STATIC CONST struct {
+	CONST CHAR16*   Name;
+	MD5_TRANSFORM   Transform;
+	BOOLEAN         (*IsSupported)(VOID);
+} Md5Transforms[] = {
+#if defined(MD5_TUNED_TRANSFORM)
+#if defined(__x86_64__) || defined(_M_X64)
+	{ L"tuned (BMI1)", Md5TransformTunedBmi, IsBmiSupported },
+#endif
+	{ L"tuned", Md5TransformTuned, NULL },
+#endif
+	{ L"generic", Md5TransformGeneric, NULL },
+};
+
+/* The MD5 transform selected by InitMd5() */
+STATIC MD5_TRANSFORM Md5Transform = Md5TransformGeneric;
+
 /* Update the message digest with the contents of the buffer (MD5) */
-STATIC VOID Md5Write(HASH_CONTEXT* Context, CONST UINT8* Buffer, UINTN Length)
+VOID Md5Write(HASH_CONTEXT* Context, CONST UINT8* Buffer, UINTN Length)
 {
-	UINTN Num = Context->ByteCount & (MD5_BLOCKSIZE - 1);
+	UINTN Num = Context->Md5.ByteCount & (MD5_BLOCKSIZE - 1);
 
 	/* Update bytecount */
-	Context->ByteCount += Length;
+	Context->Md5.ByteCount += Length;
 
 	/* Handle any leading odd-sized chunks */
 	if (Num) {
-		UINT8* p = Context->Buffer + Num;
+		UINT8* p = Context->Md5.Buffer + Num;
 
 		Num = MD5_BLOCKSIZE - Num;
 		if (Length < Num) {
-			CopyMem(p, Buffer, Num);
+			CopyMem(p, Buffer, Length);
 			return;
 		}
 		CopyMem(p, Buffer, Num);
-		Md5Transform(Context, Context->Buffer);
+		Md5Transform(Context, Context->Md5.Buffer);
 		Buffer += Num;
 		Length -= Num;
 	}
@@ -199,20 +327,20 @@ STATIC VOID Md5Write(HASH_CONTEXT* Context, CONST UINT8* Buffer, UINTN Length)
 	}
 
 	/* Handle any remaining bytes of Data. */
-	CopyMem(Context->Buffer, Buffer, Length);
+	CopyMem(Context->Md5.Buffer, Buffer, Length);
 }
 
-/* Finalize the computation and write the digest in Context->State[] */
-STATIC VOID Md5Final(HASH_CONTEXT* Context)
+/* Finalize the computation and write the digest in Context->Md5.Buffer[] */
+VOID Md5Final(HASH_CONTEXT* Context)
 {
-	UINTN Count = ((UINTN)Context->ByteCount) & (MD5_BLOCKSIZE - 1);
-	UINT64 BitCount = Context->ByteCount << 3;
+	UINTN Count = ((UINTN)Context->Md5.ByteCount) & (MD5_BLOCKSIZE - 1);
+	UINT64 BitCount = Context->Md5.ByteCount << 3;
 	UINT8* p;
 
 	/* Set the first char of padding to 0x80.
 	 * This is safe since there is always at least one byte free
 	 */
-	p = Context->Buffer + Count;
+	p = Context->Md5.Buffer + Count;
 	*p++ = 0x80;
 
 	/* Bytes of padding needed to make blocksize */
@@ -222,32 +350,32 @@ STATIC VOID Md5Final(HASH_CONTEXT* Context)
 	if (Count < 8) {
 		/* Two lots of padding: Pad the first block to blocksize */
 		ZeroMem(p, Count);
-		Md5Transform(Context, Context->Buffer);
+		Md5Transform(Context, Context->Md5.Buffer);
 
 		/* Now fill the next block */
-		ZeroMem(Context->Buffer, MD5_BLOCKSIZE - 8);
+		ZeroMem(Context->Md5.Buffer, MD5_BLOCKSIZE - 8);
 	} else {
 		/* Pad block to blocksize */
 		ZeroMem(p, Count - 8);
 	}
 
 	/* append the 64 bit Count (little endian) */
-	Context->Buffer[MD5_BLOCKSIZE - 8] = (UINT8)BitCount;
-	Context->Buffer[MD5_BLOCKSIZE - 7] = (UINT8)(BitCount >> 8);
-	Context->Buffer[MD5_BLOCKSIZE - 6] = (UINT8)(BitCount >> 16);
-	Context->Buffer[MD5_BLOCKSIZE - 5] = (UINT8)(BitCount >> 24);
-	Context->Buffer[MD5_BLOCKSIZE - 4] = (UINT8)(BitCount >> 32);
-	Context->Buffer[MD5_BLOCKSIZE - 3] = (UINT8)(BitCount >> 40);
-	Context->Buffer[MD5_BLOCKSIZE - 2] = (UINT8)(BitCount >> 48);
-	Context->Buffer[MD5_BLOCKSIZE - 1] = (UINT8)(BitCount >> 56);
-
-	Md5Transform(Context, Context->Buffer);
-
-	p = Context->Buffer;
+	Context->Md5.Buffer[MD5_BLOCKSIZE - 8] = (UINT8)BitCount;
+	Context->Md5.Buffer[MD5_BLOCKSIZE - 7] = (UINT8)(BitCount >> 8);
+	Context->Md5.Buffer[MD5_BLOCKSIZE - 6] = (UINT8)(BitCount >> 16);
+	Context->Md5.Buffer[MD5_BLOCKSIZE - 5] = (UINT8)(BitCount >> 24);
+	Context->Md5.Buffer[MD5_BLOCKSIZE - 4] = (UINT8)(BitCount >> 32);
+	Context->Md5.Buffer[MD5_BLOCKSIZE - 3] = (UINT8)(BitCount >> 40);
+	Context->Md5.Buffer[MD5_BLOCKSIZE - 2] = (UINT8)(BitCount >> 48);
+	Context->Md5.Buffer[MD5_BLOCKSIZE - 1] = (UINT8)(BitCount >> 56);
+
+	Md5Transform(Context, Context->Md5.Buffer);
+
+	p = Context->Md5.Buffer;
 #ifdef BIG_ENDIAN_HOST
-#define X(a) do { SwapBytes32(p, (UINT32)Context->State[a]); p += 4; } while(0);
+#define X(a) do { SwapBytes32(p, (UINT32)Context->Md5.State[a]); p += 4; } while(0);
 #else
-#define X(a) do { *(UINT32*)p = (UINT32)Context->State[a]; p += 4; } while(0)
+#define X(a) do { *(UINT32*)p = (UINT32)Context->Md5.State[a]; p += 4; } while(0)
 #endif
 	X(0);
 	X(1);
@@ -257,63 +385,630 @@ STATIC VOID Md5Final(HASH_CONTEXT* Context)
 }
 
 /**
-  Compute the MD5 hash of a single file.
+  Select the fastest MD5 transform that the platform supports, after
+  validating it against the RFC 1321 test suite. A transform that fails
+  the test is reported and skipped.
 
-  @param[in]   Root             A file handle to the root directory.
-  @param[in]   Path             A pointer to the CHAR16 string with the target path.
-  @param[in]   Progress         (Optional) A pointer to a PROGRESS_DATA structure. If provided then
-                                the current progress value will be updated by this call.
-  @param[out]  Hash             A pointer to the 16-byte array that is to receive the hash.
+  @retval EFI_SUCCESS           A valid MD5 transform has been selected.
+  @retval EFI_CRC_ERROR         None of the MD5 transforms passed the test.
+**/
+EFI_STATUS InitMd5(VOID)
+{
+	/* RFC 1321, Appendix A.5 */
+	STATIC CONST struct {
+		CONST CHAR8*    Message;
+		UINT8           Hash[MD5_HASHSIZE];
+	} TestSuite[] = {
+		{ "",
+		  { 0xd4, 0x1d, 0x8c, 0xd9, 0x8f, 0x00, 0xb2, 0x04, 0xe9, 0x80, 0x09, 0x98, 0xec, 0xf8, 0x42, 0x7e } },
+		{ "a",
+		  { 0x0c, 0xc1, 0x75, 0xb9, 0xc0, 0xf1, 0xb6, 0xa8, 0x31, 0xc3, 0x99, 0xe2, 0x69, 0x77, 0x26, 0x61 } },
+		{ "abc",
+		  { 0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0, 0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72 } },
+		{ "message digest",
+		  { 0xf9, 0x6b, 0x69, 0x7d, 0x7c, 0xb7, 0x93, 0x8d, 0x52, 0x5a, 0x2f, 0x31, 0xaa, 0xf1, 0x61, 0xd0 } },
+		{ "abcdefghijklmnopqrstuvwxyz",
+		  { 0xc3, 0xfc, 0xd3, 0xd7, 0x61, 0x92, 0xe4, 0x00, 0x7d, 0xfb, 0x49, 0x6c, 0xca, 0x67, 0xe1, 0x3b } },
+		{ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+		  { 0xd1, 0x74, 0xab, 0x98, 0xd2, 0x77, 0xd9, 0xf5, 0xa5, 0x61, 0x1c, 0x2c, 0x9f, 0x41, 0x9d, 0x9f } },
+		{ "12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+		  { 0x57, 0xed, 0xf4, 0xa2, 0x2b, 0xe3, 0xc9, 0x55, 0xac, 0x49, 0xda, 0x2e, 0x21, 0x07, 0xb6, 0x7a } },
+	};
+	HASH_CONTEXT Context;
+	UINTN i, j, Len;
 
-  @retval EFI_SUCCESS           The file was successfully processed and the hash has been populated.
-  @retval EFI_INVALID_PARAMETER One or more of the input parameters are invalid or one of the paths
-                                from the hash list points to a directory.
-  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
-  @retval EFI_NOT_FOUND         The target file could not be found on the media.
-  @retval EFI_END_OF_FILE       The file could not be read in full.
+	for (i = 0; i < ARRAY_SIZE(Md5Transforms); i++) {
+		if (Md5Transforms[i].IsSupported != NULL && !Md5Transforms[i].IsSupported())
+			continue;
+		Md5Transform = Md5Transforms[i].Transform;
+		for (j = 0; j < ARRAY_SIZE(TestSuite); j++) {
+			for (Len = 0; TestSuite[j].Message[Len] != 0; Len++);
+			Md5Init(&Context);
+			Md5Write(&Context, (CONST UINT8*)TestSuite[j].Message, Len);
+			Md5Final(&Context);
+			if (CompareMem(Context.Buffer, TestSuite[j].Hash, MD5_HASHSIZE) != 0)
+				break;
+		}
+		if (j >= ARRAY_SIZE(TestSuite))
+			return EFI_SUCCESS;
+		PrintWarning(L"%s MD5 transform failed self-test", Md5Transforms[i].Name);
+	}
+
+	Md5Transform = Md5TransformGeneric;
+	return EFI_CRC_ERROR;
+}
+
+/* The hash algorithms we support, in the order we look for their hash list */
+CONST HASH_ALGORITHM gHashAlgorithm[HASH_TYPE_MAX] = {
+	{ L"MD5", L"md5sum.txt", L"md5sum.chunks", L"md5sum.bin", MD5_HASHSIZE,
+	  InitMd5, Md5Init, Md5Write, Md5Final },
+	{ L"SHA-256", L"sha256sum.txt", L"sha256sum.chunks", L"sha256sum.bin", SHA256_HASHSIZE,
+	  InitSha256, Sha256Init, Sha256Write, Sha256Final },
+	{ L"BLAKE3", L"b3sum.txt", L"b3sum.chunks", L"b3sum.bin", BLAKE3_HASHSIZE,
+	  InitBlake3, Blake3Init, Blake3Write, Blake3Final },
+};
+
+/*
+ * During verification, the watchdog resets, the checks for user cancellation
+ * and the pacing of the console redraws are performed from a periodic timer
+ * event, so that the read loops only have to read and hash. The timer is also
+ * used to adjust the pause of early AMI systems (see HashFileSync()), as these
+ * systems can only process keyboard input if they get to service their timer
+ * events, which a timer that fires late shows they didn't. The pause is doubled
+ * whenever the timer is late, and halved after PAUSE_DECAY_TICKS notifications
+ * in a row that weren't. Lateness is measured over a window of notifications,
+ * of a single one with the timestamp counter, or of PAUSE_RTC_TICKS with the
+ * much coarser clock of the RTC, for systems that don't have the former, and
+ * doesn't count the time that the synchronous reads took, as the firmware may
+ * not service timers while it performs them.
+ */
+STATIC struct {
+	EFI_EVENT           Event;
+	UINTN               Ticks;      /* Number of timer notifications since the last watchdog reset */
+	UINT64              WindowStart;    /* Time of the start of the lateness window (in μs) */
+	UINT64              WindowReadTime; /* Value of ReadTime at the start of the lateness window */
+	UINTN               WindowTicks;    /* Number of timer notifications in the lateness window */
+	UINTN               OnTimeTicks;    /* Number of timer notifications in a row that weren't late */
+	volatile UINT64     ReadTime;   /* Time spent in synchronous reads that were paced (in μs) */
+	volatile BOOLEAN    Cancelled;
+} Housekeeping = { 0 };
+
+/**
+  Get the time of the RTC, for the systems that don't have a timestamp counter.
+
+  @retval      The time of the day, in microseconds, or 0 if it is not available.
+**/
+STATIC UINT64 GetRtcTime(VOID)
+{
+	EFI_TIME Time;
+
+	if (EFI_ERROR(gRT->GetTime(&Time, NULL)))
+		return 0;
+	return (((UINT64)Time.Hour * 60 + Time.Minute) * 60 + Time.Second) * 1000000ULL +
+		Time.Nanosecond / 1000 + 1;
+}
+
+/**
+  Get the timestamp from before a synchronous read, if reads are being paced.
+
+  @retval      The timestamp, or 0 if reads are not paced or there is no timestamp counter.
+**/
+STATIC __inline UINT64 GetPacedReadStart(VOID)
+{
+	return (gPauseAfterRead != 0) ? GetTimestamp() : 0;
+}
+
+/**
+  Pause after a read, on the systems that need it (see HashFileSync()), and
+  account for the time the read took if it was synchronous, so that the
+  housekeeping timer doesn't take it for the firmware lagging behind.
+
+  @param[in]   ReadStart        The value GetPacedReadStart() returned before a
+                                synchronous read, or 0 for a read that was waited for.
+**/
+STATIC VOID PauseAfterRead(
+	IN CONST UINT64 ReadStart
+)
+{
+	if (gPauseAfterRead == 0)
+		return;
+	if (ReadStart != 0)
+		Housekeeping.ReadTime += GetTimestamp() - ReadStart;
+	Sleep(gPauseAfterRead);
+}
+
+/**
+  Timer notification function, that performs the housekeeping.
+
+  @param[in]   Event            The housekeeping timer event.
+  @param[in]   Context          Unused.
+**/
+STATIC VOID EFIAPI HousekeepingNotify(
+	IN EFI_EVENT Event,
+	IN VOID* Context
+)
+{
+	UINT64 Now = GetTimestamp(), Elapsed, ReadTime;
+	UINTN Window = 1, Resolution = 0;
+
+	// The watchdog timer must be set regularly, otherwise the UEFI firmware
+	// considers the bootloader stalled and resets the system. With a default
+	// watchdog period of 5 mins (per UEFI specs), this leaves plenty of margin.
+	if (++Housekeeping.Ticks >= WATCHDOG_RESETTICKS) {
+		gBS->SetWatchdogTimer(300, 0x11D5, 0, NULL);
+		Housekeeping.Ticks = 0;
+	}
+	// Check for user cancel (keypress)
+	if (gST->BootServices->CheckEvent(gST->ConIn->WaitForKey) != EFI_NOT_READY)
+		Housekeeping.Cancelled = TRUE;
+	if (gPauseAfterRead != 0) {
+		if (Now == 0) {
+			Now = GetRtcTime();
+			Window = PAUSE_RTC_TICKS;
+			Resolution = 1000000;
+		}
+		if (++Housekeeping.WindowTicks >= Window) {
+			ReadTime = Housekeeping.ReadTime;
+			// A window that spans midnight is ignored
+			if (Now != 0 && Housekeeping.WindowStart != 0 && Now >= Housekeeping.WindowStart) {
+				Elapsed = Now - Housekeeping.WindowStart;
+				Elapsed -= MIN(Elapsed, ReadTime - Housekeeping.WindowReadTime);
+				if (Elapsed > Window * HOUSEKEEPING_INTERVAL + INPUT_LAG_MAX + Resolution) {
+					// Back off, if the pause after each read doesn't let the firmware breathe
+					gPauseAfterRead = MIN(2 * gPauseAfterRead, PAUSE_AFTER_READ_MAX);
+					Housekeeping.OnTimeTicks = 0;
+				} else if ((Housekeeping.OnTimeTicks += Window) >= PAUSE_DECAY_TICKS) {
+					// And come back down, once it has been breathing for a while
+					gPauseAfterRead = MAX(gPauseAfterRead / 2, PAUSE_AFTER_READ_MIN);
+					Housekeeping.OnTimeTicks = 0;
+				}
+			}
+			Housekeeping.WindowStart = Now;
+			Housekeeping.WindowReadTime = ReadTime;
+			Housekeeping.WindowTicks = 0;
+		}
+	}
+	SignalFrame(TRUE);
+}
+
+/**
+  Start the timer that performs the housekeeping during verification. This
+  must be called after the keyboard input has been flushed.
+
+  @retval EFI_SUCCESS           The timer was started.
+  @retval other                 The timer could not be started, in which case
+                                UpdateHashProgress() performs the housekeeping.
+**/
+EFI_STATUS InitHousekeeping(VOID)
+{
+	EFI_STATUS Status;
+
+	ExitHousekeeping();
+	Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+		HousekeepingNotify, NULL, &Housekeeping.Event);
+	if (EFI_ERROR(Status)) {
+		Housekeeping.Event = NULL;
+		return Status;
+	}
+	Status = gBS->SetTimer(Housekeeping.Event, TimerPeriodic, HOUSEKEEPING_INTERVAL * 10ULL);
+	if (EFI_ERROR(Status)) {
+		ExitHousekeeping();
+		return Status;
+	}
+	gBS->SetWatchdogTimer(300, 0x11D5, 0, NULL);
+	// Start with the smallest pause, unless we have no clock to tell if the firmware lags behind
+	if (gPauseAfterRead != 0 && (GetTimestamp() != 0 || GetRtcTime() != 0))
+		gPauseAfterRead = PAUSE_AFTER_READ_MIN;
+	return EFI_SUCCESS;
+}
+
+/**
+  Stop the housekeeping timer.
+**/
+VOID ExitHousekeeping(VOID)
+{
+	if (Housekeeping.Event != NULL) {
+		gBS->SetTimer(Housekeeping.Event, TimerCancel, 0);
+		gBS->CloseEvent(Housekeeping.Event);
+		SignalFrame(FALSE);
+	}
+	ZeroMem(&Housekeeping, sizeof(Housekeeping));
+}
+
+/**
+  Perform the housekeeping that needs to occur after each file read, i.e.
+  update the progress, and, if the housekeeping timer isn't running, reset
+  the watchdog and check for user cancellation.
+
+  @param[in]   Size             The size of the data that was read.
+  @param[in]   Progress         (Optional) A pointer to a PROGRESS_DATA structure.
+
+  @retval EFI_SUCCESS           The operation can carry on.
   @retval EFI_ABORTED           User cancelled the operation.
 **/
-EFI_STATUS HashFile(
-	IN CONST EFI_FILE_HANDLE Root,
-	IN CONST CHAR16* Path,
+EFI_STATUS UpdateHashProgress(
+	IN CONST UINTN Size,
+	OPTIONAL IN PROGRESS_DATA* Progress
+)
+{
+	STATIC UINT64 BytesSinceReset = WATCHDOG_RESETSIZE;
+	UINT64 StatsStart;
+
+	// Update the progress data (if byte type)
+	if (Progress != NULL && Progress->Type == PROGRESS_TYPE_BYTE) {
+		StatsStart = STATS_TIMESTAMP();
+		Progress->Current += Size;
+		UpdateProgress(Progress);
+		STATS_ADD(STATS_PROGRESS, StatsStart, 0);
+	}
+	if (Housekeeping.Event != NULL)
+		return Housekeeping.Cancelled ? EFI_ABORTED : EFI_SUCCESS;
+	// Do this every WATCHDOG_RESETSIZE bytes processed, as it should
+	// accomodate even very slow systems (see HousekeepingNotify()).
+	// Since the read size may vary, we count bytes rather than calls.
+	if (BytesSinceReset >= WATCHDOG_RESETSIZE) {
+		gBS->SetWatchdogTimer(300, 0x11D5, 0, NULL);
+		BytesSinceReset = 0;
+	}
+	BytesSinceReset += Size;
+	// Check for user cancel (keypress)
+	if (gST->BootServices->CheckEvent(gST->ConIn->WaitForKey) != EFI_NOT_READY)
+		return EFI_ABORTED;
+	return EFI_SUCCESS;
+}
+
+/**
+  Hash a block of data that was read from a file and perform the housekeeping
+  that needs to occur after each read.
+
+  @param[in]   Algorithm        A pointer to the HASH_ALGORITHM to use.
+  @param[in]   Context          A pointer to the hash context to update, or NULL
+                                to update the firmware hash engine computation.
+  @param[in]   Buffer           A pointer to the data that was read.
+  @param[in]   Size             The size of the data that was read.
+  @param[in]   Progress         (Optional) A pointer to a PROGRESS_DATA structure.
+
+  @retval EFI_SUCCESS           The data was successfully hashed.
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval other                 The firmware hash engine reported an error.
+**/
+STATIC EFI_STATUS HashBuffer(
+	IN CONST HASH_ALGORITHM* Algorithm,
+	IN HASH_CONTEXT* Context,
+	IN CONST UINT8* Buffer,
+	IN CONST UINTN Size,
+	OPTIONAL IN PROGRESS_DATA* Progress
+)
+{
+	EFI_STATUS Status;
+	UINT64 StatsStart = STATS_TIMESTAMP();
+
+	if (Context == NULL) {
+		Status = Hash2Update(Buffer, Size);
+		if (EFI_ERROR(Status))
+			return Status;
+	} else {
+		Algorithm->Write(Context, Buffer, Size);
+	}
+	STATS_ADD(STATS_HASH, StatsStart, Size);
+	return UpdateHashProgress(Size, Progress);
+}
+
+/**
+  Hash the content of a file using synchronous reads.
+
+  @param[in]   File             A handle to the file to hash.
+  @param[in]   Algorithm        A pointer to the HASH_ALGORITHM to use.
+  @param[in]   Context          A pointer to the hash context to update (see HashBuffer()).
+  @param[in]   Length           The number of bytes to read and hash.
+  @param[in]   Progress         (Optional) A pointer to a PROGRESS_DATA structure.
+  @param[out]  ReadBytes        A pointer to receive the number of bytes read.
+
+  @retval EFI_SUCCESS           The data was read up to Length or EOF, and hashed.
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval other                 A read error occurred.
+**/
+STATIC EFI_STATUS HashFileSync(
+	IN CONST EFI_FILE_HANDLE File,
+	IN CONST HASH_ALGORITHM* Algorithm,
+	IN HASH_CONTEXT* Context,
+	IN CONST UINT64 Length,
 	OPTIONAL IN PROGRESS_DATA* Progress,
-	OUT UINT8* Hash
+	OUT UINT64* ReadBytes
 )
 {
-	STATIC UINTN LastWatchDogReset = 0;
-	EFI_STATUS Status = EFI_INVALID_PARAMETER;
-	EFI_FILE_HANDLE File = NULL;
-	EFI_FILE_INFO* Info = NULL;
-	HASH_CONTEXT Context = { 0 };
-	UINTN Size, ReadSize;
-	UINT64 ReadBytes;
-	UINT8* Buffer = NULL;
-	CHAR16 DisplayPath[PATH_MAX], *StrSize;
+	EFI_STATUS Status;
+	UINTN ReadSize;
+	UINT8* Buffer;
+	UINT64 Time, LastTime = GetTimestamp(), ReadStart, StatsStart;
+
+	for (*ReadBytes = 0; *ReadBytes < Length; *ReadBytes += ReadSize) {
+		Buffer = GetIoBuffer(0, &ReadSize);
+		ReadSize = (UINTN)MIN(ReadSize, Length - *ReadBytes);
+		StatsStart = STATS_TIMESTAMP();
+		ReadStart = GetPacedReadStart();
+		Status = File->Read(File, &ReadSize, Buffer);
+		STATS_ADD(STATS_READ, StatsStart, EFI_ERROR(Status) ? 0 : ReadSize);
+		// Early AMI UEFI v2.0 firmwares, such as the ones found in Dell
+		// Optiplex 390s, are unable to process USB keyboard input when
+		// the USB bus is simultaneously used to read data at high speed.
+		// So we pause these systems, to give them enough time to "breathe"
+		// and process USB keyboard cancellation, for as long as the
+		// housekeeping timer shows that they need to (see Housekeeping).
+		PauseAfterRead(ReadStart);
+		if (EFI_ERROR(Status))
+			return Status;
+		if (ReadSize == 0)
+			return EFI_SUCCESS;
+		Status = HashBuffer(Algorithm, Context, Buffer, ReadSize, Progress);
+		if (EFI_ERROR(Status))
+			return Status;
+		Time = GetTimestamp();
+		UpdateIoThroughput(ReadSize, Time - LastTime);
+		LastTime = Time;
+	}
+	return EFI_SUCCESS;
+}
 
-	if ((Root == NULL) || (Path == NULL) || (Hash == NULL))
+/**
+  Hash the content of a file using a ring of asynchronous reads, so that the
+  next chunk(s) of data can be in flight while the current one is hashed.
+  This requires a revision 2 EFI_FILE_PROTOCOL, that provides ReadEx().
+
+  @param[in]   File             A handle to the file to hash.
+  @param[in]   Algorithm        A pointer to the HASH_ALGORITHM to use.
+  @param[in]   Context          A pointer to the hash context to update (see HashBuffer()).
+  @param[in]   NumBuffers       The number of buffers to use (between 1 and READ_BUFFERCOUNT).
+  @param[in]   Length           The number of bytes to read and hash.
+  @param[in]   Progress         (Optional) A pointer to a PROGRESS_DATA structure.
+  @param[out]  ReadBytes        A pointer to receive the number of bytes read.
+
+  @retval EFI_SUCCESS           The data was read up to Length or EOF, and hashed.
+  @retval EFI_UNSUPPORTED       Asynchronous reads are not supported for this file, or
+                                the first one could not be queued. No data was read, so
+                                the caller can fall back to synchronous reads.
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval other                 A read error occurred.
+**/
+STATIC EFI_STATUS HashFileAsync(
+	IN CONST EFI_FILE_HANDLE File,
+	IN CONST HASH_ALGORITHM* Algorithm,
+	IN HASH_CONTEXT* Context,
+	IN CONST UINTN NumBuffers,
+	IN CONST UINT64 Length,
+	OPTIONAL IN PROGRESS_DATA* Progress,
+	OUT UINT64* ReadBytes
+)
+{
+	EFI_STATUS Status = EFI_UNSUPPORTED;
+	EFI_FILE_IO_TOKEN Token[READ_BUFFERCOUNT] = { 0 };
+	BOOLEAN Pending[READ_BUFFERCOUNT] = { 0 };
+	UINTN i, Index, ChunkSize, Depth = 0, NumPending = 0, Requested[READ_BUFFERCOUNT];
+	UINT64 Queued = 0, Time, LastTime, StatsStart;
+
+	V_ASSERT(NumBuffers >= 1 && NumBuffers <= READ_BUFFERCOUNT);
+	*ReadBytes = 0;
+
+	if (File->Revision < EFI_FILE_PROTOCOL_REVISION2)
+		return EFI_UNSUPPORTED;
+
+	for (i = 0; i < NumBuffers; i++) {
+		if (EFI_ERROR(gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &Token[i].Event)))
+			goto out;
+	}
+
+	// Nothing to read, so let the caller use the synchronous path
+	if (Length == 0)
 		goto out;
 
-	Buffer = AllocatePool(READ_BUFFERSIZE);
-	if (Buffer == NULL) {
-		Status = EFI_OUT_OF_RESOURCES;
+	// Fill the ring. If the driver refuses some of the extra requests, just
+	// proceed with whatever depth it accepted.
+	for (Depth = 0; Depth < NumBuffers && Queued < Length; Depth++) {
+		Token[Depth].Buffer = GetIoBuffer(Depth, &ChunkSize);
+		Token[Depth].BufferSize = (UINTN)MIN(ChunkSize, Length - Queued);
+		Requested[Depth] = Token[Depth].BufferSize;
+		Status = File->ReadEx(File, &Token[Depth]);
+		if (EFI_ERROR(Status))
+			break;
+		Queued += Requested[Depth];
+		Pending[Depth] = TRUE;
+		NumPending++;
+	}
+	if (Depth == 0)
 		goto out;
+	LastTime = GetTimestamp();
+
+	// Requests complete in the order they were queued, since the
+	// driver updates the file position when the request is issued.
+	for (i = 0; NumPending != 0; i = (i + 1) % Depth) {
+		if (!Pending[i])
+			continue;
+		StatsStart = STATS_TIMESTAMP();
+		Status = gBS->WaitForEvent(1, &Token[i].Event, &Index);
+		if (EFI_ERROR(Status))
+			goto out;
+		STATS_ADD(STATS_READ, StatsStart, EFI_ERROR(Token[i].Status) ? 0 : Token[i].BufferSize);
+		Pending[i] = FALSE;
+		NumPending--;
+		// See HashFileSync() for the reason behind this pause
+		PauseAfterRead(0);
+		Status = Token[i].Status;
+		if (EFI_ERROR(Status))
+			goto out;
+		if (Token[i].BufferSize == 0)
+			break;
+		*ReadBytes += Token[i].BufferSize;
+		// Account for short reads, so that we read the remainder afterwards
+		Queued -= Requested[i] - Token[i].BufferSize;
+		Status = HashBuffer(Algorithm, Context, Token[i].Buffer, Token[i].BufferSize, Progress);
+		if (EFI_ERROR(Status))
+			goto out;
+		Time = GetTimestamp();
+		UpdateIoThroughput(Token[i].BufferSize, Time - LastTime);
+		LastTime = Time;
+		// Queue the next read into the buffer we just processed, with the
+		// read size that the I/O buffer pool currently wants us to use.
+		if (Queued >= Length)
+			continue;
+		GetIoBuffer(i, &ChunkSize);
+		Token[i].BufferSize = (UINTN)MIN(ChunkSize, Length - Queued);
+		Requested[i] = Token[i].BufferSize;
+		Status = File->ReadEx(File, &Token[i]);
+		if (EFI_ERROR(Status))
+			goto out;
+		Queued += Requested[i];
+		Pending[i] = TRUE;
+		NumPending++;
+	}
+
+out:
+	// We must not release the buffers while the driver may still write to them
+	for (i = 0; i < NumBuffers; i++) {
+		if (Pending[i])
+			gBS->WaitForEvent(1, &Token[i].Event, &Index);
+		if (Token[i].Event != NULL)
+			gBS->CloseEvent(Token[i].Event);
+	}
+	// Let the caller fall back to synchronous reads if no read could be queued,
+	// whatever the reason the driver gave, but not once data was consumed
+	if (Depth == 0)
+		Status = EFI_UNSUPPORTED;
+	else if (Status == EFI_UNSUPPORTED)
+		Status = EFI_DEVICE_ERROR;
+	return Status;
+}
+
+/* Cache of the directories that files to hash were opened from, so that
+ * the file system driver doesn't have to walk the whole path every time */
+STATIC struct {
+	EFI_FILE_HANDLE Root;
+	EFI_FILE_HANDLE Handle;
+	UINTN           LastUse;
+	CHAR16          Path[PATH_MAX + 1];
+} DirCache[DIR_CACHE_SIZE] = { 0 };
+STATIC UINTN DirCacheUse = 0;
+
+/**
+  Open the parent directory of a file, or get it from the directory cache.
+  If the directory is not cached, the least recently used entry is evicted.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   Path             A pointer to the CHAR16 string with the path of the directory.
+  @param[in]   Length           The length of the directory path.
+  @param[out]  Directory        A pointer to receive the cached handle of the directory.
+
+  @retval EFI_SUCCESS           The directory handle was retrieved.
+  @retval other                 The directory could not be opened.
+**/
+STATIC EFI_STATUS OpenParentDirectory(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST CHAR16* Path,
+	IN CONST UINTN Length,
+	OUT EFI_FILE_HANDLE* Directory
+)
+{
+	EFI_STATUS Status;
+	UINTN i, Lru = 0;
+
+	V_ASSERT(Length < ARRAY_SIZE(DirCache[0].Path));
+
+	for (i = 0; i < DIR_CACHE_SIZE; i++) {
+		if (DirCache[i].Handle != NULL && DirCache[i].Root == Root &&
+			StrnCmp(DirCache[i].Path, Path, Length) == 0 && DirCache[i].Path[Length] == L'\0') {
+			DirCache[i].LastUse = ++DirCacheUse;
+			*Directory = DirCache[i].Handle;
+			return EFI_SUCCESS;
+		}
+		// Unused entries have a LastUse of 0, so they get picked first
+		if (DirCache[i].LastUse < DirCache[Lru].LastUse)
+			Lru = i;
+	}
+
+	if (DirCache[Lru].Handle != NULL)
+		DirCache[Lru].Handle->Close(DirCache[Lru].Handle);
+	ZeroMem(&DirCache[Lru], sizeof(DirCache[Lru]));
+	CopyMem(DirCache[Lru].Path, Path, Length * sizeof(CHAR16));
+	Status = Root->Open(Root, &DirCache[Lru].Handle, DirCache[Lru].Path,
+		EFI_FILE_MODE_READ, 0);
+	if (EFI_ERROR(Status)) {
+		ZeroMem(&DirCache[Lru], sizeof(DirCache[Lru]));
+		return Status;
+	}
+	DirCache[Lru].Root = Root;
+	DirCache[Lru].LastUse = ++DirCacheUse;
+	*Directory = DirCache[Lru].Handle;
+	return EFI_SUCCESS;
+}
+
+/**
+  Close all the directory handles from the directory cache.
+**/
+VOID FlushDirectoryCache(VOID)
+{
+	UINTN i;
+
+	for (i = 0; i < DIR_CACHE_SIZE; i++) {
+		if (DirCache[i].Handle != NULL)
+			DirCache[i].Handle->Close(DirCache[i].Handle);
 	}
+	ZeroMem(DirCache, sizeof(DirCache));
+	DirCacheUse = 0;
+}
 
-	ZeroMem(Hash, MD5_HASHSIZE);
+/**
+  Open a file that is to be hashed and validate that it is not a directory.
 
-	// Open the target
-	Status = Root->Open(Root, &File, (CHAR16*)Path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   Path             A pointer to the CHAR16 string with the target path.
+  @param[out]  File             A pointer to receive the handle of the opened file.
+  @param[out]  FileSize         A pointer to receive the size of the file.
+
+  @retval EFI_SUCCESS           The file was successfully opened.
+  @retval EFI_INVALID_PARAMETER The path points to a directory.
+  @retval EFI_NOT_FOUND         The target file could not be found on the media.
+**/
+EFI_STATUS OpenFileToHash(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST CHAR16* Path,
+	OUT EFI_FILE_HANDLE* File,
+	OUT UINT64* FileSize
+)
+{
+	EFI_STATUS Status = EFI_NOT_FOUND;
+	EFI_FILE_INFO* Info = GetIoFileInfo();
+	EFI_FILE_HANDLE Directory;
+	UINTN i, Size, Separator = 0;
+	UINT64 StatsStart = STATS_TIMESTAMP();
+
+	// Read the file straight from the disk if we can, else use the file system
+	if (OpenRawFile(Path, File, FileSize) == EFI_SUCCESS) {
+		STATS_ADD(STATS_OPEN, StatsStart, 0);
+		return EFI_SUCCESS;
+	}
+
+	// Open the target relative to its parent directory, if it has one
+	for (i = 0; Path[i] != L'\0'; i++) {
+		if (Path[i] == L'\\')
+			Separator = i;
+	}
+	if (Separator != 0 && Path[Separator + 1] != L'\0' &&
+		OpenParentDirectory(Root, Path, Separator, &Directory) == EFI_SUCCESS)
+		Status = Directory->Open(Directory, File, (CHAR16*)&Path[Separator + 1],
+			EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+	// Fall back to the full path, so that errors are the same as without the cache
 	if (EFI_ERROR(Status))
-		goto out;
+		Status = Root->Open(Root, File, (CHAR16*)Path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+	STATS_ADD(STATS_OPEN, StatsStart, 0);
+	if (EFI_ERROR(Status)) {
+		*File = NULL;
+		return Status;
+	}
 
 	// Validate that it's a file and not a directory
 	Size = FILE_INFO_SIZE;
-	Info = AllocateZeroPool(Size);
-	if (Info == NULL) {
-		Status = EFI_OUT_OF_RESOURCES;
-		goto out;
-	}
-	Status = File->GetInfo(File, &gEfiFileInfoGuid, &Size, Info);
+	StatsStart = STATS_TIMESTAMP();
+	Status = (*File)->GetInfo(*File, &gEfiFileInfoGuid, &Size, Info);
+	STATS_ADD(STATS_GETINFO, StatsStart, 0);
 	if (EFI_ERROR(Status))
 		goto out;
 
@@ -321,72 +1016,971 @@ EFI_STATUS HashFile(
 		Status = EFI_INVALID_PARAMETER;
 		goto out;
 	}
+	*FileSize = Info->FileSize;
 
-	// Print the file we are currently processing, along with its size
-	V_ASSERT(ARRAY_SIZE(DisplayPath) > gConsole.Cols);
-	StrSize = SizeToHumanReadable(Info->FileSize);
-	// We could do without this assert since StrSize is at most 32 and
-	// gConsole.Cols at least COLS_MIN (>32) but in case someone worries...
-	V_ASSERT(gConsole.Cols > SafeStrLen(StrSize) - 1);
-	SafeStrCpy(DisplayPath, ARRAY_SIZE(DisplayPath), Path);
-	// The following unconditionally truncates the path to what's needed
-	// to append the size in case it's too long to fit on one line.
-	DisplayPath[gConsole.Cols - SafeStrLen(StrSize) - 1] = 0;
-	SafeStrCat(DisplayPath, ARRAY_SIZE(DisplayPath), StrSize);
-	PrintCentered(DisplayPath, gConsole.Rows / 2 - 1);
-
-	// Compute the MD5 Hash
-	Md5Init(&Context);
-	for (ReadBytes = 0; ; ReadBytes += ReadSize) {
-		ReadSize = READ_BUFFERSIZE;
-		Status = File->Read(File, &ReadSize, Buffer);
-		// Early AMI UEFI v2.0 firmwares, such as the ones found in Dell
-		// Optiplex 390s, are unable to process USB keyboard input when
-		// the USB bus is simultaneously used to read data at high speed.
-		// So we pause these systems, to give them enough time to "breathe"
-		// and process USB keyboard cancellation.
-		if (gPauseAfterRead != 0)
-			Sleep(gPauseAfterRead);
+out:
+	if (EFI_ERROR(Status)) {
+		(*File)->Close(*File);
+		*File = NULL;
+	}
+	return Status;
+}
+
+/**
+  Compute the hash of the data referenced by a hashing task, i.e. a whole
+  file or a single chunk of it.
+
+  @param[in]   Task             A pointer to the HASH_TASK to process.
+  @param[in]   Progress         (Optional) A pointer to a PROGRESS_DATA structure. If provided then
+                                the current progress value will be updated by this call.
+  @param[out]  Hash             A pointer to the HASH_SIZE_MAX array that is to receive the hash.
+  @param[out]  ReadBytes        A pointer to receive the number of bytes that were hashed.
+
+  @retval EFI_SUCCESS           The data was successfully processed and the hash has been populated.
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval other                 A read error occurred.
+**/
+EFI_STATUS HashFile(
+	IN CONST HASH_TASK* Task,
+	OPTIONAL IN PROGRESS_DATA* Progress,
+	OUT UINT8* Hash,
+	OUT UINT64* ReadBytes
+)
+{
+	EFI_STATUS Status, FinishStatus;
+	HASH_CONTEXT Context;
+	HASH_CONTEXT* UseContext = &Context;
+	UINTN NumBuffers = 1, ChunkSize;
+
+	ZeroMem(Hash, HASH_SIZE_MAX);
+	*ReadBytes = 0;
+
+	// Only use as many asynchronous read buffers as the length warrants
+	GetIoBuffer(0, &ChunkSize);
+	if (Task->File->Revision >= EFI_FILE_PROTOCOL_REVISION2)
+		NumBuffers = (UINTN)MIN(Task->Length / ChunkSize + 1, READ_BUFFERCOUNT);
+
+	// Hand the data over to the firmware hash engine, if it was found to be faster
+	if (IsHash2Selected(Task->Algorithm)) {
+		Status = Hash2Start();
 		if (EFI_ERROR(Status))
-			goto out;
-		if (ReadSize == 0)
-			break;
-		Md5Write(&Context, Buffer, ReadSize);
-		// Update the progress data (if byte type)
-		if (Progress != NULL && Progress->Type == PROGRESS_TYPE_BYTE) {
-			Progress->Current += ReadSize;
+			return Status;
+		UseContext = NULL;
+	} else {
+		Task->Algorithm->Init(&Context);
+	}
+
+	// Compute the hash, straight from the I/O pool for small files that were
+	// prefetched, else using asynchronous reads if the driver supports them,
+	// so that the media isn't idle while we hash.
+	if (Task->Data != NULL) {
+		Status = HashBuffer(Task->Algorithm, UseContext, Task->Data, (UINTN)Task->Length, Progress);
+		if (!EFI_ERROR(Status))
+			*ReadBytes = Task->Length;
+	} else {
+		Status = HashFileAsync(Task->File, Task->Algorithm, UseContext, NumBuffers,
+			Task->Length, Progress, ReadBytes);
+		if (Status == EFI_UNSUPPORTED)
+			Status = HashFileSync(Task->File, Task->Algorithm, UseContext,
+				Task->Length, Progress, ReadBytes);
+	}
+	if (UseContext == NULL) {
+		// The firmware computation must be terminated, even on error
+		FinishStatus = Hash2Finish(EFI_ERROR(Status) ? NULL : Hash);
+		if (!EFI_ERROR(Status))
+			Status = FinishStatus;
+	} else if (!EFI_ERROR(Status)) {
+		Task->Algorithm->Final(&Context);
+		CopyMem(Hash, Context.Buffer, Task->Algorithm->HashSize);
+	}
+
+	return Status;
+}
+
+/**
+  Decode a hash list entry and open the file it references.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST the entry belongs to.
+  @param[in]   Entry            A pointer to the HASH_ENTRY to process.
+  @param[out]  Result           A pointer to the HASH_RESULT for this entry. If the file
+                                can't be opened, the result is completed by this call.
+  @param[out]  File             A pointer to receive the handle of the opened file.
+
+  @retval EFI_SUCCESS           The file was successfully opened.
+  @retval other                 The entry could not be decoded or its file opened.
+**/
+STATIC EFI_STATUS OpenHashResult(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN CONST HASH_ENTRY* Entry,
+	OUT HASH_RESULT* Result,
+	OUT EFI_FILE_HANDLE* File
+)
+{
+	UINT64 StatsStart = STATS_TIMESTAMP();
+
+	ZeroMem(Result, sizeof(HASH_RESULT));
+	Result->FailedOffset = HASH_OFFSET_NONE;
+	*File = NULL;
+	CopyMem(Result->ExpectedHash, GetEntryHash(List->Buffer, Entry), List->Algorithm->HashSize);
+	Result->Status = DecodeHashEntry(List, Entry, Result->Path, ARRAY_SIZE(Result->Path));
+	if (!EFI_ERROR(Result->Status))
+		Result->Status = OpenFileToHash(GetEntryRoot(List, Entry, Root), Result->Path, File, &Result->Size);
+	// If the hash list provides the size of the file, we can fail without reading it
+	if (!EFI_ERROR(Result->Status) && GetEntrySize(List, Entry) != HASH_SIZE_UNKNOWN &&
+		GetEntrySize(List, Entry) != Result->Size) {
+		(*File)->Close(*File);
+		*File = NULL;
+		Result->Status = EFI_BAD_BUFFER_SIZE;
+	}
+	if (EFI_ERROR(Result->Status)) {
+		Result->Done = TRUE;
+		return Result->Status;
+	}
+	Result->Opened = TRUE;
+	// The time it took to open the file is part of the time of the file, once it is started
+	Result->StatsStart = STATS_TIMESTAMP() - StatsStart;
+
+	// Files that span more than one chunk are verified per chunk, provided
+	// that the chunks cover the whole file. Else, they are hashed as a whole.
+	if (List->ChunkSize != 0 && Result->Size > List->ChunkSize &&
+		FindHashChunks(List, Entry, &Result->Chunks) &&
+		Result->Chunks.NumChunks != (Result->Size + List->ChunkSize - 1) / List->ChunkSize)
+		ZeroMem(&Result->Chunks, sizeof(HASH_CHUNKS));
+	return EFI_SUCCESS;
+}
+
+/*
+ * The fixed cost of opening a file dwarfs the cost of hashing it, when it is
+ * small. So the next SMALL_FILE_PREFETCH entries are opened ahead of the one
+ * that is started, and the small files among them are read in full, with
+ * a single read into their buffer from the I/O pool, which is asynchronous if
+ * the driver supports it. Since the buffers are indexed like the results
+ * window, they can't be reused until the entry that they belong to has been
+ * reported. The events of the asynchronous reads are created on first use.
+ */
+STATIC EFI_EVENT PrefetchEvent[HASH_RESULT_WINDOW] = { 0 };
+
+/**
+  Open the entries that follow the next one to start, and, for the ones that
+  are small files, read their content. Entries that can't be opened are
+  completed, but are only skipped by StartHashTask(), once it gets to them.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST being verified.
+  @param[in]   Results          A pointer to the HASH_RESULT_WINDOW entries window.
+  @param[in]   NextEntry        The index of the next entry that is yet to be started.
+  @param[in]   NextReport       The index of the next entry to report.
+**/
+STATIC VOID PrefetchEntries(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN HASH_RESULT* Results,
+	IN CONST UINTN NextEntry,
+	IN CONST UINTN NextReport
+)
+{
+	HASH_RESULT* Result;
+	EFI_FILE_HANDLE File;
+	UINTN i, Slot;
+	UINT64 ReadStart, StatsStart;
+
+	for (i = NextEntry; i < List->NumEntries && i < NextEntry + SMALL_FILE_PREFETCH &&
+		i - NextReport < HASH_RESULT_WINDOW; i++) {
+		Slot = i % HASH_RESULT_WINDOW;
+		Result = &Results[Slot];
+		if (Result->Prefetched)
+			continue;
+		OpenHashResult(Root, List, &List->Entry[i], Result, &Result->File);
+		Result->Prefetched = TRUE;
+		File = Result->File;
+		if (Result->Done || Result->Chunks.NumChunks != 0 || Result->Size == 0 ||
+			Result->Size > SMALL_FILE_MAX)
+			continue;
+
+		Result->Token.Buffer = GetIoSmallFileBuffer(Slot);
+		Result->Token.BufferSize = (UINTN)Result->Size;
+		if (File->Revision >= EFI_FILE_PROTOCOL_REVISION2 && (PrefetchEvent[Slot] != NULL ||
+			!EFI_ERROR(gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &PrefetchEvent[Slot])))) {
+			Result->Token.Event = PrefetchEvent[Slot];
+			if (!EFI_ERROR(File->ReadEx(File, &Result->Token))) {
+				Result->ReadPending = TRUE;
+				continue;
+			}
+			Result->Token.BufferSize = (UINTN)Result->Size;
+		}
+		Result->Token.Event = NULL;
+		StatsStart = STATS_TIMESTAMP();
+		ReadStart = GetPacedReadStart();
+		Result->Token.Status = File->Read(File, &Result->Token.BufferSize, Result->Token.Buffer);
+		STATS_ADD(STATS_READ, StatsStart, EFI_ERROR(Result->Token.Status) ? 0 : Result->Token.BufferSize);
+		// See HashFileSync() for the rationale behind this
+		PauseAfterRead(ReadStart);
+	}
+}
+
+/**
+  Get the content of an entry that was prefetched, once its read has completed.
+  If the read was short, the file is rewound, so that it can be read normally.
+
+  @param[in]   Result           A pointer to the HASH_RESULT of the prefetched entry.
+  @param[out]  Data             A pointer to receive the content of the file, or NULL
+                                if the file is to be read normally.
+
+  @retval EFI_SUCCESS           The content, or the file, can be hashed.
+  @retval other                 A read error occurred.
+**/
+STATIC EFI_STATUS GetPrefetchedData(
+	IN HASH_RESULT* Result,
+	OUT CONST UINT8** Data
+)
+{
+	UINTN Index;
+	UINT64 StatsStart;
+
+	*Data = NULL;
+	if (Result->Token.Buffer == NULL)
+		return EFI_SUCCESS;
+	if (Result->ReadPending) {
+		StatsStart = STATS_TIMESTAMP();
+		gBS->WaitForEvent(1, &Result->Token.Event, &Index);
+		STATS_ADD(STATS_READ, StatsStart, EFI_ERROR(Result->Token.Status) ? 0 : Result->Token.BufferSize);
+		Result->ReadPending = FALSE;
+		PauseAfterRead(0);
+	}
+	if (EFI_ERROR(Result->Token.Status))
+		return Result->Token.Status;
+	if (Result->Token.BufferSize == Result->Size) {
+		*Data = Result->Token.Buffer;
+		return EFI_SUCCESS;
+	}
+	// Don't assume that a short read means that the file is truncated
+	return Result->File->SetPosition(Result->File, 0);
+}
+
+/**
+  Start the next hashing task, which is the next chunk of the last entry that was
+  started, if that entry is verified per chunk and has no failed chunk, or else
+  the next entry of the hash list (as long as there's room in the results window).
+  Entries that can't be opened are completed straight away and skipped.
+
+  @param[in]     Root           A file handle to the root directory.
+  @param[in]     List           A pointer to the HASH_LIST being verified.
+  @param[in]     Results        A pointer to the HASH_RESULT_WINDOW entries window.
+  @param[in,out] NextEntry      A pointer to the index of the next entry that is yet to be started.
+  @param[in]     NextReport     The index of the next entry to report.
+  @param[out]    Task           A pointer to the HASH_TASK to populate.
+
+  @retval EFI_SUCCESS           A new task was started.
+  @retval EFI_NOT_FOUND         There is no task that can be started at this stage.
+**/
+EFI_STATUS StartHashTask(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN HASH_RESULT* Results,
+	IN OUT UINTN* NextEntry,
+	IN CONST UINTN NextReport,
+	OUT HASH_TASK* Task
+)
+{
+	EFI_STATUS Status;
+	HASH_RESULT* Result;
+	CHAR16 DisplayPath[PATH_MAX];
+	UINT64 Offset, Size;
+
+	// Parse more of a streamed hash list, so that we never run out of entries
+	while (IsStreamingList() && *NextEntry + HASH_RESULT_WINDOW > List->NumEntries)
+		ParseNextEntries();
+
+	for (;;) {
+		ZeroMem(Task, sizeof(HASH_TASK));
+		Task->Algorithm = List->Algorithm;
+
+		// Carry on with the chunks of the last entry, unless one of them failed
+		Result = (*NextEntry > NextReport) ? &Results[(*NextEntry - 1) % HASH_RESULT_WINDOW] : NULL;
+		if (Result != NULL && Result->Chunks.NumChunks != 0 &&
+			Result->NextChunk < Result->Chunks.NumChunks && !EFI_ERROR(Result->Status)) {
+			Task->Entry = *NextEntry - 1;
+			Task->Chunk = Result->NextChunk++;
+			Offset = Task->Chunk * Result->Chunks.ChunkSize;
+			Task->Length = MIN(Result->Chunks.ChunkSize, Result->Size - Offset);
+			Result->PendingChunks++;
+			// Each chunk uses its own handle, since chunks may be read concurrently
+			Status = OpenRawFile(Result->Path, &Task->File, &Size);
+			if (EFI_ERROR(Status))
+				Status = Root->Open(Root, &Task->File, Result->Path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+			if (EFI_ERROR(Status)) {
+				Task->File = NULL;
+			} else {
+				Status = Task->File->SetPosition(Task->File, Offset);
+				if (!EFI_ERROR(Status))
+					return EFI_SUCCESS;
+			}
+			CompleteHashTask(Results, Task, Status, 0, NULL);
+			continue;
+		}
+
+		// Else start the next entry, as long as there's room in the window
+		if (*NextEntry >= List->NumEntries || *NextEntry - NextReport >= HASH_RESULT_WINDOW)
+			return EFI_NOT_FOUND;
+		PrefetchEntries(Root, List, Results, *NextEntry, NextReport);
+		Result = &Results[*NextEntry % HASH_RESULT_WINDOW];
+		Task->Entry = (*NextEntry)++;
+		Result->Prefetched = FALSE;
+		if (Result->Done)
+			continue;
+		// The file was opened ahead of time, so account for the time it took
+		Result->StatsStart = STATS_TIMESTAMP() - Result->StatsStart;
+		Status = GetPrefetchedData(Result, &Task->Data);
+		Task->File = Result->File;
+		Result->File = NULL;
+		if (EFI_ERROR(Status)) {
+			CompleteHashTask(Results, Task, Status, 0, NULL);
+			continue;
+		}
+		// In test mode, entries are printed when reported, to keep a consistent output
+		if (!gIsTestMode)
+			PrintFileEntry(GetDisplayPath(List, &List->Entry[Task->Entry], Result->Path,
+				DisplayPath, ARRAY_SIZE(DisplayPath)), Result->Size);
+		if (Result->Chunks.NumChunks == 0) {
+			Task->Length = Result->Size;
+		} else {
+			// The first chunk uses the handle we just opened
+			Task->Chunk = Result->NextChunk++;
+			Task->Length = Result->Chunks.ChunkSize;
+			Result->PendingChunks++;
+		}
+		return EFI_SUCCESS;
+	}
+}
+
+/**
+  Complete a hashing task, by closing its file, validating the amount of data
+  read, and comparing the computed hash against the expected one. The result of
+  an entry only becomes complete once all the chunks that were started for it
+  have been completed.
+
+  @param[in]   Results          A pointer to the HASH_RESULT_WINDOW entries window.
+  @param[in]   Task             A pointer to the HASH_TASK to complete.
+  @param[in]   Status           The status of the hash computation.
+  @param[in]   ReadBytes        The number of bytes that were hashed.
+  @param[in]   Hash             A pointer to the computed hash.
+**/
+VOID CompleteHashTask(
+	IN HASH_RESULT* Results,
+	IN HASH_TASK* Task,
+	IN CONST EFI_STATUS Status,
+	IN CONST UINT64 ReadBytes,
+	IN CONST UINT8* Hash
+)
+{
+	HASH_RESULT* Result = &Results[Task->Entry % HASH_RESULT_WINDOW];
+	EFI_STATUS TaskStatus = Status;
+	CONST UINT8* ExpectedHash;
+	UINT64 Offset;
+
+	if (Task->File != NULL) {
+		Task->File->Close(Task->File);
+		Task->File = NULL;
+	}
+
+	// Report an error if we did not read the expected amount of data, or if
+	// the hash doesn't match.
+	if (TaskStatus == EFI_SUCCESS) {
+		if (Result->Chunks.NumChunks == 0) {
+			if (ReadBytes != Result->Size) {
+				TaskStatus = EFI_END_OF_FILE;
+			} else {
+				Result->Hashed = TRUE;
+				STATS_ADD_FILE(Result->Path, Result->Size, Result->StatsStart);
+				if (CompareMem(Hash, Result->ExpectedHash, Task->Algorithm->HashSize) != 0)
+					TaskStatus = EFI_CRC_ERROR;
+			}
+		} else {
+			ExpectedHash = GetEntryHash(Result->Chunks.Buffer, &Result->Chunks.Entry[Task->Chunk]);
+			if (ReadBytes != Task->Length)
+				TaskStatus = EFI_END_OF_FILE;
+			else if (CompareMem(Hash, ExpectedHash, Task->Algorithm->HashSize) != 0)
+				TaskStatus = EFI_CRC_ERROR;
+		}
+	}
+
+	if (Result->Chunks.NumChunks == 0) {
+		Result->Status = TaskStatus;
+		Result->Done = TRUE;
+		return;
+	}
+
+	// User cancellation takes precedence. Else we report the first chunk that
+	// failed, which may not be the first one to complete.
+	Offset = Task->Chunk * Result->Chunks.ChunkSize;
+	Result->ReadBytes += ReadBytes;
+	if (TaskStatus == EFI_ABORTED) {
+		Result->Status = EFI_ABORTED;
+	} else if (EFI_ERROR(TaskStatus) && Result->Status != EFI_ABORTED &&
+		(!EFI_ERROR(Result->Status) || Offset < Result->FailedOffset)) {
+		Result->Status = TaskStatus;
+		Result->FailedOffset = Offset;
+	}
+	Result->PendingChunks--;
+	if (Result->PendingChunks == 0 &&
+		(EFI_ERROR(Result->Status) || Result->NextChunk >= Result->Chunks.NumChunks)) {
+		// A file that fails on a hash mismatch counts as processed, even if we
+		// stopped reading it early, as it would if it had been hashed as a whole.
+		Result->Hashed = (Result->Status == EFI_SUCCESS || Result->Status == EFI_CRC_ERROR);
+		Result->Done = TRUE;
+		if (Result->Hashed)
+			STATS_ADD_FILE(Result->Path, Result->Size, Result->StatsStart);
+	}
+}
+
+/**
+  Report the hash results that have been completed, in the order of the hash list.
+  Reporting stops at the first result that isn't completed, or that was aborted.
+  Failures are recorded instead of printed, if the list was reordered or merged.
+
+  @param[in]     List           A pointer to the HASH_LIST being verified.
+  @param[in]     Results        A pointer to the HASH_RESULT_WINDOW entries window.
+  @param[in,out] NextReport     A pointer to the index of the next entry to report.
+  @param[in]     NextEntry      The index of the next entry that is yet to be started.
+  @param[in]     Progress       A pointer to a PROGRESS_DATA structure.
+  @param[in,out] NumFailed      A pointer to the number of failed entries, to be updated.
+  @param[out]    LastStatus     A pointer to receive the status of the last reported entry.
+
+  @retval TRUE                  An aborted entry was encountered.
+  @retval FALSE                 Reporting can continue.
+**/
+BOOLEAN ReportHashResults(
+	IN CONST HASH_LIST* List,
+	IN HASH_RESULT* Results,
+	IN OUT UINTN* NextReport,
+	IN CONST UINTN NextEntry,
+	IN PROGRESS_DATA* Progress,
+	IN OUT UINTN* NumFailed,
+	OUT EFI_STATUS* LastStatus
+)
+{
+	HASH_RESULT* Result;
+	CONST CHAR16* Path;
+	CHAR16 DisplayPath[PATH_MAX];
+
+	while (*NextReport < NextEntry && Results[*NextReport % HASH_RESULT_WINDOW].Done) {
+		Result = &Results[*NextReport % HASH_RESULT_WINDOW];
+		if (Result->Status == EFI_ABORTED)
+			return TRUE;
+		Path = GetDisplayPath(List, &List->Entry[*NextReport], Result->Path,
+			DisplayPath, ARRAY_SIZE(DisplayPath));
+		if (gIsTestMode && Result->Opened)
+			PrintFileEntry(Path, Result->Size);
+		if (Result->Hashed) {
+			// Update the progress data, including for the chunks we skipped
+			if (Progress->Type == PROGRESS_TYPE_FILE)
+				Progress->Current++;
+			else if (Result->Chunks.NumChunks != 0)
+				Progress->Current += Result->Size - Result->ReadBytes;
 			UpdateProgress(Progress);
 		}
-		// The watchdog timer must be set regularly, otherwise the UEFI firmware
-		// considers the bootloader stalled and resets the system. Do this every
-		// WATCHDOG_RESETSIZE bytes processed, as, with a default watchdog period
-		// of 5 mins (per UEFI specs), it should accomodate even very slow systems.
-		if (LastWatchDogReset++ % (WATCHDOG_RESETSIZE / READ_BUFFERSIZE) == 0)
-			gBS->SetWatchdogTimer(300, 0x11D5, 0, NULL);
-		// Check for user cancel (keypress)
-		if (gST->BootServices->CheckEvent(gST->ConIn->WaitForKey) != EFI_NOT_READY) {
-			Status = EFI_ABORTED;
-			goto out;
+		if (EFI_ERROR(Result->Status)) {
+			if (List->Failure != NULL) {
+				List->Failure[*NumFailed].Entry = &List->Entry[*NextReport];
+				List->Failure[*NumFailed].Status = Result->Status;
+				List->Failure[*NumFailed].FailedOffset = Result->FailedOffset;
+			} else {
+				PrintFailedEntry(Result->Status, Path, Result->FailedOffset);
+			}
+			(*NumFailed)++;
 		}
+		*LastStatus = Result->Status;
+		Result->Done = FALSE;
+		(*NextReport)++;
 	}
-	// Report an error if we did not read the expected amount of data
-	if (ReadBytes != Info->FileSize) {
+	return FALSE;
+}
+
+/**
+  Queue the read of the next block of data of a hashing task. The read is
+  asynchronous if the driver supports it, else it completes straight away,
+  as it does for the content that was prefetched for small files. Reads of
+  the same task complete in the order they were queued.
+
+  @param[in]     Task           A pointer to the HASH_TASK to read from.
+  @param[in,out] Read           A pointer to the HASH_READ to queue, which must not be pending.
+  @param[out]    Buffer         A pointer to the buffer that receives the data.
+  @param[in]     Size           The number of bytes to read.
+**/
+VOID QueueHashTaskRead(
+	IN HASH_TASK* Task,
+	IN OUT HASH_READ* Read,
+	OUT UINT8* Buffer,
+	IN CONST UINTN Size
+)
+{
+	UINT64 ReadStart, StatsStart;
+
+	V_ASSERT(!Read->Pending);
+	Read->Token.Buffer = Buffer;
+	Read->Token.BufferSize = Size;
+	Read->Requested = Size;
+	if (Task->Data != NULL) {
+		Read->Token.BufferSize = (UINTN)MIN(Size, Task->Length - Task->DataPos);
+		CopyMem(Buffer, &Task->Data[Task->DataPos], Read->Token.BufferSize);
+		Task->DataPos += Read->Token.BufferSize;
+		Read->Token.Status = EFI_SUCCESS;
+		return;
+	}
+
+	// A read that the driver refuses to queue can still be performed synchronously,
+	// since the file position is only updated for the requests that are issued
+	if (Task->File->Revision >= EFI_FILE_PROTOCOL_REVISION2 && (Read->Token.Event != NULL ||
+		!EFI_ERROR(gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &Read->Token.Event)))) {
+		if (!EFI_ERROR(Task->File->ReadEx(Task->File, &Read->Token))) {
+			Read->Pending = TRUE;
+			return;
+		}
+		Read->Token.BufferSize = Size;
+	}
+	StatsStart = STATS_TIMESTAMP();
+	ReadStart = GetPacedReadStart();
+	Read->Token.Status = Task->File->Read(Task->File, &Read->Token.BufferSize, Buffer);
+	STATS_ADD(STATS_READ, StatsStart, EFI_ERROR(Read->Token.Status) ? 0 : Read->Token.BufferSize);
+	// See HashFileSync() for the rationale behind this
+	PauseAfterRead(ReadStart);
+}
+
+/**
+  Check whether a read that was queued by QueueHashTaskRead() has completed,
+  without waiting for it.
+
+  @param[in,out] Read           A pointer to the HASH_READ to check.
+
+  @retval TRUE                  The read has completed.
+  @retval FALSE                 The read is still in progress.
+**/
+BOOLEAN IsHashTaskReadDone(
+	IN OUT HASH_READ* Read
+)
+{
+	if (Read->Pending && gBS->CheckEvent(Read->Token.Event) == EFI_SUCCESS) {
+		STATS_ADD(STATS_READ, STATS_TIMESTAMP(), EFI_ERROR(Read->Token.Status) ? 0 : Read->Token.BufferSize);
+		Read->Pending = FALSE;
+		PauseAfterRead(0);
+	}
+	return !Read->Pending;
+}
+
+/**
+  Wait for a read that was queued by QueueHashTaskRead() to complete.
+
+  @param[in,out] Read           A pointer to the HASH_READ to wait for.
+  @param[out]    Size           A pointer to receive the number of bytes read.
+
+  @retval EFI_SUCCESS           The data was read.
+  @retval other                 A read error occurred.
+**/
+EFI_STATUS WaitHashTaskRead(
+	IN OUT HASH_READ* Read,
+	OUT UINTN* Size
+)
+{
+	UINTN Index;
+	UINT64 StatsStart;
+
+	if (Read->Pending) {
+		StatsStart = STATS_TIMESTAMP();
+		gBS->WaitForEvent(1, &Read->Token.Event, &Index);
+		STATS_ADD(STATS_READ, StatsStart, EFI_ERROR(Read->Token.Status) ? 0 : Read->Token.BufferSize);
+		Read->Pending = FALSE;
+		PauseAfterRead(0);
+	}
+	*Size = Read->Token.BufferSize;
+	return Read->Token.Status;
+}
+
+/**
+  Release a HASH_READ, once the read it may have in progress has completed.
+
+  @param[in,out] Read           A pointer to the HASH_READ to release.
+**/
+VOID CloseHashTaskRead(
+	IN OUT HASH_READ* Read
+)
+{
+	UINTN Index;
+
+	// We must not release the buffer while the driver may still write to it
+	if (Read->Pending)
+		gBS->WaitForEvent(1, &Read->Token.Event, &Index);
+	if (Read->Token.Event != NULL)
+		gBS->CloseEvent(Read->Token.Event);
+	ZeroMem(Read, sizeof(HASH_READ));
+}
+
+/**
+  Release a results window, along with the entries that were opened ahead of
+  time and that were not started.
+
+  @param[in]   Results          A pointer to the HASH_RESULT_WINDOW entries window.
+**/
+VOID ReleaseHashResults(
+	IN HASH_RESULT* Results
+)
+{
+	UINTN i, Index;
+
+	for (i = 0; i < HASH_RESULT_WINDOW; i++) {
+		// We must not release the buffers while the driver may still write to them
+		if (Results[i].ReadPending)
+			gBS->WaitForEvent(1, &Results[i].Token.Event, &Index);
+		if (Results[i].File != NULL)
+			Results[i].File->Close(Results[i].File);
+		if (PrefetchEvent[i] != NULL)
+			gBS->CloseEvent(PrefetchEvent[i]);
+		PrefetchEvent[i] = NULL;
+	}
+	SafeFree(Results);
+}
+
+/**
+  Verify all the entries from a hash list, one file or chunk at a time.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST to verify.
+  @param[in]   Progress         A pointer to a PROGRESS_DATA structure.
+  @param[out]  NumProcessed     A pointer to receive the number of entries processed.
+  @param[out]  NumFailed        A pointer to the number of failed entries, to be updated.
+
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval other                 The status of the last entry that was processed.
+**/
+EFI_STATUS VerifyList(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN PROGRESS_DATA* Progress,
+	OUT UINTN* NumProcessed,
+	IN OUT UINTN* NumFailed
+)
+{
+	EFI_STATUS Status, EntryStatus = EFI_SUCCESS;
+	HASH_RESULT* Results;
+	HASH_TASK Task;
+	UINT8 Hash[HASH_SIZE_MAX];
+	UINT64 ReadBytes;
+	BOOLEAN Cancelled = FALSE;
+	UINTN NextEntry = 0, NextReport = 0;
+
+	*NumProcessed = 0;
+
+	// Use a results window too, since chunked files span multiple tasks
+	Results = AllocateZeroPool(HASH_RESULT_WINDOW * sizeof(HASH_RESULT));
+	if (Results == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	while (!Cancelled && NextReport < List->NumEntries) {
+		if (StartHashTask(Root, List, Results, &NextEntry, NextReport, &Task) == EFI_SUCCESS) {
+			Status = HashFile(&Task, Progress, Hash, &ReadBytes);
+			CompleteHashTask(Results, &Task, Status, ReadBytes, Hash);
+		}
+		Cancelled = ReportHashResults(List, Results, &NextReport, NextEntry, Progress, NumFailed, &EntryStatus);
+	}
+
+	*NumProcessed = NextReport;
+	ReleaseHashResults(Results);
+	return Cancelled ? EFI_ABORTED : EntryStatus;
+}
+
+/**
+  Verify the first blocks of the boot partition against the hash from the
+  md5sum_partition directive of a hash list.
+
+  @param[in]   File             A handle to the partition, from OpenRawPartition(), that is closed by this call.
+  @param[in]   Size             The size of the partition data.
+  @param[in]   List             A pointer to the HASH_LIST with the expected hash.
+  @param[in]   Progress         A pointer to a PROGRESS_DATA structure.
+  @param[in,out] NumFailed      A pointer to the number of failed entries, to be updated.
+
+  @retval EFI_SUCCESS           The partition data matches the expected hash.
+  @retval EFI_ABORTED           User cancelled the operation.
+  @retval EFI_CRC_ERROR         The partition data doesn't match the expected hash.
+  @retval other                 A read error occurred.
+**/
+EFI_STATUS VerifyPartition(
+	IN EFI_FILE_HANDLE File,
+	IN CONST UINT64 Size,
+	IN CONST HASH_LIST* List,
+	IN PROGRESS_DATA* Progress,
+	IN OUT UINTN* NumFailed
+)
+{
+	EFI_STATUS Status;
+	HASH_TASK Task = { 0 };
+	UINT8 Hash[HASH_SIZE_MAX];
+	UINT64 ReadBytes = 0, Time;
+
+	Task.Algorithm = List->Algorithm;
+	Task.File = File;
+	Task.Length = Size;
+	if (!gIsTestMode)
+		PrintFileEntry(L"Partition", Size);
+	Time = GetTimestamp();
+	Status = HashFile(&Task, Progress, Hash, &ReadBytes);
+	Time = GetTimestamp() - Time;
+	File->Close(File);
+	if (Status == EFI_ABORTED)
+		return Status;
+
+	if (Status == EFI_SUCCESS && ReadBytes != Size)
 		Status = EFI_END_OF_FILE;
+	if (Status == EFI_SUCCESS && CompareMem(Hash, List->PartitionHash, List->Algorithm->HashSize) != 0)
+		Status = EFI_CRC_ERROR;
+	if (gIsTestMode)
+		PrintFileEntry(L"Partition", Size);
+	if (EFI_ERROR(Status)) {
+		PrintFailedEntry(Status, L"Partition", HASH_OFFSET_NONE);
+		(*NumFailed)++;
+	} else if (!gIsTestMode && Time != 0) {
+		PrintInfo(L"Partition read at %d MB/s", (UINTN)(((ReadBytes / (1024 * 1024)) * 1000000) / Time));
+	}
+	return Status;
+}
+
+/* Comparison function for SortIndexes(), that returns <0, 0 or >0, as strcmp() */
+typedef INTN (*INDEX_COMPARE)(CONST VOID* Context, CONST UINTN a, CONST UINTN b);
+
+/**
+  Sift an element down a max-heap of indexes, until the heap property is restored.
+
+  @param[in,out] Array          A pointer to the array of indexes the heap is made of.
+  @param[in]     Root           The position of the element to sift down.
+  @param[in]     Count          The number of elements in the heap.
+  @param[in]     Compare        The function that compares the elements two indexes refer to.
+  @param[in]     Context        The context to pass to the comparison function.
+**/
+STATIC VOID SiftDown(
+	IN OUT UINTN* Array,
+	IN UINTN Root,
+	IN CONST UINTN Count,
+	IN CONST INDEX_COMPARE Compare,
+	IN CONST VOID* Context
+)
+{
+	UINTN Child, Tmp;
+
+	while ((Child = 2 * Root + 1) < Count) {
+		if (Child + 1 < Count && Compare(Context, Array[Child], Array[Child + 1]) < 0)
+			Child++;
+		if (Compare(Context, Array[Root], Array[Child]) >= 0)
+			break;
+		Tmp = Array[Root];
+		Array[Root] = Array[Child];
+		Array[Child] = Tmp;
+		Root = Child;
+	}
+}
+
+/**
+  Sort an array of indexes with a heapsort, so that we neither have a
+  quadratic worst case nor need extra memory.
+
+  @param[in,out] Array          A pointer to the array of indexes to sort.
+  @param[in]     Count          The number of elements in the array.
+  @param[in]     Compare        The function that compares the elements two indexes refer to.
+  @param[in]     Context        The context to pass to the comparison function.
+**/
+STATIC VOID SortIndexes(
+	IN OUT UINTN* Array,
+	IN CONST UINTN Count,
+	IN CONST INDEX_COMPARE Compare,
+	IN CONST VOID* Context
+)
+{
+	UINTN i, Tmp;
+
+	for (i = Count / 2; i-- > 0; )
+		SiftDown(Array, i, Count, Compare, Context);
+	for (i = Count; i-- > 1; ) {
+		Tmp = Array[0];
+		Array[0] = Array[i];
+		Array[i] = Tmp;
+		SiftDown(Array, 0, i, Compare, Context);
+	}
+}
+
+/* Get a character of a path of a hash list, which is UTF-8 unless the list has WidePaths.
+ * ASCII characters are upper-cased, since FAT paths are case insensitive like the lookups. */
+STATIC __inline CHAR16 GetPathChar(
+	IN CONST HASH_LIST* List,
+	IN CONST CHAR8* Path,
+	IN CONST UINTN Index
+)
+{
+	CHAR16 c = List->WidePaths ? ((CONST CHAR16*)Path)[Index] : (CHAR16)(UINT8)Path[Index];
+
+	return (c >= L'a' && c <= L'z') ? c - L'a' + L'A' : c;
+}
+
+/* Context for the comparison of hash list entries that are being scheduled */
+typedef struct {
+	CONST HASH_LIST*    List;
+	CONST UINT64*       Key;        /* Directory path length or file size, per entry */
+	UINTN               Order;
+} SCHEDULE_CONTEXT;
+
+/* Compare entries according to the schedule order, falling back to the list order */
+STATIC INTN CompareScheduledEntries(
+	IN CONST VOID* Context,
+	IN CONST UINTN a,
+	IN CONST UINTN b
+)
+{
+	CONST SCHEDULE_CONTEXT* Schedule = (CONST SCHEDULE_CONTEXT*)Context;
+	CONST CHAR8* PathA;
+	CONST CHAR8* PathB;
+	UINTN i, Length;
+	INTN r = 0;
+
+	if (Schedule->Order == HASH_ORDER_DIRECTORY) {
+		PathA = GetEntryPath(Schedule->List->Buffer, &Schedule->List->Entry[a]);
+		PathB = GetEntryPath(Schedule->List->Buffer, &Schedule->List->Entry[b]);
+		Length = (UINTN)MIN(Schedule->Key[a], Schedule->Key[b]);
+		for (i = 0; i < Length && r == 0; i++)
+			r = (INTN)GetPathChar(Schedule->List, PathA, i) - (INTN)GetPathChar(Schedule->List, PathB, i);
+		if (r == 0 && Schedule->Key[a] != Schedule->Key[b])
+			r = (Schedule->Key[a] < Schedule->Key[b]) ? -1 : 1;
+	} else if (Schedule->Key[a] != Schedule->Key[b]) {
+		// Largest files first
+		r = (Schedule->Key[a] > Schedule->Key[b]) ? -1 : 1;
+	}
+	if (r == 0 && a != b)
+		r = (a < b) ? -1 : 1;
+	return r;
+}
+
+/* Compare failures according to the list order of their entries */
+STATIC INTN CompareFailures(
+	IN CONST VOID* Context,
+	IN CONST UINTN a,
+	IN CONST UINTN b
+)
+{
+	CONST HASH_FAILURE* Failure = (CONST HASH_FAILURE*)Context;
+
+	if (Failure[a].Entry->Index == Failure[b].Entry->Index)
+		return 0;
+	return (Failure[a].Entry->Index < Failure[b].Entry->Index) ? -1 : 1;
+}
+
+/**
+  Reorder the entries of a hash list according to its md5sum_order directive:
+  either grouped by parent directory, so that files from the same directory are
+  opened consecutively, or by decreasing file size, so that the largest files
+  (which dominate the verification time) are started first.
+  When the list is reordered, the array that records failures is also allocated,
+  so that failures can be reported in the order of the hash list file.
+
+  @param[in]     Root           A file handle to the root directory.
+  @param[in,out] List           A pointer to the HASH_LIST to reorder.
+
+  @retval EFI_SUCCESS           The list was reordered, or doesn't need to be.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS ScheduleHashList(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN OUT HASH_LIST* List
+)
+{
+	EFI_STATUS Status = EFI_OUT_OF_RESOURCES;
+	EFI_FILE_HANDLE File;
+	HASH_ENTRY* Entry = NULL;
+	SCHEDULE_CONTEXT Context;
+	CONST CHAR8* EntryPath;
+	CHAR16 Path[PATH_MAX + 1];
+	UINT64* Key = NULL;
+	UINTN i, j, *Schedule = NULL;
+
+	if (List->Order == HASH_ORDER_MANIFEST || List->NumEntries < 2)
+		return EFI_SUCCESS;
+
+	Key = AllocateZeroPool(List->NumEntries * sizeof(UINT64));
+	Schedule = AllocatePool(List->NumEntries * sizeof(UINTN));
+	Entry = AllocatePool(List->NumEntries * sizeof(HASH_ENTRY));
+	List->Failure = AllocatePool(List->NumEntries * sizeof(HASH_FAILURE));
+	if (Key == NULL || Schedule == NULL || Entry == NULL || List->Failure == NULL)
 		goto out;
+
+	for (i = 0; i < List->NumEntries; i++) {
+		Schedule[i] = i;
+		if (List->Order == HASH_ORDER_DIRECTORY) {
+			EntryPath = GetEntryPath(List->Buffer, &List->Entry[i]);
+			for (j = 0; GetPathChar(List, EntryPath, j) != L'\0'; j++) {
+				if (GetPathChar(List, EntryPath, j) == L'\\')
+					Key[i] = j;
+			}
+		} else if (GetEntrySize(List, &List->Entry[i]) != HASH_SIZE_UNKNOWN) {
+			// No need to open the files whose size the hash list provides
+			Key[i] = GetEntrySize(List, &List->Entry[i]);
+		} else if (DecodeHashEntry(List, &List->Entry[i], Path, ARRAY_SIZE(Path)) == EFI_SUCCESS &&
+			OpenFileToHash(Root, Path, &File, &Key[i]) == EFI_SUCCESS) {
+			File->Close(File);
+		}
 	}
-	Md5Final(&Context);
-	// Update the progress data (if file type)
-	if (Progress != NULL && Progress->Type == PROGRESS_TYPE_FILE)
-		Progress->Current++;
-	UpdateProgress(Progress);
 
-	CopyMem(Hash, Context.Buffer, MD5_HASHSIZE);
+	Context.List = List;
+	Context.Key = Key;
+	Context.Order = List->Order;
+	SortIndexes(Schedule, List->NumEntries, CompareScheduledEntries, &Context);
+
+	CopyMem(Entry, List->Entry, List->NumEntries * sizeof(HASH_ENTRY));
+	for (i = 0; i < List->NumEntries; i++)
+		List->Entry[i] = Entry[Schedule[i]];
 	Status = EFI_SUCCESS;
 
 out:
-	SafeFree(Buffer);
-	if (File != NULL)
-		File->Close(File);
-	SafeFree(Info);
+	if (EFI_ERROR(Status) && List->Failure != NULL)
+		SafeFree(List->Failure);
+	if (Entry != NULL)
+		SafeFree(Entry);
+	if (Schedule != NULL)
+		SafeFree(Schedule);
+	if (Key != NULL)
+		SafeFree(Key);
 	return Status;
 }
+
+/**
+  Print the failures that were recorded while verifying a reordered or merged hash list,
+  in the order of the hash list file.
+
+  @param[in]   List             A pointer to the HASH_LIST that was verified.
+  @param[in]   NumFailed        The number of failures that were recorded.
+**/
+VOID ReportFailedEntries(
+	IN CONST HASH_LIST* List,
+	IN CONST UINTN NumFailed
+)
+{
+	CONST HASH_FAILURE* Failure;
+	CHAR16 Path[PATH_MAX + 1], DisplayPath[PATH_MAX];
+	UINTN i, *Order;
+
+	if (List->Failure == NULL || NumFailed == 0)
+		return;
+
+	// If we can't sort the failures, we still want to report them
+	Order = AllocatePool(NumFailed * sizeof(UINTN));
+	for (i = 0; Order != NULL && i < NumFailed; i++)
+		Order[i] = i;
+	if (Order != NULL)
+		SortIndexes(Order, NumFailed, CompareFailures, List->Failure);
+
+	for (i = 0; i < NumFailed; i++) {
+		Failure = &List->Failure[(Order != NULL) ? Order[i] : i];
+		// The path is the one that was reported for the entry, even if it fails to decode
+		DecodeHashEntry(List, Failure->Entry, Path, ARRAY_SIZE(Path));
+		PrintFailedEntry(Failure->Status, GetDisplayPath(List, Failure->Entry, Path,
+			DisplayPath, ARRAY_SIZE(DisplayPath)), Failure->FailedOffset);
+	}
+	if (Order != NULL)
+		SafeFree(Order);
+}
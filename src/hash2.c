@@ -0,0 +1,296 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - Firmware hash engine
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * Some platforms provide an EFI_HASH2_PROTOCOL that is backed by a crypto
+ * accelerator, which may hash data faster than we can. To find out, we hash
+ * the same buffer with both engines for HASH2_CALIBRATION_TIME, and only keep
+ * the firmware one if it processed more data, and produced the same hash.
+ * Each EFI_HASH2_PROTOCOL instance can only have one hash in progress, so we
+ * create a single child from the service binding, for the sequential engine.
+ */
+
+#if defined(_GNU_EFI)
+STATIC EFI_GUID gEfiHash2ServiceBindingProtocolGuid = EFI_HASH2_SERVICE_BINDING_PROTOCOL_GUID;
+STATIC EFI_GUID gEfiHash2ProtocolGuid = EFI_HASH2_PROTOCOL_GUID;
+STATIC EFI_GUID gEfiHashAlgorithmMD5Guid = EFI_HASH_ALGORITHM_MD5_GUID;
+STATIC EFI_GUID gEfiHashAlgorithmSha256Guid = EFI_HASH_ALGORITHM_SHA256_GUID;
+#endif
+
+/* The firmware hash engine, that InitHash2() sets up */
+STATIC struct {
+	EFI_SERVICE_BINDING_PROTOCOL*   Binding;
+	EFI_HANDLE                      Child;
+	EFI_HASH2_PROTOCOL*             Hash2;
+	CONST EFI_GUID*                 Guid;
+	CONST HASH_ALGORITHM*           Algorithm;
+	BOOLEAN                         Selected;
+} Engine = { 0 };
+
+/**
+  Get the EFI_HASH2_PROTOCOL GUID of a hash algorithm.
+
+  @param[in]   Algorithm        A pointer to a HASH_ALGORITHM.
+
+  @retval      A pointer to the GUID or NULL if EFI_HASH2_PROTOCOL doesn't define one.
+**/
+STATIC CONST EFI_GUID* GetHash2Guid(
+	IN CONST HASH_ALGORITHM* Algorithm
+)
+{
+	if (Algorithm == &gHashAlgorithm[HASH_TYPE_MD5])
+		return &gEfiHashAlgorithmMD5Guid;
+	if (Algorithm == &gHashAlgorithm[HASH_TYPE_SHA256])
+		return &gEfiHashAlgorithmSha256Guid;
+	return NULL;
+}
+
+/**
+  Create an EFI_HASH2_PROTOCOL instance that supports the algorithm we need,
+  from the first service binding that provides one.
+
+  @retval EFI_SUCCESS           The Engine fields have been populated.
+  @retval EFI_NOT_FOUND         The firmware can't hash data for this algorithm.
+**/
+STATIC EFI_STATUS CreateHash2Instance(VOID)
+{
+	EFI_STATUS Status;
+	EFI_HANDLE* Handles = NULL;
+	UINTN i, NumHandles = 0, HashSize;
+
+	Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiHash2ServiceBindingProtocolGuid,
+		NULL, &NumHandles, &Handles);
+	if (EFI_ERROR(Status))
+		return EFI_NOT_FOUND;
+
+	for (i = 0; i < NumHandles; i++) {
+		Status = gBS->HandleProtocol(Handles[i], &gEfiHash2ServiceBindingProtocolGuid,
+			(VOID**)&Engine.Binding);
+		if (EFI_ERROR(Status))
+			continue;
+		Engine.Child = NULL;
+		Status = Engine.Binding->CreateChild(Engine.Binding, &Engine.Child);
+		if (EFI_ERROR(Status))
+			continue;
+		Status = gBS->HandleProtocol(Engine.Child, &gEfiHash2ProtocolGuid, (VOID**)&Engine.Hash2);
+		if (!EFI_ERROR(Status))
+			Status = Engine.Hash2->GetHashSize(Engine.Hash2, Engine.Guid, &HashSize);
+		if (!EFI_ERROR(Status) && HashSize == Engine.Algorithm->HashSize)
+			break;
+		Engine.Binding->DestroyChild(Engine.Binding, Engine.Child);
+		Engine.Child = NULL;
+	}
+
+	SafeFree(Handles);
+	return (i < NumHandles) ? EFI_SUCCESS : EFI_NOT_FOUND;
+}
+
+/**
+  Hash a buffer repeatedly, until a timer expires.
+
+  @param[in]   UseHash2         Whether to use the firmware engine or the built-in one.
+  @param[in]   Buffer           A pointer to a READ_BUFFERSIZE buffer.
+  @param[in]   Timer            A timer event, that is to be set to HASH2_CALIBRATION_TIME.
+  @param[in,out] Count          On input, the number of times to hash the buffer, or 0 to
+                                hash it until the timer expires. On output, the number of
+                                times the buffer was hashed, which can be 0 for an engine
+                                that takes longer than the timer for a single buffer.
+  @param[out]  Hash             A pointer to the HASH_SIZE_MAX array that receives the hash.
+
+  @retval EFI_SUCCESS           The buffer was hashed Count times.
+  @retval other                 The firmware engine failed to hash the data.
+**/
+STATIC EFI_STATUS HashCalibrationBuffer(
+	IN CONST BOOLEAN UseHash2,
+	IN CONST UINT8* Buffer,
+	IN CONST EFI_EVENT Timer,
+	IN OUT UINTN* Count,
+	OUT UINT8* Hash
+)
+{
+	EFI_STATUS Status = EFI_SUCCESS;
+	HASH_CONTEXT Context;
+	EFI_HASH2_OUTPUT Output;
+	UINTN i;
+
+	if (UseHash2) {
+		Status = Engine.Hash2->HashInit(Engine.Hash2, Engine.Guid);
+		if (EFI_ERROR(Status))
+			return Status;
+	} else {
+		Engine.Algorithm->Init(&Context);
+	}
+
+	if (*Count == 0) {
+		// Wait for a timer tick first, so that both engines get the same number of ticks
+		gBS->SetTimer(Timer, TimerRelative, 1);
+		while (gBS->CheckEvent(Timer) == EFI_NOT_READY);
+		gBS->SetTimer(Timer, TimerRelative, HASH2_CALIBRATION_TIME * 10000ULL);
+	}
+
+	for (i = 0; (*Count == 0) ? (gBS->CheckEvent(Timer) == EFI_NOT_READY) : (i < *Count); i++) {
+		if (UseHash2)
+			Status = Engine.Hash2->HashUpdate(Engine.Hash2, Buffer, READ_BUFFERSIZE);
+		else
+			Engine.Algorithm->Write(&Context, Buffer, READ_BUFFERSIZE);
+		if (EFI_ERROR(Status))
+			break;
+	}
+
+	if (UseHash2) {
+		if (!EFI_ERROR(Status))
+			Status = Engine.Hash2->HashFinal(Engine.Hash2, &Output);
+		if (EFI_ERROR(Status))
+			return Status;
+		CopyMem(Hash, &Output, Engine.Algorithm->HashSize);
+	} else {
+		Engine.Algorithm->Final(&Context);
+		CopyMem(Hash, Context.Buffer, Engine.Algorithm->HashSize);
+	}
+	*Count = i;
+	return EFI_SUCCESS;
+}
+
+/**
+  Look for a firmware EFI_HASH2_PROTOCOL that supports the hash algorithm and,
+  if it produces valid hashes faster than the built-in implementation, select
+  it for HashFile(). Since that protocol can only be used from the BSP, and
+  with only one hash in progress, it is only used by VerifyList() and
+  VerifyPartition(), and should therefore only be considered when neither
+  VerifyListMp() nor VerifyListLanes() can be used.
+
+  @param[in]   Algorithm        A pointer to the HASH_ALGORITHM of the hash list.
+
+  @retval EFI_SUCCESS           The firmware hash engine has been selected.
+  @retval EFI_UNSUPPORTED       The built-in hash implementation is to be used.
+**/
+EFI_STATUS InitHash2(
+	IN CONST HASH_ALGORITHM* Algorithm
+)
+{
+	EFI_STATUS Status = EFI_UNSUPPORTED;
+	EFI_EVENT Timer = NULL;
+	UINT8 *Buffer = NULL, Hash[HASH_SIZE_MAX], Hash2[HASH_SIZE_MAX];
+	UINTN i, Count = 0, Count2 = 0;
+
+	ZeroMem(&Engine, sizeof(Engine));
+	Engine.Algorithm = Algorithm;
+	Engine.Guid = GetHash2Guid(Algorithm);
+	if (Engine.Guid == NULL || EFI_ERROR(CreateHash2Instance()))
+		return EFI_UNSUPPORTED;
+
+	Buffer = AllocatePool(READ_BUFFERSIZE);
+	if (Buffer == NULL || EFI_ERROR(gBS->CreateEvent(EVT_TIMER, 0, NULL, NULL, &Timer)))
+		goto out;
+	for (i = 0; i < READ_BUFFERSIZE; i++)
+		Buffer[i] = (UINT8)(i % 251);
+
+	// Find how many buffers each engine hashes in the same amount of time
+	HashCalibrationBuffer(FALSE, Buffer, Timer, &Count, Hash);
+	if (EFI_ERROR(HashCalibrationBuffer(TRUE, Buffer, Timer, &Count2, Hash2))) {
+		PrintWarning(L"Firmware %s engine failed to hash data", Algorithm->Name);
+		goto out;
+	}
+
+	// Don't trust the firmware engine unless it produces the same hash as ours. An engine
+	// that didn't complete a single buffer is just slower than ours, and isn't checked.
+	if (Count2 != 0 && Count2 != Count) {
+		i = Count2;
+		HashCalibrationBuffer(FALSE, Buffer, Timer, &i, Hash);
+	}
+	if (Count2 != 0 && CompareMem(Hash, Hash2, Algorithm->HashSize) != 0) {
+		PrintWarning(L"Firmware %s engine failed self-test", Algorithm->Name);
+		goto out;
+	}
+
+	Engine.Selected = (Count2 > Count);
+	if (gIsTestMode)
+		PrintTest(L"Hash engine = %s", Engine.Selected ? L"firmware" : L"built-in");
+	else
+		PrintInfo(L"Using %s %s engine (firmware: %d MB/s, built-in: %d MB/s)",
+			Engine.Selected ? L"firmware" : L"built-in", Algorithm->Name,
+			(Count2 * (READ_BUFFERSIZE / (1024 * 1024)) * 1000) / HASH2_CALIBRATION_TIME,
+			(Count * (READ_BUFFERSIZE / (1024 * 1024)) * 1000) / HASH2_CALIBRATION_TIME);
+	if (Engine.Selected)
+		Status = EFI_SUCCESS;
+
+out:
+	if (Timer != NULL)
+		gBS->CloseEvent(Timer);
+	SafeFree(Buffer);
+	if (!Engine.Selected)
+		ExitHash2();
+	return Status;
+}
+
+/**
+  Release the firmware hash engine, if one was selected.
+**/
+VOID ExitHash2(VOID)
+{
+	if (Engine.Child != NULL)
+		Engine.Binding->DestroyChild(Engine.Binding, Engine.Child);
+	ZeroMem(&Engine, sizeof(Engine));
+}
+
+/**
+  Check if the firmware hash engine was selected for a hash algorithm.
+
+  @param[in]   Algorithm        A pointer to a HASH_ALGORITHM.
+
+  @retval TRUE                  Data for this algorithm is to be hashed by the firmware.
+  @retval FALSE                 Data for this algorithm is to be hashed by the built-in implementation.
+**/
+BOOLEAN IsHash2Selected(
+	IN CONST HASH_ALGORITHM* Algorithm
+)
+{
+	return (Engine.Selected && Engine.Algorithm == Algorithm);
+}
+
+/* Start a new hash computation with the firmware hash engine */
+EFI_STATUS Hash2Start(VOID)
+{
+	V_ASSERT(Engine.Selected);
+	return Engine.Hash2->HashInit(Engine.Hash2, Engine.Guid);
+}
+
+/* Update the firmware hash computation with the contents of the buffer */
+EFI_STATUS Hash2Update(
+	IN CONST UINT8* Buffer,
+	IN CONST UINTN Size
+)
+{
+	return Engine.Hash2->HashUpdate(Engine.Hash2, Buffer, Size);
+}
+
+/* Terminate the firmware hash computation and copy the hash, if requested */
+EFI_STATUS Hash2Finish(
+	OPTIONAL OUT UINT8* Hash
+)
+{
+	EFI_STATUS Status;
+	EFI_HASH2_OUTPUT Output;
+
+	Status = Engine.Hash2->HashFinal(Engine.Hash2, &Output);
+	if (!EFI_ERROR(Status) && Hash != NULL)
+		CopyMem(Hash, &Output, Engine.Algorithm->HashSize);
+	return Status;
+}
@@ -0,0 +1,596 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - Multi-lane MD5 hashing engine
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * MD5 can't be parallelized within a single stream, but the same MD5 step
+ * can be applied to 4 (SSE2 or NEON) or 8 (AVX2) independent streams at
+ * once, by placing the state of each stream into a separate SIMD lane.
+ * The engine below keeps all the lanes busy with consecutive entries from
+ * the hash list, and only uses the scalar code for the first and last bytes
+ * of each read, so that the lanes always process whole blocks. Each lane has
+ * MD5_LANE_BUFFERCOUNT buffers from the I/O pool, so that, when the driver
+ * supports asynchronous reads, the next reads of a lane are in flight while
+ * the lanes hash the current ones.
+ */
+
+#if defined(MD5_LANES_ENGINE)
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#if defined(_M_X64)
+#include <immintrin.h>
+#else
+#include <arm_neon.h>
+#endif
+#define TARGET(t)
+#else
+/* We use the GCC/Clang vector extensions, which map to SSE2, AVX2 or NEON */
+typedef UINT32 VEC4 __attribute__((vector_size(16)));
+typedef UINT32 VEC8 __attribute__((vector_size(32)));
+#if defined(__x86_64__)
+#define TARGET(t)           __attribute__((target(t)))
+#else
+#define TARGET(t)
+#endif
+#define VLOAD(p)            (*(CONST VEC*)(p))
+#define VSTORE(p, v)        (*(VEC*)(p) = (v))
+#define VADD(a, b)          ((a) + (b))
+#define VAND(a, b)          ((a) & (b))
+#define VOR(a, b)           ((a) | (b))
+#define VXOR(a, b)          ((a) ^ (b))
+#define VORNOT(a, b)        ((a) | ~(b))
+#define VROL(a, s)          (((a) << (s)) | ((a) >> (32 - (s))))
+#define VSET1(t)            (((VEC){ 0 }) + (UINT32)(t))
+#endif
+
+/* Multi-lane kernel prototype */
+typedef VOID (*MD5_LANES_TRANSFORM)(MD5_LANES* Lanes, CONST UINT8** Data, CONST UINTN NumBlocks);
+
+#define VF1(x, y, z)        VXOR(z, VAND(x, VXOR(y, z)))
+#define VF2(x, y, z)        VF1(z, x, y)
+#define VF3(x, y, z)        VXOR(VXOR(x, y), z)
+#define VF4(x, y, z)        VXOR(y, VORNOT(x, z))
+
+#define VSTEP(f, w, x, y, z, k, t, s) do { \
+	w = VADD(w, VADD(f(x, y, z), VADD(M[k], VSET1(t)))); \
+	w = VADD(VROL(w, s), x); } while(0)
+
+#define MD5X_STEPS do { \
+	VSTEP(VF1, a, b, c, d,  0, 0xd76aa478,  7); \
+	VSTEP(VF1, d, a, b, c,  1, 0xe8c7b756, 12); \
+	VSTEP(VF1, c, d, a, b,  2, 0x242070db, 17); \
+	VSTEP(VF1, b, c, d, a,  3, 0xc1bdceee, 22); \
+	VSTEP(VF1, a, b, c, d,  4, 0xf57c0faf,  7); \
+	VSTEP(VF1, d, a, b, c,  5, 0x4787c62a, 12); \
+	VSTEP(VF1, c, d, a, b,  6, 0xa8304613, 17); \
+	VSTEP(VF1, b, c, d, a,  7, 0xfd469501, 22); \
+	VSTEP(VF1, a, b, c, d,  8, 0x698098d8,  7); \
+	VSTEP(VF1, d, a, b, c,  9, 0x8b44f7af, 12); \
+	VSTEP(VF1, c, d, a, b, 10, 0xffff5bb1, 17); \
+	VSTEP(VF1, b, c, d, a, 11, 0x895cd7be, 22); \
+	VSTEP(VF1, a, b, c, d, 12, 0x6b901122,  7); \
+	VSTEP(VF1, d, a, b, c, 13, 0xfd987193, 12); \
+	VSTEP(VF1, c, d, a, b, 14, 0xa679438e, 17); \
+	VSTEP(VF1, b, c, d, a, 15, 0x49b40821, 22); \
+	VSTEP(VF2, a, b, c, d,  1, 0xf61e2562,  5); \
+	VSTEP(VF2, d, a, b, c,  6, 0xc040b340,  9); \
+	VSTEP(VF2, c, d, a, b, 11, 0x265e5a51, 14); \
+	VSTEP(VF2, b, c, d, a,  0, 0xe9b6c7aa, 20); \
+	VSTEP(VF2, a, b, c, d,  5, 0xd62f105d,  5); \
+	VSTEP(VF2, d, a, b, c, 10, 0x02441453,  9); \
+	VSTEP(VF2, c, d, a, b, 15, 0xd8a1e681, 14); \
+	VSTEP(VF2, b, c, d, a,  4, 0xe7d3fbc8, 20); \
+	VSTEP(VF2, a, b, c, d,  9, 0x21e1cde6,  5); \
+	VSTEP(VF2, d, a, b, c, 14, 0xc33707d6,  9); \
+	VSTEP(VF2, c, d, a, b,  3, 0xf4d50d87, 14); \
+	VSTEP(VF2, b, c, d, a,  8, 0x455a14ed, 20); \
+	VSTEP(VF2, a, b, c, d, 13, 0xa9e3e905,  5); \
+	VSTEP(VF2, d, a, b, c,  2, 0xfcefa3f8,  9); \
+	VSTEP(VF2, c, d, a, b,  7, 0x676f02d9, 14); \
+	VSTEP(VF2, b, c, d, a, 12, 0x8d2a4c8a, 20); \
+	VSTEP(VF3, a, b, c, d,  5, 0xfffa3942,  4); \
+	VSTEP(VF3, d, a, b, c,  8, 0x8771f681, 11); \
+	VSTEP(VF3, c, d, a, b, 11, 0x6d9d6122, 16); \
+	VSTEP(VF3, b, c, d, a, 14, 0xfde5380c, 23); \
+	VSTEP(VF3, a, b, c, d,  1, 0xa4beea44,  4); \
+	VSTEP(VF3, d, a, b, c,  4, 0x4bdecfa9, 11); \
+	VSTEP(VF3, c, d, a, b,  7, 0xf6bb4b60, 16); \
+	VSTEP(VF3, b, c, d, a, 10, 0xbebfbc70, 23); \
+	VSTEP(VF3, a, b, c, d, 13, 0x289b7ec6,  4); \
+	VSTEP(VF3, d, a, b, c,  0, 0xeaa127fa, 11); \
+	VSTEP(VF3, c, d, a, b,  3, 0xd4ef3085, 16); \
+	VSTEP(VF3, b, c, d, a,  6, 0x04881d05, 23); \
+	VSTEP(VF3, a, b, c, d,  9, 0xd9d4d039,  4); \
+	VSTEP(VF3, d, a, b, c, 12, 0xe6db99e5, 11); \
+	VSTEP(VF3, c, d, a, b, 15, 0x1fa27cf8, 16); \
+	VSTEP(VF3, b, c, d, a,  2, 0xc4ac5665, 23); \
+	VSTEP(VF4, a, b, c, d,  0, 0xf4292244,  6); \
+	VSTEP(VF4, d, a, b, c,  7, 0x432aff97, 10); \
+	VSTEP(VF4, c, d, a, b, 14, 0xab9423a7, 15); \
+	VSTEP(VF4, b, c, d, a,  5, 0xfc93a039, 21); \
+	VSTEP(VF4, a, b, c, d, 12, 0x655b59c3,  6); \
+	VSTEP(VF4, d, a, b, c,  3, 0x8f0ccc92, 10); \
+	VSTEP(VF4, c, d, a, b, 10, 0xffeff47d, 15); \
+	VSTEP(VF4, b, c, d, a,  1, 0x85845dd1, 21); \
+	VSTEP(VF4, a, b, c, d,  8, 0x6fa87e4f,  6); \
+	VSTEP(VF4, d, a, b, c, 15, 0xfe2ce6e0, 10); \
+	VSTEP(VF4, c, d, a, b,  6, 0xa3014314, 15); \
+	VSTEP(VF4, b, c, d, a, 13, 0x4e0811a1, 21); \
+	VSTEP(VF4, a, b, c, d,  4, 0xf7537e82,  6); \
+	VSTEP(VF4, d, a, b, c, 11, 0xbd3af235, 10); \
+	VSTEP(VF4, c, d, a, b,  2, 0x2ad7d2bb, 15); \
+	VSTEP(VF4, b, c, d, a,  9, 0xeb86d391, 21); } while(0)
+
+/*
+ * Transform NumBlocks consecutive blocks for each of the NumLanes lanes.
+ * The 16 message words of each block are first transposed, so that the
+ * same word from all the lanes can be loaded into a single vector.
+ */
+#define MD5X_TRANSFORM(Lanes, Data, NumBlocks, NumLanes) do { \
+	ALIGNED(32) UINT32 W[16][NumLanes]; \
+	VEC a, b, c, d, A, B, C, D, M[16]; \
+	UINTN k, l, n; \
+	A = VLOAD(Lanes->State[0]); \
+	B = VLOAD(Lanes->State[1]); \
+	C = VLOAD(Lanes->State[2]); \
+	D = VLOAD(Lanes->State[3]); \
+	for (n = 0; n < NumBlocks; n++) { \
+		for (l = 0; l < NumLanes; l++) \
+			for (k = 0; k < 16; k++) \
+				W[k][l] = LOAD32(Data[l] + n * MD5_BLOCKSIZE, k); \
+		for (k = 0; k < 16; k++) \
+			M[k] = VLOAD(W[k]); \
+		a = A; b = B; c = C; d = D; \
+		MD5X_STEPS; \
+		A = VADD(A, a); \
+		B = VADD(B, b); \
+		C = VADD(C, c); \
+		D = VADD(D, d); \
+	} \
+	VSTORE(Lanes->State[0], A); \
+	VSTORE(Lanes->State[1], B); \
+	VSTORE(Lanes->State[2], C); \
+	VSTORE(Lanes->State[3], D); } while(0)
+
+/* 4-lane transform (SSE2 or NEON) */
+#if defined(_MSC_VER) && !defined(__clang__)
+#if defined(_M_X64)
+#define VEC                 __m128i
+#define VLOAD(p)            _mm_load_si128((CONST __m128i*)(p))
+#define VSTORE(p, v)        _mm_store_si128((__m128i*)(p), v)
+#define VADD(a, b)          _mm_add_epi32(a, b)
+#define VAND(a, b)          _mm_and_si128(a, b)
+#define VOR(a, b)           _mm_or_si128(a, b)
+#define VXOR(a, b)          _mm_xor_si128(a, b)
+#define VORNOT(a, b)        _mm_or_si128(a, _mm_xor_si128(b, _mm_set1_epi32(-1)))
+#define VROL(a, s)          _mm_or_si128(_mm_slli_epi32(a, s), _mm_srli_epi32(a, 32 - (s)))
+#define VSET1(t)            _mm_set1_epi32((INT32)(t))
+#else
+#define VEC                 uint32x4_t
+#define VLOAD(p)            vld1q_u32(p)
+#define VSTORE(p, v)        vst1q_u32(p, v)
+#define VADD(a, b)          vaddq_u32(a, b)
+#define VAND(a, b)          vandq_u32(a, b)
+#define VOR(a, b)           vorrq_u32(a, b)
+#define VXOR(a, b)          veorq_u32(a, b)
+#define VORNOT(a, b)        vornq_u32(a, b)
+#define VROL(a, s)          vsriq_n_u32(vshlq_n_u32(a, s), a, 32 - (s))
+#define VSET1(t)            vdupq_n_u32(t)
+#endif
+#else
+#define VEC                 VEC4
+#endif
+TARGET("sse2") STATIC VOID Md5TransformX4(MD5_LANES* Lanes, CONST UINT8** Data, CONST UINTN NumBlocks)
+{
+	MD5X_TRANSFORM(Lanes, Data, NumBlocks, 4);
+}
+#undef VEC
+#if defined(_MSC_VER) && !defined(__clang__)
+#undef VLOAD
+#undef VSTORE
+#undef VADD
+#undef VAND
+#undef VOR
+#undef VXOR
+#undef VORNOT
+#undef VROL
+#undef VSET1
+#endif
+
+/* 8-lane transform (AVX2) */
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(_MSC_VER) && !defined(__clang__)
+#define VEC                 __m256i
+#define VLOAD(p)            _mm256_load_si256((CONST __m256i*)(p))
+#define VSTORE(p, v)        _mm256_store_si256((__m256i*)(p), v)
+#define VADD(a, b)          _mm256_add_epi32(a, b)
+#define VAND(a, b)          _mm256_and_si256(a, b)
+#define VOR(a, b)           _mm256_or_si256(a, b)
+#define VXOR(a, b)          _mm256_xor_si256(a, b)
+#define VORNOT(a, b)        _mm256_or_si256(a, _mm256_xor_si256(b, _mm256_set1_epi32(-1)))
+#define VROL(a, s)          _mm256_or_si256(_mm256_slli_epi32(a, s), _mm256_srli_epi32(a, 32 - (s)))
+#define VSET1(t)            _mm256_set1_epi32((INT32)(t))
+#else
+#define VEC                 VEC8
+#endif
+TARGET("avx2") STATIC VOID Md5TransformX8(MD5_LANES* Lanes, CONST UINT8** Data, CONST UINTN NumBlocks)
+{
+	MD5X_TRANSFORM(Lanes, Data, NumBlocks, 8);
+#if defined(_MSC_VER) && !defined(__clang__)
+	_mm256_zeroupper();
+#endif
+}
+#undef VEC
+#endif
+
+/* The state of a single lane of the engine */
+typedef struct ALIGNED(64) {
+	HASH_CONTEXT     Context;    /* Scalar context, for the head and tail of each read */
+	UINT8*           Buffer;     /* The buffer being hashed, from the last read that completed */
+	UINTN            Pos;
+	UINTN            Len;
+	UINT64           ReadBytes;
+	UINT64           Queued;     /* Number of bytes requested, less the shortfall of completed reads */
+	UINTN            NextRead;   /* The index of the oldest read in flight */
+	UINTN            NumReads;   /* The number of reads in flight */
+	UINT8*           ReadBuffer[MD5_LANE_BUFFERCOUNT];
+	HASH_READ        Read[MD5_LANE_BUFFERCOUNT];
+	HASH_TASK        Task;
+	BOOLEAN          Active;
+} MD5_LANE;
+
+/* Copy the state of lane l to its scalar context */
+STATIC __inline VOID LaneToContext(
+	IN CONST MD5_LANES* Lanes,
+	IN MD5_LANE* Lane,
+	IN CONST UINTN l
+)
+{
+	UINTN i;
+
+	for (i = 0; i < 4; i++)
+		Lane->Context.Md5.State[i] = Lanes->State[i][l];
+}
+
+/* Copy the scalar context of lane l to the lane state */
+STATIC __inline VOID ContextToLane(
+	IN MD5_LANES* Lanes,
+	IN CONST MD5_LANE* Lane,
+	IN CONST UINTN l
+)
+{
+	UINTN i;
+
+	for (i = 0; i < 4; i++)
+		Lanes->State[i][l] = Lane->Context.Md5.State[i];
+}
+
+/**
+  Wait for all the reads that a lane has in flight, so that its task can be
+  completed.
+
+  @param[in]  Lane       A pointer to the lane.
+**/
+STATIC VOID DrainLaneReads(
+	IN MD5_LANE* Lane
+)
+{
+	UINTN Size;
+
+	for (; Lane->NumReads != 0; Lane->NumReads--) {
+		WaitHashTaskRead(&Lane->Read[Lane->NextRead], &Size);
+		Lane->NextRead = (Lane->NextRead + 1) % MD5_LANE_BUFFERCOUNT;
+	}
+}
+
+/**
+  Get the next block of data for a lane, after queuing reads into the buffers
+  that it is done with, or complete its task if the data has been read in
+  full. This is only called when the lane has less than one MD5 block left to
+  process from the previous read.
+
+  @param[in]  Lanes      A pointer to the lanes state.
+  @param[in]  Lane       A pointer to the active lane.
+  @param[in]  l          The index of the lane.
+  @param[in]  Results    A pointer to the results window.
+  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
+  @param[in]  Cancelled  Set if the user requested cancellation.
+
+  @retval EFI_SUCCESS    The lane was serviced.
+  @retval EFI_ABORTED    User cancelled the operation.
+**/
+STATIC EFI_STATUS FeedLane(
+	IN MD5_LANES* Lanes,
+	IN MD5_LANE* Lane,
+	IN CONST UINTN l,
+	IN HASH_RESULT* Results,
+	IN PROGRESS_DATA* Progress,
+	IN CONST BOOLEAN Cancelled
+)
+{
+	EFI_STATUS Status = EFI_ABORTED;
+	HASH_READ* Read;
+	UINTN i, Size, Num;
+	UINT64 StatsStart;
+
+	// Hand the remainder of the previous read to the scalar context
+	LaneToContext(Lanes, Lane, l);
+	if (Lane->Pos < Lane->Len) {
+		StatsStart = STATS_TIMESTAMP();
+		Md5Write(&Lane->Context, &Lane->Buffer[Lane->Pos], Lane->Len - Lane->Pos);
+		STATS_ADD(STATS_HASH, StatsStart, Lane->Len - Lane->Pos);
+	}
+	Lane->Pos = Lane->Len = 0;
+
+	if (!Cancelled) {
+		// Queue reads into the buffers that have none in flight, as they are no longer hashed
+		while (Lane->NumReads < MD5_LANE_BUFFERCOUNT && Lane->Queued < Lane->Task.Length) {
+			i = (Lane->NextRead + Lane->NumReads) % MD5_LANE_BUFFERCOUNT;
+			Size = (UINTN)MIN(READ_BUFFERSIZE, Lane->Task.Length - Lane->Queued);
+			QueueHashTaskRead(&Lane->Task, &Lane->Read[i], Lane->ReadBuffer[i], Size);
+			Lane->Queued += Size;
+			Lane->NumReads++;
+		}
+		Status = EFI_SUCCESS;
+		Size = 0;
+		if (Lane->NumReads != 0) {
+			Read = &Lane->Read[Lane->NextRead];
+			Status = WaitHashTaskRead(Read, &Size);
+			Lane->NextRead = (Lane->NextRead + 1) % MD5_LANE_BUFFERCOUNT;
+			Lane->NumReads--;
+			// Account for short reads, so that we read the remainder afterwards
+			if (!EFI_ERROR(Status))
+				Lane->Queued -= Read->Requested - Size;
+			Lane->Buffer = Read->Token.Buffer;
+		}
+		if (!EFI_ERROR(Status) && Size != 0) {
+			Lane->ReadBytes += Size;
+			Lane->Len = Size;
+			// If the previous read wasn't a multiple of the block size, complete
+			// the block with the scalar code, so that the lane starts aligned.
+			Num = Lane->Context.Md5.ByteCount & (MD5_BLOCKSIZE - 1);
+			if (Num != 0) {
+				Lane->Pos = MIN(MD5_BLOCKSIZE - Num, Lane->Len);
+				Md5Write(&Lane->Context, Lane->Buffer, Lane->Pos);
+			}
+			ContextToLane(Lanes, Lane, l);
+			return UpdateHashProgress(Size, Progress);
+		}
+		if (!EFI_ERROR(Status))
+			Md5Final(&Lane->Context);
+	}
+
+	// The file of the task is closed once completed
+	DrainLaneReads(Lane);
+	CompleteHashTask(Results, &Lane->Task, Status, Lane->ReadBytes, Lane->Context.Buffer);
+	Lane->Active = FALSE;
+	return EFI_SUCCESS;
+}
+
+/**
+  Check a multi-lane transform against the scalar MD5 code, by processing
+  a different message in each lane from the initial state.
+
+  @param[in]  Md5TransformLanes  The multi-lane transform to check.
+  @param[in]  NumLanes           The number of lanes of the transform.
+
+  @retval TRUE   The transform produced the same states as the scalar code.
+  @retval FALSE  The transform is not usable.
+**/
+STATIC BOOLEAN TestTransformLanes(
+	IN CONST MD5_LANES_TRANSFORM Md5TransformLanes,
+	IN CONST UINTN NumLanes
+)
+{
+	ALIGNED(64) UINT8 Message[MD5_LANES_MAX][2 * MD5_BLOCKSIZE];
+	HASH_CONTEXT Context;
+	MD5_LANES Lanes;
+	CONST UINT8* Data[MD5_LANES_MAX];
+	UINTN i, l;
+
+	Md5Init(&Context);
+	for (l = 0; l < NumLanes; l++) {
+		for (i = 0; i < sizeof(Message[l]); i++)
+			Message[l][i] = (UINT8)(i * (2 * l + 1) + l);
+		for (i = 0; i < 4; i++)
+			Lanes.State[i][l] = Context.Md5.State[i];
+		Data[l] = Message[l];
+	}
+	Md5TransformLanes(&Lanes, Data, 2);
+
+	for (l = 0; l < NumLanes; l++) {
+		Md5Init(&Context);
+		Md5Write(&Context, Message[l], sizeof(Message[l]));
+		for (i = 0; i < 4; i++)
+			if (Lanes.State[i][l] != Context.Md5.State[i])
+				return FALSE;
+	}
+	return TRUE;
+}
+
+EFI_STATUS VerifyListLanes(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN PROGRESS_DATA* Progress,
+	OUT UINTN* NumProcessed,
+	IN OUT UINTN* NumFailed
+)
+{
+	EFI_STATUS Status, EntryStatus = EFI_SUCCESS;
+	EFI_PHYSICAL_ADDRESS Address;
+	MD5_LANES_TRANSFORM Md5TransformLanes = Md5TransformX4;
+	MD5_LANES Lanes;
+	MD5_LANE* Lane;
+	HASH_RESULT* Results = NULL;
+	CONST UINT8* Data[MD5_LANES_MAX];
+	BOOLEAN Cancelled = FALSE;
+	UINTN i, l, Pages, NumLanes = 4, NumActive, NumBlocks;
+	UINTN NextEntry = 0, NextReport = 0;
+	UINT64 StatsStart;
+
+	*NumProcessed = 0;
+
+	// This engine only computes MD5 hashes
+	if (List->Algorithm != &gHashAlgorithm[HASH_TYPE_MD5])
+		return EFI_UNSUPPORTED;
+
+	// The scalar path, with its asynchronous reads, is better for single files,
+	// unless they can be split into chunks.
+	if (List->NumEntries < 2 && List->NumChunks == 0)
+		return EFI_UNSUPPORTED;
+
+#if defined(__x86_64__) || defined(_M_X64)
+	if (IsAvx2Supported()) {
+		if (TestTransformLanes(Md5TransformX8, 8)) {
+			Md5TransformLanes = Md5TransformX8;
+			NumLanes = 8;
+		} else {
+			PrintWarning(L"X8 MD5 transform failed self-test");
+		}
+	}
+#endif
+	// Make sure that we never use a transform that produces invalid hashes
+	if (NumLanes == 4 && !TestTransformLanes(Md5TransformX4, 4)) {
+		PrintWarning(L"X4 MD5 transform failed self-test");
+		return EFI_UNSUPPORTED;
+	}
+
+	Results = AllocateZeroPool(HASH_RESULT_WINDOW * sizeof(HASH_RESULT));
+	if (Results == NULL)
+		return EFI_UNSUPPORTED;
+
+	// Use page allocation for the lanes, since they require 64-byte alignment
+	Pages = EFI_SIZE_TO_PAGES(NumLanes * sizeof(MD5_LANE));
+	Status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, Pages, &Address);
+	if (EFI_ERROR(Status)) {
+		SafeFree(Results);
+		return EFI_UNSUPPORTED;
+	}
+	Lane = (MD5_LANE*)(UINTN)Address;
+	ZeroMem(Lane, NumLanes * sizeof(MD5_LANE));
+	for (l = 0; l < NumLanes; l++) {
+		for (i = 0; i < MD5_LANE_BUFFERCOUNT; i++) {
+			Lane[l].ReadBuffer[i] = GetIoEngineBuffer(l * MD5_LANE_BUFFERCOUNT + i);
+			if (Lane[l].ReadBuffer[i] == NULL) {
+				gBS->FreePages(Address, Pages);
+				SafeFree(Results);
+				return EFI_UNSUPPORTED;
+			}
+		}
+		// Inactive lanes hash a buffer too
+		Lane[l].Buffer = Lane[l].ReadBuffer[0];
+	}
+	ZeroMem(&Lanes, sizeof(Lanes));
+
+	for (;;) {
+		// Service the lanes that don't have a whole block left to process
+		for (l = 0; l < NumLanes; l++) {
+			while (!Lane[l].Active || Lane[l].Len - Lane[l].Pos < MD5_BLOCKSIZE) {
+				if (Lane[l].Active) {
+					if (FeedLane(&Lanes, &Lane[l], l, Results, Progress, Cancelled) == EFI_ABORTED)
+						Cancelled = TRUE;
+					continue;
+				}
+				// Hand a new task to the lane, if there is one
+				if (Cancelled || StartHashTask(Root, List, Results, &NextEntry, NextReport,
+					&Lane[l].Task) != EFI_SUCCESS)
+					break;
+				Md5Init(&Lane[l].Context);
+				ContextToLane(&Lanes, &Lane[l], l);
+				Lane[l].Active = TRUE;
+				Lane[l].Pos = Lane[l].Len = 0;
+				Lane[l].ReadBytes = 0;
+				Lane[l].Queued = 0;
+			}
+		}
+
+		// Report the completed entries, in order
+		if (ReportHashResults(List, Results, &NextReport, NextEntry, Progress, NumFailed, &EntryStatus))
+			Cancelled = TRUE;
+
+		// Find the number of blocks that all the active lanes can process
+		NumActive = 0;
+		NumBlocks = READ_BUFFERSIZE / MD5_BLOCKSIZE;
+		for (l = 0; l < NumLanes; l++) {
+			if (!Lane[l].Active)
+				continue;
+			NumActive++;
+			NumBlocks = MIN(NumBlocks, (Lane[l].Len - Lane[l].Pos) / MD5_BLOCKSIZE);
+		}
+		if (NumActive == 0) {
+			if (Cancelled || NextReport >= List->NumEntries)
+				break;
+			continue;
+		}
+
+		// Running the multi-lane kernel for a single lane is slower than scalar
+		if (NumActive == 1) {
+			for (l = 0; !Lane[l].Active; l++);
+			StatsStart = STATS_TIMESTAMP();
+			LaneToContext(&Lanes, &Lane[l], l);
+			Md5Write(&Lane[l].Context, &Lane[l].Buffer[Lane[l].Pos], NumBlocks * MD5_BLOCKSIZE);
+			ContextToLane(&Lanes, &Lane[l], l);
+			STATS_ADD(STATS_HASH, StatsStart, NumBlocks * MD5_BLOCKSIZE);
+			Lane[l].Pos += NumBlocks * MD5_BLOCKSIZE;
+			continue;
+		}
+
+		// Inactive lanes just hash their (stale) buffer, and the result is ignored
+		for (l = 0; l < NumLanes; l++)
+			Data[l] = Lane[l].Active ? &Lane[l].Buffer[Lane[l].Pos] : Lane[l].Buffer;
+		StatsStart = STATS_TIMESTAMP();
+		Md5TransformLanes(&Lanes, Data, NumBlocks);
+		STATS_ADD(STATS_HASH, StatsStart, NumActive * NumBlocks * MD5_BLOCKSIZE);
+		for (l = 0; l < NumLanes; l++) {
+			if (!Lane[l].Active)
+				continue;
+			Lane[l].Pos += NumBlocks * MD5_BLOCKSIZE;
+			Lane[l].Context.Md5.ByteCount += NumBlocks * MD5_BLOCKSIZE;
+		}
+	}
+
+	*NumProcessed = NextReport;
+	Status = Cancelled ? EFI_ABORTED : EntryStatus;
+
+	for (l = 0; l < NumLanes; l++) {
+		for (i = 0; i < MD5_LANE_BUFFERCOUNT; i++)
+			CloseHashTaskRead(&Lane[l].Read[i]);
+		if (Lane[l].Task.File != NULL)
+			Lane[l].Task.File->Close(Lane[l].Task.File);
+	}
+	gBS->FreePages(Address, Pages);
+	ReleaseHashResults(Results);
+	return Status;
+}
+
+#else /* MD5_LANES_ENGINE */
+
+EFI_STATUS VerifyListLanes(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN PROGRESS_DATA* Progress,
+	OUT UINTN* NumProcessed,
+	IN OUT UINTN* NumFailed
+)
+{
+	*NumProcessed = 0;
+	return EFI_UNSUPPORTED;
+}
+
+#endif /* MD5_LANES_ENGINE */
@@ -0,0 +1,423 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - Multiprocessor hashing engine
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * UEFI services can only be invoked from the Boot Strap Processor (BSP),
+ * so the design is as follows:
+ * - Each Application Processor (AP) we use runs a single worker that is
+ *   started once, and that spins on a small job queue until told to quit.
+ * - Each worker owns one hashing task (a file, or a chunk of a file) at a
+ *   time. The BSP performs all the reads for that task, into the buffers
+ *   from the I/O pool that the worker is done with, and queues the data for
+ *   the worker to hash once each read completes. Reads are asynchronous if
+ *   the driver supports it, so that they overlap with the hashing. A job
+ *   with a zero size tells the worker to finalize the hash.
+ * - The jobs queues are single producer (BSP, that only updates Head) and
+ *   single consumer (AP, that only updates Tail), so no locking is needed.
+ * - Results are stored in a window and reported in the order of the list,
+ *   so that the output is the same as the one from sequential processing.
+ *   See ReportHashResults().
+ */
+
+#if defined(_GNU_EFI)
+STATIC EFI_GUID gEfiMpServiceProtocolGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
+#endif
+
+/* A block of data to be hashed by a worker */
+typedef struct {
+	CONST UINT8*     Data;
+	UINTN            Size;       /* Zero to finalize the hash */
+} MP_JOB;
+
+/* Worker data, shared between the BSP and the AP */
+typedef struct ALIGNED(64) {
+	HASH_CONTEXT     Context;
+	CONST HASH_ALGORITHM* Algorithm;
+	MP_JOB           Job[MP_QUEUE_SIZE];
+	volatile UINTN   Head;       /* Number of jobs queued by the BSP */
+	volatile UINTN   Tail;       /* Number of jobs processed by the AP */
+	volatile BOOLEAN Running;    /* Set by the AP once the worker has started */
+	volatile BOOLEAN Quit;       /* Set by the BSP to stop the worker */
+	/* The following fields are only accessed by the BSP */
+	UINTN            Pages;
+	UINT8*           Buffer[MP_QUEUE_SIZE];  /* READ_BUFFERSIZE bytes each, from the I/O pool */
+	HASH_READ        Read[MP_QUEUE_SIZE];    /* The read of each buffer */
+	EFI_EVENT        Event;
+	BOOLEAN          Active;
+	BOOLEAN          Finalizing;
+	HASH_TASK        Task;
+	UINTN            Issued;     /* Number of reads issued, which is at least Head */
+	UINT64           Queued;     /* Number of bytes requested, less the shortfall of completed reads */
+	UINT64           ReadBytes;
+	EFI_STATUS       Status;
+} MP_WORKER;
+
+/**
+  The worker that runs on an AP. This must not invoke any UEFI service.
+
+  @param[in]  Buffer     A pointer to the MP_WORKER structure of this worker.
+**/
+STATIC VOID EFIAPI MpWorker(
+	IN OUT VOID* Buffer
+)
+{
+	MP_WORKER* Worker = (MP_WORKER*)Buffer;
+	MP_JOB* Job;
+
+	Worker->Running = TRUE;
+	MemoryFence();
+	while (!Worker->Quit) {
+		if (Worker->Tail == Worker->Head) {
+			CpuPause();
+			continue;
+		}
+		// Make sure we see the job data the BSP wrote before updating Head
+		MemoryFence();
+		Job = &Worker->Job[Worker->Tail % MP_QUEUE_SIZE];
+		if (Job->Size == 0)
+			Worker->Algorithm->Final(&Worker->Context);
+		else
+			Worker->Algorithm->Write(&Worker->Context, Job->Data, Job->Size);
+		MemoryFence();
+		Worker->Tail++;
+	}
+}
+
+/**
+  Allocate a worker and start it on a specific AP.
+
+  @param[in]  Mp               A pointer to the MP Services protocol instance.
+  @param[in]  ProcessorNumber  The number of the AP to start the worker on.
+  @param[in]  Index            The index of the worker, for its buffers from the I/O pool.
+  @param[out] Worker           A pointer to receive the allocated worker.
+
+  @retval EFI_SUCCESS          The worker was started.
+  @retval EFI_OUT_OF_RESOURCES A memory allocation error occurred.
+  @retval EFI_TIMEOUT          The AP did not start the worker in time.
+  @retval other                The AP could not be started.
+**/
+STATIC EFI_STATUS StartWorker(
+	IN EFI_MP_SERVICES_PROTOCOL* Mp,
+	IN CONST UINTN ProcessorNumber,
+	IN CONST UINTN Index,
+	OUT MP_WORKER** Worker
+)
+{
+	EFI_STATUS Status;
+	EFI_PHYSICAL_ADDRESS Address;
+	UINT8* Buffer[MP_QUEUE_SIZE];
+	UINTN i, Pages, Wait;
+	MP_WORKER* w;
+
+	*Worker = NULL;
+
+	for (i = 0; i < MP_QUEUE_SIZE; i++) {
+		Buffer[i] = GetIoEngineBuffer(Index * MP_QUEUE_SIZE + i);
+		if (Buffer[i] == NULL)
+			return EFI_OUT_OF_RESOURCES;
+	}
+
+	// Use page alignment for the worker, so that workers don't share any cache lines
+	Pages = EFI_SIZE_TO_PAGES(sizeof(MP_WORKER));
+	Status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, Pages, &Address);
+	if (EFI_ERROR(Status))
+		return EFI_OUT_OF_RESOURCES;
+	w = (MP_WORKER*)(UINTN)Address;
+	ZeroMem(w, sizeof(MP_WORKER));
+	w->Pages = Pages;
+	CopyMem(w->Buffer, Buffer, sizeof(Buffer));
+
+	Status = gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &w->Event);
+	if (EFI_ERROR(Status))
+		goto out;
+
+	// Start the AP in non-blocking mode, with no timeout
+	Status = Mp->StartupThisAP(Mp, MpWorker, ProcessorNumber, w->Event, 0, w, NULL);
+	if (EFI_ERROR(Status)) {
+		gBS->CloseEvent(w->Event);
+		goto out;
+	}
+
+	for (Wait = 0; !w->Running && Wait < MP_STARTUP_TIMEOUT; Wait += 10)
+		Sleep(10);
+	if (!w->Running) {
+		// The AP may still pick up the worker at a later stage, so tell it
+		// to exit on startup and leak the memory, since we can't free it.
+		// The buffers of the worker can be reused, since the AP never got a job.
+		w->Quit = TRUE;
+		MemoryFence();
+		return EFI_TIMEOUT;
+	}
+
+	*Worker = w;
+	return EFI_SUCCESS;
+
+out:
+	gBS->FreePages(Address, Pages);
+	return Status;
+}
+
+/**
+  Stop a running worker and free its resources.
+
+  @param[in]  Worker     A pointer to the worker to stop.
+**/
+STATIC VOID StopWorker(
+	IN MP_WORKER* Worker
+)
+{
+	UINTN i, Index;
+
+	Worker->Quit = TRUE;
+	MemoryFence();
+	gBS->WaitForEvent(1, &Worker->Event, &Index);
+	gBS->CloseEvent(Worker->Event);
+	for (i = 0; i < MP_QUEUE_SIZE; i++)
+		CloseHashTaskRead(&Worker->Read[i]);
+	if (Worker->Task.File != NULL)
+		Worker->Task.File->Close(Worker->Task.File);
+	gBS->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN)Worker, Worker->Pages);
+}
+
+/**
+  Assign the next hashing task to an idle worker, if there is one.
+
+  @param[in]     Root        A file handle to the root directory.
+  @param[in]     Worker      A pointer to the idle worker.
+  @param[in]     List        A pointer to the HASH_LIST being verified.
+  @param[in]     Results     A pointer to the results window.
+  @param[in,out] NextEntry   A pointer to the index of the next entry that is yet to be started.
+  @param[in]     NextReport  The index of the next entry to report.
+**/
+STATIC VOID StartTask(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN MP_WORKER* Worker,
+	IN CONST HASH_LIST* List,
+	IN HASH_RESULT* Results,
+	IN OUT UINTN* NextEntry,
+	IN CONST UINTN NextReport
+)
+{
+	if (StartHashTask(Root, List, Results, NextEntry, NextReport, &Worker->Task) != EFI_SUCCESS)
+		return;
+
+	// The worker is idle, so we can safely reset its context
+	Worker->Algorithm = Worker->Task.Algorithm;
+	Worker->Algorithm->Init(&Worker->Context);
+	Worker->Active = TRUE;
+	Worker->Finalizing = FALSE;
+	Worker->Issued = Worker->Head;
+	Worker->Queued = 0;
+	Worker->ReadBytes = 0;
+	Worker->Status = EFI_SUCCESS;
+}
+
+/**
+  Queue a job to a worker.
+
+  @param[in]  Worker     A pointer to the worker.
+  @param[in]  Data       A pointer to the data to hash.
+  @param[in]  Size       The size of the data to hash, or zero to finalize the hash.
+**/
+STATIC __inline VOID QueueJob(
+	IN MP_WORKER* Worker,
+	IN CONST UINT8* Data,
+	IN CONST UINTN Size
+)
+{
+	Worker->Job[Worker->Head % MP_QUEUE_SIZE].Data = Data;
+	Worker->Job[Worker->Head % MP_QUEUE_SIZE].Size = Size;
+	// Make sure the AP sees the job data before it sees the updated Head
+	MemoryFence();
+	Worker->Head++;
+}
+
+/**
+  Move an active worker along, by completing its task if the worker is done,
+  or by queuing reads into the buffers it is done with, and handing it the
+  data of the oldest read, once that read has completed.
+
+  @param[in]  Worker     A pointer to the active worker.
+  @param[in]  Results    A pointer to the results window.
+  @param[in]  Progress   A pointer to a PROGRESS_DATA structure.
+  @param[in]  Cancelled  Set if the user requested cancellation.
+
+  @retval EFI_SUCCESS    The worker was serviced.
+  @retval EFI_NOT_READY  The worker is busy and nothing was done.
+  @retval EFI_ABORTED    User cancelled the operation.
+**/
+STATIC EFI_STATUS ServiceWorker(
+	IN MP_WORKER* Worker,
+	IN HASH_RESULT* Results,
+	IN PROGRESS_DATA* Progress,
+	IN CONST BOOLEAN Cancelled
+)
+{
+	EFI_STATUS Status = EFI_NOT_READY;
+	HASH_READ* Read;
+	UINTN i, Size;
+
+	if (Worker->Finalizing || Cancelled) {
+		// Wait for the queue to be drained
+		if (Worker->Tail != Worker->Head)
+			return EFI_NOT_READY;
+		// Make sure we see the data the AP wrote before updating Tail
+		MemoryFence();
+		// The file of the task is closed once completed, so wait for its reads
+		for (i = 0; i < MP_QUEUE_SIZE; i++)
+			WaitHashTaskRead(&Worker->Read[i], &Size);
+		// Tasks that weren't fully read when the user cancelled are aborted
+		CompleteHashTask(Results, &Worker->Task, Worker->Finalizing ? Worker->Status : EFI_ABORTED,
+			Worker->ReadBytes, Worker->Context.Buffer);
+		Worker->Active = FALSE;
+		return EFI_SUCCESS;
+	}
+
+	// Queue reads into the buffers that the AP is done with
+	while (Worker->Issued - Worker->Tail < MP_QUEUE_SIZE && Worker->Queued < Worker->Task.Length) {
+		// Make sure the AP is done with the buffer before we overwrite it
+		MemoryFence();
+		i = Worker->Issued % MP_QUEUE_SIZE;
+		Size = (UINTN)MIN(READ_BUFFERSIZE, Worker->Task.Length - Worker->Queued);
+		QueueHashTaskRead(&Worker->Task, &Worker->Read[i], Worker->Buffer[i], Size);
+		Worker->Queued += Size;
+		Worker->Issued++;
+		Status = EFI_SUCCESS;
+	}
+
+	// Once all the data was handed over, tell the worker to finalize the hash
+	if (Worker->Head == Worker->Issued) {
+		if (Worker->Queued < Worker->Task.Length || Worker->Head - Worker->Tail >= MP_QUEUE_SIZE)
+			return Status;
+		QueueJob(Worker, NULL, 0);
+		Worker->Issued++;
+		Worker->Finalizing = TRUE;
+		return EFI_SUCCESS;
+	}
+
+	// Else hand the worker the data of the oldest read, once it has completed
+	Read = &Worker->Read[Worker->Head % MP_QUEUE_SIZE];
+	if (!IsHashTaskReadDone(Read))
+		return Status;
+	Status = WaitHashTaskRead(Read, &Size);
+	if (EFI_ERROR(Status)) {
+		Worker->Status = Status;
+		Worker->Finalizing = TRUE;
+		return EFI_SUCCESS;
+	}
+	// A read that returns no data means that the file is shorter than expected
+	QueueJob(Worker, (Size == 0) ? NULL : Read->Token.Buffer, Size);
+	if (Size == 0) {
+		Worker->Finalizing = TRUE;
+		return EFI_SUCCESS;
+	}
+	// Account for short reads, so that we read the remainder afterwards
+	Worker->Queued -= Read->Requested - Size;
+	Worker->ReadBytes += Size;
+	return UpdateHashProgress(Size, Progress);
+}
+
+EFI_STATUS VerifyListMp(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN PROGRESS_DATA* Progress,
+	OUT UINTN* NumProcessed,
+	IN OUT UINTN* NumFailed
+)
+{
+	EFI_STATUS Status, EntryStatus = EFI_SUCCESS;
+	EFI_MP_SERVICES_PROTOCOL* Mp;
+	EFI_PROCESSOR_INFORMATION Info;
+	MP_WORKER* Workers[MP_WORKERS_MAX];
+	HASH_RESULT* Results = NULL;
+	BOOLEAN Cancelled = FALSE, Busy;
+	UINTN i, Bsp, NumProcessors, NumEnabled, NumWorkers = 0;
+	UINTN NextEntry = 0, NextReport = 0;
+	CONST UINT32 UsableAp = PROCESSOR_ENABLED_BIT | PROCESSOR_HEALTH_STATUS_BIT;
+
+	*NumProcessed = 0;
+
+	Status = gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (VOID**)&Mp);
+	if (EFI_ERROR(Status))
+		return EFI_UNSUPPORTED;
+	if (EFI_ERROR(Mp->WhoAmI(Mp, &Bsp)) ||
+		EFI_ERROR(Mp->GetNumberOfProcessors(Mp, &NumProcessors, &NumEnabled)) || NumEnabled < 2)
+		return EFI_UNSUPPORTED;
+
+	Results = AllocateZeroPool(HASH_RESULT_WINDOW * sizeof(HASH_RESULT));
+	if (Results == NULL)
+		return EFI_UNSUPPORTED;
+
+	// Start a worker on each of the usable APs
+	for (i = 0; i < NumProcessors && NumWorkers < MP_WORKERS_MAX; i++) {
+		if (i == Bsp || EFI_ERROR(Mp->GetProcessorInfo(Mp, i, &Info)) ||
+			(Info.StatusFlag & (UsableAp | PROCESSOR_AS_BSP_BIT)) != UsableAp)
+			continue;
+		if (StartWorker(Mp, i, NumWorkers, &Workers[NumWorkers]) == EFI_SUCCESS)
+			NumWorkers++;
+	}
+	if (NumWorkers == 0) {
+		Status = EFI_UNSUPPORTED;
+		goto out;
+	}
+
+	while (NextReport < List->NumEntries) {
+		Busy = TRUE;
+
+		// Hand new tasks to idle workers
+		for (i = 0; i < NumWorkers; i++) {
+			if (!Workers[i]->Active && !Cancelled)
+				StartTask(Root, Workers[i], List, Results, &NextEntry, NextReport);
+		}
+
+		// Feed the active workers
+		for (i = 0; i < NumWorkers; i++) {
+			if (!Workers[i]->Active)
+				continue;
+			Status = ServiceWorker(Workers[i], Results, Progress, Cancelled);
+			if (Status == EFI_ABORTED)
+				Cancelled = TRUE;
+			if (Status != EFI_NOT_READY)
+				Busy = FALSE;
+		}
+
+		// Report the completed entries, in order
+		if (ReportHashResults(List, Results, &NextReport, NextEntry, Progress, NumFailed, &EntryStatus))
+			Cancelled = TRUE;
+
+		if (Cancelled) {
+			for (i = 0; i < NumWorkers && !Workers[i]->Active; i++);
+			if (i >= NumWorkers)
+				break;
+		}
+
+		if (Busy)
+			CpuPause();
+	}
+
+	*NumProcessed = NextReport;
+	Status = Cancelled ? EFI_ABORTED : EntryStatus;
+
+out:
+	for (i = 0; i < NumWorkers; i++)
+		StopWorker(Workers[i]);
+	ReleaseHashResults(Results);
+	return Status;
+}
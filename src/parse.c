@@ -1,5 +1,5 @@
 /*
- * uefi-md5sum: UEFI MD5Sum validator - md5sum.txt parser
+ * uefi-md5sum: UEFI MD5Sum validator - Hash list parser
  * Copyright © 2023-2024 Pete Batard <pete@akeo.ie>
  *
  * This program is free software: you can redistribute it and/or modify
@@ -18,232 +18,781 @@
 
 #include "boot.h"
 
-/* The hash sum list file may provide a comment with the total size of bytes to process */
+/*
+ * The hash sum list file may provide a comment with the total size of bytes to process.
+ * Note that the md5sum_ prefix of the directives applies to all the hash algorithms.
+ */
 STATIC CONST CHAR8 TotalBytesString[] = "md5sum_totalbytes";
 
+/* The chunks file must provide a comment with the size of the chunks */
+STATIC CONST CHAR8 ChunkSizeString[] = "md5sum_chunksize";
+
+/* The hash sum list file may provide a comment with the order in which to verify entries */
+STATIC CONST CHAR8 OrderString[] = "md5sum_order";
+
+/* The hash sum list file may provide a comment with the size of the file of the next entry */
+STATIC CONST CHAR8 FileSizeString[] = "md5sum_filesize";
+
+/* The hash sum list file may provide a comment with the backend to use to read the files */
+STATIC CONST CHAR8 ReaderString[] = "md5sum_reader";
+
+/* The hash sum list file may provide a comment with when to verify the files */
+STATIC CONST CHAR8 VerifyString[] = "md5sum_verify";
+
+/* The hash sum list file may provide a comment with the hash of the whole boot partition */
+STATIC CONST CHAR8 PartitionString[] = "md5sum_partition";
+
+/* The hash sum list file may provide a comment with the amount of data to verify on each boot */
+STATIC CONST CHAR8 SampleString[] = "md5sum_sample";
+
+/* The hash sum list file may provide a comment with whether the next entry is always verified */
+STATIC CONST CHAR8 CriticalString[] = "md5sum_critical";
+
+/* The hash sum list file may provide a comment with whether to run the benchmark mode */
+STATIC CONST CHAR8 BenchmarkString[] = "md5sum_benchmark";
+
+/* The hash sum list file may provide comments with the labels of other volumes to verify */
+STATIC CONST CHAR8 VolumeString[] = "md5sum_volume";
+
+/* The hash sum list file may provide a comment with how long a verified media is trusted for */
+STATIC CONST CHAR8 CacheString[] = "md5sum_cache";
+
+/* Values of the md5sum_order directive, indexed by HASH_ORDER_# */
+STATIC CONST CHAR8* OrderName[HASH_ORDER_MAX] = { "manifest", "directory", "size" };
+
+/* Values of the md5sum_reader directive, indexed by HASH_READER_# */
+STATIC CONST CHAR8* ReaderName[HASH_READER_MAX] = { "filesystem", "raw" };
+
+/* Values of the md5sum_verify directive, indexed by HASH_VERIFY_# */
+STATIC CONST CHAR8* VerifyName[HASH_VERIFY_MAX] = { "full", "ondemand" };
+
+/* Values of the md5sum_critical and md5sum_benchmark directives */
+STATIC CONST CHAR8* BooleanName[] = { "no", "yes" };
+
 /**
-  Parse a hash sum list file and populate a HASH_LIST structure from it.
+  Match the "<Name> =" part of a comment directive.
 
-  @param[in]  Root   A file handle to the root directory.
-  @param[in]  Path   A pointer to the CHAR16 string.
-  @param[out] List   A pointer to the HASH_LIST structure to populate.
+  @param[in]  HashFile   A pointer to the hash file buffer.
+  @param[in]  c          The position of the start of the comment (after the '#' prefix).
+  @param[in]  i          The position following the comment's terminating '\n'.
+  @param[in]  Name       The (NUL-terminated) name of the directive.
+  @param[in]  NameSize   The size of Name, including the NUL terminator.
+  @param[out] Value      A pointer to receive the position of the value, past any spaces.
 
-  @retval EFI_SUCCESS           The file was successfully parsed and the hash list is populated.
-  @retval EFI_INVALID_PARAMETER One or more of the input parameters are invalid.
-  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
-  @retval EFI_NOT_FOUND         The hash list file does not exist.
-  @retval EFI_UNSUPPORTED       The hash list file is too small or too large.
-  @retval EFI_END_OF_FILE       The hash list file could not be read.
-  @retval EFI_ABORTED           The hash list file contains invalid data.
+  @retval EFI_SUCCESS           The directive was found.
+  @retval EFI_NOT_FOUND         The comment is not for this directive.
+  @retval EFI_INVALID_PARAMETER The directive was found but has no equal sign.
 **/
-EFI_STATUS Parse(
-	IN CONST EFI_FILE_HANDLE Root,
-	IN CONST CHAR16* Path,
-	OUT HASH_LIST* List
+STATIC EFI_STATUS MatchDirective(
+	IN CONST UINT8* HashFile,
+	IN UINTN c,
+	IN CONST UINTN i,
+	IN CONST CHAR8* Name,
+	IN CONST UINTN NameSize,
+	OUT UINTN* Value
+)
+{
+	// Skip any leading spaces
+	while (c < i - 1 && IsWhiteSpace(HashFile[c]))
+		c++;
+
+	// See if we have a match for "<Name> ="
+	if (i <= c + NameSize - 1 || CompareMem(&HashFile[c], Name, NameSize - 1) != 0)
+		return EFI_NOT_FOUND;
+
+	// Look for an equal sign
+	c += NameSize - 1;
+	while (c < i - 1 && IsWhiteSpace(HashFile[c]))
+		c++;
+	if (HashFile[c++] != '=')
+		return EFI_INVALID_PARAMETER;
+	while (c < i - 1 && IsWhiteSpace(HashFile[c]))
+		c++;
+	*Value = c;
+	return EFI_SUCCESS;
+}
+
+/**
+  Parse a "0x<64-bit hexascii value>" directive value, that extends to the end of the comment.
+
+  @param[in]  HashFile   A pointer to the hash file buffer.
+  @param[in]  c          The position of the value.
+  @param[in]  i          The position following the comment's terminating '\n'.
+  @param[out] Value      A pointer to receive the value. This is only updated on success.
+
+  @retval EFI_SUCCESS           The value is valid.
+  @retval EFI_INVALID_PARAMETER The value is invalid.
+**/
+STATIC EFI_STATUS ParseHexValue(
+	IN CONST UINT8* HashFile,
+	IN UINTN c,
+	IN CONST UINTN i,
+	OUT UINT64* Value
+)
+{
+	UINTN NumDigits = 0;
+	UINT64 Val = 0;
+
+	// Look for an '0x' prefix and parse a 64-bit *lowercase*
+	// hexascii value if valid.
+	if (c < i - 2 && HashFile[c] == '0' && HashFile[c + 1] == 'x') {
+		for (c += 2; c < i - 1; c++) {
+			if (HashFile[c] == ' ')
+				continue;
+			if (!IsValidHexAscii(HashFile[c])) {
+				NumDigits = 0;
+				break;
+			}
+			NumDigits++;
+			Val <<= 4;
+			// IsValidHexAscii() above made sure that our character
+			// is in the [0-9] or [A-F] or [a-f] ranges.
+			if (HashFile[c] - '0' < 0xa)
+				Val |= HashFile[c] - '0';
+			else if (HashFile[c] - 'A' < 6)
+				Val |= HashFile[c] - 'A' + 0xa;
+			else
+				Val |= HashFile[c] - 'a' + 0xa;
+		}
+	}
+	if (NumDigits == 0 || NumDigits > 16)
+		return EFI_INVALID_PARAMETER;
+	*Value = Val;
+	return EFI_SUCCESS;
+}
+
+/**
+  Parse a "<Name> = 0x<64-bit hexascii value>" comment directive.
+
+  @param[in]  HashFile   A pointer to the hash file buffer.
+  @param[in]  c          The position of the start of the comment (after the '#' prefix).
+  @param[in]  i          The position following the comment's terminating '\n'.
+  @param[in]  Name       The (NUL-terminated) name of the directive.
+  @param[in]  NameSize   The size of Name, including the NUL terminator.
+  @param[out] Value      A pointer to receive the value. This is only updated on success.
+
+  @retval EFI_SUCCESS           The directive was found and its value is valid.
+  @retval EFI_NOT_FOUND         The comment is not for this directive.
+  @retval EFI_INVALID_PARAMETER The directive was found but its value is invalid.
+**/
+STATIC EFI_STATUS ParseDirective(
+	IN CONST UINT8* HashFile,
+	IN UINTN c,
+	IN CONST UINTN i,
+	IN CONST CHAR8* Name,
+	IN CONST UINTN NameSize,
+	OUT UINT64* Value
 )
 {
 	EFI_STATUS Status;
-	EFI_FILE_HANDLE File = NULL;
-	EFI_FILE_INFO* Info = NULL;
-	UINT8* HashFile = NULL;
-	HASH_ENTRY* HashList = NULL;
-	UINTN i, c, Size, HashFileSize, NumLines, NumEntries, NumDigits;
-	UINT64 TotalBytes = 0;
 
-	if (Root == NULL || Path == NULL || List == NULL)
+	// See if we have a match for "<Name> = 0x########"
+	Status = MatchDirective(HashFile, c, i, Name, NameSize, &c);
+	if (EFI_ERROR(Status))
+		return Status;
+	return ParseHexValue(HashFile, c, i, Value);
+}
+
+/**
+  Parse a "md5sum_partition = <hash> 0x<number of blocks>" comment directive.
+
+  @param[in]  HashFile   A pointer to the hash file buffer.
+  @param[in]  c          The position of the start of the comment (after the '#' prefix).
+  @param[in]  i          The position following the comment's terminating '\n'.
+  @param[in]  HashSize   The size of the hash values, in bytes.
+  @param[out] Hash       A pointer to receive the hash value. This is only updated on success.
+  @param[out] NumBlocks  A pointer to receive the number of blocks. This is only updated on success.
+
+  @retval EFI_SUCCESS           The directive was found and its value is valid.
+  @retval EFI_NOT_FOUND         The comment is not for this directive.
+  @retval EFI_INVALID_PARAMETER The directive was found but its value is invalid.
+**/
+STATIC EFI_STATUS ParsePartitionDirective(
+	IN CONST UINT8* HashFile,
+	IN UINTN c,
+	IN CONST UINTN i,
+	IN CONST UINTN HashSize,
+	OUT UINT8* Hash,
+	OUT UINT64* NumBlocks
+)
+{
+	EFI_STATUS Status;
+	UINT8 b = 0, Value[HASH_SIZE_MAX];
+	UINT64 Blocks;
+	UINTN j;
+
+	Status = MatchDirective(HashFile, c, i, PartitionString, sizeof(PartitionString), &c);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	// The hash value must be followed by whitespace
+	if (c + HashSize * 2 >= i - 1 || !IsWhiteSpace(HashFile[c + HashSize * 2]))
+		return EFI_INVALID_PARAMETER;
+	for (j = 0; j < HashSize * 2; j++, c++) {
+		if (!IsValidHexAscii(HashFile[c]))
+			return EFI_INVALID_PARAMETER;
+		b = (b << 4) | (HashFile[c] >= 'a' ? (HashFile[c] - 'a' + 0x0A) :
+			(HashFile[c] >= 'A' ? (HashFile[c] - 'A' + 0x0A) : HashFile[c] - '0'));
+		if (j & 1)
+			Value[j / 2] = b;
+	}
+	while (c < i - 1 && IsWhiteSpace(HashFile[c]))
+		c++;
+	Status = ParseHexValue(HashFile, c, i, &Blocks);
+	if (EFI_ERROR(Status) || Blocks == 0)
 		return EFI_INVALID_PARAMETER;
+	CopyMem(Hash, Value, HashSize);
+	*NumBlocks = Blocks;
+	return EFI_SUCCESS;
+}
 
-	// Look for the hash file on the boot partition
-	Status = Root->Open(Root, &File, (CHAR16*)Path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
-	if (EFI_ERROR(Status)) {
-		// A missing md5sum.txt is not really an error, so don't
-		// report it, unless we're running in test mode.
-		if (Status != EFI_NOT_FOUND || gIsTestMode)
-			PrintError(L"Unable to open '%s'", Path);
-		goto out;
+/**
+  Parse a "<Name> = <value name>" comment directive, such as md5sum_order.
+
+  @param[in]  HashFile   A pointer to the hash file buffer.
+  @param[in]  c          The position of the start of the comment (after the '#' prefix).
+  @param[in]  i          The position following the comment's terminating '\n'.
+  @param[in]  Name       The (NUL-terminated) name of the directive.
+  @param[in]  NameSize   The size of Name, including the NUL terminator.
+  @param[in]  Values     An array of the (NUL-terminated) names of the values of the directive.
+  @param[in]  NumValues  The number of elements in Values.
+  @param[out] Value      A pointer to receive the index of the value. This is only updated on success.
+
+  @retval EFI_SUCCESS           The directive was found and its value is valid.
+  @retval EFI_NOT_FOUND         The comment is not for this directive.
+  @retval EFI_INVALID_PARAMETER The directive was found but its value is invalid.
+**/
+STATIC EFI_STATUS ParseNameDirective(
+	IN CONST UINT8* HashFile,
+	IN UINTN c,
+	IN CONST UINTN i,
+	IN CONST CHAR8* Name,
+	IN CONST UINTN NameSize,
+	IN CONST CHAR8** Values,
+	IN CONST UINTN NumValues,
+	OUT UINTN* Value
+)
+{
+	EFI_STATUS Status;
+	UINTN j, Len;
+
+	Status = MatchDirective(HashFile, c, i, Name, NameSize, &c);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	// The name may only be followed by spaces
+	for (Len = 0; c + Len < i - 1 && !IsWhiteSpace(HashFile[c + Len]); Len++);
+	for (j = c + Len; j < i - 1; j++) {
+		if (!IsWhiteSpace(HashFile[j]))
+			return EFI_INVALID_PARAMETER;
 	}
+	for (j = 0; j < NumValues; j++) {
+		if (Len == AsciiStrLen(Values[j]) && CompareMem(&HashFile[c], Values[j], Len) == 0) {
+			*Value = j;
+			return EFI_SUCCESS;
+		}
+	}
+	return EFI_INVALID_PARAMETER;
+}
+
+/**
+  Parse a "md5sum_volume = <label>" comment directive, where the label extends
+  to the end of the comment, and may be "*" for all the volumes.
+
+  @param[in]  HashFile   A pointer to the hash file buffer.
+  @param[in]  c          The position of the start of the comment (after the '#' prefix).
+  @param[in]  i          The position following the comment's terminating '\n'.
+  @param[out] Label      A pointer to the VOLUME_LABEL_SIZE buffer that receives the label.
+
+  @retval EFI_SUCCESS           The directive was found and its value is valid.
+  @retval EFI_NOT_FOUND         The comment is not for this directive.
+  @retval EFI_INVALID_PARAMETER The directive was found but its value is invalid.
+**/
+STATIC EFI_STATUS ParseVolumeDirective(
+	IN CONST UINT8* HashFile,
+	IN UINTN c,
+	IN CONST UINTN i,
+	OUT CHAR16* Label
+)
+{
+	EFI_STATUS Status;
+	CHAR8 Value[VOLUME_LABEL_SIZE * 3];
+	UINTN Len;
 
-	// Read the whole file into a memory buffer
-	Size = FILE_INFO_SIZE;
-	Info = AllocateZeroPool(Size);
+	Status = MatchDirective(HashFile, c, i, VolumeString, sizeof(VolumeString), &c);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	// Labels may contain spaces, but not trailing ones
+	for (Len = i - 1 - c; Len > 0 && IsWhiteSpace(HashFile[c + Len - 1]); Len--);
+	if (Len == 0 || Len >= ARRAY_SIZE(Value))
+		return EFI_INVALID_PARAMETER;
+	CopyMem(Value, &HashFile[c], Len);
+	Value[Len] = '\0';
+	return Utf8ToUcs2(Value, Len, Label, VOLUME_LABEL_SIZE, &Len);
+}
+
+/**
+  Add a volume, that md5sum_volume named, to the volumes of a hash list, which
+  start with the boot volume.
+
+  @param[in,out] List       A pointer to the HASH_LIST.
+  @param[in]  Label         The label of the volume.
+
+  @retval EFI_SUCCESS           The volume was added.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval EFI_BUFFER_TOO_SMALL  The hash list already names as many volumes as we support.
+**/
+STATIC EFI_STATUS AddHashVolume(
+	IN OUT HASH_LIST* List,
+	IN CONST CHAR16* Label
+)
+{
+	if (List->Volume == NULL) {
+		List->Volume = AllocateZeroPool(HASH_VOLUMES_MAX * sizeof(HASH_VOLUME));
+		if (List->Volume == NULL)
+			return EFI_OUT_OF_RESOURCES;
+		List->NumVolumes = 1;
+	}
+	if (List->NumVolumes >= HASH_VOLUMES_MAX)
+		return EFI_BUFFER_TOO_SMALL;
+	SafeStrCpy(List->Volume[List->NumVolumes++].Label, VOLUME_LABEL_SIZE, Label);
+	return EFI_SUCCESS;
+}
+
+/* Test if any of the bytes of a word is lower than 0x20, i.e. a control character */
+#define WORD_ONES           ((UINTN)-1 / 0xFF)
+#define HAS_CONTROL_CHAR(w) ((((w) - WORD_ONES * 0x20) & ~(w) & (WORD_ONES * 0x80)) != 0)
+
+/*
+ * State of a hash sum list file that is being parsed. The file is read and
+ * parsed HASH_FILE_READSIZE bytes at a time, so that, if the hash list is
+ * streamed, the verification of its first entries can start before the rest
+ * of the file has been read.
+ */
+typedef struct {
+	EFI_FILE_HANDLE File;
+	CONST CHAR16*   Path;
+	HASH_LIST*      List;
+	UINT8*          HashFile;
+	UINTN           HashFileSize;   /* Size of the file, plus the newline we add */
+	UINTN           ReadSize;       /* Number of bytes that were read */
+	UINTN           ScanSize;       /* Number of bytes that were validated */
+	UINTN           ParseSize;      /* Number of bytes that were converted to entries */
+	UINTN           WriteSize;      /* Number of bytes that the converted entries use */
+	UINTN           NumInvalidPaths;
+	UINTN           NumLines;
+	UINTN           MaxEntries;
+	UINT64          TotalBytes;
+	UINT64          ChunkSize;
+	UINT64          FileSize;       /* Size of the file of the next entry */
+	UINTN           Critical;       /* Whether the next entry is always verified, when sampling */
+	UINTN           Order;
+	UINTN           Reader;
+	UINTN           Verify;
+	UINT64          PartitionBlocks;
+	UINT8           PartitionHash[HASH_SIZE_MAX];
+	UINT64          SampleBytes;
+	UINT64          CacheSeconds;
+	UINTN           Benchmark;
+	BOOLEAN         Streaming;
+	EFI_STATUS      Status;
+} PARSE_STATE;
+
+/* The hash list that is being streamed, if any */
+STATIC PARSE_STATE Stream = { 0 };
+
+/**
+  Get the total size of the files of a hash list, from the size of its entries.
+
+  @param[in]  List          A pointer to the HASH_LIST.
+
+  @retval     The total size, or 0 if any of the entries doesn't provide a size.
+**/
+STATIC UINT64 GetEntriesSize(
+	IN CONST HASH_LIST* List
+)
+{
+	UINT64 TotalBytes = 0;
+	UINTN i;
+
+	for (i = 0; i < List->NumEntries; i++) {
+		if (GetEntrySize(List, &List->Entry[i]) == HASH_SIZE_UNKNOWN)
+			return 0;
+		TotalBytes += GetEntrySize(List, &List->Entry[i]);
+	}
+	return TotalBytes;
+}
+
+/**
+  Get the size of a hash list file, and check that it is one we can process.
+
+  @param[in]  File          A handle to the hash list file.
+  @param[in]  Path          A pointer to the CHAR16 string with the name of the file.
+  @param[in]  MinSize       The minimum size of a valid file.
+  @param[out] Size          A pointer to receive the size of the file.
+
+  @retval EFI_SUCCESS           The size was retrieved.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval EFI_UNSUPPORTED       The hash list file is too small or too large.
+  @retval other                 The size of the file could not be retrieved.
+**/
+STATIC EFI_STATUS GetHashFileSize(
+	IN CONST EFI_FILE_HANDLE File,
+	IN CONST CHAR16* Path,
+	IN CONST UINTN MinSize,
+	OUT UINTN* Size
+)
+{
+	EFI_STATUS Status;
+	EFI_FILE_INFO* Info = NULL;
+	UINTN InfoSize = FILE_INFO_SIZE;
+
+	Info = AllocateZeroPool(InfoSize);
 	if (Info == NULL) {
 		Status = EFI_OUT_OF_RESOURCES;
 		PrintError(L"Unable to allocate memory");
 		goto out;
 	}
-	Status = File->GetInfo(File, &gEfiFileInfoGuid, &Size, Info);
+	Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, Info);
 	if (EFI_ERROR(Status)) {
-		PrintError(L"Unable to get '%s' size", HASH_FILE);
+		PrintError(L"Unable to get '%s' size", Path);
 		goto out;
 	}
-	if (Info->FileSize < HASH_HEXASCII_SIZE + 2) {
+	if (Info->FileSize < MinSize) {
 		Status = EFI_UNSUPPORTED;
-		PrintError(L"'%s' is too small", HASH_FILE);
+		PrintError(L"'%s' is too small", Path);
 		goto out;
 	}
 	if (Info->FileSize > HASH_FILE_SIZE_MAX) {
 		Status = EFI_UNSUPPORTED;
-		PrintError(L"'%s' is too large", HASH_FILE);
+		PrintError(L"'%s' is too large", Path);
 		goto out;
 	}
-	HashFileSize = (UINTN)Info->FileSize;
-	// +1 so we can add a newline at the end
-	HashFile = AllocatePool(HashFileSize + 1);
-	if (HashFile == NULL) {
-		Status = EFI_OUT_OF_RESOURCES;
-		PrintError(L"Unable to allocate memory");
-		goto out;
-	}
-	Size = HashFileSize;
-	Status = File->Read(File, &Size, HashFile);
-	if (!EFI_ERROR(Status) && Size != HashFileSize)
+	*Size = (UINTN)Info->FileSize;
+
+out:
+	SafeFree(Info);
+	return Status;
+}
+
+/**
+  Read the next HASH_FILE_READSIZE bytes of a hash sum list file. Once the
+  whole file has been read, a newline is added at the end of the buffer.
+
+  @param[in,out] State      A pointer to the PARSE_STATE of the file.
+
+  @retval EFI_SUCCESS       The data was read.
+  @retval EFI_END_OF_FILE   The hash list file could not be read.
+**/
+STATIC EFI_STATUS ReadHashFile(
+	IN OUT PARSE_STATE* State
+)
+{
+	EFI_STATUS Status;
+	UINTN Size, FileSize = State->HashFileSize - 1;
+
+	Size = MIN(HASH_FILE_READSIZE, FileSize - State->ReadSize);
+	Status = State->File->Read(State->File, &Size, &State->HashFile[State->ReadSize]);
+	if (!EFI_ERROR(Status) && Size == 0)
 		Status = EFI_END_OF_FILE;
 	if (EFI_ERROR(Status)) {
-		PrintError(L"Unable to read '%s'", HASH_FILE);
-		goto out;
+		PrintError(L"Unable to read '%s'", State->Path);
+		return Status;
 	}
-	// Correct to the actual size of our buffer and add a newline
-	HashFile[HashFileSize++] = '\n';
+	State->ReadSize += Size;
+	// Add a newline, once we have the whole file
+	if (State->ReadSize == FileSize)
+		State->HashFile[State->ReadSize++] = '\n';
+	return EFI_SUCCESS;
+}
+
+/**
+  Validate the data that was read from a hash sum list file, convert its line
+  endings to UNIX style, and count its lines.
+
+  @param[in,out] State      A pointer to the PARSE_STATE of the file.
+
+  @retval EFI_SUCCESS       The data is valid.
+  @retval EFI_UNSUPPORTED   The hash list file contains too many lines.
+  @retval EFI_ABORTED       The hash list file contains invalid data.
+**/
+STATIC EFI_STATUS ScanHashFile(
+	IN OUT PARSE_STATE* State
+)
+{
+	EFI_STATUS Status;
+	UINT8* HashFile = State->HashFile;
+	UINTN i, Limit;
 
-	// Compute the maximum number of lines/entries we need to allocate
-	NumLines = 1;	// We added a line break
-	for (i = 0; i < HashFileSize - 1; i++) {
+	// The last byte we read is kept for the next call, since DOS style line
+	// endings require looking ahead. Once the whole file has been read, the
+	// last byte is the newline we added.
+	Limit = State->ReadSize - 1;
+	for (i = State->ScanSize; i < Limit; i++) {
+		// Skip whole words that don't contain any control character, which
+		// is the case for the vast majority of them
+		if ((i & (sizeof(UINTN) - 1)) == 0) {
+			while (i + sizeof(UINTN) <= Limit && !HAS_CONTROL_CHAR(*(UINTN*)&HashFile[i]))
+				i += sizeof(UINTN);
+			if (i >= Limit)
+				break;
+		}
 		if (HashFile[i] == '\n') {
-			NumLines++;
+			State->NumLines++;
 		} else if (HashFile[i] == '\r') {
 			// Convert to UNIX style
 			HashFile[i] = '\n';
 			// Don't double count lines with DOS style ending
 			if (HashFile[i + 1] != '\n')
-				NumLines++;
+				State->NumLines++;
 		} else if (HashFile[i] < ' ' && HashFile[i] != '\t') {
 			// Do not allow any NUL or control characters besides TAB
 			Status = EFI_ABORTED;
-			PrintError(L"'%s' contains invalid data", HASH_FILE);
-			goto out;
+			PrintError(L"'%s' contains invalid data", State->Path);
+			return Status;
 		}
 	}
+	State->ScanSize = Limit;
 
 	// Don't allow files with more than a specific set of entries
-	if (NumLines > HASH_FILE_LINES_MAX) {
+	if (State->NumLines > HASH_FILE_LINES_MAX) {
 		Status = EFI_UNSUPPORTED;
-		PrintError(L"'%s' contains too many lines", HASH_FILE);
-		goto out;
+		PrintError(L"'%s' contains too many lines", State->Path);
+		return Status;
 	}
+	return EFI_SUCCESS;
+}
 
-	// Allocate an array of hash entries
-	HashList = AllocateZeroPool(NumLines * sizeof(HASH_ENTRY));
-	if (HashList == NULL) {
-		Status = EFI_OUT_OF_RESOURCES;
-		PrintError(L"Unable to allocate memory");
-		goto out;
+/**
+  Check that the UTF-8 path of a hash list entry can be converted to UCS-2, so
+  that invalid paths are reported before the verification starts. The paths are
+  only converted when their file is opened, so the result is discarded. If the
+  path is not valid UTF-8, the entry is flagged with HASH_ENTRY_INVALID_PATH.
+
+  @param[in,out] State      A pointer to the PARSE_STATE of the file.
+  @param[in]     Path       A pointer to the UTF-8 path, that isn't only ASCII.
+  @param[in]     Length     The length of the UTF-8 path (in bytes).
+  @param[in,out] Entry      A pointer to the HASH_ENTRY the path belongs to.
+**/
+STATIC VOID CheckHashPath(
+	IN OUT PARSE_STATE* State,
+	IN CONST CHAR8* Path,
+	IN CONST UINTN Length,
+	IN OUT HASH_ENTRY* Entry
+)
+{
+	EFI_STATUS Status;
+	CHAR16 Ucs2Path[PATH_MAX + 1];
+	UINTN Ucs2Length;
+	UINT64 StatsStart;
+
+	StatsStart = STATS_TIMESTAMP();
+	Status = Utf8ToUcs2(Path, Length, Ucs2Path, ARRAY_SIZE(Ucs2Path), &Ucs2Length);
+	STATS_ADD(STATS_UTF8, StatsStart, 0);
+	if (EFI_ERROR(Status)) {
+		// Only report the first invalid path, as the entries report their own failure
+		if (State->NumInvalidPaths++ == 0)
+			PrintWarning(L"'%s' contains paths that are not valid UTF-8", State->Path);
+		Entry->Flags |= HASH_ENTRY_INVALID_PATH;
+	}
+}
+
+/**
+  Convert the lines of a hash sum list file that are validated and complete
+  into hash list entries. The binary hash value and the UTF-8 path of each
+  entry are stored in place, after the ones of the previous entries, which is
+  possible because they always are shorter than the line they come from.
+
+  @param[in,out] State      A pointer to the PARSE_STATE of the file.
+
+  @retval EFI_SUCCESS       The lines were converted.
+  @retval EFI_ABORTED       The hash list file contains invalid data.
+**/
+STATIC EFI_STATUS ParseHashFileLines(
+	IN OUT PARSE_STATE* State
+)
+{
+	EFI_STATUS Status;
+	UINT8* HashFile = State->HashFile;
+	HASH_ENTRY* HashList = State->List->Entry;
+	CONST UINTN HashSize = State->List->Algorithm->HashSize;
+	CONST UINTN HexSize = HashSize * 2;
+	CONST BOOLEAN Complete = (State->ReadSize == State->HashFileSize);
+	CHAR8* Hash;
+	CHAR16 Label[VOLUME_LABEL_SIZE];
+	UINT8 b = 0, HighBits;
+	UINTN i, j, c, Line, Path, Limit, NumEntries = State->List->NumEntries;
+
+	// Only process the lines that we have in full
+	if (Complete) {
+		Limit = State->HashFileSize;
+	} else {
+		for (Limit = State->ScanSize; Limit > State->ParseSize && HashFile[Limit - 1] != '\n'; Limit--);
 	}
 
-	// Now parse the file to populate the array
-	NumEntries = 0;
-	for (i = 0; i < HashFileSize; ) {
+	for (i = State->ParseSize; i < Limit; ) {
 		// Ignore whitespaces, control characters or anything non-ASCII
 		// (such as BOMs) that may precede a hash entry or a comment.
-		while ((HashFile[i] <= ' ' || HashFile[i] >= 0x80) && i < HashFileSize)
+		while (i < Limit && (HashFile[i] <= ' ' || HashFile[i] >= 0x80))
 			i++;
-		if (i >= HashFileSize)
+		if (i >= Limit)
 			break;
 
 		// Parse comments
 		if (HashFile[i] == '#') {
-			// Look for an "md5sum_totalbytes = 0x########" comment
+			// Look for "md5sum_totalbytes = 0x########",
+			// "md5sum_chunksize = 0x########", "md5sum_order = <name>",
+			// "md5sum_filesize = 0x########", "md5sum_reader = <name>",
+			// "md5sum_verify = <name>", "md5sum_partition = <hash> 0x########",
+			// "md5sum_sample = 0x########", "md5sum_critical = <name>",
+			// "md5sum_benchmark = <name>", "md5sum_volume = <label>" or
+			// "md5sum_cache = 0x########" comments
 
 			// Set c to the start of the comment (skipping the '#' prefix)
 			c = i + 1;
 
-			// Note that because we added a terminating '\n' to the file,
-			// we cannot overflow on the while loop below.
+			// Note that because Limit follows a newline, we cannot
+			// overflow on the while loop below.
 			while (HashFile[i++] != '\n');
 			// i - 1, used below, is the position of the terminating '\n'
 
-			// Skip any leading spaces
-			while (c < i - 1 && IsWhiteSpace(HashFile[c]))
-				c++;
-
-			// See if we have a match for "md5sum_totalbytes = 0x########"
-			if (i > c + sizeof(TotalBytesString) - 1 && (CompareMem(&HashFile[c],
-				TotalBytesString, sizeof(TotalBytesString) - 1) == 0)) {
-				NumDigits = 0;
-				// Look for an equal sign
-				c += sizeof(TotalBytesString) - 1;
-				while (c < i - 1 && IsWhiteSpace(HashFile[c]))
-					c++;
-				if (HashFile[c++] == '=') {
-					// Look for an '0x' prefix and parse a 64-bit *lowercase*
-					// hexascii value if valid.
-					while (c < i - 1 && IsWhiteSpace(HashFile[c]))
-						c++;
-					if (c < i - 2 && HashFile[c] == '0' && HashFile[c + 1] == 'x') {
-						for (c += 2; c < i - 1; c++) {
-							if (HashFile[c] == ' ')
-								continue;
-							if (!IsValidHexAscii(HashFile[c])) {
-								NumDigits = 0;
-								break;
-							}
-							NumDigits++;
-							TotalBytes <<= 4;
-							// IsValidHexAscii() above made sure that our character
-							// is in the [0-9] or [A-F] or [a-f] ranges.
-							if (HashFile[c] - '0' < 0xa)
-								TotalBytes |= HashFile[c] - '0';
-							else if (HashFile[c] - 'A' < 6)
-								TotalBytes |= HashFile[c] - 'A' + 0xa;
-							else
-								TotalBytes |= HashFile[c] - 'a' + 0xa;
-						}
-					}
-				}
-				if (NumDigits == 0 || NumDigits > 16) {
-					PrintWarning(L"Ignoring invalid md5sum_totalbytes value");
-					TotalBytes = 0;
-				}
+			if (ParseDirective(HashFile, c, i, TotalBytesString, sizeof(TotalBytesString),
+				&State->TotalBytes) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_totalbytes value");
+				State->TotalBytes = 0;
+			}
+			if (ParseDirective(HashFile, c, i, ChunkSizeString, sizeof(ChunkSizeString),
+				&State->ChunkSize) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_chunksize value");
+				State->ChunkSize = 0;
+			}
+			if (ParseNameDirective(HashFile, c, i, OrderString, sizeof(OrderString),
+				OrderName, HASH_ORDER_MAX, &State->Order) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_order value");
+				State->Order = HASH_ORDER_MANIFEST;
+			}
+			if (ParseDirective(HashFile, c, i, FileSizeString, sizeof(FileSizeString),
+				&State->FileSize) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_filesize value");
+				State->FileSize = HASH_SIZE_UNKNOWN;
+			}
+			if (ParseNameDirective(HashFile, c, i, ReaderString, sizeof(ReaderString),
+				ReaderName, HASH_READER_MAX, &State->Reader) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_reader value");
+				State->Reader = HASH_READER_FILESYSTEM;
+			}
+			if (ParseNameDirective(HashFile, c, i, VerifyString, sizeof(VerifyString),
+				VerifyName, HASH_VERIFY_MAX, &State->Verify) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_verify value");
+				State->Verify = HASH_VERIFY_FULL;
+			}
+			if (State->Streaming && State->Verify != HASH_VERIFY_FULL) {
+				PrintWarning(L"Ignoring md5sum_verify after the first entries");
+				State->Verify = HASH_VERIFY_FULL;
+			}
+			Status = ParsePartitionDirective(HashFile, c, i, HashSize, State->PartitionHash,
+				&State->PartitionBlocks);
+			if (Status == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_partition value");
+				State->PartitionBlocks = 0;
+			} else if (Status == EFI_SUCCESS && State->Streaming) {
+				PrintWarning(L"Ignoring md5sum_partition after the first entries");
+				State->PartitionBlocks = 0;
+			}
+			if (ParseDirective(HashFile, c, i, SampleString, sizeof(SampleString),
+				&State->SampleBytes) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_sample value");
+				State->SampleBytes = 0;
+			}
+			if (State->Streaming && State->SampleBytes != 0) {
+				PrintWarning(L"Ignoring md5sum_sample after the first entries");
+				State->SampleBytes = 0;
+			}
+			if (ParseNameDirective(HashFile, c, i, CriticalString, sizeof(CriticalString),
+				BooleanName, ARRAY_SIZE(BooleanName), &State->Critical) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_critical value");
+				State->Critical = 0;
+			}
+			if (ParseNameDirective(HashFile, c, i, BenchmarkString, sizeof(BenchmarkString),
+				BooleanName, ARRAY_SIZE(BooleanName), &State->Benchmark) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_benchmark value");
+				State->Benchmark = 0;
+			}
+			if (State->Streaming && State->Benchmark != 0) {
+				PrintWarning(L"Ignoring md5sum_benchmark after the first entries");
+				State->Benchmark = 0;
+			}
+			if (State->Streaming && State->Order != HASH_ORDER_MANIFEST) {
+				PrintWarning(L"Ignoring md5sum_order after the first entries");
+				State->Order = HASH_ORDER_MANIFEST;
+			}
+			if (State->Streaming && State->Reader != State->List->Reader) {
+				PrintWarning(L"Ignoring md5sum_reader after the first entries");
+				State->Reader = State->List->Reader;
+			}
+			Status = ParseVolumeDirective(HashFile, c, i, Label);
+			if (Status == EFI_INVALID_PARAMETER)
+				PrintWarning(L"Ignoring invalid md5sum_volume value");
+			else if (Status == EFI_SUCCESS && State->Streaming)
+				PrintWarning(L"Ignoring md5sum_volume after the first entries");
+			else if (Status == EFI_SUCCESS && EFI_ERROR(AddHashVolume(State->List, Label)))
+				PrintWarning(L"Ignoring md5sum_volume '%s'", Label);
+			if (ParseDirective(HashFile, c, i, CacheString, sizeof(CacheString),
+				&State->CacheSeconds) == EFI_INVALID_PARAMETER) {
+				PrintWarning(L"Ignoring invalid md5sum_cache value");
+				State->CacheSeconds = 0;
+			}
+			if (State->Streaming && State->CacheSeconds != 0) {
+				PrintWarning(L"Ignoring md5sum_cache after the first entries");
+				State->CacheSeconds = 0;
 			}
 			continue;
 		}
 
-		// Check for a valid hash, which should be HASH_HEXASCII_SIZE
-		// hexascii followed by whitespace.
-		if (i + HASH_HEXASCII_SIZE >= HashFileSize ||
-			(!IsWhiteSpace(HashFile[i + HASH_HEXASCII_SIZE]))) {
-			HashFile[MIN(HashFileSize - 1, i + HASH_HEXASCII_SIZE)] = '\0';
+		// Check for a valid hash, which should be HexSize hexascii
+		// followed by whitespace.
+		if (i + HexSize >= Limit || (!IsWhiteSpace(HashFile[i + HexSize]))) {
+			// What follows this line may change the error, so wait until we have it
+			if (i + HexSize >= Limit && !Complete)
+				break;
+			HashFile[MIN(Limit - 1, i + HexSize)] = '\0';
 			Status = EFI_ABORTED;
 			PrintError(L"Invalid data after '%a'", (CHAR8*)&HashFile[i]);
-			goto out;
+			return Status;
 		}
 
-		// NUL-terminate the hash value, add it to our array and validate it
-		HashFile[i + HASH_HEXASCII_SIZE] = '\0';
-		HashList[NumEntries].Hash = (CHAR8*)&HashFile[i];
+		// NUL-terminate the hash value and validate it
+		V_ASSERT(NumEntries < State->MaxEntries);
+		Line = i;
+		HashFile[i + HexSize] = '\0';
+		Hash = (CHAR8*)&HashFile[i];
 		for (; HashFile[i] != '\0'; i++) {
 			// Convert A-F to lowercase
 			if (HashFile[i] >= 'A' && HashFile[i] <= 'F')
 				HashFile[i] += 0x20;
 			if (!IsValidHexAscii(HashFile[i])) {
 				Status = EFI_ABORTED;
-				PrintError(L"Invalid data in '%a'", HashList[NumEntries].Hash);
-				goto out;
+				PrintError(L"Invalid data in '%a'", Hash);
+				return Status;
 			}
 		}
 
 		// Skip data between hash and path
-		while (++i < HashFileSize && HashFile[i] < 0x21) {
+		while (++i < Limit && HashFile[i] < 0x21) {
 			// Anything other than whitespace is illegal
 			if (!IsWhiteSpace(HashFile[i])) {
 				Status = EFI_ABORTED;
-				PrintError(L"Invalid data after '%a'", HashList[NumEntries].Hash);
-				goto out;
+				PrintError(L"Invalid data after '%a'", Hash);
+				return Status;
 			}
 		}
 
 		// Start of path value
 		c = i;
-		while (i < HashFileSize && HashFile[i] != '\n') {
+		HighBits = 0;
+		while (i < Limit && HashFile[i] != '\n') {
+			HighBits |= HashFile[i];
 			if (HashFile[i] == '/') {
 				// Convert slashes to backslashes
 				HashFile[i] = '\\';
@@ -257,29 +806,712 @@ EFI_STATUS Parse(
 		// Check for a path parsing error above or an illegal path length
 		if (i == c || i > c + PATH_MAX) {
 			Status = EFI_ABORTED;
-			PrintError(L"Invalid data after '%a'", HashList[NumEntries].Hash);
-			goto out;
+			PrintError(L"Invalid data after '%a'", Hash);
+			return Status;
 		}
-		// NUL-terminate the path.
-		// Note that we can't overflow here since we added an extra 0x0A to our file.
-		HashFile[i++] = '\0';
-		HashList[NumEntries].Path = (CHAR8*)&HashFile[c];
+		V_ASSERT(i > Line && State->WriteSize <= Line);
+
+		// Paths that are only ASCII, as most are, are always valid UTF-8
+		HashList[NumEntries].Flags = (State->Critical != 0) ? HASH_ENTRY_CRITICAL : 0;
+		State->Critical = 0;
+		if (HighBits & 0x80)
+			CheckHashPath(State, (CHAR8*)&HashFile[c], i - c, &HashList[NumEntries]);
+
+		// Decode the hash value. Since we never write past the hex digits we
+		// already read, the text we haven't processed yet is left untouched.
+		for (j = 0; j < HexSize; j++) {
+			b = (b << 4) | (Hash[j] >= 'a' ? (Hash[j] - 'a' + 0x0A) : Hash[j] - '0');
+			if (j & 1)
+				HashFile[State->WriteSize + j / 2] = b;
+		}
+		// Move the path after it, and NUL-terminate it.
+		// Note that we can't overflow here since Limit follows a newline.
+		Path = State->WriteSize + HashSize;
+		for (j = c; j < i; j++)
+			HashFile[Path + j - c] = HashFile[j];
+		HashFile[Path + i - c] = '\0';
+		i++;
+		HashList[NumEntries].Hash = (UINT32)State->WriteSize;
+		HashList[NumEntries].Path = (UINT32)Path;
+		State->WriteSize = Path + i - c;
+		HashList[NumEntries].Index = (UINT32)NumEntries;
+		// Most lists don't provide sizes, so we only allocate them for the ones that do
+		if (State->FileSize != HASH_SIZE_UNKNOWN && State->List->Size == NULL) {
+			State->List->Size = AllocatePool(State->MaxEntries * sizeof(UINT64));
+			if (State->List->Size == NULL) {
+				Status = EFI_OUT_OF_RESOURCES;
+				PrintError(L"Unable to allocate memory");
+				return Status;
+			}
+			for (j = 0; j < State->MaxEntries; j++)
+				State->List->Size[j] = HASH_SIZE_UNKNOWN;
+		}
+		if (State->List->Size != NULL)
+			State->List->Size[NumEntries] = State->FileSize;
+		State->FileSize = HASH_SIZE_UNKNOWN;
 		NumEntries++;
 	}
 
-	List->NumEntries = NumEntries;
-	List->Buffer = HashFile;
-	List->Entry = HashList;
-	List->TotalBytes = TotalBytes;
+	State->ParseSize = i;
+	State->List->NumEntries = NumEntries;
+	return EFI_SUCCESS;
+}
+
+/**
+  Release the memory that a fully parsed hash list doesn't use, by moving its
+  entries, sizes and buffer to allocations of the size they need.
+
+  @param[in,out] State      A pointer to the PARSE_STATE of the file.
+**/
+STATIC VOID ShrinkHashList(
+	IN OUT PARSE_STATE* State
+)
+{
+	HASH_LIST* List = State->List;
+	HASH_ENTRY* Entry;
+	UINT64* Size = NULL;
+	UINT8* Buffer;
+
+	// This is only an optimization, so allocation failures are ignored
+	if (List->NumEntries != 0 && List->NumEntries < State->MaxEntries) {
+		Entry = AllocatePool(List->NumEntries * sizeof(HASH_ENTRY));
+		if (List->Size != NULL)
+			Size = AllocatePool(List->NumEntries * sizeof(UINT64));
+		if (Entry != NULL && (List->Size == NULL || Size != NULL)) {
+			CopyMem(Entry, List->Entry, List->NumEntries * sizeof(HASH_ENTRY));
+			SafeFree(List->Entry);
+			List->Entry = Entry;
+			if (Size != NULL) {
+				CopyMem(Size, List->Size, List->NumEntries * sizeof(UINT64));
+				SafeFree(List->Size);
+				List->Size = Size;
+			}
+			State->MaxEntries = List->NumEntries;
+		} else {
+			if (Entry != NULL)
+				SafeFree(Entry);
+			if (Size != NULL)
+				SafeFree(Size);
+		}
+	}
+	if (State->WriteSize != 0 && State->WriteSize < State->HashFileSize) {
+		Buffer = AllocatePool(State->WriteSize);
+		if (Buffer != NULL) {
+			CopyMem(Buffer, List->Buffer, State->WriteSize);
+			SafeFree(List->Buffer);
+			List->Buffer = Buffer;
+			State->HashFile = Buffer;
+		}
+	}
+}
+
+/**
+  Read, validate and convert the next part of a hash sum list file.
+
+  @param[in,out] State      A pointer to the PARSE_STATE of the file.
+
+  @retval EFI_SUCCESS       The data was processed.
+  @retval other             See ParseFile().
+**/
+STATIC EFI_STATUS ParseNextPart(
+	IN OUT PARSE_STATE* State
+)
+{
+	EFI_STATUS Status;
+
+	Status = ReadHashFile(State);
+	if (!EFI_ERROR(Status))
+		Status = ScanHashFile(State);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	// Allocate the array of hash entries once we know how many we may need
+	if (State->List->Entry == NULL) {
+		if (State->ReadSize == State->HashFileSize)
+			State->MaxEntries = State->NumLines;
+		else
+			// An entry requires at least a hash, a space, a 1-character path and a newline
+			State->MaxEntries = MIN(HASH_FILE_LINES_MAX, State->HashFileSize /
+				(State->List->Algorithm->HashSize * 2 + 3) + 1);
+		State->List->Entry = AllocateZeroPool(State->MaxEntries * sizeof(HASH_ENTRY));
+		if (State->List->Entry == NULL) {
+			Status = EFI_OUT_OF_RESOURCES;
+			PrintError(L"Unable to allocate memory");
+			return Status;
+		}
+	}
+
+	Status = ParseHashFileLines(State);
+	if (!EFI_ERROR(Status) && State->ReadSize == State->HashFileSize)
+		ShrinkHashList(State);
+	return Status;
+}
+
+/**
+  Parse an opened hash sum list file and populate a HASH_LIST structure from it.
+  The hash algorithm must have been set in the HASH_LIST structure.
+  If streaming is allowed and the file is large, the beginning of the file
+  provides the total size of the files and the entries are to be verified in
+  the order of the list, then only the first part of the file is parsed, and
+  the file is kept open so that the rest can be parsed with ParseNextEntries().
+
+  @param[in]  File      A handle to the hash sum list file.
+  @param[in]  Path      A pointer to the CHAR16 string with the name of the file.
+  @param[in]  AllowStreaming Whether the file may be parsed while its entries are verified.
+  @param[in,out] List   A pointer to the HASH_LIST structure to populate.
+
+  @retval EFI_SUCCESS           The file was successfully parsed and the hash list is populated.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval EFI_UNSUPPORTED       The hash list file is too small or too large.
+  @retval EFI_END_OF_FILE       The hash list file could not be read.
+  @retval EFI_ABORTED           The hash list file contains invalid data.
+**/
+STATIC EFI_STATUS ParseFile(
+	IN CONST EFI_FILE_HANDLE File,
+	IN CONST CHAR16* Path,
+	IN CONST BOOLEAN AllowStreaming,
+	IN OUT HASH_LIST* List
+)
+{
+	EFI_STATUS Status;
+	PARSE_STATE State = { 0 };
+	UINTN Size;
+
+	State.File = File;
+	State.Path = Path;
+	State.List = List;
+	State.Order = HASH_ORDER_MANIFEST;
+	State.Reader = HASH_READER_FILESYSTEM;
+	State.FileSize = HASH_SIZE_UNKNOWN;
+	List->Reader = HASH_READER_FILESYSTEM;
+	List->Verify = HASH_VERIFY_FULL;
+	List->Buffer = NULL;
+	List->Size = NULL;
+	List->WidePaths = FALSE;
+	List->Entry = NULL;
+	List->NumEntries = 0;
+	List->Volume = NULL;
+	List->NumVolumes = 0;
+
+	// Allocate a buffer for the whole file
+	Status = GetHashFileSize(File, Path, List->Algorithm->HashSize * 2 + 2, &Size);
+	if (EFI_ERROR(Status))
+		goto out;
+	// +1 so we can add a newline at the end
+	State.HashFileSize = Size + 1;
+	State.HashFile = AllocatePool(State.HashFileSize);
+	if (State.HashFile == NULL) {
+		Status = EFI_OUT_OF_RESOURCES;
+		PrintError(L"Unable to allocate memory");
+		goto out;
+	}
+	State.NumLines = 1;	// We add a line break
+	List->Buffer = State.HashFile;
+
+	do {
+		Status = ParseNextPart(&State);
+		if (EFI_ERROR(Status))
+			goto out;
+		// We can start verifying entries before the whole list has been parsed
+		// if we don't need it for progress, for reordering, for merging it
+		// with the lists of other volumes or for comparing it with the cache.
+		if (AllowStreaming && State.ReadSize < State.HashFileSize && State.TotalBytes != 0 &&
+			State.Order == HASH_ORDER_MANIFEST && State.PartitionBlocks == 0 &&
+			State.Verify == HASH_VERIFY_FULL && State.SampleBytes == 0 && List->Volume == NULL &&
+			State.CacheSeconds == 0 && List->NumEntries != 0) {
+			State.Streaming = TRUE;
+			List->Reader = State.Reader;
+			CopyMem(&Stream, &State, sizeof(State));
+			break;
+		}
+	} while (State.ReadSize < State.HashFileSize);
+
+	// If all the entries have a size, we have the total size anyway
+	if (State.TotalBytes == 0 && !State.Streaming)
+		State.TotalBytes = GetEntriesSize(List);
+	List->TotalBytes = State.TotalBytes;
+	List->ChunkSize = State.ChunkSize;
+	List->Order = State.Order;
+	List->Reader = State.Reader;
+	List->Verify = State.Verify;
+	List->PartitionBlocks = State.PartitionBlocks;
+	CopyMem(List->PartitionHash, State.PartitionHash, sizeof(List->PartitionHash));
+	List->SampleBytes = State.SampleBytes;
+	List->CacheSeconds = State.CacheSeconds;
+	List->Benchmark = (State.Benchmark != 0);
 
 out:
-	SafeFree(Info);
-	if (File != NULL)
+	if (EFI_ERROR(Status)) {
+		if (List->Buffer != NULL)
+			SafeFree(List->Buffer);
+		if (List->Entry != NULL)
+			SafeFree(List->Entry);
+		if (List->Size != NULL)
+			SafeFree(List->Size);
+		if (List->Volume != NULL)
+			SafeFree(List->Volume);
+		List->NumEntries = 0;
+		List->NumVolumes = 0;
+	}
+
+	return Status;
+}
+
+/**
+  Check if a hash list is being streamed, i.e. if more of its entries are yet
+  to be parsed by ParseNextEntries().
+
+  @retval TRUE                  The hash list has more entries to parse.
+  @retval FALSE                 The hash list has been fully parsed, or parsing failed.
+**/
+BOOLEAN IsStreamingList(VOID)
+{
+	return Stream.Streaming;
+}
+
+/**
+  Parse the next part of the hash list that is being streamed, and add its
+  entries to the HASH_LIST that Parse() populated. If an error occurs, it is
+  reported, streaming stops and the error is returned by ExitParse().
+**/
+VOID ParseNextEntries(VOID)
+{
+	UINT64 StatsStart = STATS_TIMESTAMP();
+
+	if (!Stream.Streaming)
+		return;
+	Stream.Status = ParseNextPart(&Stream);
+	STATS_ADD(STATS_PARSE, StatsStart, 0);
+	if (EFI_ERROR(Stream.Status) || Stream.ReadSize == Stream.HashFileSize)
+		ExitParse();
+}
+
+/**
+  Stop streaming the hash list, if one is being streamed, and close its file.
+
+  @retval EFI_SUCCESS           The hash list was fully parsed, or streaming was interrupted.
+  @retval other                 An error occurred while parsing the rest of the hash list.
+**/
+EFI_STATUS ExitParse(VOID)
+{
+	if (Stream.Streaming)
+		Stream.File->Close(Stream.File);
+	Stream.Streaming = FALSE;
+	return Stream.Status;
+}
+
+/**
+  Load a precompiled binary hash list file, and populate a HASH_LIST structure
+  from it. As opposed to ParseFile(), the data is used as is, so this only
+  validates the header and the path offsets of the records, and converts the
+  slashes of the path table to backslashes, in place. The entries point at the
+  hash values of the records and at the path table of the file, so that the
+  file data is the only copy of the paths that is kept.
+
+  @param[in]  File      A handle to the binary hash list file.
+  @param[in]  Path      A pointer to the CHAR16 string with the name of the file.
+  @param[in,out] List   A pointer to the HASH_LIST structure to populate.
+
+  @retval EFI_SUCCESS           The file was successfully loaded and the hash list is populated.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval EFI_UNSUPPORTED       The hash list file is too small or too large.
+  @retval EFI_END_OF_FILE       The hash list file could not be read.
+  @retval EFI_ABORTED           The hash list file is not valid.
+**/
+STATIC EFI_STATUS ParseBinaryFile(
+	IN CONST EFI_FILE_HANDLE File,
+	IN CONST CHAR16* Path,
+	IN OUT HASH_LIST* List
+)
+{
+	EFI_STATUS Status;
+	HASH_BIN_HEADER* Header;
+	HASH_BIN_RECORD* Record;
+	CHAR16* Paths;
+	UINT32 Crc32 = 0;
+	UINTN i, Size, ReadSize, RecordSize, Offset;
+
+	List->Buffer = NULL;
+	List->Size = NULL;
+	List->WidePaths = FALSE;
+	List->Entry = NULL;
+	List->NumEntries = 0;
+	List->Volume = NULL;
+	List->NumVolumes = 0;
+
+	Status = GetHashFileSize(File, Path, sizeof(HASH_BIN_HEADER) + sizeof(CHAR16), &Size);
+	if (EFI_ERROR(Status))
+		goto out;
+	List->Buffer = AllocatePool(Size);
+	if (List->Buffer == NULL) {
+		Status = EFI_OUT_OF_RESOURCES;
+		PrintError(L"Unable to allocate memory");
+		goto out;
+	}
+	ReadSize = Size;
+	Status = File->Read(File, &ReadSize, List->Buffer);
+	if (!EFI_ERROR(Status) && ReadSize != Size)
+		Status = EFI_END_OF_FILE;
+	if (EFI_ERROR(Status)) {
+		PrintError(L"Unable to read '%s'", Path);
+		goto out;
+	}
+
+	// Validate the header, starting with its checksum
+	Header = (HASH_BIN_HEADER*)List->Buffer;
+	Crc32 = Header->Crc32;
+	Header->Crc32 = 0;
+	Status = gBS->CalculateCrc32(Header, sizeof(HASH_BIN_HEADER), &Header->Crc32);
+	RecordSize = HASH_BIN_RECORD_SIZE(List->Algorithm->HashSize);
+	if (EFI_ERROR(Status) || Header->Crc32 != Crc32 ||
+		CompareMem(Header->Magic, HASH_BIN_MAGIC, sizeof(Header->Magic)) != 0 ||
+		Header->Version != HASH_BIN_VERSION || Header->HashSize != List->Algorithm->HashSize ||
+		Header->NumEntries > HASH_FILE_LINES_MAX ||
+		Header->PathsOffset != sizeof(HASH_BIN_HEADER) + Header->NumEntries * RecordSize ||
+		(UINT64)Header->PathsOffset + Header->PathsSize != Size ||
+		Header->PathsSize < sizeof(CHAR16) || Header->PathsSize % sizeof(CHAR16) != 0) {
+		Status = EFI_ABORTED;
+		PrintError(L"'%s' has an invalid header", Path);
+		goto out;
+	}
+	// Make sure that no path can extend past the end of the table
+	Paths = (CHAR16*)&List->Buffer[Header->PathsOffset];
+	if (Paths[Header->PathsSize / sizeof(CHAR16) - 1] != L'\0') {
+		Status = EFI_ABORTED;
+		PrintError(L"'%s' contains invalid data", Path);
+		goto out;
+	}
+
+	List->Entry = AllocatePool(MAX(Header->NumEntries, 1) * sizeof(HASH_ENTRY));
+	// Only keep the sizes if the list provides any
+	for (i = 0; i < Header->NumEntries; i++) {
+		Record = (HASH_BIN_RECORD*)&List->Buffer[sizeof(HASH_BIN_HEADER) + i * RecordSize];
+		if (Record->Size != HASH_SIZE_UNKNOWN) {
+			List->Size = AllocatePool(Header->NumEntries * sizeof(UINT64));
+			break;
+		}
+	}
+	if (List->Entry == NULL || (i < Header->NumEntries && List->Size == NULL)) {
+		Status = EFI_OUT_OF_RESOURCES;
+		PrintError(L"Unable to allocate memory");
+		goto out;
+	}
+	for (i = 0; i < Header->PathsSize / sizeof(CHAR16); i++) {
+		if (Paths[i] == L'/')
+			Paths[i] = L'\\';
+	}
+	for (i = 0; i < Header->NumEntries; i++) {
+		Offset = sizeof(HASH_BIN_HEADER) + i * RecordSize;
+		Record = (HASH_BIN_RECORD*)&List->Buffer[Offset];
+		if (Record->Path >= Header->PathsSize / sizeof(CHAR16)) {
+			Status = EFI_ABORTED;
+			PrintError(L"'%s' contains invalid data", Path);
+			goto out;
+		}
+		if (List->Size != NULL)
+			List->Size[i] = Record->Size;
+		// No path is copied: with WidePaths, Path is the byte offset of the UCS-2 path in the buffer
+		List->Entry[i].Flags = 0;
+		List->Entry[i].Volume = 0;
+		List->Entry[i].Hash = (UINT32)(Offset + sizeof(HASH_BIN_RECORD));
+		List->Entry[i].Path = Header->PathsOffset + Record->Path * sizeof(CHAR16);
+		List->Entry[i].Index = (UINT32)i;
+	}
+	List->NumEntries = Header->NumEntries;
+	List->WidePaths = TRUE;
+	List->TotalBytes = (Header->TotalBytes != 0) ? Header->TotalBytes : GetEntriesSize(List);
+
+out:
+	if (EFI_ERROR(Status)) {
+		if (List->Buffer != NULL)
+			SafeFree(List->Buffer);
+		if (List->Entry != NULL)
+			SafeFree(List->Entry);
+		if (List->Size != NULL)
+			SafeFree(List->Size);
+		List->NumEntries = 0;
+	}
+	return Status;
+}
+
+/* Upper-case an ASCII character of a hash list path, since FAT paths are case insensitive */
+STATIC __inline CHAR8 UpperPathChar(
+	IN CONST CHAR8 c
+)
+{
+	return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+/* Compare two hash list paths, ignoring the case of ASCII characters */
+STATIC BOOLEAN IsSamePath(
+	IN CONST CHAR8* p1,
+	IN CONST CHAR8* p2
+)
+{
+	while (*p1 != '\0' && UpperPathChar(*p1) == UpperPathChar(*p2)) {
+		p1++;
+		p2++;
+	}
+	return (UpperPathChar(*p1) == UpperPathChar(*p2));
+}
+
+/* FNV-1a hash of a hash list path, ignoring the case of ASCII characters */
+STATIC UINT32 HashChunkPath(
+	IN CONST CHAR8* Path
+)
+{
+	UINT32 Hash = 0x811c9dc5;
+
+	for (; *Path != '\0'; Path++)
+		Hash = (Hash ^ (UINT8)UpperPathChar(*Path)) * 0x01000193;
+	return Hash;
+}
+
+/**
+  Build the path index of the chunks, so that looking up the chunks of an
+  entry doesn't have to compare its path with the one of every chunk. Since
+  the chunks of a file are listed consecutively, only the first one is indexed.
+
+  @param[in]   List             A pointer to the HASH_LIST with the chunks to index.
+
+  @retval EFI_SUCCESS           The index was built.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+STATIC EFI_STATUS BuildChunkIndex(
+	IN OUT HASH_LIST* List
+)
+{
+	CONST CHAR8 *Path, *PreviousPath = NULL;
+	UINTN i, Slot, NumSlots = 16;
+
+	// Keep the index at most half full, for short probe sequences
+	while (NumSlots < 2 * List->NumChunks)
+		NumSlots *= 2;
+	List->ChunkIndex = AllocateZeroPool(NumSlots * sizeof(UINT32));
+	if (List->ChunkIndex == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	List->ChunkIndexMask = NumSlots - 1;
+
+	// Chunks are inserted in list order, so that the first of duplicates is found first
+	for (i = 0; i < List->NumChunks; i++) {
+		Path = GetEntryPath(List->ChunkBuffer, &List->Chunk[i]);
+		if (PreviousPath != NULL && IsSamePath(Path, PreviousPath))
+			continue;
+		PreviousPath = Path;
+		for (Slot = HashChunkPath(Path) & List->ChunkIndexMask; List->ChunkIndex[Slot] != 0;
+			Slot = (Slot + 1) & List->ChunkIndexMask);
+		List->ChunkIndex[Slot] = (UINT32)(i + 1);
+	}
+	return EFI_SUCCESS;
+}
+
+/**
+  Parse the hash sum list file of a hash algorithm and populate a HASH_LIST
+  structure from it. If the optional chunks file is present, it is parsed as well.
+  If the precompiled binary hash list file is present, it is used instead, and
+  the chunks file is ignored.
+  A missing hash list file is not reported, so that the caller can look for the
+  one from another algorithm.
+
+  @param[in]  Root      A file handle to the root directory.
+  @param[in]  Algorithm A pointer to the HASH_ALGORITHM of the hash list.
+  @param[in]  AllowStreaming Whether the entries may be verified before the whole list is parsed.
+  @param[out] List      A pointer to the HASH_LIST structure to populate.
+
+  @retval EFI_SUCCESS           The file was successfully parsed and the hash list is populated.
+  @retval EFI_INVALID_PARAMETER One or more of the input parameters are invalid.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval EFI_NOT_FOUND         The hash list file does not exist.
+  @retval EFI_UNSUPPORTED       The hash list file is too small or too large.
+  @retval EFI_END_OF_FILE       The hash list file could not be read.
+  @retval EFI_ABORTED           The hash list file contains invalid data.
+**/
+EFI_STATUS Parse(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_ALGORITHM* Algorithm,
+	IN CONST BOOLEAN AllowStreaming,
+	OUT HASH_LIST* List
+)
+{
+	EFI_STATUS Status;
+	EFI_FILE_HANDLE File = NULL;
+	HASH_LIST Chunks = { 0 };
+
+	if (Root == NULL || Algorithm == NULL || List == NULL)
+		return EFI_INVALID_PARAMETER;
+	List->Algorithm = Algorithm;
+	Chunks.Algorithm = Algorithm;
+
+	// A binary hash list takes precedence, since it doesn't need parsing
+	Status = Root->Open(Root, &File, (CHAR16*)Algorithm->BinaryFile, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+	if (!EFI_ERROR(Status)) {
+		Status = ParseBinaryFile(File, Algorithm->BinaryFile, List);
 		File->Close(File);
+		return Status;
+	}
+	if (Status != EFI_NOT_FOUND) {
+		PrintError(L"Unable to open '%s'", Algorithm->BinaryFile);
+		return Status;
+	}
+
+	// Look for the hash file on the boot partition
+	Status = Root->Open(Root, &File, (CHAR16*)Algorithm->HashFile, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+	if (EFI_ERROR(Status)) {
+		if (Status != EFI_NOT_FOUND)
+			PrintError(L"Unable to open '%s'", Algorithm->HashFile);
+		return Status;
+	}
+	Status = ParseFile(File, Algorithm->HashFile, AllowStreaming, List);
+	// A hash list that is being streamed keeps its file open
+	if (!IsStreamingList())
+		File->Close(File);
+	List->ChunkSize = 0;
+	if (EFI_ERROR(Status))
+		return Status;
+
+	// The chunks file is optional, so a missing one is never reported
+	Status = Root->Open(Root, &File, (CHAR16*)Algorithm->ChunksFile, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+	if (Status == EFI_NOT_FOUND)
+		return EFI_SUCCESS;
+	if (EFI_ERROR(Status)) {
+		PrintError(L"Unable to open '%s'", Algorithm->ChunksFile);
+		goto out;
+	}
+	Status = ParseFile(File, Algorithm->ChunksFile, FALSE, &Chunks);
+	File->Close(File);
+	if (EFI_ERROR(Status))
+		goto out;
+	// Only the hash list itself may name other volumes, and the chunks have no file size
+	if (Chunks.Volume != NULL)
+		SafeFree(Chunks.Volume);
+	if (Chunks.Size != NULL)
+		SafeFree(Chunks.Size);
+	// We need the chunks to be block aligned, so that chunk hashes can be
+	// computed with the same code as the one we use for whole files.
+	if (Chunks.ChunkSize == 0 || Chunks.ChunkSize % HASH_BLOCKSIZE_MAX != 0) {
+		Status = EFI_ABORTED;
+		PrintError(L"'%s' has no valid md5sum_chunksize", Algorithm->ChunksFile);
+		goto out;
+	}
+	List->Chunk = Chunks.Entry;
+	List->NumChunks = Chunks.NumEntries;
+	List->ChunkBuffer = Chunks.Buffer;
+	List->ChunkSize = Chunks.ChunkSize;
+	Status = BuildChunkIndex(List);
+	if (EFI_ERROR(Status))
+		PrintError(L"Could not index '%s'", Algorithm->ChunksFile);
+
+out:
 	if (EFI_ERROR(Status)) {
-		SafeFree(HashFile);
-		SafeFree(HashList);
+		ExitParse();
+		SafeFree(Chunks.Buffer);
+		SafeFree(Chunks.Entry);
+		SafeFree(List->ChunkIndex);
+		List->Chunk = NULL;
+		List->ChunkBuffer = NULL;
+		List->NumChunks = 0;
+		SafeFree(List->Buffer);
+		SafeFree(List->Entry);
+		SafeFree(List->Size);
+		SafeFree(List->Volume);
+		List->NumVolumes = 0;
 	}
+	return Status;
+}
+
+/**
+  Decode the path of a hash list entry into an UCS-2 path.
+
+  @param[in]  List          A pointer to the HASH_LIST the entry belongs to.
+  @param[in]  Entry         A pointer to the HASH_ENTRY to decode.
+  @param[out] Path          A pointer to the CHAR16 buffer that receives the path.
+  @param[in]  PathSize      The size of the Path buffer (in CHAR16).
+
+  @retval EFI_SUCCESS           The entry was successfully decoded.
+  @retval EFI_INVALID_PARAMETER The path of the hash list file is not valid UTF-8.
+  @retval EFI_BUFFER_TOO_SMALL  The path is too long.
+                                For the two errors above, Path is still filled with a
+                                version of the path that can be used for error reports.
+**/
+EFI_STATUS DecodeHashEntry(
+	IN CONST HASH_LIST* List,
+	IN CONST HASH_ENTRY* Entry,
+	OUT CHAR16* Path,
+	IN CONST UINTN PathSize
+)
+{
+	EFI_STATUS Status;
+	CONST CHAR8* EntryPath = GetEntryPath(List->Buffer, Entry);
+	CONST CHAR16* WidePath = (CONST CHAR16*)EntryPath;
+	UINTN i, Length;
+	UINT64 StatsStart;
 
+	// Binary hash lists already use UCS-2
+	if (List->WidePaths) {
+		for (i = 0; WidePath[i] != L'\0' && i < PathSize - 1; i++)
+			Path[i] = WidePath[i];
+		Path[i] = L'\0';
+		return (WidePath[i] == L'\0') ? EFI_SUCCESS : EFI_BUFFER_TOO_SMALL;
+	}
+
+	// Convert the UTF-8 path to UCS-2. Invalid paths were found when the list was parsed.
+	Length = AsciiStrLen(EntryPath);
+	Status = EFI_INVALID_PARAMETER;
+	if ((Entry->Flags & HASH_ENTRY_INVALID_PATH) == 0) {
+		StatsStart = STATS_TIMESTAMP();
+		Status = Utf8ToUcs2(EntryPath, Length, Path, PathSize, &i);
+		STATS_ADD(STATS_UTF8, StatsStart, 0);
+	}
+	if (EFI_ERROR(Status)) {
+		// Conversion failed but we want a UCS-2 Path for the failure
+		// report so just filter out anything that is non lower ASCII.
+		for (i = 0; i < Length && i < PathSize - 1; i++)
+			Path[i] = ((UINT8)EntryPath[i] < ' ' || (UINT8)EntryPath[i] >= 0x80) ? L'?' : (CHAR16)EntryPath[i];
+		Path[i] = L'\0';
+	}
 	return Status;
 }
+
+/**
+  Look up the per-chunk hashes of a hash list entry.
+
+  @param[in]  List          A pointer to the HASH_LIST the entry belongs to.
+  @param[in]  Entry         A pointer to the HASH_ENTRY to look up.
+  @param[out] Chunks        A pointer to the HASH_CHUNKS structure to populate.
+
+  @retval TRUE              Chunks were found for this entry.
+  @retval FALSE             The entry has no chunks.
+**/
+BOOLEAN FindHashChunks(
+	IN CONST HASH_LIST* List,
+	IN CONST HASH_ENTRY* Entry,
+	OUT HASH_CHUNKS* Chunks
+)
+{
+	CONST CHAR8* Path = GetEntryPath(List->Buffer, Entry);
+	UINTN i, j, Slot;
+
+	ZeroMem(Chunks, sizeof(HASH_CHUNKS));
+	// The chunks file only applies to the files of the boot volume, and is
+	// ignored along with the text hash list when a binary one is used
+	if (Entry->Volume != 0 || List->WidePaths)
+		return FALSE;
+	if (List->ChunkIndex == NULL)
+		return FALSE;
+	for (Slot = HashChunkPath(Path) & List->ChunkIndexMask; ; Slot = (Slot + 1) & List->ChunkIndexMask) {
+		if (List->ChunkIndex[Slot] == 0)
+			return FALSE;
+		i = List->ChunkIndex[Slot] - 1;
+		if (IsSamePath(GetEntryPath(List->ChunkBuffer, &List->Chunk[i]), Path))
+			break;
+	}
+	// The chunks of a file are listed consecutively, in order
+	for (j = i + 1; j < List->NumChunks &&
+		IsSamePath(GetEntryPath(List->ChunkBuffer, &List->Chunk[j]), Path); j++);
+
+	Chunks->Buffer = List->ChunkBuffer;
+	Chunks->Entry = &List->Chunk[i];
+	Chunks->NumChunks = j - i;
+	Chunks->ChunkSize = List->ChunkSize;
+	return TRUE;
+}
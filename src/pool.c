@@ -0,0 +1,267 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - I/O buffer pool
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * Rather than allocating read buffers for each file, we allocate them once,
+ * from pages that are aligned to the IoAlign requirement of the boot media,
+ * so that the storage stack can perform DMA straight into them instead of
+ * using bounce buffers.
+ * The pool holds READ_BUFFERCOUNT buffers of the largest read size that the
+ * memory budget allows. Reads start at READ_BUFFERSIZE, and the read size is
+ * doubled, for as long as doing so improves the throughput we measure over
+ * IO_POOL_SAMPLE_SIZE bytes of full reads by at least IO_POOL_MIN_GAIN percent.
+ * Since buffers are always MaxChunkSize apart, the read size can change in
+ * the middle of a file, while reads of the previous size are still pending.
+ * The pool also holds a SMALL_FILE_MAX buffer for each entry of the results
+ * window, that small files are read into in full, ahead of time, as well as
+ * the READ_BUFFERSIZE buffers of the engines that hash several files at once,
+ * which are only allocated if one of these engines runs.
+ */
+
+/* The I/O buffer pool, as set up by InitIoPool() */
+STATIC struct {
+	EFI_PHYSICAL_ADDRESS    Address;
+	UINTN                   Pages;
+	UINT8*                  Buffer;         /* READ_BUFFERCOUNT buffers of MaxChunkSize bytes */
+	UINT8*                  SmallFiles;     /* HASH_RESULT_WINDOW buffers of SMALL_FILE_MAX bytes */
+	EFI_FILE_INFO*          FileInfo;       /* FILE_INFO_SIZE bytes */
+	EFI_PHYSICAL_ADDRESS    EngineAddress;
+	UINTN                   EnginePages;
+	UINT8*                  EngineBuffer;   /* IO_ENGINE_BUFFERCOUNT buffers of READ_BUFFERSIZE bytes */
+	UINTN                   IoAlign;
+	UINTN                   ChunkSize;
+	UINTN                   MaxChunkSize;
+	BOOLEAN                 Tuned;
+	UINT64                  SampleBytes;
+	UINT64                  SampleTime;
+	UINT64                  LastRate;
+} Pool = { 0 };
+
+/**
+  Get the amount of free memory, from the UEFI memory map.
+
+  @retval The size of all the EfiConventionalMemory regions, or 0 on error.
+**/
+STATIC UINT64 GetFreeMemorySize(VOID)
+{
+	EFI_STATUS Status;
+	EFI_MEMORY_DESCRIPTOR* Map = NULL;
+	EFI_MEMORY_DESCRIPTOR* Desc;
+	UINTN i, MapSize = 0, MapKey, DescSize = 0;
+	UINT32 DescVersion;
+	UINT64 Pages = 0;
+
+	Status = gBS->GetMemoryMap(&MapSize, NULL, &MapKey, &DescSize, &DescVersion);
+	if (Status != EFI_BUFFER_TOO_SMALL || DescSize == 0)
+		return 0;
+	// Allocating the buffer for the map may add a few entries to it
+	MapSize += 4 * DescSize;
+	Map = AllocatePool(MapSize);
+	if (Map == NULL)
+		return 0;
+	Status = gBS->GetMemoryMap(&MapSize, Map, &MapKey, &DescSize, &DescVersion);
+	if (!EFI_ERROR(Status)) {
+		for (i = 0; i < MapSize / DescSize; i++) {
+			Desc = (EFI_MEMORY_DESCRIPTOR*)((UINT8*)Map + i * DescSize);
+			if (Desc->Type == EfiConventionalMemory)
+				Pages += Desc->NumberOfPages;
+		}
+	}
+	SafeFree(Map);
+	return Pages * EFI_PAGE_SIZE;
+}
+
+/**
+  Allocate the I/O buffer pool, for reads from the boot media.
+
+  @param[in]   DeviceHandle     The handle of the boot media.
+
+  @retval EFI_SUCCESS           The I/O buffer pool was allocated.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS InitIoPool(
+	IN CONST EFI_HANDLE DeviceHandle
+)
+{
+	EFI_STATUS Status;
+	EFI_BLOCK_IO_PROTOCOL* BlockIo;
+	UINT64 Budget;
+	UINTN IoAlign = EFI_PAGE_SIZE;
+
+	ZeroMem(&Pool, sizeof(Pool));
+
+	// Per specs, IoAlign is a power of two, with 0 or 1 meaning no requirement
+	Status = gBS->HandleProtocol(DeviceHandle, &gEfiBlockIoProtocolGuid, (VOID**)&BlockIo);
+	if (!EFI_ERROR(Status) && BlockIo->Media != NULL && BlockIo->Media->IoAlign > IoAlign &&
+		(BlockIo->Media->IoAlign & (BlockIo->Media->IoAlign - 1)) == 0)
+		IoAlign = BlockIo->Media->IoAlign;
+
+	// Only grow the maximum read size as far as our share of free memory allows
+	Budget = GetFreeMemorySize() >> IO_POOL_BUDGET_SHIFT;
+	for (Pool.MaxChunkSize = READ_BUFFERSIZE; Pool.MaxChunkSize < READ_BUFFERSIZE_MAX &&
+		READ_BUFFERCOUNT * Pool.MaxChunkSize * 2 <= Budget; Pool.MaxChunkSize *= 2);
+
+	for (;;) {
+		Pool.Pages = EFI_SIZE_TO_PAGES(READ_BUFFERCOUNT * Pool.MaxChunkSize +
+			HASH_RESULT_WINDOW * SMALL_FILE_MAX + FILE_INFO_SIZE) + EFI_SIZE_TO_PAGES(IoAlign) - 1;
+		Status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, Pool.Pages, &Pool.Address);
+		if (!EFI_ERROR(Status) || Pool.MaxChunkSize <= READ_BUFFERSIZE)
+			break;
+		Pool.MaxChunkSize /= 2;
+	}
+	if (EFI_ERROR(Status)) {
+		ZeroMem(&Pool, sizeof(Pool));
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	Pool.Buffer = (UINT8*)(UINTN)((Pool.Address + IoAlign - 1) & ~((EFI_PHYSICAL_ADDRESS)IoAlign - 1));
+	Pool.SmallFiles = &Pool.Buffer[READ_BUFFERCOUNT * Pool.MaxChunkSize];
+	Pool.FileInfo = (EFI_FILE_INFO*)&Pool.SmallFiles[HASH_RESULT_WINDOW * SMALL_FILE_MAX];
+	Pool.IoAlign = IoAlign;
+	Pool.ChunkSize = READ_BUFFERSIZE;
+	// We can't tune the read size if we have no means of measuring throughput
+	Pool.Tuned = (Pool.MaxChunkSize == READ_BUFFERSIZE || GetTimestamp() == 0);
+	return EFI_SUCCESS;
+}
+
+/**
+  Release the I/O buffer pool.
+**/
+VOID ExitIoPool(VOID)
+{
+	if (Pool.Pages != 0)
+		gBS->FreePages(Pool.Address, Pool.Pages);
+	if (Pool.EnginePages != 0)
+		gBS->FreePages(Pool.EngineAddress, Pool.EnginePages);
+	ZeroMem(&Pool, sizeof(Pool));
+}
+
+/**
+  Get a read buffer from the I/O buffer pool.
+
+  @param[in]   Index            The index of the buffer (between 0 and READ_BUFFERCOUNT - 1).
+  @param[out]  ChunkSize        A pointer to receive the size that reads should currently use.
+
+  @retval      A pointer to a buffer that can hold at least ChunkSize bytes.
+**/
+UINT8* GetIoBuffer(
+	IN CONST UINTN Index,
+	OUT UINTN* ChunkSize
+)
+{
+	V_ASSERT(Pool.Buffer != NULL && Index < READ_BUFFERCOUNT);
+	*ChunkSize = Pool.ChunkSize;
+	return &Pool.Buffer[Index * Pool.MaxChunkSize];
+}
+
+/**
+  Get a read buffer for the engines that hash several files at once, from the
+  I/O buffer pool. These buffers are only allocated on first use.
+
+  @param[in]   Index            The index of the buffer (between 0 and IO_ENGINE_BUFFERCOUNT - 1).
+
+  @retval      A pointer to a READ_BUFFERSIZE buffer, or NULL if the buffers could not be allocated.
+**/
+UINT8* GetIoEngineBuffer(
+	IN CONST UINTN Index
+)
+{
+	V_ASSERT(Pool.Buffer != NULL && Index < IO_ENGINE_BUFFERCOUNT);
+	if (Pool.EngineBuffer == NULL) {
+		Pool.EnginePages = EFI_SIZE_TO_PAGES(IO_ENGINE_BUFFERCOUNT * READ_BUFFERSIZE) +
+			EFI_SIZE_TO_PAGES(Pool.IoAlign) - 1;
+		if (EFI_ERROR(gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, Pool.EnginePages,
+			&Pool.EngineAddress))) {
+			Pool.EnginePages = 0;
+			return NULL;
+		}
+		Pool.EngineBuffer = (UINT8*)(UINTN)((Pool.EngineAddress + Pool.IoAlign - 1) &
+			~((EFI_PHYSICAL_ADDRESS)Pool.IoAlign - 1));
+	}
+	return &Pool.EngineBuffer[Index * READ_BUFFERSIZE];
+}
+
+/**
+  Get a small file buffer from the I/O buffer pool.
+
+  @param[in]   Index            The index of the buffer (between 0 and HASH_RESULT_WINDOW - 1).
+
+  @retval      A pointer to a SMALL_FILE_MAX buffer.
+**/
+UINT8* GetIoSmallFileBuffer(
+	IN CONST UINTN Index
+)
+{
+	V_ASSERT(Pool.SmallFiles != NULL && Index < HASH_RESULT_WINDOW);
+	return &Pool.SmallFiles[Index * SMALL_FILE_MAX];
+}
+
+/**
+  Get the file information buffer from the I/O buffer pool.
+
+  @retval      A pointer to a FILE_INFO_SIZE buffer.
+**/
+EFI_FILE_INFO* GetIoFileInfo(VOID)
+{
+	V_ASSERT(Pool.FileInfo != NULL);
+	return Pool.FileInfo;
+}
+
+/**
+  Account for the time it took to read and hash a buffer and, once enough data
+  was processed with the current read size, adjust the read size. Short reads,
+  as well as reads that were issued with a previous read size, are ignored.
+
+  @param[in]   Bytes            The number of bytes that were read and hashed.
+  @param[in]   Time             The time it took, in microseconds.
+**/
+VOID UpdateIoThroughput(
+	IN CONST UINT64 Bytes,
+	IN CONST UINT64 Time
+)
+{
+	UINT64 Rate;
+
+	if (Pool.Tuned || Bytes != Pool.ChunkSize)
+		return;
+	Pool.SampleBytes += Bytes;
+	Pool.SampleTime += Time;
+	if (Pool.SampleBytes < IO_POOL_SAMPLE_SIZE || Pool.SampleTime == 0)
+		return;
+
+	// Bytes per millisecond
+	Rate = (Pool.SampleBytes * 1000) / Pool.SampleTime;
+	Pool.SampleBytes = 0;
+	Pool.SampleTime = 0;
+
+	if (Pool.LastRate == 0 || Rate * 100 >= Pool.LastRate * (100 + IO_POOL_MIN_GAIN)) {
+		Pool.LastRate = Rate;
+		if (Pool.ChunkSize < Pool.MaxChunkSize)
+			Pool.ChunkSize *= 2;
+		else
+			Pool.Tuned = TRUE;
+		return;
+	}
+
+	// Not enough of a gain, so go back to the smaller read size if it did better
+	if (Rate < Pool.LastRate)
+		Pool.ChunkSize /= 2;
+	Pool.Tuned = TRUE;
+}
@@ -0,0 +1,666 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - On-demand verification proxy
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * A typical boot only reads a small part of the media, so, when the hash list
+ * requests it, we don't verify anything up front, but replace the simple file
+ * system protocol of the boot volume with a proxy, before the original
+ * bootloader is chain loaded. The file handles that the proxy produces hash
+ * the data of the files from the hash list as it gets read, and, once a file
+ * has been read in full, fail the read that completed it, if the hash doesn't
+ * match. Files that are read out of order, or only partially, are verified
+ * when they are closed, whereas files that are closed without having been
+ * read, e.g. after a GetInfo(), are left for another handle to verify. A file
+ * that failed verification can no longer be opened, and a file that is
+ * written to is no longer verified.
+ */
+
+/* Verification state of the hash list entries */
+#define PROXY_ENTRY_UNVERIFIED  0
+#define PROXY_ENTRY_VERIFIED    1
+#define PROXY_ENTRY_FAILED      2
+
+/* Entry value for the files that are not verified */
+#define PROXY_ENTRY_NONE        ((UINTN)-1)
+
+/* Empty slot of the path index */
+#define PROXY_SLOT_EMPTY        0
+
+/* A file handle produced by the proxy */
+typedef struct ALIGNED(64) {
+	EFI_FILE_PROTOCOL   Protocol;   /* Must be the first field, as handles are cast to PROXY_FILE */
+	EFI_FILE_HANDLE     File;       /* The handle from the original file system */
+	HASH_CONTEXT        Context;
+	UINTN               Entry;      /* The hash list entry of the file, or PROXY_ENTRY_NONE */
+	UINT64              Size;
+	UINT64              Position;
+	UINT64              HashedBytes;
+	BOOLEAN             Sequential; /* Whether all the data was read in order, so far */
+	BOOLEAN             PathValid;
+	CHAR16              Path[PATH_MAX + 1];
+} PROXY_FILE;
+
+/* The proxy, as set up by InstallVerifyProxy() */
+STATIC struct {
+	EFI_HANDLE                          DeviceHandle;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL*    Original;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL     Protocol;
+	HASH_LIST                           List;
+	UINT8*                              State;      /* PROXY_ENTRY_# of each hash list entry */
+	UINT8*                              Buffer;     /* READ_BUFFERSIZE bytes, to verify files on close */
+	EFI_FILE_INFO*                      FileInfo;   /* FILE_INFO_SIZE bytes */
+	UINT32*                             Index;      /* Open addressing table of the entries, as index + 1 */
+	UINT32*                             PathHash;   /* Hash of the normalized path of each entry */
+	UINTN                               IndexMask;  /* Number of slots of the index, minus 1 */
+	CHAR16                              EntryPath[PATH_MAX + 1];
+	CHAR16                              NormalizedPath[PATH_MAX + 1];
+} Proxy = { 0 };
+
+/**
+  Append a path to a normalized path, i.e. a path with no leading separator,
+  no double separators and no "." or ".." elements.
+
+  @param[in,out] Path           A pointer to the PATH_MAX + 1 buffer with the normalized path.
+  @param[in,out] Length         A pointer to the length of Path.
+  @param[in]     Name           A pointer to the CHAR16 string with the path to append.
+
+  @retval TRUE                  The path was appended.
+  @retval FALSE                 The resulting path would be too long.
+**/
+STATIC BOOLEAN AppendPath(
+	IN OUT CHAR16* Path,
+	IN OUT UINTN* Length,
+	IN CONST CHAR16* Name
+)
+{
+	UINTN i, Start;
+
+	for (Start = 0; Name[Start] != L'\0'; Start = (Name[i] == L'\0') ? i : i + 1) {
+		for (i = Start; Name[i] != L'\0' && Name[i] != L'\\' && Name[i] != L'/'; i++);
+		if (i == Start || (i == Start + 1 && Name[Start] == L'.'))
+			continue;
+		if (i == Start + 2 && Name[Start] == L'.' && Name[Start + 1] == L'.') {
+			while (*Length > 0 && Path[*Length - 1] != L'\\')
+				(*Length)--;
+			if (*Length > 0)
+				(*Length)--;
+		} else {
+			if (*Length + (*Length > 0 ? 1 : 0) + (i - Start) > PATH_MAX)
+				return FALSE;
+			if (*Length > 0)
+				Path[(*Length)++] = L'\\';
+			CopyMem(&Path[*Length], &Name[Start], (i - Start) * sizeof(CHAR16));
+			*Length += i - Start;
+		}
+		Path[*Length] = L'\0';
+	}
+	Path[*Length] = L'\0';
+	return TRUE;
+}
+
+/**
+  Compute the hash of a normalized path for the path index. Since FAT paths
+  are case insensitive, the case of ASCII characters is ignored.
+
+  @param[in]   Path             A pointer to the CHAR16 string with the normalized path.
+
+  @retval      The 32-bit FNV-1a hash of the path.
+**/
+STATIC UINT32 HashProxyPath(
+	IN CONST CHAR16* Path
+)
+{
+	UINT32 Hash = 0x811c9dc5;
+	CHAR16 c;
+
+	for (; *Path != L'\0'; Path++) {
+		c = (*Path >= L'a' && *Path <= L'z') ? *Path - L'a' + L'A' : *Path;
+		Hash = (Hash ^ (UINT32)c) * 0x01000193;
+	}
+	return Hash;
+}
+
+/**
+  Decode the path of a hash list entry into Proxy.NormalizedPath.
+
+  @param[in]   List             A pointer to the HASH_LIST the entry belongs to.
+  @param[in]   Entry            The index of the entry.
+
+  @retval TRUE                  The path of the entry was normalized.
+  @retval FALSE                 The path of the entry could not be decoded, or is too long.
+**/
+STATIC BOOLEAN NormalizeEntryPath(
+	IN CONST HASH_LIST* List,
+	IN CONST UINTN Entry
+)
+{
+	UINTN Length = 0;
+
+	if (DecodeHashEntry(List, &List->Entry[Entry], Proxy.EntryPath,
+		ARRAY_SIZE(Proxy.EntryPath)) != EFI_SUCCESS)
+		return FALSE;
+	// Hash list paths may use a leading separator or "." elements
+	return AppendPath(Proxy.NormalizedPath, &Length, Proxy.EntryPath);
+}
+
+/**
+  Build the path index of the hash list, so that opening a file doesn't have
+  to decode and normalize the path of every entry. Entries whose paths can't
+  be normalized are left out, as they can't match any file.
+
+  @param[in]   List             A pointer to the HASH_LIST to index.
+
+  @retval EFI_SUCCESS           The index was built.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+STATIC EFI_STATUS BuildProxyIndex(
+	IN CONST HASH_LIST* List
+)
+{
+	UINTN i, Slot, NumSlots = 16;
+
+	// Keep the index at most half full, for short probe sequences
+	while (NumSlots < 2 * List->NumEntries)
+		NumSlots *= 2;
+	Proxy.Index = AllocateZeroPool(NumSlots * sizeof(UINT32));
+	Proxy.PathHash = AllocatePool((List->NumEntries + 1) * sizeof(UINT32));
+	if (Proxy.Index == NULL || Proxy.PathHash == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	Proxy.IndexMask = NumSlots - 1;
+
+	// Entries are inserted in list order, so that the first of duplicates is found first
+	for (i = 0; i < List->NumEntries; i++) {
+		if (!NormalizeEntryPath(List, i))
+			continue;
+		Proxy.PathHash[i] = HashProxyPath(Proxy.NormalizedPath);
+		for (Slot = Proxy.PathHash[i] & Proxy.IndexMask; Proxy.Index[Slot] != PROXY_SLOT_EMPTY;
+			Slot = (Slot + 1) & Proxy.IndexMask);
+		Proxy.Index[Slot] = (UINT32)(i + 1);
+	}
+	return EFI_SUCCESS;
+}
+
+/**
+  Find the hash list entry of a normalized path. Since FAT paths are case
+  insensitive, the case of ASCII characters is ignored.
+
+  @param[in]   Path             A pointer to the CHAR16 string with the normalized path.
+
+  @retval      The index of the entry, or PROXY_ENTRY_NONE if the path isn't in the hash list.
+**/
+STATIC UINTN FindProxyEntry(
+	IN CONST CHAR16* Path
+)
+{
+	UINT32 Hash = HashProxyPath(Path);
+	UINTN i, j, Slot;
+	CHAR16 a, b;
+
+	for (Slot = Hash & Proxy.IndexMask; Proxy.Index[Slot] != PROXY_SLOT_EMPTY;
+		Slot = (Slot + 1) & Proxy.IndexMask) {
+		i = Proxy.Index[Slot] - 1;
+		// Only the entries with the same hash need their path compared
+		if (Proxy.PathHash[i] != Hash || !NormalizeEntryPath(&Proxy.List, i))
+			continue;
+		for (j = 0; ; j++) {
+			a = (Path[j] >= L'a' && Path[j] <= L'z') ? Path[j] - L'a' + L'A' : Path[j];
+			b = (Proxy.NormalizedPath[j] >= L'a' && Proxy.NormalizedPath[j] <= L'z') ?
+				Proxy.NormalizedPath[j] - L'a' + L'A' : Proxy.NormalizedPath[j];
+			if (a != b || a == L'\0')
+				break;
+		}
+		if (a == b)
+			return i;
+	}
+	return PROXY_ENTRY_NONE;
+}
+
+/**
+  Complete the verification of a file whose data has all been hashed.
+
+  @param[in]   File             A pointer to the PROXY_FILE.
+
+  @retval EFI_SUCCESS           The file matches its hash.
+  @retval EFI_CRC_ERROR         The file doesn't match its hash.
+**/
+STATIC EFI_STATUS CompleteProxyEntry(
+	IN PROXY_FILE* File
+)
+{
+	EFI_STATUS Status = EFI_SUCCESS;
+	CONST HASH_ENTRY* Entry = &Proxy.List.Entry[File->Entry];
+
+	Proxy.List.Algorithm->Final(&File->Context);
+	if (CompareMem(File->Context.Buffer, GetEntryHash(Proxy.List.Buffer, Entry),
+		Proxy.List.Algorithm->HashSize) != 0)
+		Status = EFI_CRC_ERROR;
+	Proxy.State[File->Entry] = EFI_ERROR(Status) ? PROXY_ENTRY_FAILED : PROXY_ENTRY_VERIFIED;
+	if (EFI_ERROR(Status))
+		PrintError(L"'%s' failed verification", File->Path);
+	File->Entry = PROXY_ENTRY_NONE;
+	return Status;
+}
+
+/**
+  Check whether a file is still to be verified, i.e. whether it has an entry
+  that no other handle has verified in the meantime.
+
+  @param[in]   File             A pointer to the PROXY_FILE.
+
+  @retval TRUE                  The file is to be verified.
+  @retval FALSE                 The file is not to be verified.
+**/
+STATIC BOOLEAN IsProxyEntryPending(
+	IN CONST PROXY_FILE* File
+)
+{
+	return (Proxy.State != NULL && File->Entry != PROXY_ENTRY_NONE &&
+		Proxy.State[File->Entry] == PROXY_ENTRY_UNVERIFIED);
+}
+
+/*
+ * EFI_FILE_PROTOCOL implementation of the handles we produce. We only produce
+ * revision 1 handles, so that callers don't use the asynchronous methods.
+ */
+
+STATIC EFI_STATUS EFIAPI ProxyFileOpen(
+	IN EFI_FILE_HANDLE This,
+	OUT EFI_FILE_HANDLE* NewHandle,
+	IN CHAR16* FileName,
+	IN UINT64 OpenMode,
+	IN UINT64 Attributes
+);
+
+STATIC EFI_STATUS EFIAPI ProxyFileRead(
+	IN EFI_FILE_HANDLE This,
+	IN OUT UINTN* BufferSize,
+	OUT VOID* Buffer
+)
+{
+	EFI_STATUS Status;
+	PROXY_FILE* File = (PROXY_FILE*)This;
+	UINTN Skip, Size;
+
+	Status = File->File->Read(File->File, BufferSize, Buffer);
+	if (EFI_ERROR(Status) || !IsProxyEntryPending(File))
+		return Status;
+
+	// Data that was already hashed may be read again, but we can't skip any
+	if (File->Position > File->HashedBytes) {
+		File->Sequential = FALSE;
+	} else if (File->Sequential && File->Position + *BufferSize > File->HashedBytes) {
+		Skip = (UINTN)(File->HashedBytes - File->Position);
+		Size = (UINTN)MIN(*BufferSize - Skip, File->Size - File->HashedBytes);
+		Proxy.List.Algorithm->Write(&File->Context, &((UINT8*)Buffer)[Skip], Size);
+		File->HashedBytes += Size;
+	}
+	File->Position += *BufferSize;
+	// Fail the read that completes a file that doesn't match its hash
+	if (File->Sequential && File->HashedBytes == File->Size)
+		return CompleteProxyEntry(File);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI ProxyFileWrite(
+	IN EFI_FILE_HANDLE This,
+	IN OUT UINTN* BufferSize,
+	IN VOID* Buffer
+)
+{
+	PROXY_FILE* File = (PROXY_FILE*)This;
+
+	// We can't tell modified data from corrupted data
+	File->Entry = PROXY_ENTRY_NONE;
+	return File->File->Write(File->File, BufferSize, Buffer);
+}
+
+STATIC EFI_STATUS EFIAPI ProxyFileGetPosition(
+	IN EFI_FILE_HANDLE This,
+	OUT UINT64* Position
+)
+{
+	return ((PROXY_FILE*)This)->File->GetPosition(((PROXY_FILE*)This)->File, Position);
+}
+
+STATIC EFI_STATUS EFIAPI ProxyFileSetPosition(
+	IN EFI_FILE_HANDLE This,
+	IN UINT64 Position
+)
+{
+	EFI_STATUS Status;
+	PROXY_FILE* File = (PROXY_FILE*)This;
+
+	Status = File->File->SetPosition(File->File, Position);
+	if (!EFI_ERROR(Status))
+		File->Position = (Position == (UINT64)-1) ? File->Size : Position;
+	return Status;
+}
+
+STATIC EFI_STATUS EFIAPI ProxyFileGetInfo(
+	IN EFI_FILE_HANDLE This,
+	IN EFI_GUID* InformationType,
+	IN OUT UINTN* BufferSize,
+	OUT VOID* Buffer
+)
+{
+	return ((PROXY_FILE*)This)->File->GetInfo(((PROXY_FILE*)This)->File, InformationType, BufferSize, Buffer);
+}
+
+STATIC EFI_STATUS EFIAPI ProxyFileSetInfo(
+	IN EFI_FILE_HANDLE This,
+	IN EFI_GUID* InformationType,
+	IN UINTN BufferSize,
+	IN VOID* Buffer
+)
+{
+	PROXY_FILE* File = (PROXY_FILE*)This;
+
+	File->Entry = PROXY_ENTRY_NONE;
+	return File->File->SetInfo(File->File, InformationType, BufferSize, Buffer);
+}
+
+STATIC EFI_STATUS EFIAPI ProxyFileFlush(
+	IN EFI_FILE_HANDLE This
+)
+{
+	return ((PROXY_FILE*)This)->File->Flush(((PROXY_FILE*)This)->File);
+}
+
+/**
+  Verify the data of a file that hasn't been read in full, or in order, before
+  its handle is closed.
+
+  @param[in]   File             A pointer to the PROXY_FILE.
+**/
+STATIC VOID VerifyProxyFileOnClose(
+	IN PROXY_FILE* File
+)
+{
+	EFI_STATUS Status;
+	UINTN Size;
+
+	if (!IsProxyEntryPending(File))
+		return;
+	// We don't want to read files that the loader doesn't read
+	if (File->Sequential && File->HashedBytes == 0)
+		return;
+
+	if (!File->Sequential) {
+		Proxy.List.Algorithm->Init(&File->Context);
+		File->HashedBytes = 0;
+	}
+	Status = File->File->SetPosition(File->File, File->HashedBytes);
+	while (!EFI_ERROR(Status) && File->HashedBytes < File->Size) {
+		Size = (UINTN)MIN(READ_BUFFERSIZE, File->Size - File->HashedBytes);
+		Status = File->File->Read(File->File, &Size, Proxy.Buffer);
+		if (!EFI_ERROR(Status) && Size == 0)
+			Status = EFI_END_OF_FILE;
+		if (EFI_ERROR(Status))
+			break;
+		Proxy.List.Algorithm->Write(&File->Context, Proxy.Buffer, Size);
+		File->HashedBytes += Size;
+	}
+	if (EFI_ERROR(Status)) {
+		Proxy.State[File->Entry] = PROXY_ENTRY_FAILED;
+		PrintError(L"'%s' could not be verified", File->Path);
+		return;
+	}
+	CompleteProxyEntry(File);
+}
+
+STATIC EFI_STATUS EFIAPI ProxyFileClose(
+	IN EFI_FILE_HANDLE This
+)
+{
+	PROXY_FILE* File = (PROXY_FILE*)This;
+	EFI_STATUS Status;
+
+	VerifyProxyFileOnClose(File);
+	Status = File->File->Close(File->File);
+	gBS->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN)File, EFI_SIZE_TO_PAGES(sizeof(PROXY_FILE)));
+	return Status;
+}
+
+STATIC EFI_STATUS EFIAPI ProxyFileDelete(
+	IN EFI_FILE_HANDLE This
+)
+{
+	PROXY_FILE* File = (PROXY_FILE*)This;
+	EFI_STATUS Status;
+
+	Status = File->File->Delete(File->File);
+	gBS->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN)File, EFI_SIZE_TO_PAGES(sizeof(PROXY_FILE)));
+	return Status;
+}
+
+/**
+  Wrap a handle from the original file system into a proxy handle.
+
+  @param[in]   Handle           The handle to wrap. It is closed if wrapping fails.
+  @param[in]   Path             A pointer to the CHAR16 string with the normalized path of the
+                                file, or NULL if it is unknown.
+  @param[out]  NewHandle        A pointer to receive the proxy handle.
+
+  @retval EFI_SUCCESS           The handle was wrapped.
+  @retval EFI_CRC_ERROR         The file previously failed verification.
+  @retval EFI_BAD_BUFFER_SIZE   The file doesn't have the size from the hash list.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+STATIC EFI_STATUS CreateProxyFile(
+	IN EFI_FILE_HANDLE Handle,
+	IN CONST CHAR16* Path,
+	OUT EFI_FILE_HANDLE* NewHandle
+)
+{
+	EFI_STATUS Status;
+	EFI_PHYSICAL_ADDRESS Address;
+	PROXY_FILE* File;
+	UINTN Entry = PROXY_ENTRY_NONE, Size = FILE_INFO_SIZE;
+
+	*NewHandle = NULL;
+	if (Path != NULL && Proxy.State != NULL)
+		Entry = FindProxyEntry(Path);
+	if (Entry != PROXY_ENTRY_NONE && Proxy.State[Entry] == PROXY_ENTRY_FAILED) {
+		Status = EFI_CRC_ERROR;
+		goto out;
+	}
+	if (Entry != PROXY_ENTRY_NONE && Proxy.State[Entry] == PROXY_ENTRY_VERIFIED)
+		Entry = PROXY_ENTRY_NONE;
+	if (Entry != PROXY_ENTRY_NONE) {
+		Status = Handle->GetInfo(Handle, &gEfiFileInfoGuid, &Size, Proxy.FileInfo);
+		if (EFI_ERROR(Status) || (Proxy.FileInfo->Attribute & EFI_FILE_DIRECTORY))
+			Entry = PROXY_ENTRY_NONE;
+	}
+	if (Entry != PROXY_ENTRY_NONE && GetEntrySize(&Proxy.List, &Proxy.List.Entry[Entry]) != HASH_SIZE_UNKNOWN &&
+		GetEntrySize(&Proxy.List, &Proxy.List.Entry[Entry]) != Proxy.FileInfo->FileSize) {
+		Status = EFI_BAD_BUFFER_SIZE;
+		Proxy.State[Entry] = PROXY_ENTRY_FAILED;
+		PrintError(L"'%s' failed verification", Path);
+		goto out;
+	}
+
+	// Use page alignment, for the hash context
+	Status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(sizeof(PROXY_FILE)), &Address);
+	if (EFI_ERROR(Status)) {
+		Status = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+	File = (PROXY_FILE*)(UINTN)Address;
+	ZeroMem(File, sizeof(PROXY_FILE));
+	File->Protocol.Revision = EFI_FILE_PROTOCOL_REVISION;
+	File->Protocol.Open = ProxyFileOpen;
+	File->Protocol.Close = ProxyFileClose;
+	File->Protocol.Delete = ProxyFileDelete;
+	File->Protocol.Read = ProxyFileRead;
+	File->Protocol.Write = ProxyFileWrite;
+	File->Protocol.GetPosition = ProxyFileGetPosition;
+	File->Protocol.SetPosition = ProxyFileSetPosition;
+	File->Protocol.GetInfo = ProxyFileGetInfo;
+	File->Protocol.SetInfo = ProxyFileSetInfo;
+	File->Protocol.Flush = ProxyFileFlush;
+	File->File = Handle;
+	File->Entry = Entry;
+	File->Sequential = TRUE;
+	File->PathValid = (Path != NULL);
+	if (Path != NULL)
+		SafeStrCpy(File->Path, ARRAY_SIZE(File->Path), Path);
+	if (Entry != PROXY_ENTRY_NONE) {
+		File->Size = Proxy.FileInfo->FileSize;
+		Proxy.List.Algorithm->Init(&File->Context);
+	}
+	*NewHandle = &File->Protocol;
+	return EFI_SUCCESS;
+
+out:
+	Handle->Close(Handle);
+	return Status;
+}
+
+STATIC EFI_STATUS EFIAPI ProxyFileOpen(
+	IN EFI_FILE_HANDLE This,
+	OUT EFI_FILE_HANDLE* NewHandle,
+	IN CHAR16* FileName,
+	IN UINT64 OpenMode,
+	IN UINT64 Attributes
+)
+{
+	EFI_STATUS Status;
+	PROXY_FILE* File = (PROXY_FILE*)This;
+	EFI_FILE_HANDLE Handle;
+	CHAR16 Path[PATH_MAX + 1];
+	UINTN Length = 0;
+	BOOLEAN PathValid;
+
+	if (NewHandle == NULL || FileName == NULL)
+		return EFI_INVALID_PARAMETER;
+	Status = File->File->Open(File->File, &Handle, FileName, OpenMode, Attributes);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	// Paths are relative to the directory of the handle, unless they start with a separator
+	Path[0] = L'\0';
+	PathValid = (FileName[0] == L'\\') || (File->PathValid && AppendPath(Path, &Length, File->Path));
+	PathValid = PathValid && AppendPath(Path, &Length, FileName);
+	return CreateProxyFile(Handle, PathValid ? Path : NULL, NewHandle);
+}
+
+STATIC EFI_STATUS EFIAPI ProxyOpenVolume(
+	IN EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* This,
+	OUT EFI_FILE_HANDLE* Root
+)
+{
+	EFI_STATUS Status;
+	EFI_FILE_HANDLE Handle;
+
+	Status = Proxy.Original->OpenVolume(Proxy.Original, &Handle);
+	if (EFI_ERROR(Status))
+		return Status;
+	return CreateProxyFile(Handle, L"", Root);
+}
+
+/**
+  Replace the simple file system protocol of the boot volume with the on-demand
+  verification proxy. On success, the proxy takes ownership of the buffers of
+  the hash list.
+
+  @param[in]   DeviceHandle     The handle of the boot volume.
+  @param[in]   List             A pointer to the HASH_LIST with the hashes of the files.
+
+  @retval EFI_SUCCESS           The proxy was installed.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+  @retval other                 The proxy could not be installed.
+**/
+EFI_STATUS InstallVerifyProxy(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST HASH_LIST* List
+)
+{
+	EFI_STATUS Status;
+
+	ExitVerifyProxy();
+	Status = gBS->HandleProtocol(DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Proxy.Original);
+	if (EFI_ERROR(Status))
+		goto out;
+
+	Proxy.State = AllocateZeroPool(List->NumEntries + 1);
+	Proxy.Buffer = AllocatePool(READ_BUFFERSIZE);
+	Proxy.FileInfo = AllocatePool(FILE_INFO_SIZE);
+	if (Proxy.State == NULL || Proxy.Buffer == NULL || Proxy.FileInfo == NULL) {
+		Status = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+	Status = BuildProxyIndex(List);
+	if (EFI_ERROR(Status))
+		goto out;
+
+	// Reinstalling the protocol reconnects the drivers, which may open files
+	// through the proxy straight away, so it must be fully set up beforehand
+	Proxy.Protocol.Revision = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION;
+	Proxy.Protocol.OpenVolume = ProxyOpenVolume;
+	Proxy.DeviceHandle = DeviceHandle;
+	CopyMem(&Proxy.List, List, sizeof(HASH_LIST));
+	Status = gBS->ReinstallProtocolInterface(DeviceHandle, &gEfiSimpleFileSystemProtocolGuid,
+		Proxy.Original, &Proxy.Protocol);
+	if (EFI_ERROR(Status)) {
+		// The buffers of the hash list still belong to the caller, and the
+		// original protocol was not replaced
+		ZeroMem(&Proxy.List, sizeof(HASH_LIST));
+		Proxy.DeviceHandle = NULL;
+		goto out;
+	}
+
+	if (gIsTestMode)
+		PrintTest(L"Verification = on demand");
+	else
+		PrintInfo(L"Files will be verified as they are read");
+
+out:
+	if (EFI_ERROR(Status))
+		ExitVerifyProxy();
+	return Status;
+}
+
+/**
+  Restore the original simple file system protocol of the boot volume, if the
+  on-demand verification proxy was installed, and release the proxy.
+**/
+VOID ExitVerifyProxy(VOID)
+{
+	if (Proxy.DeviceHandle != NULL)
+		gBS->ReinstallProtocolInterface(Proxy.DeviceHandle, &gEfiSimpleFileSystemProtocolGuid,
+			&Proxy.Protocol, Proxy.Original);
+	if (Proxy.State != NULL)
+		FreePool(Proxy.State);
+	if (Proxy.Buffer != NULL)
+		FreePool(Proxy.Buffer);
+	if (Proxy.FileInfo != NULL)
+		FreePool(Proxy.FileInfo);
+	if (Proxy.Index != NULL)
+		FreePool(Proxy.Index);
+	if (Proxy.PathHash != NULL)
+		FreePool(Proxy.PathHash);
+	if (Proxy.List.Buffer != NULL)
+		FreePool(Proxy.List.Buffer);
+	if (Proxy.List.Entry != NULL)
+		FreePool(Proxy.List.Entry);
+	if (Proxy.List.Size != NULL)
+		FreePool(Proxy.List.Size);
+	ZeroMem(&Proxy, sizeof(Proxy));
+}
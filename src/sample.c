@@ -0,0 +1,282 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - Sampled verification
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * Machines that boot the same media every day can't afford to verify all of it
+ * on each boot. So, when the hash list requests it, we only verify the entries
+ * that are flagged as critical, along with as many of the other entries as the
+ * md5sum_sample budget allows, starting from the one that the previous boot
+ * stopped at. The position of this rotation is kept in an NV variable that is
+ * named after the serial number of the volume, and that also records a hash
+ * of the hash list, so that modified media start a new rotation. The whole
+ * media is therefore verified over a number of boots that depends on the budget.
+ */
+
+/* Vendor GUID of the NV variables that keep the position of the rotations */
+STATIC EFI_GUID SampleVariableGuid =
+	{ 0x56a7ffeb, 0x1665, 0x47bd, { 0x8e, 0xbb, 0x37, 0x7a, 0xb3, 0x35, 0x49, 0x00 } };
+
+/* Version of the content of the NV variables */
+#define SAMPLE_STATE_VERSION    1
+
+/* The content of the NV variable of a volume */
+typedef struct {
+	UINT32      Version;
+	UINT32      NumEntries;     /* Number of entries of the hash list */
+	UINT8       ListHash[HASH_SIZE_MAX];
+	UINT64      Cursor;         /* The entry that the rotation resumes from */
+	UINT32      Boots;          /* Number of boots since the current pass started */
+	UINT32      PassBoots;      /* Number of boots that the last full pass took, or 0 if none completed */
+	EFI_TIME    LastFullPass;   /* When the last full pass completed */
+} SAMPLE_STATE;
+
+/* The sample of the current boot, as selected by SampleHashList() */
+STATIC struct {
+	BOOLEAN         Active;
+	CHAR16          Name[32];   /* The name of the NV variable of the volume */
+	SAMPLE_STATE    State;      /* The content to store, once the sample has been verified */
+	UINTN           Coverage;   /* Percentage of the media that the sample covers */
+} Sample = { 0 };
+
+/**
+  Compute the hash of the entries of a hash list, i.e. of their hashes and paths.
+
+  @param[in]   List             A pointer to the HASH_LIST to hash.
+  @param[out]  Hash             A pointer to the HASH_SIZE_MAX array that receives the hash.
+**/
+VOID HashEntries(
+	IN CONST HASH_LIST* List,
+	OUT UINT8* Hash
+)
+{
+	HASH_CONTEXT Context;
+	CHAR16 Path[PATH_MAX + 1];
+	UINTN i;
+
+	List->Algorithm->Init(&Context);
+	for (i = 0; i < List->NumEntries; i++) {
+		// Hash the UCS-2 paths, so that text and binary lists of the same media match
+		DecodeHashEntry(List, &List->Entry[i], Path, ARRAY_SIZE(Path));
+		List->Algorithm->Write(&Context, GetEntryHash(List->Buffer, &List->Entry[i]),
+			List->Algorithm->HashSize);
+		List->Algorithm->Write(&Context, (CONST UINT8*)Path, (StrLen(Path) + 1) * sizeof(CHAR16));
+	}
+	List->Algorithm->Final(&Context);
+	ZeroMem(Hash, HASH_SIZE_MAX);
+	CopyMem(Hash, Context.Buffer, List->Algorithm->HashSize);
+}
+
+/**
+  Get the size of the file of a hash list entry, opening the file if the hash
+  list doesn't provide it.
+
+  @param[in]   Root             A file handle to the root directory.
+  @param[in]   List             A pointer to the HASH_LIST the entry belongs to.
+  @param[in]   Entry            A pointer to the HASH_ENTRY.
+
+  @retval      The size of the file, or 0 if it can't be opened.
+**/
+STATIC UINT64 GetEntryFileSize(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_LIST* List,
+	IN CONST HASH_ENTRY* Entry
+)
+{
+	EFI_FILE_HANDLE File;
+	CHAR16 Path[PATH_MAX + 1];
+	UINT64 Size = 0;
+
+	if (GetEntrySize(List, Entry) != HASH_SIZE_UNKNOWN)
+		return GetEntrySize(List, Entry);
+	if (DecodeHashEntry(List, Entry, Path, ARRAY_SIZE(Path)) == EFI_SUCCESS &&
+		OpenFileToHash(Root, Path, &File, &Size) == EFI_SUCCESS)
+		File->Close(File);
+	return Size;
+}
+
+/**
+  Reduce a hash list to the entries that are to be verified on this boot,
+  according to its md5sum_sample directive: the critical entries, followed by
+  the next entries of the rotation, for as long as they fit in the budget.
+  The entries are kept in the order of the list, and the total size of the
+  list is updated to the one of the sample.
+
+  @param[in]     DeviceHandle   The handle of the boot volume.
+  @param[in]     Root           A file handle to the root directory.
+  @param[in,out] List           A pointer to the HASH_LIST to sample.
+
+  @retval EFI_SUCCESS           The list was sampled.
+  @retval EFI_UNSUPPORTED       The NV variable of the volume could not be read.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS SampleHashList(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST EFI_FILE_HANDLE Root,
+	IN OUT HASH_LIST* List
+)
+{
+	EFI_STATUS Status;
+	SAMPLE_STATE State;
+	HASH_ENTRY* Entry = NULL;
+	BOOLEAN* Selected = NULL;
+	UINT8 Hash[HASH_SIZE_MAX];
+	UINT64 Serial = 0, Size, SampleBytes = 0, RotationBytes = 0;
+	UINTN i, n, DataSize, NumRotated = 0, NumSelected = 0;
+
+	ExitSample();
+	if (List->NumEntries == 0)
+		return EFI_SUCCESS;
+
+	// Media that have no serial number all share the same variable
+	GetVolumeSerial(DeviceHandle, &Serial);
+	UnicodeSPrint(Sample.Name, ARRAY_SIZE(Sample.Name), L"Sample%016lx", Serial);
+	HashEntries(List, Hash);
+
+	DataSize = sizeof(State);
+	Status = gRT->GetVariable(Sample.Name, &SampleVariableGuid, NULL, &DataSize, &State);
+	if (Status == EFI_NOT_FOUND || Status == EFI_BUFFER_TOO_SMALL ||
+		(Status == EFI_SUCCESS && (DataSize != sizeof(State) || State.Version != SAMPLE_STATE_VERSION ||
+		State.NumEntries != List->NumEntries || State.Cursor >= List->NumEntries ||
+		CompareMem(State.ListHash, Hash, sizeof(Hash)) != 0))) {
+		// Start a new rotation for new or modified media
+		ZeroMem(&State, sizeof(State));
+		State.Version = SAMPLE_STATE_VERSION;
+		State.NumEntries = (UINT32)List->NumEntries;
+		CopyMem(State.ListHash, Hash, sizeof(Hash));
+		Status = EFI_SUCCESS;
+	}
+	if (EFI_ERROR(Status)) {
+		Status = EFI_UNSUPPORTED;
+		goto out;
+	}
+
+	Selected = AllocateZeroPool(List->NumEntries * sizeof(BOOLEAN));
+	Entry = AllocatePool(List->NumEntries * sizeof(HASH_ENTRY));
+	if (Selected == NULL || Entry == NULL) {
+		Status = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+
+	// The critical entries are verified on every boot, regardless of the budget
+	for (i = 0; i < List->NumEntries; i++) {
+		if (List->Entry[i].Flags & HASH_ENTRY_CRITICAL) {
+			Selected[i] = TRUE;
+			SampleBytes += GetEntryFileSize(Root, List, &List->Entry[i]);
+		}
+	}
+
+	// Add the next entries of the rotation, with at least one of them, so
+	// that the rotation progresses even if the budget is too small
+	for (n = 0, i = (UINTN)State.Cursor; n < List->NumEntries; n++, i = (i + 1) % List->NumEntries) {
+		if (Selected[i])
+			continue;
+		Size = GetEntryFileSize(Root, List, &List->Entry[i]);
+		if (NumRotated != 0 && RotationBytes + Size > List->SampleBytes)
+			break;
+		Selected[i] = TRUE;
+		RotationBytes += Size;
+		NumRotated++;
+	}
+	SampleBytes += RotationBytes;
+
+	// A full pass completes when the rotation goes past the last entry
+	CopyMem(&Sample.State, &State, sizeof(State));
+	Sample.State.Boots++;
+	if (State.Cursor + n >= List->NumEntries) {
+		Sample.State.PassBoots = Sample.State.Boots;
+		Sample.State.Boots = 0;
+		if (EFI_ERROR(gRT->GetTime(&Sample.State.LastFullPass, NULL)))
+			ZeroMem(&Sample.State.LastFullPass, sizeof(EFI_TIME));
+	}
+	Sample.State.Cursor = i;
+
+	// Report the coverage in bytes, if we know the size of the whole media
+	for (i = 0; i < List->NumEntries; i++) {
+		if (Selected[i])
+			Entry[NumSelected++] = List->Entry[i];
+	}
+	if (List->TotalBytes != 0)
+		Sample.Coverage = (UINTN)MIN(100, (SampleBytes * 100) / List->TotalBytes);
+	else
+		Sample.Coverage = (NumSelected * 100) / List->NumEntries;
+
+	if (gIsTestMode)
+		PrintTest(L"Sample = %d/%d", NumSelected, List->NumEntries);
+	else
+		PrintInfo(L"Verifying %d of %d files on this boot", NumSelected, List->NumEntries);
+	if (!gIsTestMode && State.PassBoots != 0 && State.LastFullPass.Year != 0)
+		PrintInfo(L"The whole media was last verified on %04d.%02d.%02d, over %d boot%s",
+			State.LastFullPass.Year, State.LastFullPass.Month, State.LastFullPass.Day,
+			State.PassBoots, (State.PassBoots == 1) ? L"" : L"s");
+
+	SafeFree(List->Entry);
+	List->Entry = Entry;
+	List->NumEntries = NumSelected;
+	List->TotalBytes = SampleBytes;
+	Entry = NULL;
+	Sample.Active = TRUE;
+
+out:
+	if (Selected != NULL)
+		SafeFree(Selected);
+	if (Entry != NULL)
+		SafeFree(Entry);
+	return Status;
+}
+
+/**
+  Get the coverage of the sample of the current boot.
+
+  @param[out]  Coverage         A pointer to receive the percentage of the media that the sample covers.
+
+  @retval TRUE                  The hash list was sampled.
+  @retval FALSE                 The hash list was not sampled.
+**/
+BOOLEAN GetSampleCoverage(
+	OUT UINTN* Coverage
+)
+{
+	*Coverage = Sample.Coverage;
+	return Sample.Active;
+}
+
+/**
+  Store the position of the rotation, once the sample of the current boot has
+  been verified, so that the next boot verifies the entries that follow it.
+
+  @retval EFI_SUCCESS           The position was stored, or the hash list was not sampled.
+  @retval other                 The NV variable of the volume could not be written.
+**/
+EFI_STATUS SaveSampleState(VOID)
+{
+	if (!Sample.Active)
+		return EFI_SUCCESS;
+	return gRT->SetVariable(Sample.Name, &SampleVariableGuid,
+		EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+		sizeof(Sample.State), &Sample.State);
+}
+
+/**
+  Release the sample of the current boot.
+**/
+VOID ExitSample(VOID)
+{
+	ZeroMem(&Sample, sizeof(Sample));
+}
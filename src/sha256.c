@@ -0,0 +1,422 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - SHA-256 Hash functions
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SHA-256, as per FIPS 180-4. Besides the portable transform, we provide
+ * transforms that use the SHA extensions of x86 CPUs (SHA-NI) and the SHA2
+ * instructions of the ARMv8 Cryptographic Extension, where a whole block
+ * takes about as many instructions as a single round of the portable code.
+ */
+
+#include "boot.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SHA256_X64_TRANSFORM
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <immintrin.h>
+#endif
+#endif
+
+#if (defined(__aarch64__) && defined(__ARM_NEON)) || defined(_M_ARM64)
+#define SHA256_AA64_TRANSFORM
+#include <arm_neon.h>
+#endif
+
+/* Big endian 32-bit read of the k-th word of the data at p */
+#if defined(_MSC_VER) && !defined(__clang__)
+#define LOAD32_BE(p, k)     _byteswap_ulong(LOAD32(p, k))
+#else
+#define LOAD32_BE(p, k)     __builtin_bswap32(LOAD32(p, k))
+#endif
+
+/* SHA-256 block transform, that processes NumBlocks consecutive blocks */
+typedef VOID (*SHA256_TRANSFORM)(UINT32* State, CONST UINT8* Data, UINTN NumBlocks);
+
+STATIC CONST UINT32 ALIGNED(16) Sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define CH(x, y, z)         ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z)        (((x) & (y)) | ((z) & ((x) | (y))))
+#define SIGMA0(x)           (ROR32(x, 2) ^ ROR32(x, 13) ^ ROR32(x, 22))
+#define SIGMA1(x)           (ROR32(x, 6) ^ ROR32(x, 11) ^ ROR32(x, 25))
+#define GAMMA0(x)           (ROR32(x, 7) ^ ROR32(x, 18) ^ ((x) >> 3))
+#define GAMMA1(x)           (ROR32(x, 17) ^ ROR32(x, 19) ^ ((x) >> 10))
+
+/* Message schedule value for round i, computed in place over a 16 words window */
+#define W(i)                (((i) < 16) ? W[i] : (W[(i) & 15] += GAMMA1(W[((i) - 2) & 15]) + \
+                            W[((i) - 7) & 15] + GAMMA0(W[((i) - 15) & 15])))
+
+/* A single round, where the rotation of the working variables is performed by the caller */
+#define RND(a, b, c, d, e, f, g, h, i) do { \
+	T = h + SIGMA1(e) + CH(e, f, g) + Sha256K[i] + W(i); \
+	d += T; \
+	h = T + SIGMA0(a) + MAJ(a, b, c); } while(0)
+
+/* Portable transform */
+STATIC VOID Sha256TransformGeneric(UINT32* State, CONST UINT8* Data, UINTN NumBlocks)
+{
+	UINT32 a, b, c, d, e, f, g, h, T, W[16];
+	UINTN i;
+
+	for (; NumBlocks > 0; NumBlocks--, Data += SHA256_BLOCKSIZE) {
+		for (i = 0; i < 16; i++)
+			W[i] = LOAD32_BE(Data, i);
+		a = State[0];
+		b = State[1];
+		c = State[2];
+		d = State[3];
+		e = State[4];
+		f = State[5];
+		g = State[6];
+		h = State[7];
+		for (i = 0; i < 64; i += 8) {
+			RND(a, b, c, d, e, f, g, h, i);
+			RND(h, a, b, c, d, e, f, g, i + 1);
+			RND(g, h, a, b, c, d, e, f, i + 2);
+			RND(f, g, h, a, b, c, d, e, i + 3);
+			RND(e, f, g, h, a, b, c, d, i + 4);
+			RND(d, e, f, g, h, a, b, c, i + 5);
+			RND(c, d, e, f, g, h, a, b, i + 6);
+			RND(b, c, d, e, f, g, h, a, i + 7);
+		}
+		State[0] += a;
+		State[1] += b;
+		State[2] += c;
+		State[3] += d;
+		State[4] += e;
+		State[5] += f;
+		State[6] += g;
+		State[7] += h;
+	}
+}
+
+#undef RND
+#undef W
+
+#if defined(SHA256_X64_TRANSFORM)
+/*
+ * The SHA-NI instructions work on the state as two ABEF and CDGH vectors
+ * (with A in the high lane), and process two rounds at once for rnds2.
+ */
+#if defined(_MSC_VER) && !defined(__clang__)
+typedef __m128i VEC;
+#define TARGET_SHA
+#define VLOAD(p)            _mm_load_si128((CONST __m128i*)(p))
+#define VLOADU(p)           _mm_loadu_si128((CONST __m128i*)(p))
+#define VSTOREU(p, v)       _mm_storeu_si128((__m128i*)(p), v)
+#define VSETR(a, b, c, d)   _mm_setr_epi32(a, b, c, d)
+#define VADD(a, b)          _mm_add_epi32(a, b)
+#define VSHUF32(v, i)       _mm_shuffle_epi32(v, i)
+#define VALIGNR4(a, b)      _mm_alignr_epi8(a, b, 4)
+#define VBSWAP(v)           _mm_shuffle_epi8(v, Mask)
+#define SHA_RNDS2(a, b, k)  _mm_sha256rnds2_epu32(a, b, k)
+#define SHA_MSG1(a, b)      _mm_sha256msg1_epu32(a, b)
+#define SHA_MSG2(a, b)      _mm_sha256msg2_epu32(a, b)
+#else
+/* We use the compiler builtins, so that we don't depend on the intrinsics headers */
+typedef INT32 VEC __attribute__((vector_size(16)));
+typedef INT32 VEC_U __attribute__((vector_size(16), aligned(1)));
+typedef CHAR8 VEC_B __attribute__((vector_size(16)));
+#define TARGET_SHA          __attribute__((target("sha,ssse3")))
+#define VLOAD(p)            (*(CONST VEC*)(p))
+#define VLOADU(p)           (*(CONST VEC_U*)(p))
+#define VSTOREU(p, v)       (*(VEC_U*)(p) = (v))
+#define VSETR(a, b, c, d)   ((VEC){ (INT32)(a), (INT32)(b), (INT32)(c), (INT32)(d) })
+#define VADD(a, b)          ((a) + (b))
+#define VSHUF32(v, i)       ((VEC)__builtin_ia32_pshufd(v, i))
+#define VALIGNR4(a, b)      ((VEC){ (b)[1], (b)[2], (b)[3], (a)[0] })
+#define VBSWAP(v)           ((VEC)__builtin_ia32_pshufb128((VEC_B)(v), (VEC_B)Mask))
+#define SHA_RNDS2(a, b, k)  ((VEC)__builtin_ia32_sha256rnds2(a, b, k))
+#define SHA_MSG1(a, b)      ((VEC)__builtin_ia32_sha256msg1(a, b))
+#define SHA_MSG2(a, b)      ((VEC)__builtin_ia32_sha256msg2(a, b))
+#endif
+
+/* Four rounds, using the message vector m for rounds 4 * i to 4 * i + 3 */
+#define RNDS4(m, i) do { \
+	Tmp = VADD(m, VLOAD(&Sha256K[4 * (i)])); \
+	State1 = SHA_RNDS2(State1, State0, Tmp); \
+	State0 = SHA_RNDS2(State0, State1, VSHUF32(Tmp, 0x0E)); } while(0)
+
+/* Compute the next message vector into m0, from the four previous ones */
+#define SCHED(m0, m1, m2, m3) do { \
+	m0 = SHA_MSG2(VADD(SHA_MSG1(m0, m1), VALIGNR4(m3, m2)), m3); } while(0)
+
+TARGET_SHA STATIC VOID Sha256TransformX64(UINT32* State, CONST UINT8* Data, UINTN NumBlocks)
+{
+	CONST VEC Mask = VSETR(0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f);
+	VEC State0, State1, Save0, Save1, Tmp, M0, M1, M2, M3;
+	UINT32 Out[8];
+
+	State0 = VSETR(State[5], State[4], State[1], State[0]);
+	State1 = VSETR(State[7], State[6], State[3], State[2]);
+
+	for (; NumBlocks > 0; NumBlocks--, Data += SHA256_BLOCKSIZE) {
+		Save0 = State0;
+		Save1 = State1;
+		M0 = VBSWAP(VLOADU(Data));
+		M1 = VBSWAP(VLOADU(Data + 16));
+		M2 = VBSWAP(VLOADU(Data + 32));
+		M3 = VBSWAP(VLOADU(Data + 48));
+		RNDS4(M0, 0);
+		RNDS4(M1, 1);
+		RNDS4(M2, 2);
+		RNDS4(M3, 3);
+		SCHED(M0, M1, M2, M3); RNDS4(M0, 4);
+		SCHED(M1, M2, M3, M0); RNDS4(M1, 5);
+		SCHED(M2, M3, M0, M1); RNDS4(M2, 6);
+		SCHED(M3, M0, M1, M2); RNDS4(M3, 7);
+		SCHED(M0, M1, M2, M3); RNDS4(M0, 8);
+		SCHED(M1, M2, M3, M0); RNDS4(M1, 9);
+		SCHED(M2, M3, M0, M1); RNDS4(M2, 10);
+		SCHED(M3, M0, M1, M2); RNDS4(M3, 11);
+		SCHED(M0, M1, M2, M3); RNDS4(M0, 12);
+		SCHED(M1, M2, M3, M0); RNDS4(M1, 13);
+		SCHED(M2, M3, M0, M1); RNDS4(M2, 14);
+		SCHED(M3, M0, M1, M2); RNDS4(M3, 15);
+		State0 = VADD(State0, Save0);
+		State1 = VADD(State1, Save1);
+	}
+
+	VSTOREU(&Out[0], State0);
+	VSTOREU(&Out[4], State1);
+	State[0] = Out[3];
+	State[1] = Out[2];
+	State[2] = Out[7];
+	State[3] = Out[6];
+	State[4] = Out[1];
+	State[5] = Out[0];
+	State[6] = Out[5];
+	State[7] = Out[4];
+}
+
+#undef RNDS4
+#undef SCHED
+#endif /* SHA256_X64_TRANSFORM */
+
+#if defined(SHA256_AA64_TRANSFORM)
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_CRYPTO
+#elif defined(__clang__)
+#define TARGET_CRYPTO       __attribute__((target("crypto")))
+#else
+#define TARGET_CRYPTO       __attribute__((target("+crypto")))
+#endif
+
+/* Four rounds, using the message vector m for rounds 4 * i to 4 * i + 3 */
+#define RNDS4(m, i) do { \
+	Tmp = vaddq_u32(m, vld1q_u32(&Sha256K[4 * (i)])); \
+	Abcd = State0; \
+	State0 = vsha256hq_u32(State0, State1, Tmp); \
+	State1 = vsha256h2q_u32(State1, Abcd, Tmp); } while(0)
+
+/* Compute the next message vector into m0, from the four previous ones */
+#define SCHED(m0, m1, m2, m3) do { \
+	m0 = vsha256su1q_u32(vsha256su0q_u32(m0, m1), m2, m3); } while(0)
+
+TARGET_CRYPTO STATIC VOID Sha256TransformAa64(UINT32* State, CONST UINT8* Data, UINTN NumBlocks)
+{
+	uint32x4_t State0, State1, Save0, Save1, Abcd, Tmp, M0, M1, M2, M3;
+
+	State0 = vld1q_u32(&State[0]);
+	State1 = vld1q_u32(&State[4]);
+
+	for (; NumBlocks > 0; NumBlocks--, Data += SHA256_BLOCKSIZE) {
+		Save0 = State0;
+		Save1 = State1;
+		M0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(Data)));
+		M1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(Data + 16)));
+		M2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(Data + 32)));
+		M3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(Data + 48)));
+		RNDS4(M0, 0);
+		RNDS4(M1, 1);
+		RNDS4(M2, 2);
+		RNDS4(M3, 3);
+		SCHED(M0, M1, M2, M3); RNDS4(M0, 4);
+		SCHED(M1, M2, M3, M0); RNDS4(M1, 5);
+		SCHED(M2, M3, M0, M1); RNDS4(M2, 6);
+		SCHED(M3, M0, M1, M2); RNDS4(M3, 7);
+		SCHED(M0, M1, M2, M3); RNDS4(M0, 8);
+		SCHED(M1, M2, M3, M0); RNDS4(M1, 9);
+		SCHED(M2, M3, M0, M1); RNDS4(M2, 10);
+		SCHED(M3, M0, M1, M2); RNDS4(M3, 11);
+		SCHED(M0, M1, M2, M3); RNDS4(M0, 12);
+		SCHED(M1, M2, M3, M0); RNDS4(M1, 13);
+		SCHED(M2, M3, M0, M1); RNDS4(M2, 14);
+		SCHED(M3, M0, M1, M2); RNDS4(M3, 15);
+		State0 = vaddq_u32(State0, Save0);
+		State1 = vaddq_u32(State1, Save1);
+	}
+
+	vst1q_u32(&State[0], State0);
+	vst1q_u32(&State[4], State1);
+}
+
+#undef RNDS4
+#undef SCHED
+#endif /* SHA256_AA64_TRANSFORM */
+
+/* The list of SHA-256 transforms we can use, in order of preference */
+STATIC CONST struct {
+	CONST CHAR16*       Name;
+	SHA256_TRANSFORM    Transform;
+	BOOLEAN             (*IsSupported)(VOID);
+} Sha256Transforms[] = {
+#if defined(SHA256_X64_TRANSFORM)
+	{ L"SHA-NI", Sha256TransformX64, IsSha256Supported },
+#endif
+#if defined(SHA256_AA64_TRANSFORM)
+	{ L"ARMv8", Sha256TransformAa64, IsSha256Supported },
+#endif
+	{ L"generic", Sha256TransformGeneric, NULL },
+};
+
+/* The SHA-256 transform selected by InitSha256() */
+STATIC SHA256_TRANSFORM Sha256Transform = Sha256TransformGeneric;
+
+/* Hash context initialisation */
+VOID Sha256Init(HASH_CONTEXT* Context)
+{
+	ZeroMem(&Context->Sha256, sizeof(Context->Sha256));
+	Context->Sha256.State[0] = 0x6a09e667;
+	Context->Sha256.State[1] = 0xbb67ae85;
+	Context->Sha256.State[2] = 0x3c6ef372;
+	Context->Sha256.State[3] = 0xa54ff53a;
+	Context->Sha256.State[4] = 0x510e527f;
+	Context->Sha256.State[5] = 0x9b05688c;
+	Context->Sha256.State[6] = 0x1f83d9ab;
+	Context->Sha256.State[7] = 0x5be0cd19;
+}
+
+/* Update the message digest with the contents of the buffer (SHA-256) */
+VOID Sha256Write(HASH_CONTEXT* Context, CONST UINT8* Buffer, UINTN Length)
+{
+	UINTN Num = Context->Sha256.ByteCount & (SHA256_BLOCKSIZE - 1);
+
+	Context->Sha256.ByteCount += Length;
+
+	/* Handle any leading odd-sized chunks */
+	if (Num) {
+		Num = SHA256_BLOCKSIZE - Num;
+		if (Length < Num) {
+			CopyMem(Context->Sha256.Buffer + SHA256_BLOCKSIZE - Num, Buffer, Length);
+			return;
+		}
+		CopyMem(Context->Sha256.Buffer + SHA256_BLOCKSIZE - Num, Buffer, Num);
+		Sha256Transform(Context->Sha256.State, Context->Sha256.Buffer, 1);
+		Buffer += Num;
+		Length -= Num;
+	}
+
+	/* Process all the whole blocks in one go, so that the state stays in registers */
+	if (Length >= SHA256_BLOCKSIZE) {
+		Sha256Transform(Context->Sha256.State, Buffer, Length / SHA256_BLOCKSIZE);
+		Buffer += Length & ~((UINTN)SHA256_BLOCKSIZE - 1);
+		Length &= SHA256_BLOCKSIZE - 1;
+	}
+
+	/* Handle any remaining bytes of Data */
+	CopyMem(Context->Sha256.Buffer, Buffer, Length);
+}
+
+/* Finalize the computation and write the digest in Context->Sha256.Buffer[] */
+VOID Sha256Final(HASH_CONTEXT* Context)
+{
+	UINTN i, Count = ((UINTN)Context->Sha256.ByteCount) & (SHA256_BLOCKSIZE - 1);
+	UINT64 BitCount = Context->Sha256.ByteCount << 3;
+
+	/* There is always at least one byte free for the padding */
+	Context->Sha256.Buffer[Count++] = 0x80;
+	if (Count > SHA256_BLOCKSIZE - 8) {
+		ZeroMem(&Context->Sha256.Buffer[Count], SHA256_BLOCKSIZE - Count);
+		Sha256Transform(Context->Sha256.State, Context->Sha256.Buffer, 1);
+		Count = 0;
+	}
+	ZeroMem(&Context->Sha256.Buffer[Count], SHA256_BLOCKSIZE - 8 - Count);
+
+	/* Append the 64 bit count (big endian) */
+	for (i = 0; i < 8; i++)
+		Context->Sha256.Buffer[SHA256_BLOCKSIZE - 1 - i] = (UINT8)(BitCount >> (8 * i));
+	Sha256Transform(Context->Sha256.State, Context->Sha256.Buffer, 1);
+
+	for (i = 0; i < 8; i++) {
+		Context->Sha256.Buffer[4 * i] = (UINT8)(Context->Sha256.State[i] >> 24);
+		Context->Sha256.Buffer[4 * i + 1] = (UINT8)(Context->Sha256.State[i] >> 16);
+		Context->Sha256.Buffer[4 * i + 2] = (UINT8)(Context->Sha256.State[i] >> 8);
+		Context->Sha256.Buffer[4 * i + 3] = (UINT8)Context->Sha256.State[i];
+	}
+}
+
+/**
+  Select the fastest SHA-256 transform that the platform supports, after
+  validating it against the FIPS 180 test vectors. A transform that fails
+  the test is reported and skipped.
+
+  @retval EFI_SUCCESS           A valid SHA-256 transform has been selected.
+  @retval EFI_CRC_ERROR         None of the SHA-256 transforms passed the test.
+**/
+EFI_STATUS InitSha256(VOID)
+{
+	/* FIPS 180-4 examples, from NIST's Cryptographic Standards and Guidelines */
+	STATIC CONST struct {
+		CONST CHAR8*    Message;
+		UINT8           Hash[SHA256_HASHSIZE];
+	} TestSuite[] = {
+		{ "",
+		  { 0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+		    0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55 } },
+		{ "abc",
+		  { 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+		    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad } },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+		  { 0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+		    0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1 } },
+		{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+		  { 0xcf, 0x5b, 0x16, 0xa7, 0x78, 0xaf, 0x83, 0x80, 0x03, 0x6c, 0xe5, 0x9e, 0x7b, 0x04, 0x92, 0x37,
+		    0x0b, 0x24, 0x9b, 0x11, 0xe8, 0xf0, 0x7a, 0x51, 0xaf, 0xac, 0x45, 0x03, 0x7a, 0xfe, 0xe9, 0xd1 } },
+	};
+	HASH_CONTEXT Context;
+	UINTN i, j, Len;
+
+	for (i = 0; i < ARRAY_SIZE(Sha256Transforms); i++) {
+		if (Sha256Transforms[i].IsSupported != NULL && !Sha256Transforms[i].IsSupported())
+			continue;
+		Sha256Transform = Sha256Transforms[i].Transform;
+		for (j = 0; j < ARRAY_SIZE(TestSuite); j++) {
+			for (Len = 0; TestSuite[j].Message[Len] != 0; Len++);
+			Sha256Init(&Context);
+			Sha256Write(&Context, (CONST UINT8*)TestSuite[j].Message, Len);
+			Sha256Final(&Context);
+			if (CompareMem(Context.Buffer, TestSuite[j].Hash, SHA256_HASHSIZE) != 0)
+				break;
+		}
+		if (j >= ARRAY_SIZE(TestSuite))
+			return EFI_SUCCESS;
+		PrintWarning(L"%s SHA-256 transform failed self-test", Sha256Transforms[i].Name);
+	}
+
+	Sha256Transform = Sha256TransformGeneric;
+	return EFI_CRC_ERROR;
+}
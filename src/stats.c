@@ -0,0 +1,219 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - Verification statistics
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * Where the benchmark mode measures each component in isolation, the
+ * statistics measure an actual verification: the time spent parsing the hash
+ * list, converting its paths, opening the files and getting their size,
+ * reading and hashing them, updating the progress and loading the original
+ * bootloader, along with the files that took the longest to verify. Since
+ * the measurements are taken on the hot path, they are only compiled in when
+ * ENABLE_STATS is defined (see the STATS_ macros), and they are only taken
+ * on the BSP, so that the hashing of the multiprocessor engine is not part of
+ * them. The timestamps come from the counter that InitTimestamp() calibrated.
+ */
+
+#if defined(ENABLE_STATS)
+
+/* Names of the phases, in the order of their STATS_ values */
+STATIC CONST CHAR16* PhaseName[STATS_PHASE_MAX] = {
+	L"Parse", L"UTF-8", L"Open", L"GetInfo", L"Read", L"Hash", L"Progress", L"Chain load"
+};
+
+/* The statistics of the current boot */
+STATIC struct {
+	EFI_FILE_HANDLE Root;       /* The volume to write the statistics to, or NULL */
+	struct {
+		UINT64  Count;
+		UINT64  Time;
+		UINT64  Bytes;
+	} Phase[STATS_PHASE_MAX];
+	UINTN       NumFiles;
+	struct {
+		UINT64  Size;
+		UINT64  Time;
+		CHAR16  Path[PATH_MAX + 1];
+	} File[STATS_SLOWEST_FILES];    /* The slowest files, from the slowest one */
+} Stats = { 0 };
+
+/**
+  Set up the statistics report, along with the volume that it is written to.
+
+  @param[in]   Root             (Optional) A file handle to the root directory of the
+                                volume to write STATS_LOG_NAME to, or NULL for none.
+**/
+VOID InitStats(
+	OPTIONAL IN CONST EFI_FILE_HANDLE Root
+)
+{
+	Stats.Root = Root;
+}
+
+/**
+  Account for the time spent in a phase of the verification.
+
+  @param[in]   Phase            The STATS_ phase to account the time to.
+  @param[in]   Time             The time that was spent, in microseconds.
+  @param[in]   Size             The number of bytes that were processed.
+**/
+VOID AddPhaseStats(
+	IN CONST UINTN Phase,
+	IN CONST UINT64 Time,
+	IN CONST UINT64 Size
+)
+{
+	V_ASSERT(Phase < STATS_PHASE_MAX);
+	Stats.Phase[Phase].Count++;
+	Stats.Phase[Phase].Time += Time;
+	Stats.Phase[Phase].Bytes += Size;
+}
+
+/**
+  Account for the time it took to verify a file, and record it if it is one
+  of the STATS_SLOWEST_FILES slowest.
+
+  @param[in]   Path             A pointer to the CHAR16 string with the path of the file.
+  @param[in]   Size             The size of the file.
+  @param[in]   Time             The time it took, in microseconds.
+**/
+VOID AddFileStats(
+	IN CONST CHAR16* Path,
+	IN CONST UINT64 Size,
+	IN CONST UINT64 Time
+)
+{
+	UINTN i;
+
+	Stats.NumFiles++;
+	for (i = 0; i < MIN(Stats.NumFiles - 1, STATS_SLOWEST_FILES) && Stats.File[i].Time >= Time; i++);
+	if (i >= STATS_SLOWEST_FILES)
+		return;
+	CopyMem(&Stats.File[i + 1], &Stats.File[i], (STATS_SLOWEST_FILES - i - 1) * sizeof(Stats.File[0]));
+	Stats.File[i].Size = Size;
+	Stats.File[i].Time = Time;
+	SafeStrCpy(Stats.File[i].Path, ARRAY_SIZE(Stats.File[i].Path), Path);
+}
+
+/**
+  Open the file that the statistics are written to, replacing the one from
+  the previous boot.
+
+  @retval      A handle to the file, or NULL if the volume is not writable.
+**/
+STATIC EFI_FILE_HANDLE OpenStatsLog(VOID)
+{
+	EFI_FILE_HANDLE File;
+
+	if (!EFI_ERROR(Stats.Root->Open(Stats.Root, &File, STATS_LOG_NAME,
+		EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0)))
+		File->Delete(File);
+	if (EFI_ERROR(Stats.Root->Open(Stats.Root, &File, STATS_LOG_NAME,
+		EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0)))
+		return NULL;
+	return File;
+}
+
+/**
+  Output a line of the statistics, on the console and to their file.
+
+  @param[in]   Log              (Optional) A handle to the file the statistics are written to.
+  @param[in]   Line             A pointer to the CHAR16 string with the line.
+**/
+STATIC VOID ReportStatsLine(
+	OPTIONAL IN CONST EFI_FILE_HANDLE Log,
+	IN CONST CHAR16* Line
+)
+{
+	UINTN Size;
+
+	if (!gIsTestMode)
+		Print(L"%s\n", Line);
+	if (Log == NULL)
+		return;
+	// The file is UTF-16, so that the lines can be written as is
+	Size = StrLen(Line) * sizeof(CHAR16);
+	Log->Write(Log, &Size, (VOID*)Line);
+	Size = 2 * sizeof(CHAR16);
+	Log->Write(Log, &Size, L"\r\n");
+}
+
+/**
+  Report the statistics, i.e. the time spent in each phase and the slowest
+  files, on the console (unless running in test mode) and to STATS_LOG_NAME,
+  if the volume set by InitStats() is writable. This only reports data if
+  ENABLE_STATS is defined.
+**/
+VOID ReportStats(VOID)
+{
+	EFI_FILE_HANDLE Log = NULL;
+	CONST CHAR16 Bom = 0xFEFF;
+	CHAR16 Line[STRING_MAX];
+	UINTN i, Size;
+
+	if (Stats.Root != NULL)
+		Log = OpenStatsLog();
+	if (Log != NULL) {
+		Size = sizeof(Bom);
+		Log->Write(Log, &Size, (VOID*)&Bom);
+	}
+	SetTextPosition(0, gConsole.Rows / 2 + 1);
+
+	for (i = 0; i < STATS_PHASE_MAX; i++) {
+		if (Stats.Phase[i].Count == 0)
+			continue;
+		if (Stats.Phase[i].Bytes == 0)
+			UnicodeSPrint(Line, ARRAY_SIZE(Line), L"%s: %ld call%s, %ld.%03ld ms", PhaseName[i],
+				Stats.Phase[i].Count, (Stats.Phase[i].Count == 1) ? L"" : L"s",
+				Stats.Phase[i].Time / 1000, Stats.Phase[i].Time % 1000);
+		else
+			UnicodeSPrint(Line, ARRAY_SIZE(Line), L"%s: %ld call%s, %ld.%03ld ms, %d MB/s", PhaseName[i],
+				Stats.Phase[i].Count, (Stats.Phase[i].Count == 1) ? L"" : L"s",
+				Stats.Phase[i].Time / 1000, Stats.Phase[i].Time % 1000,
+				GetThroughput(Stats.Phase[i].Bytes, Stats.Phase[i].Time));
+		ReportStatsLine(Log, Line);
+	}
+
+	UnicodeSPrint(Line, ARRAY_SIZE(Line), L"Slowest of %d file%s:", Stats.NumFiles,
+		(Stats.NumFiles == 1) ? L"" : L"s");
+	ReportStatsLine(Log, Line);
+	for (i = 0; i < MIN(Stats.NumFiles, STATS_SLOWEST_FILES); i++) {
+		UnicodeSPrint(Line, ARRAY_SIZE(Line), L"%2d. %s%s: %ld.%03ld ms, %d MB/s", i + 1,
+			Stats.File[i].Path, SizeToHumanReadable(Stats.File[i].Size), Stats.File[i].Time / 1000,
+			Stats.File[i].Time % 1000, GetThroughput(Stats.File[i].Size, Stats.File[i].Time));
+		ReportStatsLine(Log, Line);
+	}
+
+	if (Log != NULL)
+		Log->Close(Log);
+}
+
+#else /* ENABLE_STATS */
+
+VOID InitStats(
+	OPTIONAL IN CONST EFI_FILE_HANDLE Root
+)
+{
+}
+
+VOID ReportStats(VOID)
+{
+}
+
+#endif /* ENABLE_STATS */
@@ -234,3 +234,198 @@ BOOLEAN IsProblematicNtfsDriver(
 	}
 	return FALSE;
 }
+
+/**
+  Detect if the CPU supports the AVX2 instruction set, and if the YMM registers
+  have been enabled by the firmware.
+
+  @retval TRUE   AVX2 instructions can be used.
+  @retval FALSE  AVX2 instructions are not available.
+**/
+BOOLEAN IsAvx2Supported(VOID)
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	UINT32 MaxLeaf, Ebx, Ecx;
+	UINT64 Xcr0;
+#if defined(_MSC_VER)
+	INT32 Regs[4];
+
+	__cpuid(Regs, 0);
+	MaxLeaf = (UINT32)Regs[0];
+	__cpuid(Regs, 1);
+	Ecx = (UINT32)Regs[2];
+#else
+	AsmCpuid(0, &MaxLeaf, NULL, NULL, NULL);
+	AsmCpuid(1, NULL, NULL, &Ecx, NULL);
+#endif
+	// We need both AVX (bit 28) and XGETBV being enabled (OSXSAVE, bit 27)
+	if (MaxLeaf < 7 || (Ecx & 0x18000000) != 0x18000000)
+		return FALSE;
+	// And the firmware must have enabled the XMM and YMM state (XCR0 bits 1 and 2)
+#if defined(_MSC_VER)
+	Xcr0 = _xgetbv(0);
+	__cpuidex(Regs, 7, 0);
+	Ebx = (UINT32)Regs[1];
+#else
+	Xcr0 = AsmXGetBv(0);
+	AsmCpuidEx(7, 0, NULL, &Ebx, NULL, NULL);
+#endif
+	if ((Xcr0 & 0x06) != 0x06)
+		return FALSE;
+	return (Ebx & 0x20) ? TRUE : FALSE;
+#else
+	return FALSE;
+#endif
+}
+
+/**
+  Detect if the CPU supports the BMI1 instruction set.
+
+  @retval TRUE   BMI1 instructions can be used.
+  @retval FALSE  BMI1 instructions are not available.
+**/
+BOOLEAN IsBmiSupported(VOID)
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	UINT32 MaxLeaf, Ebx;
+#if defined(_MSC_VER)
+	INT32 Regs[4];
+
+	__cpuid(Regs, 0);
+	MaxLeaf = (UINT32)Regs[0];
+	if (MaxLeaf < 7)
+		return FALSE;
+	__cpuidex(Regs, 7, 0);
+	Ebx = (UINT32)Regs[1];
+#else
+	AsmCpuid(0, &MaxLeaf, NULL, NULL, NULL);
+	if (MaxLeaf < 7)
+		return FALSE;
+	AsmCpuidEx(7, 0, NULL, &Ebx, NULL, NULL);
+#endif
+	// BMI1 is reported in bit 3
+	return (Ebx & 0x08) ? TRUE : FALSE;
+#else
+	return FALSE;
+#endif
+}
+
+/**
+  Detect if the CPU supports the SHA-256 instructions, i.e. the SHA extensions
+  (along with SSSE3) on x86 or the SHA2 instructions of the ARMv8 Cryptographic
+  Extension on AArch64.
+
+  @retval TRUE   SHA-256 instructions can be used.
+  @retval FALSE  SHA-256 instructions are not available.
+**/
+BOOLEAN IsSha256Supported(VOID)
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	UINT32 MaxLeaf, Ebx, Ecx;
+#if defined(_MSC_VER)
+	INT32 Regs[4];
+
+	__cpuid(Regs, 0);
+	MaxLeaf = (UINT32)Regs[0];
+	__cpuid(Regs, 1);
+	Ecx = (UINT32)Regs[2];
+#else
+	AsmCpuid(0, &MaxLeaf, NULL, NULL, NULL);
+	AsmCpuid(1, NULL, NULL, &Ecx, NULL);
+#endif
+	// The SHA-NI transform also needs SSSE3 (bit 9) for the byte swapping
+	if (MaxLeaf < 7 || (Ecx & 0x200) == 0)
+		return FALSE;
+#if defined(_MSC_VER)
+	__cpuidex(Regs, 7, 0);
+	Ebx = (UINT32)Regs[1];
+#else
+	AsmCpuidEx(7, 0, NULL, &Ebx, NULL, NULL);
+#endif
+	// SHA is reported in bit 29
+	return (Ebx & 0x20000000) ? TRUE : FALSE;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	UINT64 Isar0;
+#if defined(_MSC_VER)
+	Isar0 = (UINT64)_ReadStatusReg(ARM64_SYSREG(3, 0, 0, 6, 0));
+#else
+	__asm__ volatile("mrs %0, id_aa64isar0_el1" : "=r" (Isar0));
+#endif
+	// SHA2 is reported in ID_AA64ISAR0_EL1 bits [15:12]
+	return ((Isar0 >> 12) & 0x0f) ? TRUE : FALSE;
+#else
+	return FALSE;
+#endif
+}
+
+/* Number of timestamp counter ticks per millisecond, as set by InitTimestamp() */
+STATIC UINT64 TimestampTicksPerMs = 0;
+
+/**
+  Read the free-running counter of the CPU, i.e. the TSC on x86, the virtual
+  count of the generic timer on ARM64 or the time CSR on RISC-V.
+
+  @retval The current value of the counter, or 0 if the CPU has no such counter.
+**/
+STATIC UINT64 ReadTimestampCounter(VOID)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+	return AsmReadTsc();
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+	return (UINT64)_ReadStatusReg(ARM64_CNTVCT);
+#elif defined(__aarch64__)
+	UINT64 Value;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r" (Value));
+	return Value;
+#elif defined(__riscv) && (__riscv_xlen == 64)
+	UINT64 Value;
+	__asm__ volatile("rdtime %0" : "=r" (Value));
+	return Value;
+#else
+	return 0;
+#endif
+}
+
+/**
+  Calibrate the timestamp counter that GetTimestamp() uses against gBS->Stall().
+**/
+VOID InitTimestamp(VOID)
+{
+	UINT64 Start = ReadTimestampCounter();
+
+	gBS->Stall(TIMESTAMP_CALIBRATION_TIME * 1000);
+	TimestampTicksPerMs = (ReadTimestampCounter() - Start) / TIMESTAMP_CALIBRATION_TIME;
+}
+
+/**
+  Get a timestamp, that is only meant to measure elapsed time.
+
+  @retval The timestamp in microseconds, or 0 if the platform has no usable timestamp counter.
+**/
+UINT64 GetTimestamp(VOID)
+{
+	UINT64 Ticks;
+
+	if (TimestampTicksPerMs == 0)
+		return 0;
+	Ticks = ReadTimestampCounter();
+	return (Ticks / TimestampTicksPerMs) * 1000 + ((Ticks % TimestampTicksPerMs) * 1000) / TimestampTicksPerMs;
+}
+
+/**
+  Compute a throughput in MB/s.
+
+  @param[in]   Bytes            The number of bytes that were processed.
+  @param[in]   Time             The time it took, in microseconds.
+
+  @retval      The throughput in MB/s.
+**/
+UINTN GetThroughput(
+	IN CONST UINT64 Bytes,
+	IN CONST UINT64 Time
+)
+{
+	return (UINTN)((Bytes * 1000000) / (MAX(Time, 1) * 1024 * 1024));
+}
@@ -32,6 +32,7 @@ STATIC CHAR32 GetNextUnicodeChar(
 )
 {
 	CHAR32 UnicodeChar = (CHAR32)-1;
+	UINTN i;
 
 	if (Start == NULL || Size == NULL)
 		return (CHAR32)-1;
@@ -54,6 +55,14 @@ STATIC CHAR32 GetNextUnicodeChar(
 		return (CHAR32)-1;
 	}
 
+	// Reject truncated sequences, so that we never read past the NUL terminator
+	for (i = 1; i < *Size; i++) {
+		if ((Start[i] & 0xC0) != 0x80) {
+			*Size = 0;
+			return (CHAR32)-1;
+		}
+	}
+
 	// Decode the UTF-8 sequence into a 32-bit Unicode character
 	switch (*Size) {
 	case 1:
@@ -86,10 +95,15 @@ STATIC CHAR32 GetNextUnicodeChar(
 
 /**
   Convert a UTF-8 encoded string to a UCS-2 encoded string.
+  Runs of ASCII characters, which most paths are made of, are widened 8 bytes
+  at a time, and only the other characters go through GetNextUnicodeChar().
 
-  @param[in]  Utf8String      A pointer to the input UTF-8 encoded string.
+  @param[in]  Utf8String      A pointer to the input NUL-terminated UTF-8 encoded string.
+  @param[in]  Utf8Length      The length of Utf8String (in bytes, not including the NUL terminator).
   @param[out] Ucs2String      A pointer to the output UCS-2 encoded string.
   @param[in]  Ucs2StringSize  The size of the Ucs2String buffer (in CHAR16).
+  @param[out] Ucs2Length      A pointer to the variable that receives the length of Ucs2String
+                              (in CHAR16, not including the NUL terminator).
 
   @retval EFI_SUCCESS            The conversion was successful.
   @retval EFI_INVALID_PARAMETER  One or more of the input parameters are invalid.
@@ -97,21 +111,33 @@ STATIC CHAR32 GetNextUnicodeChar(
 **/
 EFI_STATUS Utf8ToUcs2(
 	IN CONST CHAR8* Utf8String,
+	IN CONST UINTN Utf8Length,
 	OUT CHAR16* Ucs2String,
-	IN CONST UINTN Ucs2StringSize
+	IN CONST UINTN Ucs2StringSize,
+	OUT UINTN* Ucs2Length
 )
 {
 	CHAR32 UnicodeChar;
-	UINTN Size, Index = 0, Ucs2Index = 0;
+	UINTN i, Size, Index = 0, Ucs2Index = 0;
 
-	if (Utf8String == NULL || Ucs2String == NULL)
+	if (Utf8String == NULL || Ucs2String == NULL || Ucs2Length == NULL)
 		return EFI_INVALID_PARAMETER;
 
 	// Sanity check
 	V_ASSERT(Ucs2StringSize <= STRING_MAX);
 
 	// Iterate through the UTF-8 string
-	while (Utf8String[Index] != '\0') {
+	while (Index < Utf8Length) {
+		// Widen whole words that only contain ASCII characters
+		if (Index + 8 <= Utf8Length && Ucs2Index + 8 < Ucs2StringSize &&
+			((LOAD32(&Utf8String[Index], 0) | LOAD32(&Utf8String[Index], 1)) & 0x80808080) == 0) {
+			for (i = 0; i < 8; i++)
+				Ucs2String[Ucs2Index + i] = (CHAR16)Utf8String[Index + i];
+			Index += 8;
+			Ucs2Index += 8;
+			continue;
+		}
+
 		// Decode UTF-8 character to Unicode
 		UnicodeChar = GetNextUnicodeChar(&Utf8String[Index], &Size);
 
@@ -142,6 +168,66 @@ EFI_STATUS Utf8ToUcs2(
 
 	// NUL-terminate the UCS-2 string
 	Ucs2String[Ucs2Index] = L'\0';
+	*Ucs2Length = Ucs2Index;
 
 	return EFI_SUCCESS;
 }
+
+/**
+  Convert a UCS-2 encoded string to a UTF-8 encoded string.
+
+  @param[in]  Ucs2String      A pointer to the input NUL-terminated UCS-2 encoded string.
+  @param[out] Utf8String      A pointer to the output UTF-8 encoded string, or NULL to
+                              only compute the length of the result.
+  @param[in]  Utf8StringSize  The size of the Utf8String buffer (in bytes).
+
+  @retval     The length of the UTF-8 string (in bytes, not including the NUL terminator),
+              which is only written up to Utf8StringSize bytes, NUL terminator included.
+**/
+UINTN Ucs2ToUtf8(
+	IN CONST CHAR16* Ucs2String,
+	OUT CHAR8* Utf8String,
+	IN CONST UINTN Utf8StringSize
+)
+{
+	CHAR32 UnicodeChar;
+	CHAR8 Sequence[4];
+	UINTN i, Size, Index = 0;
+
+	for (; *Ucs2String != L'\0'; Ucs2String++) {
+		UnicodeChar = *Ucs2String;
+		// Combine surrogate pairs, and leave unpaired surrogates as they are
+		if (UnicodeChar >= 0xD800 && UnicodeChar < 0xDC00 &&
+			Ucs2String[1] >= 0xDC00 && Ucs2String[1] < 0xE000) {
+			UnicodeChar = 0x10000 + ((UnicodeChar - 0xD800) << 10) + (Ucs2String[1] - 0xDC00);
+			Ucs2String++;
+		}
+		if (UnicodeChar < 0x80) {
+			Sequence[0] = (CHAR8)UnicodeChar;
+			Size = 1;
+		} else if (UnicodeChar < 0x800) {
+			Sequence[0] = (CHAR8)(0xC0 | (UnicodeChar >> 6));
+			Sequence[1] = (CHAR8)(0x80 | (UnicodeChar & 0x3F));
+			Size = 2;
+		} else if (UnicodeChar < 0x10000) {
+			Sequence[0] = (CHAR8)(0xE0 | (UnicodeChar >> 12));
+			Sequence[1] = (CHAR8)(0x80 | ((UnicodeChar >> 6) & 0x3F));
+			Sequence[2] = (CHAR8)(0x80 | (UnicodeChar & 0x3F));
+			Size = 3;
+		} else {
+			Sequence[0] = (CHAR8)(0xF0 | (UnicodeChar >> 18));
+			Sequence[1] = (CHAR8)(0x80 | ((UnicodeChar >> 12) & 0x3F));
+			Sequence[2] = (CHAR8)(0x80 | ((UnicodeChar >> 6) & 0x3F));
+			Sequence[3] = (CHAR8)(0x80 | (UnicodeChar & 0x3F));
+			Size = 4;
+		}
+		for (i = 0; i < Size; i++, Index++) {
+			if (Utf8String != NULL && Index + 1 < Utf8StringSize)
+				Utf8String[Index] = Sequence[i];
+		}
+	}
+
+	if (Utf8String != NULL && Utf8StringSize != 0)
+		Utf8String[MIN(Index, Utf8StringSize - 1)] = '\0';
+	return Index;
+}
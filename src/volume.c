@@ -0,0 +1,481 @@
+/*
+ * uefi-md5sum: UEFI MD5Sum validator - Verification of multiple volumes
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * Media that span more than one partition or device, such as an ESP along with
+ * a data partition, can have the hash list of the boot volume name the other
+ * volumes to verify, by label, with md5sum_volume. Each of these volumes has
+ * its own hash list, at the root, which uses the algorithm of the boot one.
+ * Rather than verifying the volumes one after the other, their entries are
+ * merged into the hash list of the boot volume, by alternating between the
+ * volumes according to the amount of data scheduled from each one, so that the
+ * verification engines keep reads in flight on all the devices at once, and
+ * hash their data on the same processors, with a single progress bar. Each
+ * entry records the volume it belongs to, and failures are reported in the
+ * order of the volumes, and then of their hash lists.
+ */
+
+/* Label that md5sum_volume uses for all the other volumes that have a hash list */
+STATIC CONST CHAR16 AllVolumes[] = L"*";
+
+/**
+  Get the label of a volume, from its file system information.
+
+  @param[in]   Root             A file handle to the root directory of the volume.
+  @param[out]  Label            A pointer to the VOLUME_LABEL_SIZE buffer that receives the
+                                label, which is empty if the volume has none.
+**/
+VOID GetVolumeLabel(
+	IN CONST EFI_FILE_HANDLE Root,
+	OUT CHAR16* Label
+)
+{
+	UINT64 Buffer[(SIZE_OF_EFI_FILE_SYSTEM_INFO + (RAW_NAME_MAX + 1) * sizeof(CHAR16)) / sizeof(UINT64) + 1];
+	EFI_FILE_SYSTEM_INFO* Info = (EFI_FILE_SYSTEM_INFO*)Buffer;
+	UINTN i, Size = sizeof(Buffer);
+
+	Label[0] = L'\0';
+	if (EFI_ERROR(Root->GetInfo(Root, &gEfiFileSystemInfoGuid, &Size, Info)))
+		return;
+	// Labels that are longer than the ones of any file system we know of are truncated
+	for (i = 0; i < VOLUME_LABEL_SIZE - 1 && Info->VolumeLabel[i] != L'\0'; i++)
+		Label[i] = Info->VolumeLabel[i];
+	Label[i] = L'\0';
+}
+
+/**
+  Open the root directory of a volume and get its label.
+
+  @param[in]   Handle           The handle of the volume.
+  @param[out]  Root             A pointer to receive the root directory.
+  @param[out]  Label            A pointer to the VOLUME_LABEL_SIZE buffer that receives the label.
+
+  @retval EFI_SUCCESS           The volume was opened.
+  @retval other                 The volume could not be opened.
+**/
+STATIC EFI_STATUS OpenVolume(
+	IN CONST EFI_HANDLE Handle,
+	OUT EFI_FILE_HANDLE* Root,
+	OUT CHAR16* Label
+)
+{
+	EFI_STATUS Status;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+
+	Status = gBS->OpenProtocol(Handle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Volume,
+		gMainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (!EFI_ERROR(Status))
+		Status = Volume->OpenVolume(Volume, Root);
+	if (EFI_ERROR(Status))
+		return Status;
+	GetVolumeLabel(*Root, Label);
+	return EFI_SUCCESS;
+}
+
+/**
+  Check if a volume has a hash list, for an algorithm.
+
+  @param[in]   Root             A file handle to the root directory of the volume.
+  @param[in]   Algorithm        A pointer to the HASH_ALGORITHM.
+
+  @retval TRUE                  The volume has a hash list, in text or binary form.
+  @retval FALSE                 The volume has no hash list.
+**/
+STATIC BOOLEAN HasHashList(
+	IN CONST EFI_FILE_HANDLE Root,
+	IN CONST HASH_ALGORITHM* Algorithm
+)
+{
+	EFI_FILE_HANDLE File;
+
+	if (EFI_ERROR(Root->Open(Root, &File, (CHAR16*)Algorithm->HashFile, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY)) &&
+		EFI_ERROR(Root->Open(Root, &File, (CHAR16*)Algorithm->BinaryFile, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY)))
+		return FALSE;
+	File->Close(File);
+	return TRUE;
+}
+
+/**
+  Parse the hash list of a volume, and reorder it according to its md5sum_order
+  directive. The directives that only apply to the whole media, as well as the
+  chunks file, are ignored.
+
+  @param[in]   Volume           A pointer to the HASH_VOLUME.
+  @param[in]   Algorithm        A pointer to the HASH_ALGORITHM of the boot hash list.
+  @param[out]  List             A pointer to the HASH_LIST to populate.
+
+  @retval EFI_SUCCESS           The hash list was parsed.
+  @retval other                 The hash list could not be parsed, which has been reported.
+**/
+STATIC EFI_STATUS ParseVolume(
+	IN CONST HASH_VOLUME* Volume,
+	IN CONST HASH_ALGORITHM* Algorithm,
+	OUT HASH_LIST* List
+)
+{
+	EFI_STATUS Status;
+
+	Status = Parse(Volume->Root, Algorithm, FALSE, List);
+	if (Status == EFI_NOT_FOUND)
+		PrintError(L"Unable to open '%s' on '%s'", Algorithm->HashFile, Volume->Label);
+	if (EFI_ERROR(Status))
+		return Status;
+	if (List->Volume != NULL)
+		SafeFree(List->Volume);
+	if (List->Chunk != NULL)
+		SafeFree(List->Chunk);
+	if (List->ChunkBuffer != NULL)
+		SafeFree(List->ChunkBuffer);
+	if (List->ChunkIndex != NULL)
+		SafeFree(List->ChunkIndex);
+	Status = ScheduleHashList(Volume->Root, List);
+	if (EFI_ERROR(Status))
+		PrintError(L"Could not reorder the hash list of '%s'", Volume->Label);
+	// The failures are recorded into the merged list
+	if (List->Failure != NULL)
+		SafeFree(List->Failure);
+	return Status;
+}
+
+/* Get the length of the UTF-8 path of an entry, once it is merged (in bytes) */
+STATIC UINTN GetMergedPathLength(
+	IN CONST HASH_LIST* Source,
+	IN CONST HASH_ENTRY* Entry
+)
+{
+	CONST CHAR8* Path = GetEntryPath(Source->Buffer, Entry);
+
+	return Source->WidePaths ? Ucs2ToUtf8((CONST CHAR16*)Path, NULL, 0) : AsciiStrLen(Path);
+}
+
+/**
+  Merge the entries of the hash lists of the volumes into the hash list of
+  the boot volume, by picking the next entry from the volume that has the
+  least data scheduled so far, and copying its hash and path into the buffer of
+  the merged list. The paths of the merged list are UTF-8, so the ones from a
+  binary hash list are converted.
+
+  @param[in,out] List           A pointer to the HASH_LIST of the boot volume.
+  @param[in]     VolumeList     An array of the HASH_LIST of each volume, where the
+                                one of the boot volume, as well as the ones of the
+                                volumes that are not used, are ignored.
+
+  @retval EFI_SUCCESS           The lists were merged.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+STATIC EFI_STATUS MergeVolumes(
+	IN OUT HASH_LIST* List,
+	IN CONST HASH_LIST* VolumeList
+)
+{
+	CONST UINTN HashSize = List->Algorithm->HashSize;
+	CONST HASH_LIST* Source;
+	CONST CHAR8* Path;
+	HASH_ENTRY* Entry;
+	UINT8* Buffer;
+	UINT64* Size = NULL;
+	BOOLEAN HasSizes = FALSE;
+	UINT64 Scheduled[HASH_VOLUMES_MAX] = { 0 }, AverageSize[HASH_VOLUMES_MAX] = { 0 }, TotalBytes = 0;
+	UINTN i, n, v, Len, NumEntries = 0, BufferSize = 0;
+	UINTN Next[HASH_VOLUMES_MAX] = { 0 }, FirstIndex[HASH_VOLUMES_MAX] = { 0 };
+
+	for (v = 0; v < List->NumVolumes; v++) {
+		Source = (v == 0) ? List : &VolumeList[v];
+		if (v != 0 && List->Volume[v].Root == NULL)
+			continue;
+		FirstIndex[v] = NumEntries;
+		NumEntries += Source->NumEntries;
+		for (i = 0; i < Source->NumEntries; i++)
+			BufferSize += HashSize + GetMergedPathLength(Source, &Source->Entry[i]) + 1;
+		// The total size is only known if it is known for all the volumes
+		TotalBytes = (Source->TotalBytes != 0 && (v == 0 || TotalBytes != 0)) ?
+			TotalBytes + Source->TotalBytes : 0;
+		// Entries without a size are assumed to be of the average size of their
+		// volume, if known, so that volumes alternate by number of entries otherwise
+		AverageSize[v] = (Source->TotalBytes != 0 && Source->NumEntries != 0) ?
+			MAX(Source->TotalBytes / Source->NumEntries, 1) : 1;
+		List->Volume[v].NumEntries = Source->NumEntries;
+		HasSizes |= (Source->Size != NULL);
+	}
+
+	Entry = AllocatePool(NumEntries * sizeof(HASH_ENTRY));
+	Buffer = AllocatePool(BufferSize);
+	if (HasSizes)
+		Size = AllocatePool(NumEntries * sizeof(UINT64));
+	if (List->Failure != NULL)
+		SafeFree(List->Failure);
+	List->Failure = AllocatePool(NumEntries * sizeof(HASH_FAILURE));
+	if (Entry == NULL || Buffer == NULL || (HasSizes && Size == NULL) || List->Failure == NULL) {
+		if (Entry != NULL)
+			SafeFree(Entry);
+		if (Buffer != NULL)
+			SafeFree(Buffer);
+		if (Size != NULL)
+			SafeFree(Size);
+		if (List->Failure != NULL)
+			SafeFree(List->Failure);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	for (BufferSize = 0, n = 0; n < NumEntries; n++) {
+		// Pick the volume with the least data scheduled, that has entries left
+		for (v = HASH_VOLUMES_MAX, i = 0; i < List->NumVolumes; i++) {
+			Source = (i == 0) ? List : &VolumeList[i];
+			if ((i != 0 && List->Volume[i].Root == NULL) || Next[i] >= Source->NumEntries)
+				continue;
+			if (v == HASH_VOLUMES_MAX || Scheduled[i] < Scheduled[v])
+				v = i;
+		}
+		V_ASSERT(v < List->NumVolumes);
+		Source = (v == 0) ? List : &VolumeList[v];
+		Entry[n] = Source->Entry[Next[v]++];
+		Scheduled[v] += (GetEntrySize(Source, &Entry[n]) != HASH_SIZE_UNKNOWN) ?
+			GetEntrySize(Source, &Entry[n]) : AverageSize[v];
+		// The sizes are indexed in the order of the hash list files, like the entries
+		if (Size != NULL)
+			Size[FirstIndex[v] + Entry[n].Index] = GetEntrySize(Source, &Entry[n]);
+		CopyMem(&Buffer[BufferSize], GetEntryHash(Source->Buffer, &Entry[n]), HashSize);
+		Path = GetEntryPath(Source->Buffer, &Entry[n]);
+		Len = GetMergedPathLength(Source, &Entry[n]) + 1;
+		Entry[n].Hash = (UINT32)BufferSize;
+		Entry[n].Path = (UINT32)(BufferSize + HashSize);
+		Entry[n].Index += (UINT32)FirstIndex[v];
+		Entry[n].Volume = (UINT16)v;
+		if (Source->WidePaths)
+			Ucs2ToUtf8((CONST CHAR16*)Path, (CHAR8*)&Buffer[Entry[n].Path], Len);
+		else
+			CopyMem(&Buffer[Entry[n].Path], Path, Len);
+		BufferSize += HashSize + Len;
+	}
+
+	SafeFree(List->Entry);
+	SafeFree(List->Buffer);
+	if (List->Size != NULL)
+		SafeFree(List->Size);
+	List->Entry = Entry;
+	List->Buffer = Buffer;
+	List->Size = Size;
+	List->WidePaths = FALSE;
+	List->NumEntries = NumEntries;
+	List->TotalBytes = TotalBytes;
+	return EFI_SUCCESS;
+}
+
+/**
+  Open the volumes that the md5sum_volume directives of a hash list name, parse
+  their own hash list, with the algorithm of the boot one, and merge their
+  entries into the hash list, so that all the volumes are verified at once.
+  Volumes that can't be used are reported, and counted as failures.
+
+  @param[in]     DeviceHandle   The handle of the boot volume.
+  @param[in]     Root           A file handle to the root directory of the boot volume.
+  @param[in,out] List           A pointer to the HASH_LIST of the boot volume.
+  @param[out]    NumFailed      A pointer to receive the number of volumes that can't be used.
+
+  @retval EFI_SUCCESS           The volumes were merged, or the hash list names none.
+  @retval EFI_OUT_OF_RESOURCES  A memory allocation error occurred.
+**/
+EFI_STATUS OpenHashVolumes(
+	IN CONST EFI_HANDLE DeviceHandle,
+	IN CONST EFI_FILE_HANDLE Root,
+	IN OUT HASH_LIST* List,
+	OUT UINTN* NumFailed
+)
+{
+	EFI_STATUS Status;
+	EFI_HANDLE* Handles = NULL;
+	EFI_FILE_HANDLE VolumeRoot;
+	HASH_VOLUME* Volume;
+	HASH_LIST VolumeList[HASH_VOLUMES_MAX] = { 0 };
+	CHAR16 Label[VOLUME_LABEL_SIZE];
+	BOOLEAN Any = FALSE;
+	UINTN i, v, NumHandles = 0;
+
+	*NumFailed = 0;
+	if (List->NumVolumes < 2)
+		return EFI_SUCCESS;
+
+	// The volumes are only looked up by label, so the wildcard is removed
+	for (v = 1; v < List->NumVolumes; v++) {
+		if (StrCmp(List->Volume[v].Label, AllVolumes) == 0) {
+			Any = TRUE;
+			CopyMem(&List->Volume[v], &List->Volume[v + 1], (List->NumVolumes - v - 1) * sizeof(HASH_VOLUME));
+			List->NumVolumes--;
+			v--;
+		}
+	}
+	List->Volume[0].Root = Root;
+	GetVolumeLabel(Root, List->Volume[0].Label);
+	if (List->Volume[0].Label[0] == L'\0')
+		SafeStrCpy(List->Volume[0].Label, VOLUME_LABEL_SIZE, L"Boot");
+
+	// Match the volumes of the system against the labels
+	gBS->LocateHandleBuffer(ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &NumHandles, &Handles);
+	for (i = 0; i < NumHandles; i++) {
+		if (Handles[i] == DeviceHandle || EFI_ERROR(OpenVolume(Handles[i], &VolumeRoot, Label)))
+			continue;
+		for (v = 1; v < List->NumVolumes; v++) {
+			if (List->Volume[v].Root == NULL && _StriCmp(List->Volume[v].Label, Label) == 0)
+				break;
+		}
+		// Only the volumes that have a hash list are added by the wildcard
+		if (v >= List->NumVolumes && Any && List->NumVolumes < HASH_VOLUMES_MAX &&
+			HasHashList(VolumeRoot, List->Algorithm)) {
+			v = List->NumVolumes++;
+			if (Label[0] == L'\0')
+				UnicodeSPrint(Label, VOLUME_LABEL_SIZE, L"Volume %d", v);
+		}
+		if (v >= List->NumVolumes) {
+			VolumeRoot->Close(VolumeRoot);
+			continue;
+		}
+		// Display the label of the volume, rather than the one of the hash list
+		SafeStrCpy(List->Volume[v].Label, VOLUME_LABEL_SIZE, Label);
+		List->Volume[v].Root = VolumeRoot;
+	}
+	if (Handles != NULL)
+		SafeFree(Handles);
+
+	// Parse the hash lists of the volumes we found
+	for (v = 1; v < List->NumVolumes; v++) {
+		Volume = &List->Volume[v];
+		Status = EFI_NOT_FOUND;
+		if (Volume->Root == NULL)
+			PrintError(L"Could not find volume '%s'", Volume->Label);
+		else
+			Status = ParseVolume(Volume, List->Algorithm, &VolumeList[v]);
+		if (EFI_ERROR(Status)) {
+			if (Volume->Root != NULL)
+				Volume->Root->Close(Volume->Root);
+			Volume->Root = NULL;
+			Volume->Status = Status;
+			(*NumFailed)++;
+		}
+	}
+
+	Status = MergeVolumes(List, VolumeList);
+	if (EFI_ERROR(Status))
+		PrintError(L"Could not merge the hash lists of the volumes");
+
+	for (v = 1; v < List->NumVolumes; v++) {
+		if (VolumeList[v].Entry != NULL)
+			SafeFree(VolumeList[v].Entry);
+		if (VolumeList[v].Buffer != NULL)
+			SafeFree(VolumeList[v].Buffer);
+		if (VolumeList[v].Size != NULL)
+			SafeFree(VolumeList[v].Size);
+	}
+	return Status;
+}
+
+/**
+  Get the path of a hash list entry, as it is displayed, i.e. prefixed with
+  the label of its volume, if it isn't on the boot volume.
+
+  @param[in]   List             A pointer to the HASH_LIST the entry belongs to.
+  @param[in]   Entry            A pointer to the HASH_ENTRY.
+  @param[in]   Path             A pointer to the decoded path of the entry.
+  @param[out]  Buffer           A pointer to a buffer that may receive the displayed path.
+  @param[in]   BufferSize       The size of Buffer (in CHAR16).
+
+  @retval      Either Path or Buffer.
+**/
+CONST CHAR16* GetDisplayPath(
+	IN CONST HASH_LIST* List,
+	IN CONST HASH_ENTRY* Entry,
+	IN CONST CHAR16* Path,
+	OUT CHAR16* Buffer,
+	IN CONST UINTN BufferSize
+)
+{
+	CONST CHAR16* Label;
+	UINTN i, j;
+
+	if (Entry->Volume == 0)
+		return Path;
+	Label = List->Volume[Entry->Volume].Label;
+	for (i = 0; Label[i] != L'\0' && i < BufferSize - 2; i++)
+		Buffer[i] = Label[i];
+	Buffer[i++] = L':';
+	for (j = 0; Path[j] != L'\0' && i < BufferSize - 1; j++)
+		Buffer[i++] = Path[j];
+	Buffer[i] = L'\0';
+	return Buffer;
+}
+
+/**
+  Print the number of files and of failures of each of the volumes that a
+  hash list was verified from, if there is more than one.
+
+  @param[in]   List             A pointer to the HASH_LIST that was verified.
+  @param[in]   NumFailed        The number of failures that were recorded.
+  @param[in]   YPos             The vertical position of the report on the console.
+**/
+VOID ReportHashVolumes(
+	IN CONST HASH_LIST* List,
+	IN CONST UINTN NumFailed,
+	IN CONST UINTN YPos
+)
+{
+	CONST HASH_VOLUME* Volume;
+	CHAR16 Message[PATH_MAX], Part[64];
+	UINTN i, v, Failed[HASH_VOLUMES_MAX] = { 0 };
+
+	if (List->NumVolumes < 2)
+		return;
+	for (i = 0; List->Failure != NULL && i < NumFailed; i++)
+		Failed[List->Failure[i].Entry->Volume]++;
+
+	Message[0] = L'\0';
+	for (v = 0; v < List->NumVolumes; v++) {
+		Volume = &List->Volume[v];
+		if (EFI_ERROR(Volume->Status))
+			UnicodeSPrint(Part, ARRAY_SIZE(Part), L"%s%s: %r", (v == 0) ? L"" : L", ",
+				Volume->Label, Volume->Status);
+		else
+			UnicodeSPrint(Part, ARRAY_SIZE(Part), L"%s%s: %d file%s [%d failed]", (v == 0) ? L"" : L", ",
+				Volume->Label, Volume->NumEntries, (Volume->NumEntries == 1) ? L"" : L"s", Failed[v]);
+		if (StrLen(Message) + StrLen(Part) >= ARRAY_SIZE(Message))
+			break;
+		SafeStrCat(Message, ARRAY_SIZE(Message), Part);
+	}
+	PrintCentered(Message, YPos);
+}
+
+/**
+  Close the volumes of a hash list, besides the boot one, and release them.
+
+  @param[in,out] List           A pointer to the HASH_LIST.
+**/
+VOID CloseHashVolumes(
+	IN OUT HASH_LIST* List
+)
+{
+	UINTN v;
+
+	if (List->Volume == NULL)
+		return;
+	for (v = 1; v < List->NumVolumes; v++) {
+		if (List->Volume[v].Root != NULL)
+			List->Volume[v].Root->Close(List->Volume[v].Root);
+	}
+	SafeFree(List->Volume);
+	List->NumVolumes = 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * uefi-md5sum: Host build - Hash list parser fuzzing target
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libFuzzer entry point for Parse(): each input is written as the md5sum.txt
+ * of a scratch volume, parsed (including the streamed part of the list, if
+ * any), and the path of each resulting entry is decoded, as verification
+ * would. When built with FUZZ_REPLAY defined, rather than against libFuzzer,
+ * the inputs are instead read from the files provided on the command line,
+ * so that crashes can be reproduced with any compiler.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "boot.h"
+#include "shim.h"
+
+STATIC EFI_FILE_HANDLE Root = NULL;
+STATIC char Dir[] = "/tmp/md5sum_fuzz_XXXXXX";
+STATIC char ListPath[sizeof(Dir) + sizeof("/md5sum.txt")];
+
+STATIC VOID Cleanup(VOID)
+{
+	unlink(ListPath);
+	rmdir(Dir);
+}
+
+int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+
+	if (mkdtemp(Dir) == NULL) {
+		perror("md5sum_fuzz");
+		exit(1);
+	}
+	snprintf(ListPath, sizeof(ListPath), "%s/md5sum.txt", Dir);
+	atexit(Cleanup);
+	// The messages that Parse() reports in test mode are of no interest here
+	if (freopen("/dev/null", "w", stdout) == NULL)
+		exit(1);
+	gHost.TestMode = TRUE;
+	gIsTestMode = TRUE;
+	gHost.RootPath = Dir;
+	HostSetup();
+	if (EFI_ERROR(gBS->HandleProtocol(gHost.DeviceHandle, &gEfiSimpleFileSystemProtocolGuid,
+		(VOID**)&Volume)) || EFI_ERROR(Volume->OpenVolume(Volume, &Root))) {
+		fprintf(stderr, "Could not open %s\n", Dir);
+		exit(1);
+	}
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* Data, size_t Size)
+{
+	HASH_LIST List = { 0 };
+	CHAR16 Path[PATH_MAX + 1];
+	EFI_STATUS Status;
+	FILE* File;
+	UINTN i;
+
+	File = fopen(ListPath, "wb");
+	if (File == NULL || fwrite(Data, 1, Size, File) != Size || fclose(File) != 0)
+		abort();
+
+	Status = Parse(Root, &gHashAlgorithm[HASH_TYPE_MD5], TRUE, &List);
+	while (!EFI_ERROR(Status) && IsStreamingList())
+		ParseNextEntries();
+	if (!EFI_ERROR(Status))
+		Status = ExitParse();
+	if (!EFI_ERROR(Status)) {
+		for (i = 0; i < List.NumEntries; i++)
+			DecodeHashEntry(&List, &List.Entry[i], Path, ARRAY_SIZE(Path));
+	}
+
+	SafeFree(List.Buffer);
+	SafeFree(List.Entry);
+	SafeFree(List.Size);
+	SafeFree(List.ChunkBuffer);
+	SafeFree(List.Chunk);
+	SafeFree(List.ChunkIndex);
+	SafeFree(List.Failure);
+	SafeFree(List.Volume);
+	return 0;
+}
+
+#if defined(FUZZ_REPLAY)
+int main(int argc, char** argv)
+{
+	FILE* File;
+	uint8_t* Data;
+	long Size;
+	int i;
+
+	LLVMFuzzerInitialize(&argc, &argv);
+	for (i = 1; i < argc; i++) {
+		File = fopen(argv[i], "rb");
+		if (File == NULL) {
+			perror(argv[i]);
+			return 1;
+		}
+		fseek(File, 0, SEEK_END);
+		Size = ftell(File);
+		fseek(File, 0, SEEK_SET);
+		Data = malloc(Size + 1);
+		if (Data == NULL || fread(Data, 1, Size, File) != (size_t)Size)
+			return 1;
+		fclose(File);
+		LLVMFuzzerTestOneInput(Data, Size);
+		free(Data);
+		fprintf(stderr, "%s: OK\n", argv[i]);
+	}
+	return 0;
+}
+#endif
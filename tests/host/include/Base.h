@@ -0,0 +1,189 @@
+/*
+ * uefi-md5sum: Host build shim - EDK2 base types
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * This is NOT a copy of the EDK2 headers, but a minimal re-declaration of
+ * the subset of types, macros and library calls that uefi-md5sum uses, so
+ * that its sources can be compiled and run natively (see tests/host/).
+ * It must be compiled with -fshort-wchar so that L"" literals are UCS-2.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#if !defined(__SIZEOF_WCHAR_T__) || (__SIZEOF_WCHAR_T__ != 2)
+#error The host shim must be compiled with -fshort-wchar
+#endif
+
+typedef uint8_t             UINT8;
+typedef int8_t              INT8;
+typedef uint16_t            UINT16;
+typedef int16_t             INT16;
+typedef uint32_t            UINT32;
+typedef int32_t             INT32;
+typedef uint64_t            UINT64;
+typedef int64_t             INT64;
+typedef uintptr_t           UINTN;
+typedef intptr_t            INTN;
+typedef char                CHAR8;
+typedef unsigned short      CHAR16;
+typedef unsigned char       BOOLEAN;
+typedef void                VOID;
+
+typedef UINTN               RETURN_STATUS;
+typedef RETURN_STATUS       EFI_STATUS;
+typedef VOID*               EFI_HANDLE;
+typedef VOID*               EFI_EVENT;
+typedef UINTN               EFI_TPL;
+typedef UINT64              EFI_LBA;
+typedef UINT64              EFI_PHYSICAL_ADDRESS;
+typedef UINT64              EFI_VIRTUAL_ADDRESS;
+
+typedef struct {
+	UINT32  Data1;
+	UINT16  Data2;
+	UINT16  Data3;
+	UINT8   Data4[8];
+} GUID;
+typedef GUID                EFI_GUID;
+
+#define CONST               const
+#define STATIC              static
+#define IN
+#define OUT
+#define OPTIONAL
+#define EFIAPI
+#define TRUE                ((BOOLEAN)(1 == 1))
+#define FALSE               ((BOOLEAN)(0 == 1))
+#ifndef NULL
+#define NULL                ((VOID *) 0)
+#endif
+
+#define VA_LIST             va_list
+#define VA_START            va_start
+#define VA_END              va_end
+#define VA_ARG              va_arg
+
+#define OFFSET_OF(TYPE, Field) ((UINTN) offsetof(TYPE, Field))
+#define ALIGN_VALUE(Value, Alignment) ((Value) + (((Alignment) - (Value)) & ((Alignment) - 1U)))
+#define BASE_CR(Record, TYPE, Field)  ((TYPE *) ((CHAR8 *) (Record) - OFFSET_OF(TYPE, Field)))
+
+#define SIZE_4KB            0x00001000
+#define SIZE_1MB            0x00100000
+#define EFI_PAGE_SIZE       SIZE_4KB
+#define EFI_PAGE_MASK       0xFFF
+#define EFI_PAGE_SHIFT      12
+#define EFI_SIZE_TO_PAGES(Size)  (((Size) >> EFI_PAGE_SHIFT) + (((Size) & EFI_PAGE_MASK) ? 1 : 0))
+#define EFI_PAGES_TO_SIZE(Pages) ((Pages) << EFI_PAGE_SHIFT)
+
+#define MAX_BIT             ((UINTN)1 << (sizeof(UINTN) * 8 - 1))
+#define ENCODE_ERROR(a)     ((RETURN_STATUS)(MAX_BIT | (a)))
+#define ENCODE_WARNING(a)   ((RETURN_STATUS)(a))
+#define RETURN_ERROR(a)     (((INTN)(RETURN_STATUS)(a)) < 0)
+#define EFI_ERROR(A)        RETURN_ERROR(A)
+
+#define EFI_SUCCESS               0
+#define EFI_LOAD_ERROR            ENCODE_ERROR(1)
+#define EFI_INVALID_PARAMETER     ENCODE_ERROR(2)
+#define EFI_UNSUPPORTED           ENCODE_ERROR(3)
+#define EFI_BAD_BUFFER_SIZE       ENCODE_ERROR(4)
+#define EFI_BUFFER_TOO_SMALL      ENCODE_ERROR(5)
+#define EFI_NOT_READY             ENCODE_ERROR(6)
+#define EFI_DEVICE_ERROR          ENCODE_ERROR(7)
+#define EFI_WRITE_PROTECTED       ENCODE_ERROR(8)
+#define EFI_OUT_OF_RESOURCES      ENCODE_ERROR(9)
+#define EFI_VOLUME_CORRUPTED      ENCODE_ERROR(10)
+#define EFI_VOLUME_FULL           ENCODE_ERROR(11)
+#define EFI_NO_MEDIA              ENCODE_ERROR(12)
+#define EFI_MEDIA_CHANGED         ENCODE_ERROR(13)
+#define EFI_NOT_FOUND             ENCODE_ERROR(14)
+#define EFI_ACCESS_DENIED         ENCODE_ERROR(15)
+#define EFI_NO_RESPONSE           ENCODE_ERROR(16)
+#define EFI_NO_MAPPING            ENCODE_ERROR(17)
+#define EFI_TIMEOUT               ENCODE_ERROR(18)
+#define EFI_NOT_STARTED           ENCODE_ERROR(19)
+#define EFI_ALREADY_STARTED       ENCODE_ERROR(20)
+#define EFI_ABORTED               ENCODE_ERROR(21)
+#define EFI_ICMP_ERROR            ENCODE_ERROR(22)
+#define EFI_TFTP_ERROR            ENCODE_ERROR(23)
+#define EFI_PROTOCOL_ERROR        ENCODE_ERROR(24)
+#define EFI_INCOMPATIBLE_VERSION  ENCODE_ERROR(25)
+#define EFI_SECURITY_VIOLATION    ENCODE_ERROR(26)
+#define EFI_CRC_ERROR             ENCODE_ERROR(27)
+#define EFI_END_OF_MEDIA          ENCODE_ERROR(28)
+#define EFI_END_OF_FILE           ENCODE_ERROR(31)
+#define EFI_INVALID_LANGUAGE      ENCODE_ERROR(32)
+#define EFI_COMPROMISED_DATA      ENCODE_ERROR(33)
+
+#define RETURN_SUCCESS            EFI_SUCCESS
+
+/*
+ * BaseLib / BaseMemoryLib / MemoryAllocationLib / PrintLib / UefiLib subset
+ */
+VOID* CopyMem(VOID* Destination, CONST VOID* Source, UINTN Length);
+VOID* SetMem(VOID* Buffer, UINTN Length, UINT8 Value);
+VOID* ZeroMem(VOID* Buffer, UINTN Length);
+INTN CompareMem(CONST VOID* DestinationBuffer, CONST VOID* SourceBuffer, UINTN Length);
+BOOLEAN CompareGuid(CONST GUID* Guid1, CONST GUID* Guid2);
+VOID* ScanMem8(CONST VOID* Buffer, UINTN Length, UINT8 Value);
+
+VOID* AllocatePool(UINTN AllocationSize);
+VOID* AllocateZeroPool(UINTN AllocationSize);
+VOID* AllocateCopyPool(UINTN AllocationSize, CONST VOID* Buffer);
+VOID* ReallocatePool(UINTN OldSize, UINTN NewSize, VOID* OldBuffer);
+VOID FreePool(VOID* Buffer);
+VOID* AllocatePages(UINTN Pages);
+VOID* AllocateAlignedPages(UINTN Pages, UINTN Alignment);
+VOID FreePages(VOID* Buffer, UINTN Pages);
+VOID FreeAlignedPages(VOID* Buffer, UINTN Pages);
+
+UINTN StrLen(CONST CHAR16* String);
+UINTN StrSize(CONST CHAR16* String);
+INTN StrCmp(CONST CHAR16* FirstString, CONST CHAR16* SecondString);
+INTN StrnCmp(CONST CHAR16* FirstString, CONST CHAR16* SecondString, UINTN Length);
+RETURN_STATUS StrCpyS(CHAR16* Destination, UINTN DestMax, CONST CHAR16* Source);
+RETURN_STATUS StrCatS(CHAR16* Destination, UINTN DestMax, CONST CHAR16* Source);
+RETURN_STATUS StrnCpyS(CHAR16* Destination, UINTN DestMax, CONST CHAR16* Source, UINTN Length);
+UINTN AsciiStrLen(CONST CHAR8* String);
+INTN AsciiStrCmp(CONST CHAR8* FirstString, CONST CHAR8* SecondString);
+INTN AsciiStrnCmp(CONST CHAR8* FirstString, CONST CHAR8* SecondString, UINTN Length);
+UINT32 SwapBytes32(UINT32 Value);
+UINT64 SwapBytes64(UINT64 Value);
+UINT32 ReadUnaligned32(CONST UINT32* Buffer);
+UINT64 ReadUnaligned64(CONST UINT64* Buffer);
+UINT32 LRotU32(UINT32 Operand, UINTN Count);
+UINT32 RRotU32(UINT32 Operand, UINTN Count);
+UINT64 DivU64x32(UINT64 Dividend, UINT32 Divisor);
+UINT64 DivU64x64Remainder(UINT64 Dividend, UINT64 Divisor, UINT64* Remainder);
+UINT64 MultU64x32(UINT64 Multiplicand, UINT32 Multiplier);
+VOID CpuPause(VOID);
+VOID MemoryFence(VOID);
+#if defined(__x86_64__) || defined(__i386__)
+UINT32 AsmCpuid(UINT32 Index, UINT32* RegisterEax, UINT32* RegisterEbx, UINT32* RegisterEcx, UINT32* RegisterEdx);
+UINT32 AsmCpuidEx(UINT32 Index, UINT32 SubIndex, UINT32* RegisterEax, UINT32* RegisterEbx, UINT32* RegisterEcx, UINT32* RegisterEdx);
+UINT64 AsmReadTsc(VOID);
+UINT64 AsmXGetBv(UINT32 Index);
+#endif
+
+UINTN UnicodeSPrint(CHAR16* StartOfBuffer, UINTN BufferSize, CONST CHAR16* FormatString, ...);
+UINTN UnicodeVSPrint(CHAR16* StartOfBuffer, UINTN BufferSize, CONST CHAR16* FormatString, VA_LIST Marker);
+UINTN AsciiSPrint(CHAR8* StartOfBuffer, UINTN BufferSize, CONST CHAR8* FormatString, ...);
+UINTN Print(CONST CHAR16* Format, ...);
@@ -0,0 +1,3 @@
+/* Host build shim: all the definitions are in Uefi.h */
+#pragma once
+#include <Uefi.h>
@@ -0,0 +1,72 @@
+/*
+ * uefi-md5sum: Host build shim - EFI_HASH2_PROTOCOL definitions
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <Uefi.h>
+
+#define EFI_HASH2_SERVICE_BINDING_PROTOCOL_GUID \
+	{ 0xda836f8d, 0x217f, 0x4ca0, { 0x99, 0xc2, 0x1c, 0xa4, 0xe1, 0x60, 0x77, 0xea } }
+#define EFI_HASH2_PROTOCOL_GUID \
+	{ 0x55b1d734, 0xc5e1, 0x49db, { 0x96, 0x47, 0xb1, 0x6a, 0xfb, 0x0e, 0x30, 0x5b } }
+#define EFI_HASH_ALGORITHM_MD5_GUID \
+	{ 0x0af7c79c, 0x65b5, 0x4319, { 0xb0, 0xae, 0x44, 0xec, 0x48, 0x4e, 0x4a, 0xd7 } }
+#define EFI_HASH_ALGORITHM_SHA256_GUID \
+	{ 0x51aa59de, 0xfdf2, 0x4ea3, { 0xbc, 0x63, 0x87, 0x5f, 0xb7, 0x84, 0x2e, 0xe9 } }
+
+typedef struct _EFI_HASH2_PROTOCOL EFI_HASH2_PROTOCOL;
+
+typedef UINT8 EFI_MD5_HASH2[16];
+typedef UINT8 EFI_SHA1_HASH2[20];
+typedef UINT8 EFI_SHA224_HASH2[28];
+typedef UINT8 EFI_SHA256_HASH2[32];
+typedef UINT8 EFI_SHA384_HASH2[48];
+typedef UINT8 EFI_SHA512_HASH2[64];
+
+typedef union {
+	EFI_MD5_HASH2 Md5Hash;
+	EFI_SHA1_HASH2 Sha1Hash;
+	EFI_SHA224_HASH2 Sha224Hash;
+	EFI_SHA256_HASH2 Sha256Hash;
+	EFI_SHA384_HASH2 Sha384Hash;
+	EFI_SHA512_HASH2 Sha512Hash;
+} EFI_HASH2_OUTPUT;
+
+typedef EFI_STATUS (EFIAPI *EFI_HASH2_GET_HASH_SIZE)(IN CONST EFI_HASH2_PROTOCOL* This,
+	IN CONST EFI_GUID* HashAlgorithm, OUT UINTN* HashSize);
+typedef EFI_STATUS (EFIAPI *EFI_HASH2_HASH)(IN CONST EFI_HASH2_PROTOCOL* This,
+	IN CONST EFI_GUID* HashAlgorithm, IN CONST UINT8* Message, IN UINTN MessageSize,
+	IN OUT EFI_HASH2_OUTPUT* Hash);
+typedef EFI_STATUS (EFIAPI *EFI_HASH2_HASH_INIT)(IN CONST EFI_HASH2_PROTOCOL* This,
+	IN CONST EFI_GUID* HashAlgorithm);
+typedef EFI_STATUS (EFIAPI *EFI_HASH2_HASH_UPDATE)(IN CONST EFI_HASH2_PROTOCOL* This,
+	IN CONST UINT8* Message, IN UINTN MessageSize);
+typedef EFI_STATUS (EFIAPI *EFI_HASH2_HASH_FINAL)(IN CONST EFI_HASH2_PROTOCOL* This,
+	IN OUT EFI_HASH2_OUTPUT* Hash);
+
+struct _EFI_HASH2_PROTOCOL {
+	EFI_HASH2_GET_HASH_SIZE GetHashSize;
+	EFI_HASH2_HASH Hash;
+	EFI_HASH2_HASH_INIT HashInit;
+	EFI_HASH2_HASH_UPDATE HashUpdate;
+	EFI_HASH2_HASH_FINAL HashFinal;
+};
+
+extern EFI_GUID gEfiHash2ServiceBindingProtocolGuid;
+extern EFI_GUID gEfiHash2ProtocolGuid;
+extern EFI_GUID gEfiHashAlgorithmMD5Guid;
+extern EFI_GUID gEfiHashAlgorithmSha256Guid;
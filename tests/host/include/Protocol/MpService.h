@@ -0,0 +1,69 @@
+/*
+ * uefi-md5sum: Host build shim - EFI_MP_SERVICES_PROTOCOL definitions
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <Uefi.h>
+
+#define EFI_MP_SERVICES_PROTOCOL_GUID \
+	{ 0x3fdda605, 0xa76e, 0x4f46, { 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08 } }
+
+#define PROCESSOR_AS_BSP_BIT        0x00000001
+#define PROCESSOR_ENABLED_BIT       0x00000002
+#define PROCESSOR_HEALTH_STATUS_BIT 0x00000004
+#define END_OF_CPU_LIST             0xffffffff
+
+typedef struct {
+	UINT32  Package;
+	UINT32  Core;
+	UINT32  Thread;
+} EFI_CPU_PHYSICAL_LOCATION;
+
+typedef struct {
+	UINT32  Package;
+	UINT32  Module;
+	UINT32  Tile;
+	UINT32  Die;
+	UINT32  Core;
+	UINT32  Thread;
+} EFI_CPU_PHYSICAL_LOCATION2;
+
+typedef union {
+	EFI_CPU_PHYSICAL_LOCATION2  Location2;
+} EXTENDED_PROCESSOR_INFORMATION;
+
+typedef struct {
+	UINT64                          ProcessorId;
+	UINT32                          StatusFlag;
+	EFI_CPU_PHYSICAL_LOCATION       Location;
+	EXTENDED_PROCESSOR_INFORMATION  ExtendedInformation;
+} EFI_PROCESSOR_INFORMATION;
+
+typedef struct _EFI_MP_SERVICES_PROTOCOL EFI_MP_SERVICES_PROTOCOL;
+typedef VOID (EFIAPI *EFI_AP_PROCEDURE)(IN OUT VOID* Buffer);
+
+struct _EFI_MP_SERVICES_PROTOCOL {
+	EFI_STATUS  (EFIAPI *GetNumberOfProcessors)(IN EFI_MP_SERVICES_PROTOCOL* This, OUT UINTN* NumberOfProcessors, OUT UINTN* NumberOfEnabledProcessors);
+	EFI_STATUS  (EFIAPI *GetProcessorInfo)(IN EFI_MP_SERVICES_PROTOCOL* This, IN UINTN ProcessorNumber, OUT EFI_PROCESSOR_INFORMATION* ProcessorInfoBuffer);
+	EFI_STATUS  (EFIAPI *StartupAllAPs)(IN EFI_MP_SERVICES_PROTOCOL* This, IN EFI_AP_PROCEDURE Procedure, IN BOOLEAN SingleThread, IN EFI_EVENT WaitEvent OPTIONAL, IN UINTN TimeoutInMicroSeconds, IN VOID* ProcedureArgument OPTIONAL, OUT UINTN** FailedCpuList OPTIONAL);
+	EFI_STATUS  (EFIAPI *StartupThisAP)(IN EFI_MP_SERVICES_PROTOCOL* This, IN EFI_AP_PROCEDURE Procedure, IN UINTN ProcessorNumber, IN EFI_EVENT WaitEvent OPTIONAL, IN UINTN TimeoutInMicroseconds, IN VOID* ProcedureArgument OPTIONAL, OUT BOOLEAN* Finished OPTIONAL);
+	EFI_STATUS  (EFIAPI *SwitchBSP)(IN EFI_MP_SERVICES_PROTOCOL* This, IN UINTN ProcessorNumber, IN BOOLEAN EnableOldBSP);
+	EFI_STATUS  (EFIAPI *EnableDisableAP)(IN EFI_MP_SERVICES_PROTOCOL* This, IN UINTN ProcessorNumber, IN BOOLEAN EnableAP, IN UINT32* HealthFlag OPTIONAL);
+	EFI_STATUS  (EFIAPI *WhoAmI)(IN EFI_MP_SERVICES_PROTOCOL* This, OUT UINTN* ProcessorNumber);
+};
+
+extern EFI_GUID gEfiMpServiceProtocolGuid;
@@ -0,0 +1,522 @@
+/*
+ * uefi-md5sum: Host build shim - UEFI types and protocols
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Base.h>
+
+/*
+ * Time, memory and events
+ */
+typedef struct {
+	UINT16  Year;
+	UINT8   Month;
+	UINT8   Day;
+	UINT8   Hour;
+	UINT8   Minute;
+	UINT8   Second;
+	UINT8   Pad1;
+	UINT32  Nanosecond;
+	INT16   TimeZone;
+	UINT8   Daylight;
+	UINT8   Pad2;
+} EFI_TIME;
+
+typedef struct {
+	UINT32  Resolution;
+	UINT32  Accuracy;
+	BOOLEAN SetsToZero;
+} EFI_TIME_CAPABILITIES;
+
+typedef enum {
+	AllocateAnyPages,
+	AllocateMaxAddress,
+	AllocateAddress,
+	MaxAllocateType
+} EFI_ALLOCATE_TYPE;
+
+typedef enum {
+	EfiReservedMemoryType,
+	EfiLoaderCode,
+	EfiLoaderData,
+	EfiBootServicesCode,
+	EfiBootServicesData,
+	EfiRuntimeServicesCode,
+	EfiRuntimeServicesData,
+	EfiConventionalMemory,
+	EfiUnusableMemory,
+	EfiACPIReclaimMemory,
+	EfiACPIMemoryNVS,
+	EfiMemoryMappedIO,
+	EfiMemoryMappedIOPortSpace,
+	EfiPalCode,
+	EfiPersistentMemory,
+	EfiMaxMemoryType
+} EFI_MEMORY_TYPE;
+
+typedef struct {
+	UINT32                Type;
+	EFI_PHYSICAL_ADDRESS  PhysicalStart;
+	EFI_VIRTUAL_ADDRESS   VirtualStart;
+	UINT64                NumberOfPages;
+	UINT64                Attribute;
+} EFI_MEMORY_DESCRIPTOR;
+
+#define EVT_TIMER                         0x80000000
+#define EVT_RUNTIME                       0x40000000
+#define EVT_NOTIFY_WAIT                   0x00000100
+#define EVT_NOTIFY_SIGNAL                 0x00000200
+
+#define TPL_APPLICATION                   4
+#define TPL_CALLBACK                      8
+#define TPL_NOTIFY                        16
+#define TPL_HIGH_LEVEL                    31
+
+typedef VOID (EFIAPI *EFI_EVENT_NOTIFY)(IN EFI_EVENT Event, IN VOID* Context);
+
+typedef enum {
+	TimerCancel,
+	TimerPeriodic,
+	TimerRelative
+} EFI_TIMER_DELAY;
+
+typedef enum {
+	EfiResetCold,
+	EfiResetWarm,
+	EfiResetShutdown,
+	EfiResetPlatformSpecific
+} EFI_RESET_TYPE;
+
+typedef enum {
+	AllHandles,
+	ByRegisterNotify,
+	ByProtocol
+} EFI_LOCATE_SEARCH_TYPE;
+
+typedef enum {
+	EFI_NATIVE_INTERFACE
+} EFI_INTERFACE_TYPE;
+
+#define EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL  0x00000001
+#define EFI_OPEN_PROTOCOL_GET_PROTOCOL        0x00000002
+#define EFI_OPEN_PROTOCOL_TEST_PROTOCOL       0x00000004
+#define EFI_OPEN_PROTOCOL_BY_CHILD_CONTROLLER 0x00000008
+#define EFI_OPEN_PROTOCOL_BY_DRIVER           0x00000010
+#define EFI_OPEN_PROTOCOL_EXCLUSIVE           0x00000020
+
+typedef struct {
+	EFI_HANDLE  AgentHandle;
+	EFI_HANDLE  ControllerHandle;
+	UINT32      Attributes;
+	UINT32      OpenCount;
+} EFI_OPEN_PROTOCOL_INFORMATION_ENTRY;
+
+#define EFI_VARIABLE_NON_VOLATILE         0x00000001
+#define EFI_VARIABLE_BOOTSERVICE_ACCESS   0x00000002
+#define EFI_VARIABLE_RUNTIME_ACCESS       0x00000004
+
+/*
+ * Device path
+ */
+typedef struct {
+	UINT8   Type;
+	UINT8   SubType;
+	UINT8   Length[2];
+} EFI_DEVICE_PATH_PROTOCOL;
+typedef EFI_DEVICE_PATH_PROTOCOL EFI_DEVICE_PATH;
+
+/*
+ * Tables
+ */
+typedef struct {
+	UINT64  Signature;
+	UINT32  Revision;
+	UINT32  HeaderSize;
+	UINT32  CRC32;
+	UINT32  Reserved;
+} EFI_TABLE_HEADER;
+
+#define EFI_2_00_SYSTEM_TABLE_REVISION    ((2 << 16) | (00))
+
+typedef struct {
+	EFI_GUID  VendorGuid;
+	VOID*     VendorTable;
+} EFI_CONFIGURATION_TABLE;
+
+/*
+ * Console
+ */
+typedef struct {
+	UINT16  ScanCode;
+	CHAR16  UnicodeChar;
+} EFI_INPUT_KEY;
+
+typedef struct _EFI_SIMPLE_TEXT_INPUT_PROTOCOL EFI_SIMPLE_TEXT_INPUT_PROTOCOL;
+typedef EFI_STATUS (EFIAPI *EFI_INPUT_RESET)(IN EFI_SIMPLE_TEXT_INPUT_PROTOCOL* This, IN BOOLEAN ExtendedVerification);
+typedef EFI_STATUS (EFIAPI *EFI_INPUT_READ_KEY)(IN EFI_SIMPLE_TEXT_INPUT_PROTOCOL* This, OUT EFI_INPUT_KEY* Key);
+struct _EFI_SIMPLE_TEXT_INPUT_PROTOCOL {
+	EFI_INPUT_RESET     Reset;
+	EFI_INPUT_READ_KEY  ReadKeyStroke;
+	EFI_EVENT           WaitForKey;
+};
+
+typedef struct {
+	INT32   MaxMode;
+	INT32   Mode;
+	INT32   Attribute;
+	INT32   CursorColumn;
+	INT32   CursorRow;
+	BOOLEAN CursorVisible;
+} EFI_SIMPLE_TEXT_OUTPUT_MODE;
+
+typedef struct _EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL;
+typedef EFI_STATUS (EFIAPI *EFI_TEXT_RESET)(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, IN BOOLEAN ExtendedVerification);
+typedef EFI_STATUS (EFIAPI *EFI_TEXT_STRING)(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, IN CHAR16* String);
+typedef EFI_STATUS (EFIAPI *EFI_TEXT_TEST_STRING)(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, IN CHAR16* String);
+typedef EFI_STATUS (EFIAPI *EFI_TEXT_QUERY_MODE)(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, IN UINTN ModeNumber, OUT UINTN* Columns, OUT UINTN* Rows);
+typedef EFI_STATUS (EFIAPI *EFI_TEXT_SET_MODE)(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, IN UINTN ModeNumber);
+typedef EFI_STATUS (EFIAPI *EFI_TEXT_SET_ATTRIBUTE)(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, IN UINTN Attribute);
+typedef EFI_STATUS (EFIAPI *EFI_TEXT_CLEAR_SCREEN)(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This);
+typedef EFI_STATUS (EFIAPI *EFI_TEXT_SET_CURSOR_POSITION)(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, IN UINTN Column, IN UINTN Row);
+typedef EFI_STATUS (EFIAPI *EFI_TEXT_ENABLE_CURSOR)(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, IN BOOLEAN Visible);
+struct _EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL {
+	EFI_TEXT_RESET                Reset;
+	EFI_TEXT_STRING               OutputString;
+	EFI_TEXT_TEST_STRING          TestString;
+	EFI_TEXT_QUERY_MODE           QueryMode;
+	EFI_TEXT_SET_MODE             SetMode;
+	EFI_TEXT_SET_ATTRIBUTE        SetAttribute;
+	EFI_TEXT_CLEAR_SCREEN         ClearScreen;
+	EFI_TEXT_SET_CURSOR_POSITION  SetCursorPosition;
+	EFI_TEXT_ENABLE_CURSOR        EnableCursor;
+	EFI_SIMPLE_TEXT_OUTPUT_MODE*  Mode;
+};
+
+#define EFI_BLACK                 0x00
+#define EFI_BLUE                  0x01
+#define EFI_GREEN                 0x02
+#define EFI_CYAN                  0x03
+#define EFI_RED                   0x04
+#define EFI_MAGENTA               0x05
+#define EFI_BROWN                 0x06
+#define EFI_LIGHTGRAY             0x07
+#define EFI_DARKGRAY              0x08
+#define EFI_LIGHTBLUE             0x09
+#define EFI_LIGHTGREEN            0x0A
+#define EFI_LIGHTCYAN             0x0B
+#define EFI_LIGHTRED              0x0C
+#define EFI_LIGHTMAGENTA          0x0D
+#define EFI_YELLOW                0x0E
+#define EFI_WHITE                 0x0F
+#define EFI_TEXT_ATTR(f, b)       ((f) | ((b) << 4))
+
+#define BLOCKELEMENT_FULL_BLOCK   0x2588
+#define BLOCKELEMENT_LIGHT_SHADE  0x2591
+
+/*
+ * Boot and runtime services
+ */
+struct _EFI_SYSTEM_TABLE;
+typedef EFI_STATUS (EFIAPI *EFI_IMAGE_ENTRY_POINT)(IN EFI_HANDLE ImageHandle, IN struct _EFI_SYSTEM_TABLE* SystemTable);
+
+typedef struct {
+	EFI_TABLE_HEADER  Hdr;
+	EFI_TPL     (EFIAPI *RaiseTPL)(IN EFI_TPL NewTpl);
+	VOID        (EFIAPI *RestoreTPL)(IN EFI_TPL OldTpl);
+	EFI_STATUS  (EFIAPI *AllocatePages)(IN EFI_ALLOCATE_TYPE Type, IN EFI_MEMORY_TYPE MemoryType, IN UINTN Pages, IN OUT EFI_PHYSICAL_ADDRESS* Memory);
+	EFI_STATUS  (EFIAPI *FreePages)(IN EFI_PHYSICAL_ADDRESS Memory, IN UINTN Pages);
+	EFI_STATUS  (EFIAPI *GetMemoryMap)(IN OUT UINTN* MemoryMapSize, OUT EFI_MEMORY_DESCRIPTOR* MemoryMap, OUT UINTN* MapKey, OUT UINTN* DescriptorSize, OUT UINT32* DescriptorVersion);
+	EFI_STATUS  (EFIAPI *AllocatePool)(IN EFI_MEMORY_TYPE PoolType, IN UINTN Size, OUT VOID** Buffer);
+	EFI_STATUS  (EFIAPI *FreePool)(IN VOID* Buffer);
+	EFI_STATUS  (EFIAPI *CreateEvent)(IN UINT32 Type, IN EFI_TPL NotifyTpl, IN EFI_EVENT_NOTIFY NotifyFunction OPTIONAL, IN VOID* NotifyContext OPTIONAL, OUT EFI_EVENT* Event);
+	EFI_STATUS  (EFIAPI *SetTimer)(IN EFI_EVENT Event, IN EFI_TIMER_DELAY Type, IN UINT64 TriggerTime);
+	EFI_STATUS  (EFIAPI *WaitForEvent)(IN UINTN NumberOfEvents, IN EFI_EVENT* Event, OUT UINTN* Index);
+	EFI_STATUS  (EFIAPI *SignalEvent)(IN EFI_EVENT Event);
+	EFI_STATUS  (EFIAPI *CloseEvent)(IN EFI_EVENT Event);
+	EFI_STATUS  (EFIAPI *CheckEvent)(IN EFI_EVENT Event);
+	EFI_STATUS  (EFIAPI *InstallProtocolInterface)(IN OUT EFI_HANDLE* Handle, IN EFI_GUID* Protocol, IN EFI_INTERFACE_TYPE InterfaceType, IN VOID* Interface);
+	EFI_STATUS  (EFIAPI *ReinstallProtocolInterface)(IN EFI_HANDLE Handle, IN EFI_GUID* Protocol, IN VOID* OldInterface, IN VOID* NewInterface);
+	EFI_STATUS  (EFIAPI *UninstallProtocolInterface)(IN EFI_HANDLE Handle, IN EFI_GUID* Protocol, IN VOID* Interface);
+	EFI_STATUS  (EFIAPI *HandleProtocol)(IN EFI_HANDLE Handle, IN EFI_GUID* Protocol, OUT VOID** Interface);
+	VOID*       Reserved;
+	EFI_STATUS  (EFIAPI *RegisterProtocolNotify)(IN EFI_GUID* Protocol, IN EFI_EVENT Event, OUT VOID** Registration);
+	EFI_STATUS  (EFIAPI *LocateHandle)(IN EFI_LOCATE_SEARCH_TYPE SearchType, IN EFI_GUID* Protocol OPTIONAL, IN VOID* SearchKey OPTIONAL, IN OUT UINTN* BufferSize, OUT EFI_HANDLE* Buffer);
+	EFI_STATUS  (EFIAPI *LocateDevicePath)(IN EFI_GUID* Protocol, IN OUT EFI_DEVICE_PATH_PROTOCOL** DevicePath, OUT EFI_HANDLE* Device);
+	EFI_STATUS  (EFIAPI *InstallConfigurationTable)(IN EFI_GUID* Guid, IN VOID* Table);
+	EFI_STATUS  (EFIAPI *LoadImage)(IN BOOLEAN BootPolicy, IN EFI_HANDLE ParentImageHandle, IN EFI_DEVICE_PATH_PROTOCOL* DevicePath, IN VOID* SourceBuffer OPTIONAL, IN UINTN SourceSize, OUT EFI_HANDLE* ImageHandle);
+	EFI_STATUS  (EFIAPI *StartImage)(IN EFI_HANDLE ImageHandle, OUT UINTN* ExitDataSize, OUT CHAR16** ExitData OPTIONAL);
+	EFI_STATUS  (EFIAPI *Exit)(IN EFI_HANDLE ImageHandle, IN EFI_STATUS ExitStatus, IN UINTN ExitDataSize, IN CHAR16* ExitData OPTIONAL);
+	EFI_STATUS  (EFIAPI *UnloadImage)(IN EFI_HANDLE ImageHandle);
+	EFI_STATUS  (EFIAPI *ExitBootServices)(IN EFI_HANDLE ImageHandle, IN UINTN MapKey);
+	EFI_STATUS  (EFIAPI *GetNextMonotonicCount)(OUT UINT64* Count);
+	EFI_STATUS  (EFIAPI *Stall)(IN UINTN Microseconds);
+	EFI_STATUS  (EFIAPI *SetWatchdogTimer)(IN UINTN Timeout, IN UINT64 WatchdogCode, IN UINTN DataSize, IN CHAR16* WatchdogData OPTIONAL);
+	EFI_STATUS  (EFIAPI *ConnectController)(IN EFI_HANDLE ControllerHandle, IN EFI_HANDLE* DriverImageHandle OPTIONAL, IN EFI_DEVICE_PATH_PROTOCOL* RemainingDevicePath OPTIONAL, IN BOOLEAN Recursive);
+	EFI_STATUS  (EFIAPI *DisconnectController)(IN EFI_HANDLE ControllerHandle, IN EFI_HANDLE DriverImageHandle OPTIONAL, IN EFI_HANDLE ChildHandle OPTIONAL);
+	EFI_STATUS  (EFIAPI *OpenProtocol)(IN EFI_HANDLE Handle, IN EFI_GUID* Protocol, OUT VOID** Interface OPTIONAL, IN EFI_HANDLE AgentHandle, IN EFI_HANDLE ControllerHandle, IN UINT32 Attributes);
+	EFI_STATUS  (EFIAPI *CloseProtocol)(IN EFI_HANDLE Handle, IN EFI_GUID* Protocol, IN EFI_HANDLE AgentHandle, IN EFI_HANDLE ControllerHandle);
+	EFI_STATUS  (EFIAPI *OpenProtocolInformation)(IN EFI_HANDLE Handle, IN EFI_GUID* Protocol, OUT EFI_OPEN_PROTOCOL_INFORMATION_ENTRY** EntryBuffer, OUT UINTN* EntryCount);
+	EFI_STATUS  (EFIAPI *ProtocolsPerHandle)(IN EFI_HANDLE Handle, OUT EFI_GUID*** ProtocolBuffer, OUT UINTN* ProtocolBufferCount);
+	EFI_STATUS  (EFIAPI *LocateHandleBuffer)(IN EFI_LOCATE_SEARCH_TYPE SearchType, IN EFI_GUID* Protocol OPTIONAL, IN VOID* SearchKey OPTIONAL, OUT UINTN* NoHandles, OUT EFI_HANDLE** Buffer);
+	EFI_STATUS  (EFIAPI *LocateProtocol)(IN EFI_GUID* Protocol, IN VOID* Registration OPTIONAL, OUT VOID** Interface);
+	EFI_STATUS  (EFIAPI *InstallMultipleProtocolInterfaces)(IN OUT EFI_HANDLE* Handle, ...);
+	EFI_STATUS  (EFIAPI *UninstallMultipleProtocolInterfaces)(IN EFI_HANDLE Handle, ...);
+	EFI_STATUS  (EFIAPI *CalculateCrc32)(IN VOID* Data, IN UINTN DataSize, OUT UINT32* Crc32);
+	VOID        (EFIAPI *CopyMem)(IN VOID* Destination, IN VOID* Source, IN UINTN Length);
+	VOID        (EFIAPI *SetMem)(IN VOID* Buffer, IN UINTN Size, IN UINT8 Value);
+	EFI_STATUS  (EFIAPI *CreateEventEx)(IN UINT32 Type, IN EFI_TPL NotifyTpl, IN EFI_EVENT_NOTIFY NotifyFunction OPTIONAL, IN CONST VOID* NotifyContext OPTIONAL, IN CONST EFI_GUID* EventGroup OPTIONAL, OUT EFI_EVENT* Event);
+} EFI_BOOT_SERVICES;
+
+typedef struct {
+	EFI_TABLE_HEADER  Hdr;
+	EFI_STATUS  (EFIAPI *GetTime)(OUT EFI_TIME* Time, OUT EFI_TIME_CAPABILITIES* Capabilities OPTIONAL);
+	EFI_STATUS  (EFIAPI *SetTime)(IN EFI_TIME* Time);
+	VOID*       GetWakeupTime;
+	VOID*       SetWakeupTime;
+	VOID*       SetVirtualAddressMap;
+	VOID*       ConvertPointer;
+	EFI_STATUS  (EFIAPI *GetVariable)(IN CHAR16* VariableName, IN EFI_GUID* VendorGuid, OUT UINT32* Attributes OPTIONAL, IN OUT UINTN* DataSize, OUT VOID* Data OPTIONAL);
+	EFI_STATUS  (EFIAPI *GetNextVariableName)(IN OUT UINTN* VariableNameSize, IN OUT CHAR16* VariableName, IN OUT EFI_GUID* VendorGuid);
+	EFI_STATUS  (EFIAPI *SetVariable)(IN CHAR16* VariableName, IN EFI_GUID* VendorGuid, IN UINT32 Attributes, IN UINTN DataSize, IN VOID* Data);
+	VOID*       GetNextHighMonotonicCount;
+	VOID        (EFIAPI *ResetSystem)(IN EFI_RESET_TYPE ResetType, IN EFI_STATUS ResetStatus, IN UINTN DataSize, IN VOID* ResetData OPTIONAL);
+	VOID*       UpdateCapsule;
+	VOID*       QueryCapsuleCapabilities;
+	VOID*       QueryVariableInfo;
+} EFI_RUNTIME_SERVICES;
+
+typedef struct _EFI_SYSTEM_TABLE {
+	EFI_TABLE_HEADER                  Hdr;
+	CHAR16*                           FirmwareVendor;
+	UINT32                            FirmwareRevision;
+	EFI_HANDLE                        ConsoleInHandle;
+	EFI_SIMPLE_TEXT_INPUT_PROTOCOL*   ConIn;
+	EFI_HANDLE                        ConsoleOutHandle;
+	EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL*  ConOut;
+	EFI_HANDLE                        StandardErrorHandle;
+	EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL*  StdErr;
+	EFI_RUNTIME_SERVICES*             RuntimeServices;
+	EFI_BOOT_SERVICES*                BootServices;
+	UINTN                             NumberOfTableEntries;
+	EFI_CONFIGURATION_TABLE*          ConfigurationTable;
+} EFI_SYSTEM_TABLE;
+
+extern EFI_SYSTEM_TABLE*      gST;
+extern EFI_BOOT_SERVICES*     gBS;
+extern EFI_RUNTIME_SERVICES*  gRT;
+
+/*
+ * Loaded image
+ */
+typedef struct {
+	UINT32                     Revision;
+	EFI_HANDLE                 ParentHandle;
+	EFI_SYSTEM_TABLE*          SystemTable;
+	EFI_HANDLE                 DeviceHandle;
+	EFI_DEVICE_PATH_PROTOCOL*  FilePath;
+	VOID*                      Reserved;
+	UINT32                     LoadOptionsSize;
+	VOID*                      LoadOptions;
+	VOID*                      ImageBase;
+	UINT64                     ImageSize;
+	EFI_MEMORY_TYPE            ImageCodeType;
+	EFI_MEMORY_TYPE            ImageDataType;
+	VOID*                      Unload;
+} EFI_LOADED_IMAGE_PROTOCOL;
+
+/*
+ * File protocols
+ */
+#define EFI_FILE_PROTOCOL_REVISION        0x00010000
+#define EFI_FILE_PROTOCOL_REVISION2       0x00020000
+#define EFI_FILE_PROTOCOL_LATEST_REVISION EFI_FILE_PROTOCOL_REVISION2
+
+#define EFI_FILE_MODE_READ                0x0000000000000001ULL
+#define EFI_FILE_MODE_WRITE               0x0000000000000002ULL
+#define EFI_FILE_MODE_CREATE              0x8000000000000000ULL
+
+#define EFI_FILE_READ_ONLY                0x0000000000000001ULL
+#define EFI_FILE_HIDDEN                   0x0000000000000002ULL
+#define EFI_FILE_SYSTEM                   0x0000000000000004ULL
+#define EFI_FILE_RESERVED                 0x0000000000000008ULL
+#define EFI_FILE_DIRECTORY                0x0000000000000010ULL
+#define EFI_FILE_ARCHIVE                  0x0000000000000020ULL
+#define EFI_FILE_VALID_ATTR               0x0000000000000037ULL
+
+typedef struct {
+	EFI_EVENT   Event;
+	EFI_STATUS  Status;
+	UINTN       BufferSize;
+	VOID*       Buffer;
+} EFI_FILE_IO_TOKEN;
+
+typedef struct _EFI_FILE_PROTOCOL EFI_FILE_PROTOCOL;
+typedef EFI_FILE_PROTOCOL* EFI_FILE_HANDLE;
+typedef EFI_FILE_PROTOCOL  EFI_FILE;
+
+struct _EFI_FILE_PROTOCOL {
+	UINT64      Revision;
+	EFI_STATUS  (EFIAPI *Open)(IN EFI_FILE_PROTOCOL* This, OUT EFI_FILE_PROTOCOL** NewHandle, IN CHAR16* FileName, IN UINT64 OpenMode, IN UINT64 Attributes);
+	EFI_STATUS  (EFIAPI *Close)(IN EFI_FILE_PROTOCOL* This);
+	EFI_STATUS  (EFIAPI *Delete)(IN EFI_FILE_PROTOCOL* This);
+	EFI_STATUS  (EFIAPI *Read)(IN EFI_FILE_PROTOCOL* This, IN OUT UINTN* BufferSize, OUT VOID* Buffer);
+	EFI_STATUS  (EFIAPI *Write)(IN EFI_FILE_PROTOCOL* This, IN OUT UINTN* BufferSize, IN VOID* Buffer);
+	EFI_STATUS  (EFIAPI *GetPosition)(IN EFI_FILE_PROTOCOL* This, OUT UINT64* Position);
+	EFI_STATUS  (EFIAPI *SetPosition)(IN EFI_FILE_PROTOCOL* This, IN UINT64 Position);
+	EFI_STATUS  (EFIAPI *GetInfo)(IN EFI_FILE_PROTOCOL* This, IN EFI_GUID* InformationType, IN OUT UINTN* BufferSize, OUT VOID* Buffer);
+	EFI_STATUS  (EFIAPI *SetInfo)(IN EFI_FILE_PROTOCOL* This, IN EFI_GUID* InformationType, IN UINTN BufferSize, IN VOID* Buffer);
+	EFI_STATUS  (EFIAPI *Flush)(IN EFI_FILE_PROTOCOL* This);
+	EFI_STATUS  (EFIAPI *OpenEx)(IN EFI_FILE_PROTOCOL* This, OUT EFI_FILE_PROTOCOL** NewHandle, IN CHAR16* FileName, IN UINT64 OpenMode, IN UINT64 Attributes, IN OUT EFI_FILE_IO_TOKEN* Token);
+	EFI_STATUS  (EFIAPI *ReadEx)(IN EFI_FILE_PROTOCOL* This, IN OUT EFI_FILE_IO_TOKEN* Token);
+	EFI_STATUS  (EFIAPI *WriteEx)(IN EFI_FILE_PROTOCOL* This, IN OUT EFI_FILE_IO_TOKEN* Token);
+	EFI_STATUS  (EFIAPI *FlushEx)(IN EFI_FILE_PROTOCOL* This, IN OUT EFI_FILE_IO_TOKEN* Token);
+};
+
+typedef struct {
+	UINT64    Size;
+	UINT64    FileSize;
+	UINT64    PhysicalSize;
+	EFI_TIME  CreateTime;
+	EFI_TIME  LastAccessTime;
+	EFI_TIME  ModificationTime;
+	UINT64    Attribute;
+	CHAR16    FileName[1];
+} EFI_FILE_INFO;
+#define SIZE_OF_EFI_FILE_INFO OFFSET_OF(EFI_FILE_INFO, FileName)
+
+typedef struct {
+	UINT64    Size;
+	BOOLEAN   ReadOnly;
+	UINT64    VolumeSize;
+	UINT64    FreeSpace;
+	UINT32    BlockSize;
+	CHAR16    VolumeLabel[1];
+} EFI_FILE_SYSTEM_INFO;
+#define SIZE_OF_EFI_FILE_SYSTEM_INFO OFFSET_OF(EFI_FILE_SYSTEM_INFO, VolumeLabel)
+
+typedef struct _EFI_SIMPLE_FILE_SYSTEM_PROTOCOL EFI_SIMPLE_FILE_SYSTEM_PROTOCOL;
+struct _EFI_SIMPLE_FILE_SYSTEM_PROTOCOL {
+	UINT64      Revision;
+	EFI_STATUS  (EFIAPI *OpenVolume)(IN EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* This, OUT EFI_FILE_PROTOCOL** Root);
+};
+#define EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION 0x00010000
+
+/*
+ * Block and disk I/O
+ */
+typedef struct {
+	UINT32    MediaId;
+	BOOLEAN   RemovableMedia;
+	BOOLEAN   MediaPresent;
+	BOOLEAN   LogicalPartition;
+	BOOLEAN   ReadOnly;
+	BOOLEAN   WriteCaching;
+	UINT32    BlockSize;
+	UINT32    IoAlign;
+	EFI_LBA   LastBlock;
+	EFI_LBA   LowestAlignedLba;
+	UINT32    LogicalBlocksPerPhysicalBlock;
+	UINT32    OptimalTransferLengthGranularity;
+} EFI_BLOCK_IO_MEDIA;
+
+typedef struct _EFI_BLOCK_IO_PROTOCOL EFI_BLOCK_IO_PROTOCOL;
+struct _EFI_BLOCK_IO_PROTOCOL {
+	UINT64               Revision;
+	EFI_BLOCK_IO_MEDIA*  Media;
+	EFI_STATUS  (EFIAPI *Reset)(IN EFI_BLOCK_IO_PROTOCOL* This, IN BOOLEAN ExtendedVerification);
+	EFI_STATUS  (EFIAPI *ReadBlocks)(IN EFI_BLOCK_IO_PROTOCOL* This, IN UINT32 MediaId, IN EFI_LBA Lba, IN UINTN BufferSize, OUT VOID* Buffer);
+	EFI_STATUS  (EFIAPI *WriteBlocks)(IN EFI_BLOCK_IO_PROTOCOL* This, IN UINT32 MediaId, IN EFI_LBA Lba, IN UINTN BufferSize, IN VOID* Buffer);
+	EFI_STATUS  (EFIAPI *FlushBlocks)(IN EFI_BLOCK_IO_PROTOCOL* This);
+};
+
+typedef struct _EFI_DISK_IO_PROTOCOL EFI_DISK_IO_PROTOCOL;
+struct _EFI_DISK_IO_PROTOCOL {
+	UINT64      Revision;
+	EFI_STATUS  (EFIAPI *ReadDisk)(IN EFI_DISK_IO_PROTOCOL* This, IN UINT32 MediaId, IN UINT64 Offset, IN UINTN BufferSize, OUT VOID* Buffer);
+	EFI_STATUS  (EFIAPI *WriteDisk)(IN EFI_DISK_IO_PROTOCOL* This, IN UINT32 MediaId, IN UINT64 Offset, IN UINTN BufferSize, IN VOID* Buffer);
+};
+
+typedef struct {
+	EFI_EVENT   Event;
+	EFI_STATUS  TransactionStatus;
+} EFI_DISK_IO2_TOKEN;
+
+typedef struct _EFI_DISK_IO2_PROTOCOL EFI_DISK_IO2_PROTOCOL;
+struct _EFI_DISK_IO2_PROTOCOL {
+	UINT64      Revision;
+	EFI_STATUS  (EFIAPI *Cancel)(IN EFI_DISK_IO2_PROTOCOL* This);
+	EFI_STATUS  (EFIAPI *ReadDiskEx)(IN EFI_DISK_IO2_PROTOCOL* This, IN UINT32 MediaId, IN UINT64 Offset, IN OUT EFI_DISK_IO2_TOKEN* Token, IN UINTN BufferSize, OUT VOID* Buffer);
+	EFI_STATUS  (EFIAPI *WriteDiskEx)(IN EFI_DISK_IO2_PROTOCOL* This, IN UINT32 MediaId, IN UINT64 Offset, IN OUT EFI_DISK_IO2_TOKEN* Token, IN UINTN BufferSize, IN VOID* Buffer);
+	EFI_STATUS  (EFIAPI *FlushDiskEx)(IN EFI_DISK_IO2_PROTOCOL* This, IN OUT EFI_DISK_IO2_TOKEN* Token);
+};
+
+/*
+ * Driver model
+ */
+typedef struct _EFI_COMPONENT_NAME_PROTOCOL EFI_COMPONENT_NAME_PROTOCOL;
+struct _EFI_COMPONENT_NAME_PROTOCOL {
+	EFI_STATUS  (EFIAPI *GetDriverName)(IN EFI_COMPONENT_NAME_PROTOCOL* This, IN CHAR8* Language, OUT CHAR16** DriverName);
+	VOID*       GetControllerName;
+	CHAR8*      SupportedLanguages;
+};
+
+typedef struct _EFI_COMPONENT_NAME2_PROTOCOL EFI_COMPONENT_NAME2_PROTOCOL;
+struct _EFI_COMPONENT_NAME2_PROTOCOL {
+	EFI_STATUS  (EFIAPI *GetDriverName)(IN EFI_COMPONENT_NAME2_PROTOCOL* This, IN CHAR8* Language, OUT CHAR16** DriverName);
+	VOID*       GetControllerName;
+	CHAR8*      SupportedLanguages;
+};
+
+typedef struct {
+	VOID*       Supported;
+	VOID*       Start;
+	VOID*       Stop;
+	UINT32      Version;
+	EFI_HANDLE  ImageHandle;
+	EFI_HANDLE  DriverBindingHandle;
+} EFI_DRIVER_BINDING_PROTOCOL;
+
+typedef struct _EFI_SERVICE_BINDING_PROTOCOL EFI_SERVICE_BINDING_PROTOCOL;
+struct _EFI_SERVICE_BINDING_PROTOCOL {
+	EFI_STATUS  (EFIAPI *CreateChild)(IN EFI_SERVICE_BINDING_PROTOCOL* This, IN OUT EFI_HANDLE* ChildHandle);
+	EFI_STATUS  (EFIAPI *DestroyChild)(IN EFI_SERVICE_BINDING_PROTOCOL* This, IN EFI_HANDLE ChildHandle);
+};
+
+/*
+ * GUIDs
+ */
+extern EFI_GUID gEfiLoadedImageProtocolGuid;
+extern EFI_GUID gEfiSimpleFileSystemProtocolGuid;
+extern EFI_GUID gEfiFileInfoGuid;
+extern EFI_GUID gEfiFileSystemInfoGuid;
+extern EFI_GUID gEfiSmbiosTableGuid;
+extern EFI_GUID gEfiSmbios3TableGuid;
+extern EFI_GUID gEfiDiskIoProtocolGuid;
+extern EFI_GUID gEfiDiskIo2ProtocolGuid;
+extern EFI_GUID gEfiBlockIoProtocolGuid;
+extern EFI_GUID gEfiDriverBindingProtocolGuid;
+extern EFI_GUID gEfiComponentNameProtocolGuid;
+extern EFI_GUID gEfiComponentName2ProtocolGuid;
+extern EFI_GUID gEfiUnicodeCollationProtocolGuid;
+extern EFI_GUID gEfiUnicodeCollation2ProtocolGuid;
+extern EFI_GUID gEfiDevicePathProtocolGuid;
+
+/*
+ * DevicePathLib subset
+ */
+EFI_DEVICE_PATH_PROTOCOL* FileDevicePath(IN EFI_HANDLE Device OPTIONAL, IN CONST CHAR16* FileName);
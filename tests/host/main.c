@@ -0,0 +1,125 @@
+/*
+ * uefi-md5sum: Host build - Application runner
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the whole application natively, against a directory that stands for
+ * the boot volume, so that the test list of tests/ can be run without QEMU,
+ * by setting QEMU_CMD to "md5sum_host -t image" (see the Makefile). The two
+ * BdsDxe lines that run_tests.sh skips are printed before starting. Each -v
+ * option adds a directory that stands for another volume, with its label.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+EFI_STATUS EFIAPI efi_main(EFI_HANDLE BaseImageHandle, EFI_SYSTEM_TABLE* SystemTable);
+
+static void Usage(void)
+{
+	fprintf(stderr, "Usage: md5sum_host [-t] [-r file_revision] [-c cpus] [-m max_read_size]\n"
+		"  [-n nvram_dir] [-k key_after_checks] [-d read_delay_ns_per_mb] [-w cols] [-h rows]\n"
+		"  [-l volume_label] [-H fast|slow|bad|fail|stall] [-v dir:label]... image_dir\n"
+		"Environment: HOST_DISK=fat16|fat32|exfat[:frag][:sync], HOST_IOALIGN, HOST_AMI,\n"
+		"  HOST_READ_LATENCY_US, HOST_READ_SLEEP_US, HOST_LOADER_READS, HOST_MKIMG, HOST_STATS,\n"
+		"  HOST_READEX=fail, HOST_NVRAM=nvram_dir (when -n isn't used)\n");
+	exit(1);
+}
+
+static void PrintStats(void)
+{
+	if (getenv("HOST_STATS") == NULL)
+		return;
+	fprintf(stderr, "files: read=%llu reads=%llu async=%llu opens=%llu getinfo=%llu maxread=%llu unaligned=%llu\n",
+		(unsigned long long)gHost.BytesRead, (unsigned long long)gHost.FileReads,
+		(unsigned long long)gHost.AsyncReads, (unsigned long long)gHost.FileOpens,
+		(unsigned long long)gHost.FileGetInfos, (unsigned long long)gHost.MaxRead,
+		(unsigned long long)gHost.UnalignedReads);
+	fprintf(stderr, "console: calls=%llu chars=%llu watchdog=%llu stall=%llu\n",
+		(unsigned long long)gHost.ConsoleCalls, (unsigned long long)gHost.ConsoleChars,
+		(unsigned long long)gHost.WatchdogResets, (unsigned long long)gHost.StallTime);
+	fprintf(stderr, "disk: reads=%llu async=%llu bytes=%llu\n", (unsigned long long)gHost.DiskReads,
+		(unsigned long long)gHost.DiskAsyncReads, (unsigned long long)gHost.DiskBytes);
+	if (gHost.Hash2Mode != NULL)
+		fprintf(stderr, "hash2: calls=%llu bytes=%llu children=%llu\n", (unsigned long long)gHost.Hash2Calls,
+			(unsigned long long)gHost.Hash2Bytes, (unsigned long long)gHost.Hash2Children);
+}
+
+int main(int argc, char** argv)
+{
+	int c;
+	char* Label;
+	EFI_STATUS Status;
+
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+	while ((c = getopt(argc, argv, "tr:c:m:n:k:d:w:h:l:H:v:")) != -1) {
+		switch (c) {
+		case 't': gHost.TestMode = TRUE; break;
+		case 'r': gHost.FileRevision = strtoull(optarg, NULL, 0); break;
+		case 'c': gHost.NumCpus = strtoul(optarg, NULL, 0); break;
+		case 'm': gHost.MaxReadSize = strtoul(optarg, NULL, 0); break;
+		case 'n': gHost.NvramPath = optarg; break;
+		case 'k': gHost.KeyAfterChecks = strtoul(optarg, NULL, 0); break;
+		case 'd': gHost.ReadDelayNsPerMB = strtoull(optarg, NULL, 0); break;
+		case 'w': gHost.Cols = strtoul(optarg, NULL, 0); break;
+		case 'h': gHost.Rows = strtoul(optarg, NULL, 0); break;
+		case 'l': gHost.VolumeLabel = optarg; break;
+		case 'H': gHost.Hash2Mode = optarg; break;
+		case 'v':
+			Label = strrchr(optarg, ':');
+			if (Label == NULL || gHost.NumExtraVolumes >= HOST_EXTRA_VOLUMES_MAX)
+				Usage();
+			*Label++ = '\0';
+			gHost.ExtraRootPath[gHost.NumExtraVolumes] = realpath(optarg, NULL);
+			gHost.ExtraLabel[gHost.NumExtraVolumes] = Label;
+			if (gHost.ExtraRootPath[gHost.NumExtraVolumes++] == NULL) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default: Usage();
+		}
+	}
+	if (optind >= argc)
+		Usage();
+	gHost.RootPath = realpath(argv[optind], NULL);
+	if (gHost.RootPath == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+	gHost.DiskType = getenv("HOST_DISK");
+	if (gHost.NvramPath == NULL)
+		gHost.NvramPath = getenv("HOST_NVRAM");
+	if (getenv("HOST_IOALIGN") != NULL)
+		gHost.IoAlign = strtoul(getenv("HOST_IOALIGN"), NULL, 0);
+	if (getenv("HOST_AMI") != NULL) {
+		gHost.FirmwareVendor = L"American Megatrends";
+		gHost.FirmwareRevision = 0x20000;
+	}
+	gHost.OnExit = PrintStats;
+	HostSetup();
+
+	printf("BdsDxe: loading Boot0001 \"host\"\nBdsDxe: starting Boot0001 \"host\"\n");
+	Status = efi_main(gHost.ImageHandle, HostSystemTable());
+	fflush(stdout);
+	PrintStats();
+	return EFI_ERROR(Status) ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * uefi-md5sum: Host build - Microbenchmarks
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measures the hot paths of the application in isolation, with the same code
+ * as the UEFI build: the hash algorithms (with the transform that their self
+ * test selected) for various write sizes, Parse() on synthetic hash lists of
+ * NUM_ENTRIES lines, with and without an md5sum_totalbytes header (i.e. with
+ * and without streaming), and Utf8ToUcs2() on ASCII and non ASCII paths.
+ * Each measurement is the best of NUM_RUNS runs, to filter out the noise of
+ * the host, and the results are printed in a format that is easy to diff.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "boot.h"
+#include "shim.h"
+
+#define NUM_RUNS        5
+#define NUM_ENTRIES     100000
+#define UTF8_LOOPS      200
+
+/* The write sizes that the hash algorithms are measured with */
+STATIC CONST UINTN HashWriteSize[] = { 64, 512, 4096, 64 * 1024, 1024 * 1024 };
+
+/* The amount of data that is hashed for each of them */
+STATIC UINT64 HashBytes = 256 * 1024 * 1024;
+
+STATIC double GetTime(VOID)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+STATIC VOID BenchmarkHash(CONST HASH_ALGORITHM* Algorithm)
+{
+	HASH_CONTEXT Context = { 0 };
+	char Name[16];
+	UINT8* Buffer;
+	UINT64 Size;
+	UINTN i, Run;
+	double Start, Best;
+
+	HostUcs2ToUtf8(Algorithm->Name, Name, sizeof(Name));
+	if (EFI_ERROR(Algorithm->SelfTest())) {
+		printf("%-8s self test failed\n", Name);
+		return;
+	}
+	Buffer = AllocateZeroPool(HashWriteSize[ARRAY_SIZE(HashWriteSize) - 1]);
+	for (i = 0; i < HashWriteSize[ARRAY_SIZE(HashWriteSize) - 1]; i++)
+		Buffer[i] = (UINT8)(i * 7 + 3);
+	for (i = 0; i < ARRAY_SIZE(HashWriteSize); i++) {
+		for (Run = 0, Best = 1e9; Run < NUM_RUNS; Run++) {
+			Start = GetTime();
+			Algorithm->Init(&Context);
+			for (Size = 0; Size < HashBytes; Size += HashWriteSize[i])
+				Algorithm->Write(&Context, Buffer, HashWriteSize[i]);
+			Algorithm->Final(&Context);
+			Best = MIN(Best, GetTime() - Start);
+		}
+		printf("%-8s %7zu B writes: %6.2f GB/s\n", Name, (size_t)HashWriteSize[i],
+			HashBytes / Best / (1024.0 * 1024.0 * 1024.0));
+	}
+	FreePool(Buffer);
+}
+
+/*
+ * Write a synthetic md5sum.txt of NUM_ENTRIES lines, spread over 100
+ * directories and, optionally, with an md5sum_totalbytes header.
+ */
+STATIC BOOLEAN WriteHashList(CONST char* Dir, BOOLEAN TotalBytes, CONST char* Suffix)
+{
+	char Path[256];
+	FILE* File;
+	UINTN i, j;
+
+	snprintf(Path, sizeof(Path), "%s/md5sum.txt", Dir);
+	File = fopen(Path, "w");
+	if (File == NULL)
+		return FALSE;
+	if (TotalBytes)
+		fprintf(File, "# md5sum_totalbytes = 0x%x\n", NUM_ENTRIES * 4096);
+	for (i = 0; i < NUM_ENTRIES; i++) {
+		for (j = 0; j < 4; j++)
+			fprintf(File, "%08x", (UINT32)((i + j) * 0x9e3779b1u));
+		fprintf(File, "  ./dir%02zu/subdirectory/file%06zu%s.bin\n", (size_t)(i % 100), (size_t)i, Suffix);
+	}
+	return fclose(File) == 0;
+}
+
+STATIC VOID FreeHashList(HASH_LIST* List)
+{
+	SafeFree(List->Buffer);
+	SafeFree(List->Entry);
+	SafeFree(List->Size);
+	SafeFree(List->ChunkBuffer);
+	SafeFree(List->Chunk);
+	SafeFree(List->ChunkIndex);
+	SafeFree(List->Failure);
+	ZeroMem(List, sizeof(HASH_LIST));
+}
+
+STATIC VOID BenchmarkParse(EFI_FILE_HANDLE Root, CONST char* Dir, CONST char* Name,
+	BOOLEAN TotalBytes, CONST char* Suffix)
+{
+	HASH_LIST List = { 0 };
+	EFI_STATUS Status;
+	UINTN Run, NumEntries = 0;
+	double Start, Best;
+
+	if (!WriteHashList(Dir, TotalBytes, Suffix)) {
+		printf("Parse %-16s could not write the hash list\n", Name);
+		return;
+	}
+	for (Run = 0, Best = 1e9; Run < NUM_RUNS; Run++) {
+		Start = GetTime();
+		Status = Parse(Root, &gHashAlgorithm[HASH_TYPE_MD5], TRUE, &List);
+		while (!EFI_ERROR(Status) && IsStreamingList())
+			ParseNextEntries();
+		if (!EFI_ERROR(Status))
+			Status = ExitParse();
+		Best = MIN(Best, GetTime() - Start);
+		NumEntries = List.NumEntries;
+		FreeHashList(&List);
+		if (EFI_ERROR(Status)) {
+			printf("Parse %-16s failed: 0x%zx\n", Name, (size_t)Status);
+			return;
+		}
+	}
+	printf("Parse %-16s %zu entries: %6.2f M entries/s\n", Name, (size_t)NumEntries,
+		NumEntries / Best / 1e6);
+}
+
+STATIC VOID BenchmarkUtf8(CONST char* Name, CONST CHAR8* Prefix)
+{
+	CHAR8 (*Path)[PATH_MAX + 1];
+	CHAR16 Ucs2[PATH_MAX + 1];
+	UINT64 Bytes = 0;
+	UINTN i, Loop, Run, Length[1000], Ucs2Length;
+	double Start, Best;
+
+	Path = AllocatePool(1000 * sizeof(*Path));
+	for (i = 0; i < 1000; i++)
+		AsciiSPrint(Path[i], sizeof(*Path), "%a/dir%02d/file%06d.bin", Prefix, i % 100, i);
+	for (i = 0; i < 1000; i++) {
+		Length[i] = AsciiStrLen(Path[i]);
+		Bytes += Length[i];
+	}
+	for (Run = 0, Best = 1e9; Run < NUM_RUNS; Run++) {
+		Start = GetTime();
+		for (Loop = 0; Loop < UTF8_LOOPS; Loop++)
+			for (i = 0; i < 1000; i++)
+				Utf8ToUcs2(Path[i], Length[i], Ucs2, ARRAY_SIZE(Ucs2), &Ucs2Length);
+		Best = MIN(Best, GetTime() - Start);
+	}
+	printf("Utf8ToUcs2 %-11s %4.0f MB/s, %6.2f M paths/s\n", Name,
+		Bytes * UTF8_LOOPS / Best / (1024.0 * 1024.0), 1000.0 * UTF8_LOOPS / Best / 1e6);
+	FreePool(Path);
+}
+
+int main(int argc, char** argv)
+{
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	EFI_FILE_HANDLE Root;
+	char Dir[] = "/tmp/md5sum_bench_XXXXXX", Path[64];
+	UINTN i;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:")) != -1) {
+		switch (c) {
+		case 's': HashBytes = strtoull(optarg, NULL, 0) * 1024 * 1024; break;
+		default:
+			fprintf(stderr, "Usage: md5sum_bench [-s hashed_MB]\n");
+			return 1;
+		}
+	}
+	if (HashBytes == 0 || mkdtemp(Dir) == NULL) {
+		perror("md5sum_bench");
+		return 1;
+	}
+
+	// Parse() only reports errors, in test mode, so that the output is not garbled
+	gHost.TestMode = TRUE;
+	gIsTestMode = TRUE;
+	gHost.RootPath = Dir;
+	HostSetup();
+	if (EFI_ERROR(gBS->HandleProtocol(gHost.DeviceHandle, &gEfiSimpleFileSystemProtocolGuid,
+		(VOID**)&Volume)) || EFI_ERROR(Volume->OpenVolume(Volume, &Root))) {
+		fprintf(stderr, "Could not open %s\n", Dir);
+		return 1;
+	}
+	InitTimestamp();
+
+	for (i = 0; i < HASH_TYPE_MAX; i++)
+		BenchmarkHash(&gHashAlgorithm[i]);
+	BenchmarkParse(Root, Dir, "(whole)", FALSE, "");
+	BenchmarkParse(Root, Dir, "(streamed)", TRUE, "");
+	BenchmarkParse(Root, Dir, "(non ASCII)", FALSE, "_\xc3\xa9t\xc3\xa9_\xe6\x96\x87\xe4\xbb\xb6");
+	BenchmarkUtf8("(ASCII)", "./efi/boot/subdirectory");
+	BenchmarkUtf8("(non ASCII)", "./\xc3\xa9t\xc3\xa9/\xe6\x96\x87\xe4\xbb\xb6/\xd0\xbf\xd0\xb0\xd0\xbf\xd0\xba\xd0\xb0");
+
+	Root->Close(Root);
+	snprintf(Path, sizeof(Path), "%s/md5sum.txt", Dir);
+	unlink(Path);
+	rmdir(Dir);
+	return 0;
+}
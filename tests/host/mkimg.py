@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+#
+# uefi-md5sum: Host build shim - FAT16/FAT32/exFAT image generation
+# Copyright © 2024 Pete Batard <pete@akeo.ie>
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Usage: mkimg.py fat16|fat32|exfat dir out [1 (to fragment the files)]
+import os, sys, struct
+
+fstype, src, out = sys.argv[1], sys.argv[2], sys.argv[3]
+frag = len(sys.argv) > 4 and sys.argv[4] == '1'
+BPS = 512
+SPC = {'fat16': 4, 'fat32': 1, 'exfat': 8}[fstype]
+
+def count_clusters(spc):
+    n = 0
+    for root, dirs, files in os.walk(src):
+        n += (len(dirs) + len(files)) * 64 // (BPS * spc) + 1
+        n += sum((os.path.getsize(os.path.join(root, f)) + BPS * spc - 1) // (BPS * spc) for f in files)
+    return n
+
+# FAT16 has less than 64K clusters, so large trees require larger clusters
+while fstype == 'fat16' and SPC < 128 and count_clusters(SPC) > 60000:
+    SPC *= 2
+CS = BPS * SPC
+EOC = {'fat16': 0xFFFF, 'fat32': 0x0FFFFFFF, 'exfat': 0xFFFFFFFF}[fstype]
+
+fat = {}
+data = {}          # cluster -> bytes
+nxt = [2]
+contiguous = set()
+
+def alloc(n, fragment=False):
+    cl = []
+    if fragment and n > 1:
+        # runs of 2 clusters with a 1 cluster gap, and pairs swapped
+        while len(cl) < n:
+            b = nxt[0]
+            cl += [b + 3, b + 4, b, b + 1]
+            nxt[0] += 6
+        cl = cl[:n]
+    else:
+        cl = list(range(nxt[0], nxt[0] + n))
+        nxt[0] += n
+    for a, b in zip(cl, cl[1:]):
+        fat[a] = b
+    if cl:
+        fat[cl[-1]] = EOC
+    return cl
+
+def put(cl, buf):
+    for i, c in enumerate(cl):
+        data[c] = buf[i * CS:(i + 1) * CS]
+
+def nclusters(size):
+    return (size + CS - 1) // CS
+
+def short_ok(name):
+    if name in ('.', '..'):
+        return False
+    base, dot, ext = name.partition('.')
+    ok = lambda s, m: 0 < len(s) <= m and all(c.isascii() and (c.isalnum() or c in '_-~!#$%&') for c in s)
+    return ok(base, 8) and (not dot or ok(ext, 3)) and '.' not in ext
+
+alias_count = [0]
+def make_short(name):
+    if short_ok(name):
+        b, _, e = name.upper().partition('.')
+        return (b.ljust(8) + e.ljust(3)).encode(), False
+    alias_count[0] += 1
+    b = ('F%06d' % alias_count[0])[:6] + '~1'
+    return (b.ljust(8) + 'BIN').encode(), True
+
+def lfn_checksum(sn):
+    s = 0
+    for c in sn:
+        s = (((s & 1) << 7) + (s >> 1) + c) & 0xFF
+    return s
+
+def fat_entries(name, attr, cluster, size):
+    sn, need_lfn = make_short(name)
+    ents = b''
+    if need_lfn:
+        u = name.encode('utf-16le')
+        chars = [u[i:i + 2] for i in range(0, len(u), 2)]
+        n = (len(chars) + 12) // 13
+        chars += [b'\0\0'] if len(chars) % 13 else []
+        chars += [b'\xff\xff'] * (n * 13 - len(chars))
+        cs = lfn_checksum(sn)
+        for o in range(n, 0, -1):
+            c = chars[(o - 1) * 13:o * 13]
+            ents += struct.pack('<B10sBBB12sH4s', o | (0x40 if o == n else 0), b''.join(c[0:5]), 0x0F, 0, cs,
+                                b''.join(c[5:11]), 0, b''.join(c[11:13]))
+    nt = 0
+    if not need_lfn:
+        b, _, e = name.partition('.')
+        nt = (0x08 if b.islower() else 0) | (0x10 if e.islower() else 0)
+    ents += struct.pack('<11sBBBHHHHHHHI', sn, attr, nt, 0, 0, 0, 0, (cluster >> 16) if fstype == 'fat32' else 0, 0, 0,
+                        cluster & 0xFFFF, size)
+    return ents
+
+def exfat_entries(name, attr, cluster, size, nofat):
+    u = name.encode('utf-16le')
+    nl = len(u) // 2
+    nn = (nl + 14) // 15
+    ents = struct.pack('<BBHH26s', 0x85, 1 + nn, 0, attr, b'')
+    ents += struct.pack('<BBBBHHQIIQ', 0xC0, 0x01 | (0x02 if nofat else 0), 0, nl, 0, 0, size, 0, cluster, size)
+    for i in range(nn):
+        ents += struct.pack('<BB30s', 0xC1, 0, u[i * 30:(i + 1) * 30])
+    return ents
+
+def count_entries(name):
+    if fstype == 'exfat':
+        return 2 + (len(name) + 14) // 15
+    _, need = make_short(name)
+    if not need:
+        return 1
+    return 1 + (len(name.encode('utf-16le')) // 2 + 12) // 13
+
+def build_dir(path, self_cl, parent_cl, is_root):
+    names = sorted(os.listdir(path))
+    ents = b''
+    if not is_root and fstype != 'exfat':
+        ents += struct.pack('<11sBBBHHHHHHHI', b'.          ', 0x10, 0, 0, 0, 0, 0, self_cl >> 16, 0, 0, self_cl & 0xFFFF, 0)
+        p = 0 if parent_cl is None else parent_cl
+        ents += struct.pack('<11sBBBHHHHHHHI', b'..         ', 0x10, 0, 0, 0, 0, 0, p >> 16, 0, 0, p & 0xFFFF, 0)
+    for raw in names:
+        name = raw
+        full = os.path.join(path, raw)
+        if os.path.isdir(full):
+            cnt = sum(count_entries(n) for n in os.listdir(full)) + (0 if fstype == 'exfat' else 2)
+            dsize = max(1, nclusters(cnt * 32 + 32)) * CS
+            cl = alloc(dsize // CS)
+            sub, _ = build_dir(full, cl[0], 0 if is_root else self_cl, False)
+            put(cl, sub)
+            if fstype == 'exfat':
+                ents += exfat_entries(name, 0x10, cl[0], dsize, False)
+            else:
+                ents += fat_entries(name, 0x10, cl[0], 0)
+        else:
+            buf = open(full, 'rb').read()
+            cl = alloc(nclusters(len(buf)), frag)
+            put(cl, buf)
+            first = cl[0] if cl else 0
+            if fstype == 'exfat':
+                nofat = not frag and len(cl) > 0
+                ents += exfat_entries(name, 0x20, first, len(buf), nofat)
+            else:
+                ents += fat_entries(name, 0x20, first, len(buf))
+    return ents, self_cl
+
+root_cnt = sum(count_entries(n) for n in os.listdir(src))
+if fstype == 'fat16':
+    root_entries = max(512, (root_cnt + 16) // 16 * 16)
+    rootents = build_dir(src, 0, None, True)[0]
+    root_cl = 0
+else:
+    rcl = alloc(max(1, nclusters(root_cnt * 32 + 64)))
+    root_cl = rcl[0]
+    rootents = build_dir(src, root_cl, None, True)[0]
+    put(rcl, rootents)
+
+used = nxt[0]
+img = bytearray()
+if fstype == 'fat16':
+    cc = max(used + 16, 4200)
+    assert cc < 65525
+    fatsz = ((cc + 2) * 2 + BPS - 1) // BPS
+    res = 1
+    rootsecs = root_entries * 32 // BPS
+    total = res + 2 * fatsz + rootsecs + cc * SPC
+    bs = struct.pack('<3s8sHBHBHHBHHHII', b'\xeb\x3c\x90', b'MSWIN4.1', BPS, SPC, res, 2, root_entries,
+                     total if total < 65536 else 0, 0xF8, fatsz, 63, 255, 0, 0 if total < 65536 else total)
+    fatoff = res * BPS
+    rootoff = (res + 2 * fatsz) * BPS
+    dataoff = rootoff + rootsecs * BPS
+    esz = 2
+elif fstype == 'fat32':
+    cc = max(used + 16, 66000)
+    fatsz = ((cc + 2) * 4 + BPS - 1) // BPS
+    res = 32
+    total = res + 2 * fatsz + cc * SPC
+    bs = struct.pack('<3s8sHBHBHHBHHHIIIHHI', b'\xeb\x58\x90', b'MSWIN4.1', BPS, SPC, res, 2, 0, 0, 0xF8, 0, 63, 255, 0,
+                     total, fatsz, 0, 0, root_cl)
+    fatoff = res * BPS
+    dataoff = (res + 2 * fatsz) * BPS
+    esz = 4
+else:
+    cc = used + 16
+    fatsz = ((cc + 2) * 4 + BPS - 1) // BPS
+    fatoffs = 32
+    heap = fatoffs + fatsz
+    heap = (heap + SPC - 1) // SPC * SPC
+    total = heap + cc * SPC
+    bs = struct.pack('<3s8s53sQQIIIIIIHHBBB', b'\xeb\x76\x90', b'EXFAT   ', b'', 0, total, fatoffs, fatsz, heap, cc,
+                     root_cl, 0x1234, 0x100, 0, 9, SPC.bit_length() - 1, 1)
+    fatoff = fatoffs * BPS
+    dataoff = heap * BPS
+    esz = 4
+bs = bs.ljust(510, b'\0') + b'\x55\xaa'
+
+with open(out, 'wb') as f:
+    f.truncate(total * BPS)
+    f.seek(0); f.write(bs)
+    fatbuf = bytearray(fatsz * BPS)
+    media = {'fat16': (0xFFF8, 0xFFFF), 'fat32': (0x0FFFFFF8, 0x0FFFFFFF), 'exfat': (0xFFFFFFF8, 0xFFFFFFFF)}[fstype]
+    vals = {0: media[0], 1: media[1]}
+    vals.update(fat)
+    for c, v in vals.items():
+        struct.pack_into('<H' if esz == 2 else '<I', fatbuf, c * esz, v)
+    nf = 1 if fstype == 'exfat' else 2
+    for i in range(nf):
+        f.seek(fatoff + i * fatsz * BPS); f.write(fatbuf)
+    if fstype == 'fat16':
+        f.seek(rootoff); f.write(rootents)
+    for c, b in data.items():
+        f.seek(dataoff + (c - 2) * CS); f.write(b)
@@ -0,0 +1,1944 @@
+/*
+ * uefi-md5sum: Host build shim - UEFI services emulation over POSIX
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "shim.h"
+
+/*
+ * GUIDs (values are the real ones, for readability of any dumps)
+ */
+EFI_GUID gEfiLoadedImageProtocolGuid       = { 0x5B1B31A1, 0x9562, 0x11d2, { 0x8E, 0x3F, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } };
+EFI_GUID gEfiSimpleFileSystemProtocolGuid  = { 0x964E5B22, 0x6459, 0x11d2, { 0x8E, 0x39, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } };
+EFI_GUID gEfiFileInfoGuid                  = { 0x09576E92, 0x6D3F, 0x11d2, { 0x8E, 0x39, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } };
+EFI_GUID gEfiFileSystemInfoGuid            = { 0x09576E93, 0x6D3F, 0x11d2, { 0x8E, 0x39, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } };
+EFI_GUID gEfiSmbiosTableGuid               = { 0xEB9D2D31, 0x2D88, 0x11D3, { 0x9A, 0x16, 0x00, 0x90, 0x27, 0x3F, 0xC1, 0x4D } };
+EFI_GUID gEfiSmbios3TableGuid              = { 0xF2FD1544, 0x9794, 0x4A2C, { 0x99, 0x2E, 0xE5, 0xBB, 0xCF, 0x20, 0xE3, 0x94 } };
+EFI_GUID gEfiDiskIoProtocolGuid            = { 0xCE345171, 0xBA0B, 0x11d2, { 0x8E, 0x4F, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } };
+EFI_GUID gEfiDiskIo2ProtocolGuid           = { 0x151C8EAE, 0x7F2C, 0x472C, { 0x9E, 0x54, 0x98, 0x28, 0x19, 0x4F, 0x6A, 0x88 } };
+EFI_GUID gEfiBlockIoProtocolGuid           = { 0x964E5B21, 0x6459, 0x11d2, { 0x8E, 0x39, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } };
+EFI_GUID gEfiDriverBindingProtocolGuid     = { 0x18A031AB, 0xB443, 0x4D1A, { 0xA5, 0xC0, 0x0C, 0x09, 0x26, 0x1E, 0x9F, 0x71 } };
+EFI_GUID gEfiComponentNameProtocolGuid     = { 0x107A772C, 0xD5E1, 0x11D4, { 0x9A, 0x46, 0x00, 0x90, 0x27, 0x3F, 0xC1, 0x4D } };
+EFI_GUID gEfiComponentName2ProtocolGuid    = { 0x6A7A5CFF, 0xE8D9, 0x4F70, { 0xBA, 0xDA, 0x75, 0xAB, 0x30, 0x25, 0xCE, 0x14 } };
+EFI_GUID gEfiUnicodeCollationProtocolGuid  = { 0x1D85CD7F, 0xF43D, 0x11D2, { 0x9A, 0x0C, 0x00, 0x90, 0x27, 0x3F, 0xC1, 0x4D } };
+EFI_GUID gEfiUnicodeCollation2ProtocolGuid = { 0xA4C751FC, 0x23AE, 0x4C3E, { 0x92, 0xE9, 0x49, 0x64, 0xCF, 0x63, 0xF3, 0x49 } };
+EFI_GUID gEfiDevicePathProtocolGuid        = { 0x09576E91, 0x6D3F, 0x11D2, { 0x8E, 0x39, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } };
+
+EFI_SYSTEM_TABLE*     gST = NULL;
+EFI_BOOT_SERVICES*    gBS = NULL;
+EFI_RUNTIME_SERVICES* gRT = NULL;
+
+HOST_CONFIG gHost = { 0 };
+
+/*
+ * BaseLib / BaseMemoryLib / MemoryAllocationLib
+ */
+VOID* CopyMem(VOID* Destination, CONST VOID* Source, UINTN Length) { return memmove(Destination, Source, Length); }
+VOID* SetMem(VOID* Buffer, UINTN Length, UINT8 Value) { return memset(Buffer, Value, Length); }
+VOID* ZeroMem(VOID* Buffer, UINTN Length) { return memset(Buffer, 0, Length); }
+INTN CompareMem(CONST VOID* a, CONST VOID* b, UINTN Length) { return (Length == 0) ? 0 : memcmp(a, b, Length); }
+BOOLEAN CompareGuid(CONST GUID* Guid1, CONST GUID* Guid2) { return memcmp(Guid1, Guid2, sizeof(GUID)) == 0; }
+VOID* ScanMem8(CONST VOID* Buffer, UINTN Length, UINT8 Value) { return (VOID*)memchr(Buffer, Value, Length); }
+
+VOID* AllocatePool(UINTN Size) { return malloc(Size == 0 ? 1 : Size); }
+VOID* AllocateZeroPool(UINTN Size) { return calloc(1, Size == 0 ? 1 : Size); }
+VOID* AllocateCopyPool(UINTN Size, CONST VOID* Buffer)
+{
+	VOID* p = AllocatePool(Size);
+	if (p != NULL)
+		memcpy(p, Buffer, Size);
+	return p;
+}
+VOID* ReallocatePool(UINTN OldSize, UINTN NewSize, VOID* OldBuffer)
+{
+	(void)OldSize;
+	return realloc(OldBuffer, NewSize == 0 ? 1 : NewSize);
+}
+VOID FreePool(VOID* Buffer) { free(Buffer); }
+VOID* AllocatePages(UINTN Pages) { return AllocateAlignedPages(Pages, EFI_PAGE_SIZE); }
+VOID* AllocateAlignedPages(UINTN Pages, UINTN Alignment)
+{
+	VOID* p = NULL;
+	if (Alignment < EFI_PAGE_SIZE)
+		Alignment = EFI_PAGE_SIZE;
+	return (posix_memalign(&p, Alignment, EFI_PAGES_TO_SIZE(Pages)) == 0) ? p : NULL;
+}
+VOID FreePages(VOID* Buffer, UINTN Pages) { (void)Pages; free(Buffer); }
+VOID FreeAlignedPages(VOID* Buffer, UINTN Pages) { (void)Pages; free(Buffer); }
+
+UINTN StrLen(CONST CHAR16* s) { UINTN n = 0; while (s[n] != 0) n++; return n; }
+UINTN StrSize(CONST CHAR16* s) { return (StrLen(s) + 1) * sizeof(CHAR16); }
+INTN StrCmp(CONST CHAR16* a, CONST CHAR16* b)
+{
+	while (*a != 0 && *a == *b)
+		a++, b++;
+	return (INTN)*a - (INTN)*b;
+}
+INTN StrnCmp(CONST CHAR16* a, CONST CHAR16* b, UINTN Length)
+{
+	if (Length == 0)
+		return 0;
+	while (*a != 0 && *a == *b && Length > 1)
+		a++, b++, Length--;
+	return (INTN)*a - (INTN)*b;
+}
+RETURN_STATUS StrCpyS(CHAR16* Destination, UINTN DestMax, CONST CHAR16* Source)
+{
+	if (Destination == NULL || Source == NULL || DestMax == 0)
+		return EFI_INVALID_PARAMETER;
+	if (StrLen(Source) >= DestMax)
+		return EFI_BUFFER_TOO_SMALL;
+	memcpy(Destination, Source, StrSize(Source));
+	return EFI_SUCCESS;
+}
+RETURN_STATUS StrnCpyS(CHAR16* Destination, UINTN DestMax, CONST CHAR16* Source, UINTN Length)
+{
+	UINTN i;
+	if (Destination == NULL || Source == NULL || DestMax == 0)
+		return EFI_INVALID_PARAMETER;
+	for (i = 0; i < Length && Source[i] != 0; i++);
+	if (i >= DestMax)
+		return EFI_BUFFER_TOO_SMALL;
+	memcpy(Destination, Source, i * sizeof(CHAR16));
+	Destination[i] = 0;
+	return EFI_SUCCESS;
+}
+RETURN_STATUS StrCatS(CHAR16* Destination, UINTN DestMax, CONST CHAR16* Source)
+{
+	UINTN Len;
+	if (Destination == NULL || Source == NULL || DestMax == 0)
+		return EFI_INVALID_PARAMETER;
+	Len = StrLen(Destination);
+	if (Len + StrLen(Source) >= DestMax)
+		return EFI_BUFFER_TOO_SMALL;
+	memcpy(&Destination[Len], Source, StrSize(Source));
+	return EFI_SUCCESS;
+}
+UINTN AsciiStrLen(CONST CHAR8* String) { return strlen(String); }
+INTN AsciiStrCmp(CONST CHAR8* a, CONST CHAR8* b) { return strcmp(a, b); }
+INTN AsciiStrnCmp(CONST CHAR8* a, CONST CHAR8* b, UINTN Length) { return strncmp(a, b, Length); }
+UINT32 SwapBytes32(UINT32 Value) { return __builtin_bswap32(Value); }
+UINT64 SwapBytes64(UINT64 Value) { return __builtin_bswap64(Value); }
+UINT32 ReadUnaligned32(CONST UINT32* Buffer) { UINT32 v; memcpy(&v, Buffer, sizeof(v)); return v; }
+UINT64 ReadUnaligned64(CONST UINT64* Buffer) { UINT64 v; memcpy(&v, Buffer, sizeof(v)); return v; }
+UINT32 LRotU32(UINT32 v, UINTN n) { n &= 31; return (n == 0) ? v : (v << n) | (v >> (32 - n)); }
+UINT32 RRotU32(UINT32 v, UINTN n) { n &= 31; return (n == 0) ? v : (v >> n) | (v << (32 - n)); }
+UINT64 DivU64x32(UINT64 Dividend, UINT32 Divisor) { return Dividend / Divisor; }
+UINT64 DivU64x64Remainder(UINT64 Dividend, UINT64 Divisor, UINT64* Remainder)
+{
+	if (Remainder != NULL)
+		*Remainder = Dividend % Divisor;
+	return Dividend / Divisor;
+}
+UINT64 MultU64x32(UINT64 Multiplicand, UINT32 Multiplier) { return Multiplicand * Multiplier; }
+VOID MemoryFence(VOID) { __sync_synchronize(); }
+VOID CpuPause(VOID)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+#if defined(__x86_64__) || defined(__i386__)
+UINT32 AsmCpuidEx(UINT32 Index, UINT32 SubIndex, UINT32* Eax, UINT32* Ebx, UINT32* Ecx, UINT32* Edx)
+{
+	UINT32 a, b, c, d;
+	__cpuid_count(Index, SubIndex, a, b, c, d);
+	if (Eax != NULL) *Eax = a;
+	if (Ebx != NULL) *Ebx = b;
+	if (Ecx != NULL) *Ecx = c;
+	if (Edx != NULL) *Edx = d;
+	return Index;
+}
+UINT32 AsmCpuid(UINT32 Index, UINT32* Eax, UINT32* Ebx, UINT32* Ecx, UINT32* Edx)
+{
+	return AsmCpuidEx(Index, 0, Eax, Ebx, Ecx, Edx);
+}
+UINT64 AsmReadTsc(VOID) { return __rdtsc(); }
+UINT64 AsmXGetBv(UINT32 Index)
+{
+	UINT32 Eax, Edx;
+	__asm__ __volatile__("xgetbv" : "=a"(Eax), "=d"(Edx) : "c"(Index));
+	return ((UINT64)Edx << 32) | Eax;
+}
+#endif
+
+/*
+ * PrintLib (EDK2 semantics: %s = CHAR16*, %a = CHAR8*, %r = EFI_STATUS,
+ * %x/%X = uppercase hex, 'l' = 64-bit argument, sizes are in bytes).
+ */
+STATIC CONST CHAR8* StatusString[] = {
+	"Success", "Load Error", "Invalid Parameter", "Unsupported", "Bad Buffer Size",
+	"Buffer Too Small", "Not Ready", "Device Error", "Write Protected", "Out of Resources",
+	"Volume Corrupt", "Volume Full", "No Media", "Media changed", "Not Found",
+	"Access Denied", "No Response", "No mapping", "Time out", "Not started",
+	"Already started", "Aborted", "ICMP Error", "TFTP Error", "Protocol Error",
+	"Incompatible Version", "Security Violation", "CRC Error", "End of Media", "Reserved (29)",
+	"Reserved (30)", "End of File", "Invalid Language", "Compromised Data"
+};
+
+STATIC UINTN PutChar(CHAR16* Buffer, UINTN Max, UINTN Index, CHAR16 c)
+{
+	if (Index + 1 < Max)
+		Buffer[Index] = c;
+	return Index + 1;
+}
+
+STATIC UINTN PutPadded(CHAR16* Buffer, UINTN Max, UINTN Index, CONST CHAR8* s,
+	UINTN Width, BOOLEAN LeftJustify, CHAR16 Pad)
+{
+	UINTN Len = strlen(s), i;
+	if (!LeftJustify)
+		for (i = Len; i < Width; i++)
+			Index = PutChar(Buffer, Max, Index, Pad);
+	for (i = 0; i < Len; i++)
+		Index = PutChar(Buffer, Max, Index, (CHAR16)(UINT8)s[i]);
+	if (LeftJustify)
+		for (i = Len; i < Width; i++)
+			Index = PutChar(Buffer, Max, Index, L' ');
+	return Index;
+}
+
+UINTN UnicodeVSPrint(CHAR16* Buffer, UINTN BufferSize, CONST CHAR16* Format, VA_LIST Marker)
+{
+	UINTN Max = BufferSize / sizeof(CHAR16), Index = 0, Width, Precision, i;
+	BOOLEAN Long, LeftJustify, HasPrecision;
+	CHAR16 Pad;
+	CHAR8 Num[80];
+	CONST CHAR16* Str16;
+	CONST CHAR8* Str8;
+	UINT64 u;
+	INT64 s;
+	EFI_STATUS Status;
+
+	if (Buffer == NULL || Max == 0)
+		return 0;
+	for (; *Format != 0; Format++) {
+		if (*Format != L'%') {
+			Index = PutChar(Buffer, Max, Index, *Format);
+			continue;
+		}
+		Long = FALSE; LeftJustify = FALSE; HasPrecision = FALSE;
+		Pad = L' '; Width = 0; Precision = 0;
+		for (Format++; ; Format++) {
+			if (*Format == L'-') LeftJustify = TRUE;
+			else if (*Format == L'0' && Width == 0) Pad = L'0';
+			else if (*Format == L'+' || *Format == L' ' || *Format == L',') continue;
+			else break;
+		}
+		if (*Format == L'*') {
+			Width = va_arg(Marker, UINTN);
+			Format++;
+		}
+		while (*Format >= L'0' && *Format <= L'9')
+			Width = Width * 10 + (*Format++ - L'0');
+		if (*Format == L'.') {
+			HasPrecision = TRUE;
+			Format++;
+			if (*Format == L'*') {
+				Precision = va_arg(Marker, UINTN);
+				Format++;
+			}
+			while (*Format >= L'0' && *Format <= L'9')
+				Precision = Precision * 10 + (*Format++ - L'0');
+		}
+		while (*Format == L'l' || *Format == L'L') {
+			Long = TRUE;
+			Format++;
+		}
+		switch (*Format) {
+		case L'd':
+		case L'i':
+			s = Long ? va_arg(Marker, INT64) : (INT64)va_arg(Marker, int);
+			snprintf(Num, sizeof(Num), "%lld", (long long)s);
+			Index = PutPadded(Buffer, Max, Index, Num, Width, LeftJustify, Pad);
+			break;
+		case L'u':
+			u = Long ? va_arg(Marker, UINT64) : (UINT64)va_arg(Marker, unsigned int);
+			snprintf(Num, sizeof(Num), "%llu", (unsigned long long)u);
+			Index = PutPadded(Buffer, Max, Index, Num, Width, LeftJustify, Pad);
+			break;
+		case L'x':
+		case L'X':
+			u = Long ? va_arg(Marker, UINT64) : (UINT64)va_arg(Marker, unsigned int);
+			snprintf(Num, sizeof(Num), "%llX", (unsigned long long)u);
+			if (*Format == L'X')
+				Pad = L'0';
+			Index = PutPadded(Buffer, Max, Index, Num, Width, LeftJustify, Pad);
+			break;
+		case L'p':
+			snprintf(Num, sizeof(Num), "%p", va_arg(Marker, VOID*));
+			Index = PutPadded(Buffer, Max, Index, Num, Width, LeftJustify, Pad);
+			break;
+		case L'c':
+			Index = PutChar(Buffer, Max, Index, (CHAR16)va_arg(Marker, int));
+			break;
+		case L's':
+			Str16 = va_arg(Marker, CHAR16*);
+			if (Str16 == NULL)
+				Str16 = L"<null string>";
+			for (i = 0; Str16[i] != 0 && (!HasPrecision || i < Precision); i++);
+			if (!LeftJustify)
+				for (; i < Width; Width--)
+					Index = PutChar(Buffer, Max, Index, L' ');
+			for (i = 0; Str16[i] != 0 && (!HasPrecision || i < Precision); i++)
+				Index = PutChar(Buffer, Max, Index, Str16[i]);
+			if (LeftJustify)
+				for (; i < Width; i++)
+					Index = PutChar(Buffer, Max, Index, L' ');
+			break;
+		case L'a':
+			Str8 = va_arg(Marker, CHAR8*);
+			if (Str8 == NULL)
+				Str8 = "<null string>";
+			for (i = 0; Str8[i] != 0 && (!HasPrecision || i < Precision); i++)
+				Index = PutChar(Buffer, Max, Index, (CHAR16)(UINT8)Str8[i]);
+			break;
+		case L'g':
+			{
+				EFI_GUID* g = va_arg(Marker, EFI_GUID*);
+				snprintf(Num, sizeof(Num), "%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+					g->Data1, g->Data2, g->Data3, g->Data4[0], g->Data4[1], g->Data4[2],
+					g->Data4[3], g->Data4[4], g->Data4[5], g->Data4[6], g->Data4[7]);
+				Index = PutPadded(Buffer, Max, Index, Num, 0, FALSE, L' ');
+			}
+			break;
+		case L'r':
+			Status = va_arg(Marker, EFI_STATUS);
+			if ((Status & ~MAX_BIT) < ARRAY_SIZE_SHIM(StatusString))
+				Str8 = StatusString[Status & ~MAX_BIT];
+			else {
+				snprintf(Num, sizeof(Num), "%08llX", (unsigned long long)Status);
+				Str8 = Num;
+			}
+			Index = PutPadded(Buffer, Max, Index, Str8, Width, LeftJustify, L' ');
+			break;
+		case L'%':
+			Index = PutChar(Buffer, Max, Index, L'%');
+			break;
+		case 0:
+			Format--;
+			break;
+		default:
+			Index = PutChar(Buffer, Max, Index, *Format);
+			break;
+		}
+	}
+	Buffer[MIN_SHIM(Index, Max - 1)] = 0;
+	return MIN_SHIM(Index, Max - 1);
+}
+
+UINTN UnicodeSPrint(CHAR16* Buffer, UINTN BufferSize, CONST CHAR16* Format, ...)
+{
+	UINTN r;
+	VA_LIST Marker;
+	va_start(Marker, Format);
+	r = UnicodeVSPrint(Buffer, BufferSize, Format, Marker);
+	va_end(Marker);
+	return r;
+}
+
+UINTN AsciiSPrint(CHAR8* Buffer, UINTN BufferSize, CONST CHAR8* Format, ...)
+{
+	/* Only used for simple host side formatting */
+	int r;
+	va_list Marker;
+	va_start(Marker, Format);
+	r = vsnprintf(Buffer, BufferSize, Format, Marker);
+	va_end(Marker);
+	return (r < 0) ? 0 : (UINTN)r;
+}
+
+UINTN Print(CONST CHAR16* Format, ...)
+{
+	STATIC CHAR16 Buffer[4096];
+	UINTN r;
+	VA_LIST Marker;
+	va_start(Marker, Format);
+	r = UnicodeVSPrint(Buffer, sizeof(Buffer), Format, Marker);
+	va_end(Marker);
+	gST->ConOut->OutputString(gST->ConOut, Buffer);
+	return r;
+}
+
+/*
+ * UCS-2 <-> UTF-8 helpers for the host side
+ */
+UINTN HostUcs2ToUtf8(CONST CHAR16* Src, char* Dst, UINTN DstSize)
+{
+	UINTN n = 0;
+	UINT32 c;
+	for (; *Src != 0 && n + 4 < DstSize; Src++) {
+		c = *Src;
+		if (c >= 0xD800 && c < 0xDC00 && Src[1] >= 0xDC00 && Src[1] < 0xE000) {
+			c = 0x10000 + ((c - 0xD800) << 10) + (Src[1] - 0xDC00);
+			Src++;
+		}
+		if (c < 0x80) {
+			Dst[n++] = (char)c;
+		} else if (c < 0x800) {
+			Dst[n++] = (char)(0xC0 | (c >> 6));
+			Dst[n++] = (char)(0x80 | (c & 0x3F));
+		} else if (c < 0x10000) {
+			Dst[n++] = (char)(0xE0 | (c >> 12));
+			Dst[n++] = (char)(0x80 | ((c >> 6) & 0x3F));
+			Dst[n++] = (char)(0x80 | (c & 0x3F));
+		} else {
+			Dst[n++] = (char)(0xF0 | (c >> 18));
+			Dst[n++] = (char)(0x80 | ((c >> 12) & 0x3F));
+			Dst[n++] = (char)(0x80 | ((c >> 6) & 0x3F));
+			Dst[n++] = (char)(0x80 | (c & 0x3F));
+		}
+	}
+	Dst[n] = 0;
+	return n;
+}
+
+STATIC UINTN Utf8ToUcs2Host(CONST char* Src, CHAR16* Dst, UINTN DstLen)
+{
+	UINTN n = 0;
+	UINT32 c;
+	CONST UINT8* s = (CONST UINT8*)Src;
+	while (*s != 0 && n + 1 < DstLen) {
+		if (*s < 0x80) { c = *s++; }
+		else if ((*s & 0xE0) == 0xC0 && s[1]) { c = ((s[0] & 0x1F) << 6) | (s[1] & 0x3F); s += 2; }
+		else if ((*s & 0xF0) == 0xE0 && s[1] && s[2]) { c = ((s[0] & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F); s += 3; }
+		else if ((*s & 0xF8) == 0xF0 && s[1] && s[2] && s[3]) {
+			c = ((s[0] & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F); s += 4;
+		} else { c = '?'; s++; }
+		if (c > 0xFFFF) {
+			if (n + 2 >= DstLen)
+				break;
+			c -= 0x10000;
+			Dst[n++] = (CHAR16)(0xD800 + (c >> 10));
+			Dst[n++] = (CHAR16)(0xDC00 + (c & 0x3FF));
+		} else {
+			Dst[n++] = (CHAR16)c;
+		}
+	}
+	Dst[n] = 0;
+	return n;
+}
+
+/*
+ * Time
+ */
+UINT64 HostNanoTime(VOID)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64)ts.tv_sec * 1000000000ULL + (UINT64)ts.tv_nsec - gHost.HiddenNs;
+}
+
+/*
+ * Events and TPL
+ */
+typedef struct _HOST_EVENT {
+	UINT32              Type;
+	EFI_TPL             NotifyTpl;
+	EFI_EVENT_NOTIFY    NotifyFunction;
+	VOID*               NotifyContext;
+	volatile int        Signaled;
+	int                 IsKeyEvent;
+	EFI_TIMER_DELAY     TimerType;
+	UINT64              Period;     /* in ns */
+	UINT64              Deadline;   /* in ns */
+	struct _HOST_EVENT* Next;
+} HOST_EVENT;
+
+STATIC pthread_mutex_t EventLock = PTHREAD_MUTEX_INITIALIZER;
+STATIC HOST_EVENT* TimerList = NULL;
+STATIC EFI_TPL CurrentTpl = TPL_APPLICATION;
+STATIC HOST_EVENT KeyEvent = { .Type = EVT_NOTIFY_WAIT, .IsKeyEvent = 1 };
+STATIC BOOLEAN InDispatch = FALSE;
+
+STATIC BOOLEAN KeyAvailable(VOID)
+{
+	struct pollfd p = { .fd = 0, .events = POLLIN };
+	if (gHost.KeyAfterChecks != 0) {
+		if (--gHost.KeyAfterChecks == 0) {
+			gHost.KeyPending = TRUE;
+		}
+	}
+	if (gHost.KeyPending)
+		return TRUE;
+	if (!isatty(0))
+		return FALSE;
+	return poll(&p, 1, 0) > 0;
+}
+
+STATIC VOID NotifyEvent(HOST_EVENT* Event)
+{
+	if ((Event->Type & EVT_NOTIFY_SIGNAL) && Event->NotifyFunction != NULL) {
+		EFI_TPL OldTpl = CurrentTpl;
+		CurrentTpl = Event->NotifyTpl;
+		Event->NotifyFunction((EFI_EVENT)Event, Event->NotifyContext);
+		CurrentTpl = OldTpl;
+	}
+}
+
+/* Fire any expired timer, in the same manner as the firmware's timer interrupt would */
+VOID HostDispatchTimers(VOID)
+{
+	HOST_EVENT* Event;
+	UINT64 Now;
+
+	if (InDispatch || TimerList == NULL)
+		return;
+	InDispatch = TRUE;
+	Now = HostNanoTime();
+	for (Event = TimerList; Event != NULL; Event = Event->Next) {
+		if (Event->TimerType == TimerCancel || Now < Event->Deadline)
+			continue;
+		if (CurrentTpl >= Event->NotifyTpl && (Event->Type & EVT_NOTIFY_SIGNAL))
+			continue;
+		if (Event->TimerType == TimerPeriodic)
+			Event->Deadline = Now + Event->Period;
+		else
+			Event->TimerType = TimerCancel;
+		__atomic_store_n(&Event->Signaled, 1, __ATOMIC_SEQ_CST);
+		NotifyEvent(Event);
+		if (Event->Type & EVT_NOTIFY_SIGNAL)
+			__atomic_store_n(&Event->Signaled, 0, __ATOMIC_SEQ_CST);
+	}
+	InDispatch = FALSE;
+}
+
+STATIC EFI_TPL EFIAPI HostRaiseTPL(EFI_TPL NewTpl)
+{
+	EFI_TPL Old = CurrentTpl;
+	CurrentTpl = NewTpl;
+	return Old;
+}
+
+STATIC VOID EFIAPI HostRestoreTPL(EFI_TPL OldTpl)
+{
+	CurrentTpl = OldTpl;
+	HostDispatchTimers();
+}
+
+STATIC EFI_STATUS EFIAPI HostCreateEvent(UINT32 Type, EFI_TPL NotifyTpl, EFI_EVENT_NOTIFY NotifyFunction,
+	VOID* NotifyContext, EFI_EVENT* Event)
+{
+	HOST_EVENT* e;
+	if (Event == NULL)
+		return EFI_INVALID_PARAMETER;
+	if ((Type & (EVT_NOTIFY_SIGNAL | EVT_NOTIFY_WAIT)) == (EVT_NOTIFY_SIGNAL | EVT_NOTIFY_WAIT))
+		return EFI_INVALID_PARAMETER;
+	if ((Type & (EVT_NOTIFY_SIGNAL | EVT_NOTIFY_WAIT)) && NotifyFunction == NULL)
+		return EFI_INVALID_PARAMETER;
+	e = calloc(1, sizeof(*e));
+	if (e == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	e->Type = Type;
+	e->NotifyTpl = NotifyTpl;
+	e->NotifyFunction = NotifyFunction;
+	e->NotifyContext = NotifyContext;
+	e->TimerType = TimerCancel;
+	pthread_mutex_lock(&EventLock);
+	if (Type & EVT_TIMER) {
+		e->Next = TimerList;
+		TimerList = e;
+	}
+	pthread_mutex_unlock(&EventLock);
+	*Event = e;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostCreateEventEx(UINT32 Type, EFI_TPL NotifyTpl, EFI_EVENT_NOTIFY NotifyFunction,
+	CONST VOID* NotifyContext, CONST EFI_GUID* EventGroup, EFI_EVENT* Event)
+{
+	(void)EventGroup;
+	return HostCreateEvent(Type, NotifyTpl, NotifyFunction, (VOID*)NotifyContext, Event);
+}
+
+STATIC EFI_STATUS EFIAPI HostSetTimer(EFI_EVENT Event, EFI_TIMER_DELAY Type, UINT64 TriggerTime)
+{
+	HOST_EVENT* e = (HOST_EVENT*)Event;
+	if (e == NULL || !(e->Type & EVT_TIMER))
+		return EFI_INVALID_PARAMETER;
+	e->TimerType = Type;
+	e->Period = TriggerTime * 100ULL;
+	if (e->Period == 0)
+		e->Period = 1000000ULL;
+	e->Deadline = HostNanoTime() + e->Period;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostSignalEvent(EFI_EVENT Event)
+{
+	HOST_EVENT* e = (HOST_EVENT*)Event;
+	if (e == NULL)
+		return EFI_INVALID_PARAMETER;
+	__atomic_store_n(&e->Signaled, 1, __ATOMIC_SEQ_CST);
+	/* Notifications are only delivered from the main thread */
+	if ((e->Type & EVT_NOTIFY_SIGNAL) && pthread_equal(pthread_self(), gHost.MainThread)) {
+		if (CurrentTpl < e->NotifyTpl) {
+			NotifyEvent(e);
+			__atomic_store_n(&e->Signaled, 0, __ATOMIC_SEQ_CST);
+		}
+	}
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostCloseEvent(EFI_EVENT Event)
+{
+	HOST_EVENT *e = (HOST_EVENT*)Event, **p;
+	if (e == NULL)
+		return EFI_INVALID_PARAMETER;
+	if (e->IsKeyEvent)
+		return EFI_SUCCESS;
+	pthread_mutex_lock(&EventLock);
+	for (p = &TimerList; *p != NULL; p = &(*p)->Next) {
+		if (*p == e) {
+			*p = e->Next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&EventLock);
+	free(e);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostCheckEvent(EFI_EVENT Event)
+{
+	HOST_EVENT* e = (HOST_EVENT*)Event;
+	if (e == NULL)
+		return EFI_INVALID_PARAMETER;
+	if (e->Type & EVT_NOTIFY_SIGNAL)
+		return EFI_INVALID_PARAMETER;
+	HostDispatchTimers();
+	if (e->IsKeyEvent)
+		return KeyAvailable() ? EFI_SUCCESS : EFI_NOT_READY;
+	if (__atomic_exchange_n(&e->Signaled, 0, __ATOMIC_SEQ_CST))
+		return EFI_SUCCESS;
+	return EFI_NOT_READY;
+}
+
+STATIC EFI_STATUS EFIAPI HostWaitForEvent(UINTN NumberOfEvents, EFI_EVENT* Event, UINTN* Index)
+{
+	UINTN i;
+	if (NumberOfEvents == 0 || Event == NULL || Index == NULL)
+		return EFI_INVALID_PARAMETER;
+	if (CurrentTpl != TPL_APPLICATION)
+		return EFI_UNSUPPORTED;
+	for (;;) {
+		for (i = 0; i < NumberOfEvents; i++) {
+			HOST_EVENT* e = (HOST_EVENT*)Event[i];
+			if (e->Type & EVT_NOTIFY_SIGNAL) {
+				*Index = i;
+				return EFI_INVALID_PARAMETER;
+			}
+			if (e->IsKeyEvent) {
+				/* Non interactive sessions would otherwise wait forever */
+				if (KeyAvailable() || !isatty(0)) {
+					*Index = i;
+					return EFI_SUCCESS;
+				}
+				continue;
+			}
+			if (__atomic_exchange_n(&e->Signaled, 0, __ATOMIC_SEQ_CST)) {
+				*Index = i;
+				return EFI_SUCCESS;
+			}
+		}
+		HostDispatchTimers();
+		usleep(20);
+	}
+}
+
+STATIC EFI_STATUS EFIAPI HostStall(UINTN Microseconds)
+{
+	UINT64 End = HostNanoTime() + (UINT64)Microseconds * 1000ULL;
+	/* Don't freeze the host on Halt() */
+	if (Microseconds > 10 * 1000 * 1000) {
+		fflush(stdout);
+		exit(2);
+	}
+	do {
+		HostDispatchTimers();
+		if (HostNanoTime() >= End)
+			break;
+		usleep(MIN_SHIM(Microseconds, 100));
+	} while (1);
+	gHost.StallTime += Microseconds;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostSetWatchdogTimer(UINTN Timeout, UINT64 WatchdogCode, UINTN DataSize, CHAR16* WatchdogData)
+{
+	(void)Timeout; (void)WatchdogCode; (void)DataSize; (void)WatchdogData;
+	gHost.WatchdogResets++;
+	return EFI_SUCCESS;
+}
+
+/*
+ * Memory services
+ */
+STATIC EFI_STATUS EFIAPI HostAllocatePool(EFI_MEMORY_TYPE PoolType, UINTN Size, VOID** Buffer)
+{
+	(void)PoolType;
+	*Buffer = AllocatePool(Size);
+	return (*Buffer == NULL) ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFreePool(VOID* Buffer)
+{
+	FreePool(Buffer);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostAllocatePages(EFI_ALLOCATE_TYPE Type, EFI_MEMORY_TYPE MemoryType, UINTN Pages,
+	EFI_PHYSICAL_ADDRESS* Memory)
+{
+	VOID* p;
+	(void)MemoryType;
+	if (Type != AllocateAnyPages || Memory == NULL)
+		return EFI_UNSUPPORTED;
+	p = AllocatePages(Pages);
+	if (p == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	*Memory = (EFI_PHYSICAL_ADDRESS)(UINTN)p;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFreePages(EFI_PHYSICAL_ADDRESS Memory, UINTN Pages)
+{
+	FreePages((VOID*)(UINTN)Memory, Pages);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostGetMemoryMap(UINTN* MemoryMapSize, EFI_MEMORY_DESCRIPTOR* MemoryMap,
+	UINTN* MapKey, UINTN* DescriptorSize, UINT32* DescriptorVersion)
+{
+	/* Report a single region of free memory */
+	if (MemoryMapSize == NULL)
+		return EFI_INVALID_PARAMETER;
+	if (DescriptorSize != NULL)
+		*DescriptorSize = sizeof(EFI_MEMORY_DESCRIPTOR);
+	if (DescriptorVersion != NULL)
+		*DescriptorVersion = 1;
+	if (*MemoryMapSize < sizeof(EFI_MEMORY_DESCRIPTOR)) {
+		*MemoryMapSize = sizeof(EFI_MEMORY_DESCRIPTOR);
+		return EFI_BUFFER_TOO_SMALL;
+	}
+	*MemoryMapSize = sizeof(EFI_MEMORY_DESCRIPTOR);
+	MemoryMap->Type = EfiConventionalMemory;
+	MemoryMap->PhysicalStart = 0x100000;
+	MemoryMap->VirtualStart = 0;
+	MemoryMap->NumberOfPages = (gHost.MemoryMB * 1024ULL * 1024ULL) / EFI_PAGE_SIZE;
+	MemoryMap->Attribute = 0;
+	if (MapKey != NULL)
+		*MapKey = 1;
+	return EFI_SUCCESS;
+}
+
+/*
+ * Console
+ */
+STATIC EFI_SIMPLE_TEXT_OUTPUT_MODE ConOutMode = { 1, 0, 0x07, 0, 0, TRUE };
+
+STATIC EFI_STATUS EFIAPI HostOutputString(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, CHAR16* String)
+{
+	STATIC char Buffer[16384];
+	UINTN Len;
+	(void)This;
+	HostDispatchTimers();
+	Len = HostUcs2ToUtf8(String, Buffer, sizeof(Buffer));
+	fwrite(Buffer, 1, Len, stdout);
+	gHost.ConsoleChars += StrLen(String);
+	gHost.ConsoleCalls++;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostTestString(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, CHAR16* String)
+{
+	(void)This; (void)String;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostTextReset(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, BOOLEAN Ext)
+{
+	(void)This; (void)Ext;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostQueryMode(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN ModeNumber, UINTN* Columns, UINTN* Rows)
+{
+	(void)This; (void)ModeNumber;
+	*Columns = gHost.Cols;
+	*Rows = gHost.Rows;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostSetMode(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN ModeNumber)
+{
+	(void)This; (void)ModeNumber;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostSetAttribute(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN Attribute)
+{
+	STATIC CONST int Ansi[8] = { 30, 34, 32, 36, 31, 35, 33, 37 };
+	(void)This;
+	ConOutMode.Attribute = (INT32)Attribute;
+	printf("\033[%d;%dm", (Attribute & 0x08) ? 1 : 0, Ansi[Attribute & 0x07]);
+	gHost.ConsoleCalls++;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostClearScreen(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This)
+{
+	(void)This;
+	printf("\033[2J\033[H");
+	gHost.ConsoleCalls++;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostSetCursorPosition(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN Column, UINTN Row)
+{
+	(void)This;
+	if (Column >= gHost.Cols || Row >= gHost.Rows)
+		return EFI_UNSUPPORTED;
+	ConOutMode.CursorColumn = (INT32)Column;
+	ConOutMode.CursorRow = (INT32)Row;
+	printf("\033[%d;%dH", (int)Row + 1, (int)Column + 1);
+	gHost.ConsoleCalls++;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostEnableCursor(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, BOOLEAN Visible)
+{
+	(void)This;
+	ConOutMode.CursorVisible = Visible;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostInputReset(EFI_SIMPLE_TEXT_INPUT_PROTOCOL* This, BOOLEAN Ext)
+{
+	(void)This; (void)Ext;
+	gHost.KeyPending = FALSE;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostReadKeyStroke(EFI_SIMPLE_TEXT_INPUT_PROTOCOL* This, EFI_INPUT_KEY* Key)
+{
+	char c;
+	(void)This;
+	if (gHost.KeyPending) {
+		gHost.KeyPending = FALSE;
+		Key->ScanCode = 0;
+		Key->UnicodeChar = L' ';
+		return EFI_SUCCESS;
+	}
+	if (!KeyAvailable() || read(0, &c, 1) != 1)
+		return EFI_NOT_READY;
+	Key->ScanCode = 0;
+	Key->UnicodeChar = (CHAR16)(UINT8)c;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL ConOut = {
+	HostTextReset, HostOutputString, HostTestString, HostQueryMode, HostSetMode,
+	HostSetAttribute, HostClearScreen, HostSetCursorPosition, HostEnableCursor, &ConOutMode
+};
+
+STATIC EFI_SIMPLE_TEXT_INPUT_PROTOCOL ConIn = {
+	HostInputReset, HostReadKeyStroke, (EFI_EVENT)&KeyEvent
+};
+
+/*
+ * Handle database
+ */
+#define MAX_HANDLES     16
+#define MAX_PROTOCOLS   16
+
+typedef struct {
+	EFI_GUID  Guid;
+	VOID*     Interface;
+} HOST_PROTOCOL;
+
+typedef struct {
+	BOOLEAN        Used;
+	HOST_PROTOCOL  Protocol[MAX_PROTOCOLS];
+	UINTN          NumProtocols;
+} HOST_HANDLE;
+
+STATIC HOST_HANDLE Handles[MAX_HANDLES];
+
+EFI_HANDLE HostNewHandle(VOID)
+{
+	UINTN i;
+	for (i = 0; i < MAX_HANDLES; i++) {
+		if (!Handles[i].Used) {
+			ZeroMem(&Handles[i], sizeof(Handles[i]));
+			Handles[i].Used = TRUE;
+			return (EFI_HANDLE)&Handles[i];
+		}
+	}
+	return NULL;
+}
+
+STATIC HOST_HANDLE* ToHandle(EFI_HANDLE Handle)
+{
+	HOST_HANDLE* h = (HOST_HANDLE*)Handle;
+	if (h < &Handles[0] || h >= &Handles[MAX_HANDLES] || !h->Used)
+		return NULL;
+	return h;
+}
+
+STATIC HOST_PROTOCOL* FindProtocol(HOST_HANDLE* h, CONST EFI_GUID* Guid)
+{
+	UINTN i;
+	for (i = 0; i < h->NumProtocols; i++)
+		if (CompareGuid(&h->Protocol[i].Guid, Guid))
+			return &h->Protocol[i];
+	return NULL;
+}
+
+EFI_STATUS HostInstallProtocol(EFI_HANDLE Handle, CONST EFI_GUID* Guid, VOID* Interface)
+{
+	HOST_HANDLE* h = ToHandle(Handle);
+	if (h == NULL || h->NumProtocols >= MAX_PROTOCOLS)
+		return EFI_OUT_OF_RESOURCES;
+	if (FindProtocol(h, Guid) != NULL)
+		return EFI_INVALID_PARAMETER;
+	h->Protocol[h->NumProtocols].Guid = *Guid;
+	h->Protocol[h->NumProtocols++].Interface = Interface;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostHandleProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, VOID** Interface)
+{
+	HOST_HANDLE* h = ToHandle(Handle);
+	HOST_PROTOCOL* p;
+	if (h == NULL || Protocol == NULL || Interface == NULL)
+		return EFI_INVALID_PARAMETER;
+	p = FindProtocol(h, Protocol);
+	if (p == NULL)
+		return EFI_UNSUPPORTED;
+	*Interface = p->Interface;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostOpenProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, VOID** Interface,
+	EFI_HANDLE AgentHandle, EFI_HANDLE ControllerHandle, UINT32 Attributes)
+{
+	VOID* Dummy;
+	(void)AgentHandle; (void)ControllerHandle;
+	if (Attributes == EFI_OPEN_PROTOCOL_TEST_PROTOCOL)
+		Interface = &Dummy;
+	return HostHandleProtocol(Handle, Protocol, Interface);
+}
+
+STATIC EFI_STATUS EFIAPI HostCloseProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, EFI_HANDLE AgentHandle,
+	EFI_HANDLE ControllerHandle)
+{
+	(void)Handle; (void)Protocol; (void)AgentHandle; (void)ControllerHandle;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostOpenProtocolInformation(EFI_HANDLE Handle, EFI_GUID* Protocol,
+	EFI_OPEN_PROTOCOL_INFORMATION_ENTRY** EntryBuffer, UINTN* EntryCount)
+{
+	(void)Handle; (void)Protocol;
+	*EntryBuffer = NULL;
+	*EntryCount = 0;
+	return EFI_NOT_FOUND;
+}
+
+STATIC EFI_STATUS EFIAPI HostLocateHandleBuffer(EFI_LOCATE_SEARCH_TYPE SearchType, EFI_GUID* Protocol,
+	VOID* SearchKey, UINTN* NoHandles, EFI_HANDLE** Buffer)
+{
+	UINTN i, n = 0;
+	(void)SearchKey;
+	if (NoHandles == NULL || Buffer == NULL)
+		return EFI_INVALID_PARAMETER;
+	*Buffer = AllocateZeroPool(MAX_HANDLES * sizeof(EFI_HANDLE));
+	if (*Buffer == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	for (i = 0; i < MAX_HANDLES; i++) {
+		if (!Handles[i].Used)
+			continue;
+		if (SearchType == AllHandles || (Protocol != NULL && FindProtocol(&Handles[i], Protocol) != NULL))
+			(*Buffer)[n++] = (EFI_HANDLE)&Handles[i];
+	}
+	*NoHandles = n;
+	if (n == 0) {
+		FreePool(*Buffer);
+		*Buffer = NULL;
+		return EFI_NOT_FOUND;
+	}
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostLocateProtocol(EFI_GUID* Protocol, VOID* Registration, VOID** Interface)
+{
+	UINTN i;
+	HOST_PROTOCOL* p;
+	(void)Registration;
+	for (i = 0; i < MAX_HANDLES; i++) {
+		if (!Handles[i].Used)
+			continue;
+		p = FindProtocol(&Handles[i], Protocol);
+		if (p != NULL) {
+			*Interface = p->Interface;
+			return EFI_SUCCESS;
+		}
+	}
+	return EFI_NOT_FOUND;
+}
+
+STATIC EFI_STATUS EFIAPI HostInstallProtocolInterface(EFI_HANDLE* Handle, EFI_GUID* Protocol,
+	EFI_INTERFACE_TYPE InterfaceType, VOID* Interface)
+{
+	(void)InterfaceType;
+	if (Handle == NULL || Protocol == NULL)
+		return EFI_INVALID_PARAMETER;
+	if (*Handle == NULL)
+		*Handle = HostNewHandle();
+	return HostInstallProtocol(*Handle, Protocol, Interface);
+}
+
+STATIC EFI_STATUS EFIAPI HostReinstallProtocolInterface(EFI_HANDLE Handle, EFI_GUID* Protocol,
+	VOID* OldInterface, VOID* NewInterface)
+{
+	HOST_HANDLE* h = ToHandle(Handle);
+	HOST_PROTOCOL* p;
+	if (h == NULL)
+		return EFI_INVALID_PARAMETER;
+	p = FindProtocol(h, Protocol);
+	if (p == NULL || p->Interface != OldInterface)
+		return EFI_NOT_FOUND;
+	p->Interface = NewInterface;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostUninstallProtocolInterface(EFI_HANDLE Handle, EFI_GUID* Protocol, VOID* Interface)
+{
+	HOST_HANDLE* h = ToHandle(Handle);
+	HOST_PROTOCOL* p;
+	if (h == NULL)
+		return EFI_INVALID_PARAMETER;
+	p = FindProtocol(h, Protocol);
+	if (p == NULL || p->Interface != Interface)
+		return EFI_NOT_FOUND;
+	*p = h->Protocol[--h->NumProtocols];
+	return EFI_SUCCESS;
+}
+
+/*
+ * Host file system
+ */
+typedef struct {
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL Proto;
+	CONST char*        RootPath;
+	CONST char*        Label;
+} HOST_VOLUME;
+
+/* The boot volume, followed by the extra volumes */
+STATIC HOST_VOLUME Volumes[1 + HOST_EXTRA_VOLUMES_MAX];
+
+typedef struct {
+	EFI_FILE_PROTOCOL  Proto;
+	HOST_VOLUME*       Volume;
+	char*              HostPath;
+	int                Fd;
+	DIR*               Dir;
+	BOOLEAN            IsDir;
+	BOOLEAN            IsRoot;
+	UINT64             Position;
+	UINT64             ReservedPosition;
+} HOST_FILE;
+
+typedef struct {
+	HOST_FILE*          File;
+	EFI_FILE_IO_TOKEN*  Token;
+	UINT64              Offset;
+} HOST_ASYNC_READ;
+
+STATIC EFI_FILE_PROTOCOL FileTemplate;
+
+STATIC EFI_STATUS ErrnoToStatus(int e)
+{
+	switch (e) {
+	case ENOENT:
+	case ENAMETOOLONG:
+	case ENOTDIR:
+		return EFI_NOT_FOUND;
+	case EACCES:
+	case EPERM:
+		return EFI_ACCESS_DENIED;
+	case EROFS:
+		return EFI_WRITE_PROTECTED;
+	case ENOMEM:
+		return EFI_OUT_OF_RESOURCES;
+	default:
+		return EFI_DEVICE_ERROR;
+	}
+}
+
+/* Case insensitive lookup of a single path component, FAT style */
+STATIC BOOLEAN FindComponent(CONST char* Dir, CONST char* Name, char* Out, size_t OutSize)
+{
+	DIR* d;
+	struct dirent* e;
+	BOOLEAN Found = FALSE;
+
+	snprintf(Out, OutSize, "%s/%s", Dir, Name);
+	if (access(Out, F_OK) == 0)
+		return TRUE;
+	d = opendir(Dir);
+	if (d == NULL)
+		return FALSE;
+	while ((e = readdir(d)) != NULL) {
+		if (strcasecmp(e->d_name, Name) == 0) {
+			snprintf(Out, OutSize, "%s/%s", Dir, e->d_name);
+			Found = TRUE;
+			break;
+		}
+	}
+	closedir(d);
+	return Found;
+}
+
+STATIC HOST_FILE* NewHostFile(HOST_VOLUME* Volume, CONST char* HostPath, BOOLEAN IsRoot)
+{
+	HOST_FILE* f = calloc(1, sizeof(*f));
+	if (f == NULL)
+		return NULL;
+	f->Proto = FileTemplate;
+	f->Volume = Volume;
+	f->Proto.Revision = gHost.FileRevision;
+	f->HostPath = strdup(HostPath);
+	f->Fd = -1;
+	f->IsRoot = IsRoot;
+	return f;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileOpen(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle,
+	CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes)
+{
+	HOST_FILE *Parent = (HOST_FILE*)This, *f;
+	char Path8[4096], Cur[8192], Next[8192], *Comp, *Save;
+	size_t RootLen = strlen(Parent->Volume->RootPath);
+	struct stat st;
+	int Flags;
+	(void)Attributes;
+
+	if (This == NULL || NewHandle == NULL || FileName == NULL)
+		return EFI_INVALID_PARAMETER;
+	gHost.FileOpens++;
+	HostDispatchTimers();
+	HostUcs2ToUtf8(FileName, Path8, sizeof(Path8));
+	if (FileName[0] == L'\\')
+		snprintf(Cur, sizeof(Cur), "%s", Parent->Volume->RootPath);
+	else
+		snprintf(Cur, sizeof(Cur), "%s", Parent->HostPath);
+	for (Comp = strtok_r(Path8, "\\", &Save); Comp != NULL; Comp = strtok_r(NULL, "\\", &Save)) {
+		if (strcmp(Comp, ".") == 0)
+			continue;
+		if (strcmp(Comp, "..") == 0) {
+			char* Slash = strrchr(Cur, '/');
+			if (strlen(Cur) > RootLen && Slash != NULL)
+				*Slash = 0;
+			continue;
+		}
+		if (strlen(Comp) > 255)
+			return EFI_NOT_FOUND;
+		if (!FindComponent(Cur, Comp, Next, sizeof(Next))) {
+			if ((OpenMode & EFI_FILE_MODE_CREATE) && strchr(Save != NULL ? Save : "", '\\') == NULL) {
+				snprintf(Next, sizeof(Next), "%s/%s", Cur, Comp);
+			} else {
+				return EFI_NOT_FOUND;
+			}
+		}
+		snprintf(Cur, sizeof(Cur), "%s", Next);
+	}
+
+	if (stat(Cur, &st) != 0) {
+		if (!(OpenMode & EFI_FILE_MODE_CREATE))
+			return ErrnoToStatus(errno);
+		if (Attributes & EFI_FILE_DIRECTORY) {
+			if (mkdir(Cur, 0755) != 0)
+				return ErrnoToStatus(errno);
+		} else {
+			int Fd = open(Cur, O_CREAT | O_WRONLY, 0644);
+			if (Fd < 0)
+				return ErrnoToStatus(errno);
+			close(Fd);
+		}
+		stat(Cur, &st);
+	}
+	if ((OpenMode & EFI_FILE_MODE_WRITE) && gHost.ReadOnly)
+		return EFI_WRITE_PROTECTED;
+
+	f = NewHostFile(Parent->Volume, Cur, strlen(Cur) == RootLen);
+	if (f == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	if (S_ISDIR(st.st_mode)) {
+		f->IsDir = TRUE;
+		f->Dir = opendir(Cur);
+		if (f->Dir == NULL) {
+			free(f->HostPath);
+			free(f);
+			return ErrnoToStatus(errno);
+		}
+	} else {
+		Flags = (OpenMode & EFI_FILE_MODE_WRITE) ? O_RDWR : O_RDONLY;
+		f->Fd = open(Cur, Flags);
+		if (f->Fd < 0) {
+			free(f->HostPath);
+			free(f);
+			return ErrnoToStatus(errno);
+		}
+	}
+	*NewHandle = &f->Proto;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileClose(EFI_FILE_PROTOCOL* This)
+{
+	HOST_FILE* f = (HOST_FILE*)This;
+	if (f == NULL)
+		return EFI_INVALID_PARAMETER;
+	if (f->Fd >= 0)
+		close(f->Fd);
+	if (f->Dir != NULL)
+		closedir(f->Dir);
+	free(f->HostPath);
+	free(f);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileDelete(EFI_FILE_PROTOCOL* This)
+{
+	HOST_FILE* f = (HOST_FILE*)This;
+	EFI_STATUS Status = EFI_SUCCESS;
+	if (f->IsDir ? rmdir(f->HostPath) : unlink(f->HostPath))
+		Status = EFI_WARN_DELETE_FAILURE_SHIM;
+	HostFileClose(This);
+	return Status;
+}
+
+STATIC VOID FillFileInfo(CONST char* Name, struct stat* st, EFI_FILE_INFO* Info, UINTN NameLen16)
+{
+	struct tm tm;
+	ZeroMem(Info, SIZE_OF_EFI_FILE_INFO);
+	Info->Size = SIZE_OF_EFI_FILE_INFO + (NameLen16 + 1) * sizeof(CHAR16);
+	Info->FileSize = S_ISDIR(st->st_mode) ? 0 : (UINT64)st->st_size;
+	Info->PhysicalSize = (UINT64)st->st_blocks * 512ULL;
+	Info->Attribute = S_ISDIR(st->st_mode) ? EFI_FILE_DIRECTORY : EFI_FILE_ARCHIVE;
+	localtime_r(&st->st_mtime, &tm);
+	Info->ModificationTime.Year = (UINT16)(tm.tm_year + 1900);
+	Info->ModificationTime.Month = (UINT8)(tm.tm_mon + 1);
+	Info->ModificationTime.Day = (UINT8)tm.tm_mday;
+	Info->ModificationTime.Hour = (UINT8)tm.tm_hour;
+	Info->ModificationTime.Minute = (UINT8)tm.tm_min;
+	Info->ModificationTime.Second = (UINT8)tm.tm_sec;
+	Info->CreateTime = Info->ModificationTime;
+	Info->LastAccessTime = Info->ModificationTime;
+	Utf8ToUcs2Host(Name, Info->FileName, NameLen16 + 1);
+}
+
+STATIC EFI_STATUS ReadFileAt(HOST_FILE* f, UINT64 Offset, UINTN* BufferSize, VOID* Buffer)
+{
+	ssize_t r;
+	UINTN Done = 0;
+	UINTN Size = *BufferSize;
+	/* Short reads only apply to hashed content, since Parse() expects full reads */
+	if (gHost.MaxReadSize != 0 && Size > gHost.MaxReadSize && strstr(f->HostPath, "sum.") == NULL)
+		Size = gHost.MaxReadSize;
+	while (Done < Size) {
+		r = pread(f->Fd, (UINT8*)Buffer + Done, Size - Done, (off_t)(Offset + Done));
+		if (r < 0)
+			return ErrnoToStatus(errno);
+		if (r == 0)
+			break;
+		Done += (UINTN)r;
+	}
+	if (getenv("HOST_READ_SLEEP_US") != NULL)
+		usleep(strtoul(getenv("HOST_READ_SLEEP_US"), NULL, 0));
+	if (getenv("HOST_READ_LATENCY_US") != NULL) {
+		UINT64 End = HostNanoTime() + strtoull(getenv("HOST_READ_LATENCY_US"), NULL, 0) * 1000ULL;
+		while (HostNanoTime() < End);
+	}
+	if (Size > gHost.MaxRead && strstr(f->HostPath, "sum.") == NULL)
+		gHost.MaxRead = Size;
+	if (((UINTN)Buffer & 0xFFFF) != 0 && strstr(f->HostPath, "sum.") == NULL)
+		gHost.UnalignedReads++;
+	if (gHost.ReadDelayNsPerMB != 0) {
+		UINT64 End = HostNanoTime() + (gHost.ReadDelayNsPerMB * Done) / (1024 * 1024);
+		while (HostNanoTime() < End);
+	}
+	*BufferSize = Done;
+	gHost.BytesRead += Done;
+	gHost.FileReads++;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileRead(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, VOID* Buffer)
+{
+	HOST_FILE* f = (HOST_FILE*)This;
+	EFI_STATUS Status;
+	struct dirent* e;
+	struct stat st;
+	char Full[8192];
+	CHAR16 Tmp[512];
+	UINTN NameLen, Size;
+
+	if (f == NULL || BufferSize == NULL)
+		return EFI_INVALID_PARAMETER;
+	HostDispatchTimers();
+	if (!f->IsDir) {
+		Status = ReadFileAt(f, f->Position, BufferSize, Buffer);
+		if (!EFI_ERROR(Status))
+			f->Position += *BufferSize;
+		return Status;
+	}
+	do {
+		e = readdir(f->Dir);
+		if (e == NULL) {
+			*BufferSize = 0;
+			return EFI_SUCCESS;
+		}
+	} while (f->IsRoot && (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0));
+	snprintf(Full, sizeof(Full), "%s/%s", f->HostPath, e->d_name);
+	if (stat(Full, &st) != 0)
+		ZeroMem(&st, sizeof(st));
+	NameLen = Utf8ToUcs2Host(e->d_name, Tmp, ARRAY_SIZE_SHIM(Tmp));
+	Size = SIZE_OF_EFI_FILE_INFO + (NameLen + 1) * sizeof(CHAR16);
+	if (*BufferSize < Size) {
+		seekdir(f->Dir, telldir(f->Dir) - 1);
+		*BufferSize = Size;
+		return EFI_BUFFER_TOO_SMALL;
+	}
+	FillFileInfo(e->d_name, &st, (EFI_FILE_INFO*)Buffer, NameLen);
+	*BufferSize = Size;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileWrite(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, VOID* Buffer)
+{
+	HOST_FILE* f = (HOST_FILE*)This;
+	ssize_t r;
+	if (f == NULL || BufferSize == NULL || f->IsDir)
+		return EFI_UNSUPPORTED;
+	r = pwrite(f->Fd, Buffer, *BufferSize, (off_t)f->Position);
+	if (r < 0)
+		return ErrnoToStatus(errno);
+	*BufferSize = (UINTN)r;
+	f->Position += (UINT64)r;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileGetPosition(EFI_FILE_PROTOCOL* This, UINT64* Position)
+{
+	HOST_FILE* f = (HOST_FILE*)This;
+	if (f->IsDir)
+		return EFI_UNSUPPORTED;
+	*Position = f->Position;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileSetPosition(EFI_FILE_PROTOCOL* This, UINT64 Position)
+{
+	HOST_FILE* f = (HOST_FILE*)This;
+	struct stat st;
+	if (f->IsDir) {
+		if (Position != 0)
+			return EFI_UNSUPPORTED;
+		rewinddir(f->Dir);
+		return EFI_SUCCESS;
+	}
+	if (Position == 0xFFFFFFFFFFFFFFFFULL) {
+		fstat(f->Fd, &st);
+		Position = (UINT64)st.st_size;
+	}
+	f->Position = Position;
+	f->ReservedPosition = Position;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileGetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType,
+	UINTN* BufferSize, VOID* Buffer)
+{
+	HOST_FILE* f = (HOST_FILE*)This;
+	struct stat st;
+	struct statvfs vfs;
+	CHAR16 Tmp[512];
+	CONST char* Name;
+	UINTN NameLen, Size;
+
+	if (f == NULL || InformationType == NULL || BufferSize == NULL)
+		return EFI_INVALID_PARAMETER;
+	gHost.FileGetInfos++;
+	if (CompareGuid(InformationType, &gEfiFileInfoGuid)) {
+		if (stat(f->HostPath, &st) != 0)
+			return ErrnoToStatus(errno);
+		Name = f->IsRoot ? "" : strrchr(f->HostPath, '/') + 1;
+		NameLen = Utf8ToUcs2Host(Name, Tmp, ARRAY_SIZE_SHIM(Tmp));
+		Size = SIZE_OF_EFI_FILE_INFO + (NameLen + 1) * sizeof(CHAR16);
+		if (*BufferSize < Size) {
+			*BufferSize = Size;
+			return EFI_BUFFER_TOO_SMALL;
+		}
+		FillFileInfo(Name, &st, (EFI_FILE_INFO*)Buffer, NameLen);
+		*BufferSize = Size;
+		return EFI_SUCCESS;
+	}
+	if (CompareGuid(InformationType, &gEfiFileSystemInfoGuid)) {
+		EFI_FILE_SYSTEM_INFO* Info = (EFI_FILE_SYSTEM_INFO*)Buffer;
+		NameLen = Utf8ToUcs2Host(f->Volume->Label, Tmp, ARRAY_SIZE_SHIM(Tmp));
+		Size = SIZE_OF_EFI_FILE_SYSTEM_INFO + (NameLen + 1) * sizeof(CHAR16);
+		if (*BufferSize < Size) {
+			*BufferSize = Size;
+			return EFI_BUFFER_TOO_SMALL;
+		}
+		if (statvfs(f->Volume->RootPath, &vfs) != 0)
+			ZeroMem(&vfs, sizeof(vfs));
+		Info->Size = Size;
+		Info->ReadOnly = gHost.ReadOnly;
+		Info->VolumeSize = (UINT64)vfs.f_blocks * vfs.f_frsize;
+		Info->FreeSpace = (UINT64)vfs.f_bavail * vfs.f_frsize;
+		Info->BlockSize = (UINT32)vfs.f_bsize;
+		CopyMem(Info->VolumeLabel, Tmp, (NameLen + 1) * sizeof(CHAR16));
+		*BufferSize = Size;
+		return EFI_SUCCESS;
+	}
+	return EFI_UNSUPPORTED;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileSetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType,
+	UINTN BufferSize, VOID* Buffer)
+{
+	(void)This; (void)InformationType; (void)BufferSize; (void)Buffer;
+	return EFI_UNSUPPORTED;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileFlush(EFI_FILE_PROTOCOL* This)
+{
+	HOST_FILE* f = (HOST_FILE*)This;
+	if (f->Fd >= 0)
+		fsync(f->Fd);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileOpenEx(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle,
+	CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes, EFI_FILE_IO_TOKEN* Token)
+{
+	EFI_STATUS Status;
+	if (Token == NULL)
+		return EFI_INVALID_PARAMETER;
+	Status = HostFileOpen(This, NewHandle, FileName, OpenMode, Attributes);
+	if (Token->Event == NULL)
+		return Status;
+	Token->Status = Status;
+	HostSignalEvent(Token->Event);
+	return EFI_SUCCESS;
+}
+
+STATIC VOID* AsyncReadThread(VOID* Arg)
+{
+	HOST_ASYNC_READ* Req = (HOST_ASYNC_READ*)Arg;
+	UINTN Size = Req->Token->BufferSize;
+	Req->Token->Status = ReadFileAt(Req->File, Req->Offset, &Size, Req->Token->Buffer);
+	Req->Token->BufferSize = Size;
+	HostSignalEvent(Req->Token->Event);
+	free(Req);
+	return NULL;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileReadEx(EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token)
+{
+	HOST_FILE* f = (HOST_FILE*)This;
+	HOST_ASYNC_READ* Req;
+	pthread_t Thread;
+	struct stat st;
+	UINTN Size;
+
+	if (f == NULL || Token == NULL)
+		return EFI_INVALID_PARAMETER;
+	if (f->Proto.Revision < EFI_FILE_PROTOCOL_REVISION2)
+		return EFI_UNSUPPORTED;
+	/* Drivers that report revision 2 without really supporting it */
+	if (getenv("HOST_READEX") != NULL && strcmp(getenv("HOST_READEX"), "fail") == 0)
+		return EFI_DEVICE_ERROR;
+	if (f->IsDir || Token->Event == NULL) {
+		Size = Token->BufferSize;
+		Token->Status = HostFileRead(This, &Size, Token->Buffer);
+		Token->BufferSize = Size;
+		if (Token->Event != NULL)
+			HostSignalEvent(Token->Event);
+		return (Token->Event == NULL) ? Token->Status : EFI_SUCCESS;
+	}
+	/* Reserve the file region at submission time, as a queueing driver would */
+	fstat(f->Fd, &st);
+	if (f->Position > (UINT64)st.st_size)
+		f->Position = (UINT64)st.st_size;
+	Req = calloc(1, sizeof(*Req));
+	Req->File = f;
+	Req->Token = Token;
+	Req->Offset = f->Position;
+	Size = (UINTN)MIN_SHIM((UINT64)Token->BufferSize, (UINT64)st.st_size - f->Position);
+	if (gHost.MaxReadSize != 0 && Size > gHost.MaxReadSize)
+		Size = gHost.MaxReadSize;
+	Token->BufferSize = Size;
+	f->Position += Size;
+	gHost.AsyncReads++;
+	if (pthread_create(&Thread, NULL, AsyncReadThread, Req) != 0) {
+		AsyncReadThread(Req);
+		return EFI_SUCCESS;
+	}
+	pthread_detach(Thread);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileWriteEx(EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token)
+{
+	(void)This; (void)Token;
+	return EFI_UNSUPPORTED;
+}
+
+STATIC EFI_STATUS EFIAPI HostFileFlushEx(EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token)
+{
+	(void)This; (void)Token;
+	return EFI_UNSUPPORTED;
+}
+
+STATIC EFI_FILE_PROTOCOL FileTemplate = {
+	EFI_FILE_PROTOCOL_REVISION2, HostFileOpen, HostFileClose, HostFileDelete, HostFileRead,
+	HostFileWrite, HostFileGetPosition, HostFileSetPosition, HostFileGetInfo, HostFileSetInfo,
+	HostFileFlush, HostFileOpenEx, HostFileReadEx, HostFileWriteEx, HostFileFlushEx
+};
+
+STATIC EFI_STATUS EFIAPI HostOpenVolume(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* This, EFI_FILE_PROTOCOL** Root)
+{
+	HOST_VOLUME* Volume = (HOST_VOLUME*)This;
+	HOST_FILE* f;
+	f = NewHostFile(Volume, Volume->RootPath, TRUE);
+	if (f == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	f->IsDir = TRUE;
+	f->Dir = opendir(Volume->RootPath);
+	if (f->Dir == NULL) {
+		free(f->HostPath);
+		free(f);
+		return EFI_NOT_FOUND;
+	}
+	*Root = &f->Proto;
+	return EFI_SUCCESS;
+}
+
+
+/*
+ * Device paths and images
+ */
+typedef struct {
+	EFI_DEVICE_PATH_PROTOCOL  Header;
+	CHAR16                    PathName[1];
+} HOST_FILEPATH_DEVICE_PATH;
+
+EFI_DEVICE_PATH_PROTOCOL* FileDevicePath(EFI_HANDLE Device, CONST CHAR16* FileName)
+{
+	UINTN Size = sizeof(EFI_DEVICE_PATH_PROTOCOL) + StrSize(FileName);
+	UINT8* Buffer = AllocateZeroPool(Size + sizeof(EFI_DEVICE_PATH_PROTOCOL));
+	HOST_FILEPATH_DEVICE_PATH* Node = (HOST_FILEPATH_DEVICE_PATH*)Buffer;
+	EFI_DEVICE_PATH_PROTOCOL* End;
+	(void)Device;
+	if (Buffer == NULL)
+		return NULL;
+	Node->Header.Type = 0x04;
+	Node->Header.SubType = 0x04;
+	Node->Header.Length[0] = (UINT8)Size;
+	Node->Header.Length[1] = (UINT8)(Size >> 8);
+	CopyMem(Node->PathName, FileName, StrSize(FileName));
+	End = (EFI_DEVICE_PATH_PROTOCOL*)(Buffer + Size);
+	End->Type = 0x7F;
+	End->SubType = 0xFF;
+	End->Length[0] = sizeof(EFI_DEVICE_PATH_PROTOCOL);
+	return (EFI_DEVICE_PATH_PROTOCOL*)Buffer;
+}
+
+STATIC BOOLEAN LoadedImageValid = FALSE;
+
+STATIC EFI_STATUS EFIAPI HostLoadImage(BOOLEAN BootPolicy, EFI_HANDLE ParentImageHandle,
+	EFI_DEVICE_PATH_PROTOCOL* DevicePath, VOID* SourceBuffer, UINTN SourceSize, EFI_HANDLE* ImageHandle)
+{
+	HOST_FILEPATH_DEVICE_PATH* Node = (HOST_FILEPATH_DEVICE_PATH*)DevicePath;
+	EFI_FILE_PROTOCOL *Root, *File;
+	UINT8 Magic[2] = { 0 };
+	UINTN Size = sizeof(Magic);
+	EFI_STATUS Status;
+	(void)BootPolicy; (void)ParentImageHandle; (void)SourceBuffer; (void)SourceSize;
+
+	if (Node == NULL || ImageHandle == NULL)
+		return EFI_INVALID_PARAMETER;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Sfs;
+	UINT8 Data[4096];
+	UINTN Total = 0;
+	Status = HostHandleProtocol(gHost.DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Sfs);
+	if (EFI_ERROR(Status))
+		return Status;
+	Status = Sfs->OpenVolume(Sfs, &Root);
+	if (EFI_ERROR(Status))
+		return Status;
+	Status = Root->Open(Root, &File, Node->PathName, EFI_FILE_MODE_READ, 0);
+	Root->Close(Root);
+	if (EFI_ERROR(Status))
+		return Status;
+	/* Read the whole image, like the firmware does */
+	do {
+		Size = sizeof(Data);
+		Status = File->Read(File, &Size, Data);
+		if (Total == 0 && Size >= 2) { Magic[0] = Data[0]; Magic[1] = Data[1]; }
+		Total += Size;
+	} while (!EFI_ERROR(Status) && Size != 0);
+	File->Close(File);
+	if (EFI_ERROR(Status))
+		return Status;
+	if (Total < 2 || Magic[0] != 'M' || Magic[1] != 'Z')
+		return EFI_UNSUPPORTED;
+	LoadedImageValid = TRUE;
+	*ImageHandle = gHost.ImageHandle;
+	return EFI_SUCCESS;
+}
+
+/* HOST_LOADER_READS="path[@offset:len],..." : have the test bootloader read files through the volume's SFS */
+STATIC VOID HostLoaderReads(VOID)
+{
+	const char* spec = getenv("HOST_LOADER_READS");
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Sfs;
+	EFI_FILE_PROTOCOL *Root, *File;
+	static UINT8 Data[65536];
+	char buf[1024], *tok, *save, *at;
+	CHAR16 Path[512];
+	UINTN i, Size;
+	EFI_STATUS Status;
+	if (spec == NULL || EFI_ERROR(HostHandleProtocol(gHost.DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Sfs)))
+		return;
+	if (EFI_ERROR(Sfs->OpenVolume(Sfs, &Root)))
+		return;
+	snprintf(buf, sizeof(buf), "%s", spec);
+	for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+		unsigned long long off = 0, len = ~0ULL, done = 0;
+		at = strchr(tok, '@');
+		if (at != NULL) { *at = 0; off = strtoull(at + 1, &at, 0); if (*at == ':') len = strtoull(at + 1, NULL, 0); }
+		for (i = 0; tok[i] && i < 511; i++) Path[i] = tok[i];
+		Path[i] = 0;
+		Status = Root->Open(Root, &File, Path, EFI_FILE_MODE_READ, 0);
+		if (EFI_ERROR(Status)) { Print(L"loader: open %s: %r\n", Path, Status); continue; }
+		File->SetPosition(File, off);
+		do {
+			Size = (UINTN)((len - done) < sizeof(Data) ? (len - done) : sizeof(Data));
+			Status = File->Read(File, &Size, Data);
+			done += Size;
+		} while (!EFI_ERROR(Status) && Size != 0 && done < len);
+		Print(L"loader: read %s: %d bytes, %r\n", Path, (UINTN)done, Status);
+		File->Close(File);
+	}
+	Root->Close(Root);
+}
+
+STATIC EFI_STATUS EFIAPI HostStartImage(EFI_HANDLE ImageHandle, UINTN* ExitDataSize, CHAR16** ExitData)
+{
+	(void)ImageHandle; (void)ExitDataSize; (void)ExitData;
+	if (!LoadedImageValid)
+		return EFI_INVALID_PARAMETER;
+	if (gHost.OnStartImage != NULL)
+		gHost.OnStartImage();
+	Print(L"Test bootloader\n");
+	HostLoaderReads();
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostGetNextMonotonicCount(UINT64* Count)
+{
+	STATIC UINT64 Counter = 0;
+	*Count = Counter++;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostCalculateCrc32(VOID* Data, UINTN DataSize, UINT32* Crc32)
+{
+	UINT32 Crc = 0xFFFFFFFF, i, j;
+	for (i = 0; i < DataSize; i++) {
+		Crc ^= ((UINT8*)Data)[i];
+		for (j = 0; j < 8; j++)
+			Crc = (Crc >> 1) ^ (0xEDB88320 & (0 - (Crc & 1)));
+	}
+	*Crc32 = ~Crc;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostUnsupported(VOID)
+{
+	return EFI_UNSUPPORTED;
+}
+
+/*
+ * Runtime services
+ */
+NO_RETURN_SHIM STATIC VOID EFIAPI HostResetSystem(EFI_RESET_TYPE ResetType, EFI_STATUS ResetStatus,
+	UINTN DataSize, VOID* ResetData)
+{
+	(void)ResetStatus; (void)DataSize; (void)ResetData;
+	fflush(stdout);
+	if (gHost.OnExit != NULL)
+		gHost.OnExit();
+	exit(ResetType == EfiResetShutdown ? 0 : 3);
+}
+
+STATIC EFI_STATUS EFIAPI HostGetTime(EFI_TIME* Time, EFI_TIME_CAPABILITIES* Capabilities)
+{
+	struct timespec ts;
+	struct tm tm;
+	if (Time == NULL)
+		return EFI_INVALID_PARAMETER;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += (time_t)gHost.TimeOffset;
+	gmtime_r(&ts.tv_sec, &tm);
+	ZeroMem(Time, sizeof(*Time));
+	Time->Year = (UINT16)(tm.tm_year + 1900);
+	Time->Month = (UINT8)(tm.tm_mon + 1);
+	Time->Day = (UINT8)tm.tm_mday;
+	Time->Hour = (UINT8)tm.tm_hour;
+	Time->Minute = (UINT8)tm.tm_min;
+	Time->Second = (UINT8)tm.tm_sec;
+	Time->Nanosecond = (UINT32)ts.tv_nsec;
+	Time->TimeZone = 0x07FF;
+	if (Capabilities != NULL) {
+		Capabilities->Resolution = 1;
+		Capabilities->Accuracy = 50000000;
+		Capabilities->SetsToZero = FALSE;
+	}
+	return EFI_SUCCESS;
+}
+
+STATIC VOID VariablePath(CONST CHAR16* Name, CONST EFI_GUID* Guid, char* Out, size_t OutSize)
+{
+	char Name8[512];
+	HostUcs2ToUtf8(Name, Name8, sizeof(Name8));
+	snprintf(Out, OutSize, "%s/%s-%08x-%04x-%04x", gHost.NvramPath, Name8, Guid->Data1, Guid->Data2, Guid->Data3);
+}
+
+STATIC EFI_STATUS EFIAPI HostGetVariable(CHAR16* VariableName, EFI_GUID* VendorGuid, UINT32* Attributes,
+	UINTN* DataSize, VOID* Data)
+{
+	char Path[4096];
+	struct stat st;
+	FILE* fd;
+	if (VariableName == NULL || VendorGuid == NULL || DataSize == NULL)
+		return EFI_INVALID_PARAMETER;
+	if (gHost.NvramPath == NULL)
+		return EFI_NOT_FOUND;
+	VariablePath(VariableName, VendorGuid, Path, sizeof(Path));
+	if (stat(Path, &st) != 0)
+		return EFI_NOT_FOUND;
+	if (*DataSize < (UINTN)st.st_size) {
+		*DataSize = (UINTN)st.st_size;
+		return EFI_BUFFER_TOO_SMALL;
+	}
+	fd = fopen(Path, "rb");
+	if (fd == NULL)
+		return EFI_DEVICE_ERROR;
+	*DataSize = fread(Data, 1, (size_t)st.st_size, fd);
+	fclose(fd);
+	if (Attributes != NULL)
+		*Attributes = EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostSetVariable(CHAR16* VariableName, EFI_GUID* VendorGuid, UINT32 Attributes,
+	UINTN DataSize, VOID* Data)
+{
+	char Path[4096];
+	FILE* fd;
+	(void)Attributes;
+	if (VariableName == NULL || VendorGuid == NULL)
+		return EFI_INVALID_PARAMETER;
+	/* Without a store, behave like a firmware whose variables are reset on every boot */
+	if (gHost.NvramPath == NULL)
+		return EFI_SUCCESS;
+	mkdir(gHost.NvramPath, 0755);
+	VariablePath(VariableName, VendorGuid, Path, sizeof(Path));
+	if (DataSize == 0) {
+		return (unlink(Path) == 0) ? EFI_SUCCESS : EFI_NOT_FOUND;
+	}
+	fd = fopen(Path, "wb");
+	if (fd == NULL)
+		return EFI_DEVICE_ERROR;
+	fwrite(Data, 1, DataSize, fd);
+	fclose(fd);
+	return EFI_SUCCESS;
+}
+
+/*
+ * Tables
+ */
+STATIC EFI_BOOT_SERVICES BootServices;
+STATIC EFI_RUNTIME_SERVICES RuntimeServices;
+STATIC EFI_SYSTEM_TABLE SystemTable;
+STATIC EFI_CONFIGURATION_TABLE ConfigurationTable[4];
+STATIC EFI_LOADED_IMAGE_PROTOCOL LoadedImage;
+STATIC SMBIOS_TABLE_3_0_ENTRY_POINT Smbios3Entry;
+STATIC UINT8 SmbiosData[256];
+
+STATIC VOID SetupSmbios(CONST char* Vendor)
+{
+	SMBIOS_TABLE_TYPE0* Type0 = (SMBIOS_TABLE_TYPE0*)SmbiosData;
+	UINTN Offset;
+
+	ZeroMem(SmbiosData, sizeof(SmbiosData));
+	Type0->Hdr.Type = 0;
+	Type0->Hdr.Length = sizeof(SMBIOS_TABLE_TYPE0);
+	Type0->Vendor = 1;
+	Type0->BiosVersion = 2;
+	Offset = sizeof(SMBIOS_TABLE_TYPE0);
+	strcpy((char*)&SmbiosData[Offset], Vendor);
+	Offset += strlen(Vendor) + 1;
+	strcpy((char*)&SmbiosData[Offset], "v1.0");
+	Offset += strlen("v1.0") + 2;
+	/* End of table structure */
+	SmbiosData[Offset] = 0x7F;
+	SmbiosData[Offset + 1] = 4;
+	Offset += 6;
+
+	memcpy(Smbios3Entry.AnchorString, "_SM3_", 5);
+	Smbios3Entry.TableAddress = (UINT64)(UINTN)SmbiosData;
+	Smbios3Entry.TableMaximumSize = (UINT32)Offset;
+	ConfigurationTable[SystemTable.NumberOfTableEntries].VendorGuid = gEfiSmbios3TableGuid;
+	ConfigurationTable[SystemTable.NumberOfTableEntries++].VendorTable = &Smbios3Entry;
+}
+
+VOID HostSetup(VOID)
+{
+	VOID** p;
+	UINTN i;
+
+	gHost.MainThread = pthread_self();
+	if (gHost.Cols == 0)
+		gHost.Cols = 80;
+	if (gHost.Rows == 0)
+		gHost.Rows = 25;
+	if (gHost.FileRevision == 0)
+		gHost.FileRevision = EFI_FILE_PROTOCOL_REVISION2;
+	if (gHost.MemoryMB == 0)
+		gHost.MemoryMB = 2048;
+	/* The label of the volumes of QEMU's VVFAT driver, which the tests use */
+	if (gHost.VolumeLabel == NULL)
+		gHost.VolumeLabel = "QEMU VVFAT";
+
+	/* Anything we don't explicitly implement returns EFI_UNSUPPORTED */
+	for (p = (VOID**)&BootServices.RaiseTPL; p <= (VOID**)&BootServices.CreateEventEx; p++)
+		*p = (VOID*)HostUnsupported;
+	for (p = (VOID**)&RuntimeServices.GetTime; p <= (VOID**)&RuntimeServices.QueryVariableInfo; p++)
+		*p = (VOID*)HostUnsupported;
+
+	BootServices.RaiseTPL = HostRaiseTPL;
+	BootServices.RestoreTPL = HostRestoreTPL;
+	BootServices.AllocatePages = HostAllocatePages;
+	BootServices.FreePages = HostFreePages;
+	BootServices.GetMemoryMap = HostGetMemoryMap;
+	BootServices.AllocatePool = HostAllocatePool;
+	BootServices.FreePool = HostFreePool;
+	BootServices.CreateEvent = HostCreateEvent;
+	BootServices.CreateEventEx = HostCreateEventEx;
+	BootServices.SetTimer = HostSetTimer;
+	BootServices.WaitForEvent = HostWaitForEvent;
+	BootServices.SignalEvent = HostSignalEvent;
+	BootServices.CloseEvent = HostCloseEvent;
+	BootServices.CheckEvent = HostCheckEvent;
+	BootServices.InstallProtocolInterface = HostInstallProtocolInterface;
+	BootServices.ReinstallProtocolInterface = HostReinstallProtocolInterface;
+	BootServices.UninstallProtocolInterface = HostUninstallProtocolInterface;
+	BootServices.HandleProtocol = HostHandleProtocol;
+	BootServices.LoadImage = HostLoadImage;
+	BootServices.StartImage = HostStartImage;
+	BootServices.GetNextMonotonicCount = HostGetNextMonotonicCount;
+	BootServices.Stall = HostStall;
+	BootServices.SetWatchdogTimer = HostSetWatchdogTimer;
+	BootServices.OpenProtocol = HostOpenProtocol;
+	BootServices.CloseProtocol = HostCloseProtocol;
+	BootServices.OpenProtocolInformation = HostOpenProtocolInformation;
+	BootServices.LocateHandleBuffer = HostLocateHandleBuffer;
+	BootServices.LocateProtocol = HostLocateProtocol;
+	BootServices.CalculateCrc32 = HostCalculateCrc32;
+
+	RuntimeServices.GetTime = HostGetTime;
+	RuntimeServices.GetVariable = HostGetVariable;
+	RuntimeServices.SetVariable = HostSetVariable;
+	RuntimeServices.ResetSystem = HostResetSystem;
+
+	SystemTable.Hdr.Revision = gHost.FirmwareRevision != 0 ? gHost.FirmwareRevision : ((2 << 16) | 70);
+	SystemTable.FirmwareVendor = gHost.FirmwareVendor != NULL ? gHost.FirmwareVendor : L"uefi-md5sum host shim";
+	SystemTable.ConIn = &ConIn;
+	SystemTable.ConOut = &ConOut;
+	SystemTable.StdErr = &ConOut;
+	SystemTable.BootServices = &BootServices;
+	SystemTable.RuntimeServices = &RuntimeServices;
+	SystemTable.ConfigurationTable = ConfigurationTable;
+	SystemTable.NumberOfTableEntries = 0;
+	SetupSmbios(gHost.TestMode ? "GitHub Actions Test" : "Host");
+
+	gST = &SystemTable;
+	gBS = &BootServices;
+	gRT = &RuntimeServices;
+
+	for (i = 0; i < MAX_HANDLES; i++)
+		Handles[i].Used = FALSE;
+	gHost.ImageHandle = HostNewHandle();
+	gHost.DeviceHandle = HostNewHandle();
+	LoadedImage.DeviceHandle = gHost.DeviceHandle;
+	LoadedImage.SystemTable = &SystemTable;
+	HostInstallProtocol(gHost.ImageHandle, &gEfiLoadedImageProtocolGuid, &LoadedImage);
+	for (i = 0; i <= gHost.NumExtraVolumes; i++) {
+		Volumes[i].Proto.Revision = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION;
+		Volumes[i].Proto.OpenVolume = HostOpenVolume;
+		Volumes[i].RootPath = (i == 0) ? gHost.RootPath : gHost.ExtraRootPath[i - 1];
+		Volumes[i].Label = (i == 0) ? gHost.VolumeLabel : gHost.ExtraLabel[i - 1];
+		/* Extra volumes come after the boot one, as a second drive would */
+		HostInstallProtocol((i == 0) ? gHost.DeviceHandle : HostNewHandle(),
+			&gEfiSimpleFileSystemProtocolGuid, &Volumes[i].Proto);
+	}
+	HostSetupDisk(gHost.DeviceHandle);
+	HostSetupMp();
+	HostSetupHash2();
+}
+
+EFI_SYSTEM_TABLE* HostSystemTable(VOID)
+{
+	return &SystemTable;
+}
@@ -0,0 +1,76 @@
+/*
+ * uefi-md5sum: Host build shim - Host configuration and helpers
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <pthread.h>
+#include <Uefi.h>
+#include <IndustryStandard/SmBios.h>
+
+#define MIN_SHIM(a, b)             (((a) < (b)) ? (a) : (b))
+#define ARRAY_SIZE_SHIM(a)         (sizeof(a) / sizeof((a)[0]))
+#define NO_RETURN_SHIM             __attribute__((noreturn))
+#define EFI_WARN_DELETE_FAILURE_SHIM ENCODE_WARNING(2)
+#define HOST_EXTRA_VOLUMES_MAX     4
+
+typedef struct {
+	const char*  RootPath;
+	const char*  NvramPath;
+	const char*  VolumeLabel;
+	const char*  ExtraRootPath[HOST_EXTRA_VOLUMES_MAX];  /* Directories of the volumes besides RootPath */
+	const char*  ExtraLabel[HOST_EXTRA_VOLUMES_MAX];
+	UINTN        NumExtraVolumes;
+	const char*  DiskType;        /* fat16|fat32|exfat[:frag][:sync] image of RootPath, or NULL */
+	const char*  Hash2Mode;       /* fast|slow|bad|fail|stall EFI_HASH2_PROTOCOL, or NULL */
+	UINT32       IoAlign;         /* IoAlign of the BlockIo media */
+	BOOLEAN      TestMode;
+	BOOLEAN      ReadOnly;
+	BOOLEAN      KeyPending;
+	UINTN        KeyAfterChecks;
+	UINTN        Cols, Rows;
+	UINTN        NumCpus;
+	UINT64       FileRevision;
+	UINT64       MemoryMB;
+	UINTN        MaxReadSize;
+	UINT64       ReadDelayNsPerMB;
+	INT64        TimeOffset;
+	UINT64       HiddenNs;
+	UINT32       FirmwareRevision;
+	CHAR16*      FirmwareVendor;
+	pthread_t    MainThread;
+	EFI_HANDLE   ImageHandle, DeviceHandle;
+	VOID         (*OnStartImage)(VOID);
+	VOID         (*OnExit)(VOID);
+	/* Statistics */
+	UINT64       BytesRead, FileReads, AsyncReads, FileOpens, FileGetInfos;
+	UINT64       ConsoleChars, ConsoleCalls, WatchdogResets, StallTime;
+	UINT64       MaxRead, UnalignedReads, DiskReads, DiskAsyncReads, DiskBytes;
+	UINT64       Hash2Calls, Hash2Children, Hash2Bytes;
+} HOST_CONFIG;
+
+extern HOST_CONFIG gHost;
+
+UINT64 HostNanoTime(VOID);
+VOID HostDispatchTimers(VOID);
+EFI_HANDLE HostNewHandle(VOID);
+EFI_STATUS HostInstallProtocol(EFI_HANDLE Handle, CONST EFI_GUID* Guid, VOID* Interface);
+UINTN HostUcs2ToUtf8(CONST CHAR16* Src, char* Dst, UINTN DstSize);
+VOID HostSetup(VOID);
+VOID HostSetupDisk(EFI_HANDLE Handle);
+VOID HostSetupMp(VOID);
+VOID HostSetupHash2(VOID);
+EFI_SYSTEM_TABLE* HostSystemTable(VOID);
@@ -0,0 +1,152 @@
+/*
+ * uefi-md5sum: Host build shim - BlockIo/DiskIo/DiskIo2 emulation
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * When gHost.DiskType is set, the root directory is also exposed as a disk,
+ * through a FAT16, FAT32 or exFAT image of it that mkimg.py (from the same
+ * directory as the executable, unless HOST_MKIMG says otherwise) generates,
+ * so that the raw reader and the partition verification can be exercised.
+ * Asynchronous reads complete from their own thread, after an optional
+ * HOST_READ_LATENCY_US delay.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+typedef struct {
+	UINT64               Offset;
+	UINTN                Size;
+	VOID*                Buffer;
+	EFI_DISK_IO2_TOKEN*  Token;
+} HOST_DISK_READ;
+
+STATIC EFI_BLOCK_IO_MEDIA Media;
+STATIC EFI_BLOCK_IO_PROTOCOL BlockIo;
+STATIC EFI_DISK_IO_PROTOCOL DiskIo;
+STATIC EFI_DISK_IO2_PROTOCOL DiskIo2;
+STATIC int DiskFd = -1;
+
+STATIC EFI_STATUS EFIAPI HostReadDisk(EFI_DISK_IO_PROTOCOL* This, UINT32 MediaId, UINT64 Offset,
+	UINTN Size, VOID* Buffer)
+{
+	if (MediaId != Media.MediaId)
+		return EFI_MEDIA_CHANGED;
+	__sync_fetch_and_add(&gHost.DiskReads, 1);
+	__sync_fetch_and_add(&gHost.DiskBytes, Size);
+	return (pread(DiskFd, Buffer, Size, Offset) == (ssize_t)Size) ? EFI_SUCCESS : EFI_DEVICE_ERROR;
+}
+
+STATIC VOID* DiskReadThread(VOID* Arg)
+{
+	HOST_DISK_READ* Read = Arg;
+
+	if (getenv("HOST_READ_LATENCY_US") != NULL)
+		usleep(strtoul(getenv("HOST_READ_LATENCY_US"), NULL, 0));
+	Read->Token->TransactionStatus = HostReadDisk(&DiskIo, Media.MediaId, Read->Offset, Read->Size, Read->Buffer);
+	HostSystemTable()->BootServices->SignalEvent(Read->Token->Event);
+	free(Read);
+	return NULL;
+}
+
+STATIC EFI_STATUS EFIAPI HostReadDiskEx(EFI_DISK_IO2_PROTOCOL* This, UINT32 MediaId, UINT64 Offset,
+	EFI_DISK_IO2_TOKEN* Token, UINTN Size, VOID* Buffer)
+{
+	pthread_t Thread;
+	HOST_DISK_READ* Read;
+
+	if (Token == NULL || Token->Event == NULL)
+		return HostReadDisk(&DiskIo, MediaId, Offset, Size, Buffer);
+	Read = calloc(1, sizeof(HOST_DISK_READ));
+	if (Read == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	__sync_fetch_and_add(&gHost.DiskAsyncReads, 1);
+	Read->Offset = Offset;
+	Read->Size = Size;
+	Read->Buffer = Buffer;
+	Read->Token = Token;
+	pthread_create(&Thread, NULL, DiskReadThread, Read);
+	pthread_detach(Thread);
+	return EFI_SUCCESS;
+}
+
+/*
+ * Generate the image of the root directory, and return a descriptor to it.
+ */
+STATIC int CreateDiskImage(VOID)
+{
+	char Cmd[2 * PATH_MAX + 64], Exe[PATH_MAX], Image[PATH_MAX];
+	const char *MkImg = getenv("HOST_MKIMG"), *TmpDir = getenv("TMPDIR");
+	ssize_t Len;
+	int Fd;
+
+	if (MkImg == NULL) {
+		Len = readlink("/proc/self/exe", Exe, sizeof(Exe) - sizeof("/mkimg.py"));
+		if (Len <= 0)
+			return -1;
+		Exe[Len] = '\0';
+		strcat(dirname(Exe), "/mkimg.py");
+		MkImg = Exe;
+	}
+	snprintf(Image, sizeof(Image), "%s/md5sum_host_XXXXXX", (TmpDir != NULL) ? TmpDir : "/tmp");
+	Fd = mkstemp(Image);
+	if (Fd < 0)
+		return -1;
+	snprintf(Cmd, sizeof(Cmd), "python3 '%s' %.5s '%s' '%s' %s", MkImg, gHost.DiskType, gHost.RootPath,
+		Image, (strstr(gHost.DiskType, "frag") != NULL) ? "1" : "0");
+	if (system(Cmd) != 0) {
+		close(Fd);
+		Fd = -1;
+	}
+	unlink(Image);
+	return Fd;
+}
+
+VOID HostSetupDisk(EFI_HANDLE Handle)
+{
+	if (gHost.IoAlign == 0 && gHost.DiskType == NULL)
+		return;
+	Media.IoAlign = gHost.IoAlign;
+	Media.BlockSize = 512;
+	Media.MediaId = 0x1234;
+	BlockIo.Media = &Media;
+	HostInstallProtocol(Handle, &gEfiBlockIoProtocolGuid, &BlockIo);
+	if (gHost.DiskType == NULL)
+		return;
+
+	DiskFd = CreateDiskImage();
+	if (DiskFd < 0) {
+		fprintf(stderr, "Could not create the %s image of %s\n", gHost.DiskType, gHost.RootPath);
+		exit(1);
+	}
+	Media.LastBlock = lseek(DiskFd, 0, SEEK_END) / Media.BlockSize - 1;
+	DiskIo.ReadDisk = HostReadDisk;
+	HostInstallProtocol(Handle, &gEfiDiskIoProtocolGuid, &DiskIo);
+	if (strstr(gHost.DiskType, "sync") == NULL) {
+		DiskIo2.ReadDiskEx = HostReadDiskEx;
+		HostInstallProtocol(Handle, &gEfiDiskIo2ProtocolGuid, &DiskIo2);
+	}
+}
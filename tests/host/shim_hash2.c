@@ -0,0 +1,147 @@
+/*
+ * uefi-md5sum: Host build shim - EFI_HASH2_PROTOCOL emulation
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Modes (-H): fast = firmware time is hidden from the timers, slow = firmware
+ * is 4x slower than the built-in code, bad = wrong hashes, fail = HashUpdate()
+ * fails after 8 calls past calibration, stall = a single HashUpdate() takes
+ * longer than the whole calibration.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "boot.h"
+#include "shim.h"
+
+EFI_GUID gEfiHash2ServiceBindingProtocolGuid = EFI_HASH2_SERVICE_BINDING_PROTOCOL_GUID;
+EFI_GUID gEfiHash2ProtocolGuid = EFI_HASH2_PROTOCOL_GUID;
+EFI_GUID gEfiHashAlgorithmMD5Guid = EFI_HASH_ALGORITHM_MD5_GUID;
+EFI_GUID gEfiHashAlgorithmSha256Guid = EFI_HASH_ALGORITHM_SHA256_GUID;
+
+typedef struct {
+	EFI_HASH2_PROTOCOL Protocol;
+	EFI_HANDLE Handle;
+	CONST HASH_ALGORITHM* Algorithm;
+	HASH_CONTEXT Context;
+	BOOLEAN Started;
+} HOST_HASH2;
+
+STATIC CONST HASH_ALGORITHM* FindAlgorithm(CONST EFI_GUID* Guid)
+{
+	if (Guid == NULL)
+		return NULL;
+	if (memcmp(Guid, &gEfiHashAlgorithmMD5Guid, sizeof(EFI_GUID)) == 0)
+		return &gHashAlgorithm[HASH_TYPE_MD5];
+	if (memcmp(Guid, &gEfiHashAlgorithmSha256Guid, sizeof(EFI_GUID)) == 0)
+		return &gHashAlgorithm[HASH_TYPE_SHA256];
+	return NULL;
+}
+
+STATIC EFI_STATUS EFIAPI GetHashSize(CONST EFI_HASH2_PROTOCOL* This, CONST EFI_GUID* Guid, UINTN* Size)
+{
+	CONST HASH_ALGORITHM* a = FindAlgorithm(Guid);
+	if (a == NULL)
+		return EFI_UNSUPPORTED;
+	*Size = a->HashSize;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HashInit(CONST EFI_HASH2_PROTOCOL* This, CONST EFI_GUID* Guid)
+{
+	HOST_HASH2* h = (HOST_HASH2*)This;
+	if (!pthread_equal(pthread_self(), gHost.MainThread))
+		return EFI_DEVICE_ERROR;
+	if (h->Started)
+		return EFI_ALREADY_STARTED;
+	h->Algorithm = FindAlgorithm(Guid);
+	if (h->Algorithm == NULL)
+		return EFI_UNSUPPORTED;
+	h->Algorithm->Init(&h->Context);
+	h->Started = TRUE;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HashUpdate(CONST EFI_HASH2_PROTOCOL* This, CONST UINT8* Message, UINTN Size)
+{
+	HOST_HASH2* h = (HOST_HASH2*)This;
+	UINT64 Start = HostNanoTime(), Elapsed;
+	int i;
+	if (!h->Started)
+		return EFI_NOT_READY;
+	gHost.Hash2Calls++;
+	if (strcmp(gHost.Hash2Mode, "fail") == 0 && gHost.Hash2Calls > 60)
+		return EFI_DEVICE_ERROR;
+	h->Algorithm->Write(&h->Context, Message, Size);
+	gHost.Hash2Bytes += Size;
+	if (strcmp(gHost.Hash2Mode, "slow") == 0) {
+		HASH_CONTEXT Dummy;
+		for (i = 0; i < 3; i++) {
+			h->Algorithm->Init(&Dummy);
+			h->Algorithm->Write(&Dummy, Message, Size);
+		}
+	}
+	if (strcmp(gHost.Hash2Mode, "stall") == 0)
+		usleep(2 * HASH2_CALIBRATION_TIME * 1000);
+	Elapsed = HostNanoTime() - Start;
+	if (strcmp(gHost.Hash2Mode, "fast") == 0 || strcmp(gHost.Hash2Mode, "fail") == 0 || strcmp(gHost.Hash2Mode, "bad") == 0)
+		gHost.HiddenNs += Elapsed * 3 / 4;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HashFinal(CONST EFI_HASH2_PROTOCOL* This, EFI_HASH2_OUTPUT* Hash)
+{
+	HOST_HASH2* h = (HOST_HASH2*)This;
+	if (!h->Started)
+		return EFI_NOT_READY;
+	h->Started = FALSE;
+	h->Algorithm->Final(&h->Context);
+	memcpy(Hash, h->Context.Buffer, h->Algorithm->HashSize);
+	if (strcmp(gHost.Hash2Mode, "bad") == 0)
+		Hash->Sha256Hash[0] ^= 1;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI CreateChild(EFI_SERVICE_BINDING_PROTOCOL* This, EFI_HANDLE* Child)
+{
+	HOST_HASH2* h = calloc(1, sizeof(HOST_HASH2));
+	h->Protocol.GetHashSize = GetHashSize;
+	h->Protocol.HashInit = HashInit;
+	h->Protocol.HashUpdate = HashUpdate;
+	h->Protocol.HashFinal = HashFinal;
+	h->Handle = HostNewHandle();
+	HostInstallProtocol(h->Handle, &gEfiHash2ProtocolGuid, h);
+	*Child = h->Handle;
+	gHost.Hash2Children++;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI DestroyChild(EFI_SERVICE_BINDING_PROTOCOL* This, EFI_HANDLE Child)
+{
+	gHost.Hash2Children--;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_SERVICE_BINDING_PROTOCOL Binding = { CreateChild, DestroyChild };
+
+VOID HostSetupHash2(VOID)
+{
+	if (gHost.Hash2Mode == NULL)
+		return;
+	HostInstallProtocol(HostNewHandle(), &gEfiHash2ServiceBindingProtocolGuid, &Binding);
+}
@@ -0,0 +1,149 @@
+/*
+ * uefi-md5sum: Host build shim - MP Services emulation over pthreads
+ * Copyright © 2024 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "shim.h"
+#include <Protocol/MpService.h>
+
+EFI_GUID gEfiMpServiceProtocolGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
+
+typedef struct {
+	EFI_AP_PROCEDURE  Procedure;
+	VOID*             Argument;
+	EFI_EVENT         Event;
+	BOOLEAN*          Finished;
+	volatile int      Busy;
+} HOST_AP;
+
+STATIC HOST_AP* Aps = NULL;
+STATIC __thread UINTN CurrentProcessor = 0;
+
+STATIC EFI_STATUS EFIAPI MpGetNumberOfProcessors(EFI_MP_SERVICES_PROTOCOL* This, UINTN* Num, UINTN* NumEnabled)
+{
+	if (!pthread_equal(pthread_self(), gHost.MainThread))
+		return EFI_DEVICE_ERROR;
+	*Num = gHost.NumCpus;
+	*NumEnabled = gHost.NumCpus;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI MpGetProcessorInfo(EFI_MP_SERVICES_PROTOCOL* This, UINTN ProcessorNumber, EFI_PROCESSOR_INFORMATION* Info)
+{
+	if (ProcessorNumber >= gHost.NumCpus || Info == NULL)
+		return EFI_NOT_FOUND;
+	ZeroMem(Info, sizeof(*Info));
+	Info->ProcessorId = ProcessorNumber;
+	Info->StatusFlag = PROCESSOR_ENABLED_BIT | PROCESSOR_HEALTH_STATUS_BIT | ((ProcessorNumber == 0) ? PROCESSOR_AS_BSP_BIT : 0);
+	Info->Location.Core = (UINT32)ProcessorNumber;
+	return EFI_SUCCESS;
+}
+
+STATIC VOID* ApThread(VOID* Arg)
+{
+	HOST_AP* Ap = (HOST_AP*)Arg;
+	CurrentProcessor = (UINTN)(Ap - Aps);
+	Ap->Procedure(Ap->Argument);
+	if (Ap->Finished != NULL)
+		*Ap->Finished = TRUE;
+	__atomic_store_n(&Ap->Busy, 0, __ATOMIC_SEQ_CST);
+	if (Ap->Event != NULL)
+		gBS->SignalEvent(Ap->Event);
+	return NULL;
+}
+
+STATIC EFI_STATUS EFIAPI MpStartupThisAP(EFI_MP_SERVICES_PROTOCOL* This, EFI_AP_PROCEDURE Procedure,
+	UINTN ProcessorNumber, EFI_EVENT WaitEvent, UINTN Timeout, VOID* Argument, BOOLEAN* Finished)
+{
+	HOST_AP* Ap;
+	pthread_t Thread;
+	if (!pthread_equal(pthread_self(), gHost.MainThread))
+		return EFI_DEVICE_ERROR;
+	if (ProcessorNumber == 0)
+		return EFI_INVALID_PARAMETER;
+	if (ProcessorNumber >= gHost.NumCpus || Procedure == NULL)
+		return EFI_NOT_FOUND;
+	Ap = &Aps[ProcessorNumber];
+	if (Ap->Busy)
+		return EFI_NOT_READY;
+	Ap->Procedure = Procedure;
+	Ap->Argument = Argument;
+	Ap->Event = WaitEvent;
+	Ap->Finished = Finished;
+	if (Finished != NULL)
+		*Finished = FALSE;
+	Ap->Busy = 1;
+	if (pthread_create(&Thread, NULL, ApThread, Ap) != 0) {
+		Ap->Busy = 0;
+		return EFI_DEVICE_ERROR;
+	}
+	if (WaitEvent != NULL) {
+		pthread_detach(Thread);
+		return EFI_SUCCESS;
+	}
+	pthread_join(Thread, NULL);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI MpStartupAllAPs(EFI_MP_SERVICES_PROTOCOL* This, EFI_AP_PROCEDURE Procedure,
+	BOOLEAN SingleThread, EFI_EVENT WaitEvent, UINTN Timeout, VOID* Argument, UINTN** FailedCpuList)
+{
+	UINTN i;
+	EFI_STATUS Status;
+	if (WaitEvent != NULL)
+		return EFI_UNSUPPORTED;
+	if (gHost.NumCpus <= 1)
+		return EFI_NOT_STARTED;
+	for (i = 1; i < gHost.NumCpus; i++) {
+		Status = MpStartupThisAP(This, Procedure, i, NULL, Timeout, Argument, NULL);
+		if (EFI_ERROR(Status))
+			return Status;
+	}
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI MpSwitchBSP(EFI_MP_SERVICES_PROTOCOL* This, UINTN ProcessorNumber, BOOLEAN EnableOldBSP)
+{
+	return EFI_UNSUPPORTED;
+}
+
+STATIC EFI_STATUS EFIAPI MpEnableDisableAP(EFI_MP_SERVICES_PROTOCOL* This, UINTN ProcessorNumber, BOOLEAN EnableAP, UINT32* HealthFlag)
+{
+	return EFI_UNSUPPORTED;
+}
+
+STATIC EFI_STATUS EFIAPI MpWhoAmI(EFI_MP_SERVICES_PROTOCOL* This, UINTN* ProcessorNumber)
+{
+	*ProcessorNumber = CurrentProcessor;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_MP_SERVICES_PROTOCOL MpServices = {
+	MpGetNumberOfProcessors, MpGetProcessorInfo, MpStartupAllAPs, MpStartupThisAP,
+	MpSwitchBSP, MpEnableDisableAP, MpWhoAmI
+};
+
+VOID HostSetupMp(VOID)
+{
+	EFI_HANDLE Handle;
+	if (gHost.NumCpus == 0)
+		return;
+	Aps = calloc(gHost.NumCpus, sizeof(HOST_AP));
+	Handle = HostNewHandle();
+	HostInstallProtocol(Handle, &gEfiMpServiceProtocolGuid, &MpServices);
+}
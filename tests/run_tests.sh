@@ -17,12 +17,54 @@ MAX_TEST="${2:-999}"
 NUM_PASS=0
 NUM_FAIL=0
 NUM_ERROR=0
+# The timing data of each test is logged there, one line per test, as
+# 'test=### wall_ms=# files=# bytes=# parse_us=# verify_us=# total_us=# name=...',
+# where bytes is 0 if the hash list doesn't provide md5sum_totalbytes
+PERF_LOG="${PERF_LOG:-./perf.log}"
+# Percentage to apply to the budgets of the tests, for slower or faster systems,
+# or 0 to only log the timing data
+PERF_BUDGET_PERCENT="${PERF_BUDGET_PERCENT:-100}"
+# Optional perf.log of a previous run on the same system, whose values replace
+# the budgets that the tests set
+PERF_BASELINE="${PERF_BASELINE:-}"
 
 if [[ -z "$QEMU_CMD" ]]; then
   echo '$QEMU_CMD is not set'
   exit 1
 fi
 
+# A setup script can set 'budget_<key>' to the maximum value of any of the
+# 'key=value' timing data (including 'wall_ms'), in which case a test that
+# exceeds it fails. With PERF_BASELINE, the budget is the value that the
+# baseline recorded for the test instead, if any. Print the data that exceed
+# their budget, if any.
+check_budgets() {
+  local data key value budget baseline=""
+  if [[ $PERF_BUDGET_PERCENT -eq 0 ]]; then
+    return
+  fi
+  if [[ -f "$PERF_BASELINE" ]]; then
+    baseline=" $(grep -aF " name=$2" "$PERF_BASELINE" | head -n 1) "
+  fi
+  for data in $1; do
+    key=${data%%=*}
+    value=${data#*=}
+    budget="budget_$key"
+    budget=${!budget}
+    if [[ -n "$budget" && "$baseline" =~ " $key="([0-9]+)" " ]]; then
+      budget=${BASH_REMATCH[1]}
+    fi
+    if [[ -n "$budget" ]]; then
+      budget=$((budget * PERF_BUDGET_PERCENT / 100))
+      if [[ $value -gt $budget ]]; then
+        echo -n "$key = $value > $budget "
+      fi
+    fi
+  done
+}
+
+rm -f "$PERF_LOG"
+
 for t in $TEST_DIR/*.dat; do
 
   base=$(basename "${t%.dat}")
@@ -52,7 +94,9 @@ for t in $TEST_DIR/*.dat; do
     break
   fi
 
-  # Run pre test script if required
+  # Run pre test script if required. It may also set the budgets of the
+  # test, as well as a test_timeout, for the tests that take longer.
+  unset test_timeout ${!budget_@}
   if [[ -x "$TEST_DIR/$test_number setup.sh" ]]; then
     . "$TEST_DIR/$test_number setup.sh"  > /dev/null 2>&1
   fi
@@ -65,9 +109,25 @@ for t in $TEST_DIR/*.dat; do
   fi
   # Run qemu with a timeout
   rm -f output.txt error.txt
-  timeout --foreground $TIMEOUT bash -c "${QEMU_CMD} 1>output.txt 2>error.txt"
+  start_ms=$(date +%s%3N)
+  timeout --foreground ${test_timeout:-$TIMEOUT} bash -c "${QEMU_CMD} 1>output.txt 2>error.txt"
 
   err=$?
+  wall_ms=$(($(date +%s%3N) - start_ms))
+  # The timing data varies from one run to the next, so it must be kept out
+  # of the comparison with the expected output
+  timing="wall_ms=$wall_ms"
+  data=$(grep -a '^\[TEST\] Timing: ' output.txt 2>/dev/null | tr -d '\r' | cut -c 16-)
+  if [[ -n "$data" ]]; then
+    timing="$timing $data"
+  fi
+  # The same goes for the values that the benchmark measures, which are masked
+  if [[ -f output.txt ]]; then
+    grep -av '^\[TEST\] Timing: ' output.txt | \
+      sed -E 's/^(\[TEST\] Benchmark .* = )[0-9]+ (MB\/s|us)/\1# \2/' > output.tmp
+    mv output.tmp output.txt
+  fi
+  echo "test=$test_number $timing name=$test_name" >> "$PERF_LOG"
   if [[ $err -eq 124 ]]; then
     echo "[ERROR] (Time out)"
     if [[ $dump_hashlist -ne 0 ]]; then
@@ -93,7 +153,15 @@ for t in $TEST_DIR/*.dat; do
     else
       tail -n +3 output.txt | grep -F -f "$t" >/dev/null 2>&1
     fi
-    if [[ $? -eq 0 ]]; then
+    match=$?
+    over_budget=""
+    if [[ $match -eq 0 ]]; then
+      over_budget=$(check_budgets "$timing" "$test_name")
+    fi
+    if [[ -n "$over_budget" ]]; then
+      echo "[FAIL] (Over budget: ${over_budget% })"
+      NUM_FAIL=$((NUM_FAIL + 1))
+    elif [[ $match -eq 0 ]]; then
       echo "[PASS]"
       NUM_PASS=$((NUM_PASS + 1))
     else